@@ -0,0 +1,335 @@
+#include "batch_renderer.h"
+#include "gl_state.h"
+#include "profiler.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+	// Layout fixed by GL for glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	struct BatchMesh
+	{
+		// Where the mesh's own buffers are, until BatchFinalise copies them
+		GLuint source_vertex_buffer;
+		GLuint source_index_buffer;
+		GLenum source_index_type;
+		uint32_t vertex_count;
+		uint32_t index_count;
+		glm::mat4 dequantise;
+
+		// Where it ends up in the shared buffers
+		GLint base_vertex;
+		GLuint first_index;
+	};
+
+	struct BatchMaterial
+	{
+		GLuint program;
+		GLint eye_location;
+		GLuint stereo_program;
+	};
+
+	std::vector<BatchMesh> meshes;
+	std::vector<BatchMaterial> materials;
+	std::vector<uint32_t> object_meshes;
+	std::vector<uint32_t> object_materials;
+	std::vector<glm::mat4> object_models;		// model * dequantise, what goes into the storage buffer
+
+	GLuint vao = 0;
+	GLuint vertex_buffer = 0;
+	GLuint index_buffer = 0;
+	GLenum index_type = GL_UNSIGNED_SHORT;
+	GLuint object_id_buffer = 0;
+	GLuint transform_buffer = 0;
+	GLuint command_buffer = 0;
+
+	// This frame's commands, grouped by material
+	const uint32_t* visible_objects = nullptr;
+	uint32_t visible_count = 0;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<uint32_t> material_first_command;
+	std::vector<uint32_t> material_command_count;
+	int commands_instance_count = 0;		// 0 when the commands need rebuilding
+
+	GLsizei IndexSize(GLenum type)
+	{
+		return type == GL_UNSIGNED_SHORT ? 2 : 4;
+	}
+
+	// One command per visible object, a counting sort puts each material's commands together
+	void BuildCommands(int instance_count)
+	{
+		if (commands_instance_count == instance_count)
+			return;
+
+		for (size_t material = 0; material < materials.size(); ++material)
+			material_command_count[material] = 0;
+		for (uint32_t i = 0; i < visible_count; ++i)
+			material_command_count[object_materials[visible_objects[i]]] += 1;
+
+		uint32_t first = 0;
+		for (size_t material = 0; material < materials.size(); ++material)
+		{
+			material_first_command[material] = first;
+			first += material_command_count[material];
+			material_command_count[material] = 0;
+		}
+
+		for (uint32_t i = 0; i < visible_count; ++i)
+		{
+			uint32_t object = visible_objects[i];
+			uint32_t material = object_materials[object];
+			const BatchMesh& mesh = meshes[object_meshes[object]];
+
+			DrawElementsIndirectCommand& command = commands[material_first_command[material] + material_command_count[material]++];
+			command.count = mesh.index_count;
+			command.instance_count = instance_count;
+			command.first_index = mesh.first_index;
+			command.base_vertex = mesh.base_vertex;
+			command.base_instance = object;
+		}
+
+		// Orphan and refill, the driver hands back fresh storage if last frame's is still in use
+		GLStateBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+		if (visible_count > 0)
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, visible_count * sizeof(DrawElementsIndirectCommand), &commands[0]);
+
+		commands_instance_count = instance_count;
+	}
+
+	int DrawMaterials(int eye, bool stereo)
+	{
+		BuildCommands(stereo ? 2 : 1);
+
+		GLStateBindVertexArray(vao);
+		GLStateBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+		GLStateBindBufferBase(GL_SHADER_STORAGE_BUFFER, batch_transforms_binding, transform_buffer);
+
+		int draw_calls = 0;
+		for (size_t material = 0; material < materials.size(); ++material)
+		{
+			if (material_command_count[material] == 0)
+				continue;
+
+			if (stereo)
+			{
+				GLStateUseProgram(materials[material].stereo_program);
+			}
+			else
+			{
+				GLStateUseProgram(materials[material].program);
+				glUniform1i(materials[material].eye_location, eye);
+			}
+
+			glMultiDrawElementsIndirect(GL_TRIANGLES, index_type,
+				(const void*)(material_first_command[material] * sizeof(DrawElementsIndirectCommand)),
+				material_command_count[material], 0);
+			draw_calls += 1;
+		}
+
+		// The command buffer stays bound, the next eye draws from it too
+		GLStateBindVertexArray(0);
+		return draw_calls;
+	}
+}
+
+bool BatchSupported()
+{
+	bool supported = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance && GLEW_ARB_shader_storage_buffer_object);
+	if (!supported)
+		printf("Batch: needs GL 4.3 or ARB_multi_draw_indirect, ARB_base_instance and ARB_shader_storage_buffer_object\n");
+	return supported;
+}
+
+uint32_t BatchAddMesh(const Mesh& mesh)
+{
+	BatchMesh batch_mesh;
+	batch_mesh.source_vertex_buffer = mesh.vertex_buffer;
+	batch_mesh.source_index_buffer = mesh.index_buffer;
+	batch_mesh.source_index_type = mesh.index_type;
+	batch_mesh.vertex_count = mesh.vertex_count;
+	batch_mesh.index_count = mesh.index_count;
+	batch_mesh.dequantise = mesh.dequantise;
+	batch_mesh.base_vertex = 0;
+	batch_mesh.first_index = 0;
+	meshes.push_back(batch_mesh);
+	return (uint32_t)meshes.size() - 1;
+}
+
+uint32_t BatchAddMaterial(GLuint program, GLuint stereo_program)
+{
+	BatchMaterial material;
+	material.program = program;
+	material.eye_location = glGetUniformLocation(program, "eye");
+	material.stereo_program = stereo_program;
+	materials.push_back(material);
+
+	GLuint programs[2] = { program, stereo_program };
+	for (int i = 0; i < 2; ++i)
+	{
+		GLuint block = glGetProgramResourceIndex(programs[i], GL_SHADER_STORAGE_BLOCK, "ObjectTransforms");
+		if (block != GL_INVALID_INDEX)
+			glShaderStorageBlockBinding(programs[i], block, batch_transforms_binding);
+	}
+	return (uint32_t)materials.size() - 1;
+}
+
+uint32_t BatchAddObject(uint32_t mesh, uint32_t material, const glm::mat4& model)
+{
+	object_meshes.push_back(mesh);
+	object_materials.push_back(material);
+	object_models.push_back(model * meshes[mesh].dequantise);
+	return (uint32_t)object_models.size() - 1;
+}
+
+bool BatchFinalise()
+{
+	if (object_models.empty())
+	{
+		printf("Batch: nothing to draw\n");
+		return false;
+	}
+
+	// Indices are relative to each mesh's base vertex, so 16 bits do as long as every mesh has 16 bit indices
+	uint64_t vertex_total = 0, index_total = 0;
+	index_type = GL_UNSIGNED_SHORT;
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		meshes[i].base_vertex = (GLint)vertex_total;
+		meshes[i].first_index = (GLuint)index_total;
+		vertex_total += meshes[i].vertex_count;
+		index_total += meshes[i].index_count;
+		if (meshes[i].source_index_type != GL_UNSIGNED_SHORT)
+			index_type = GL_UNSIGNED_INT;
+	}
+
+	glGenVertexArrays(1, &vao);
+	GLStateBindVertexArray(vao);
+
+	glGenBuffers(1, &vertex_buffer);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(vertex_total * sizeof(MeshFileVertex)), nullptr, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &index_buffer);
+	GLStateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(index_total * IndexSize(index_type)), nullptr, GL_STATIC_DRAW);
+
+	// Straight GPU to GPU copies, except 16 bit indices going into a 32 bit batch which have to be widened
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		const BatchMesh& mesh = meshes[i];
+		GLStateBindBuffer(GL_COPY_READ_BUFFER, mesh.source_vertex_buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, (GLintptr)(mesh.base_vertex * sizeof(MeshFileVertex)),
+			(GLsizeiptr)(mesh.vertex_count * sizeof(MeshFileVertex)));
+
+		GLStateBindBuffer(GL_COPY_READ_BUFFER, mesh.source_index_buffer);
+		GLintptr index_offset = (GLintptr)mesh.first_index * IndexSize(index_type);
+		if (mesh.source_index_type == index_type)
+		{
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, 0, index_offset, (GLsizeiptr)mesh.index_count * IndexSize(index_type));
+		}
+		else
+		{
+			std::vector<uint16_t> narrow(mesh.index_count);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, mesh.index_count * sizeof(uint16_t), &narrow[0]);
+			std::vector<uint32_t> wide(narrow.begin(), narrow.end());
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, index_offset, mesh.index_count * sizeof(uint32_t), &wide[0]);
+		}
+	}
+	GLStateBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	GLStateBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	glEnableVertexAttribArray(mesh_position_attribute);
+	glVertexAttribPointer(mesh_position_attribute, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(MeshFileVertex), (const void *)offsetof(MeshFileVertex, position));
+	glEnableVertexAttribArray(mesh_normal_attribute);
+	glVertexAttribPointer(mesh_normal_attribute, 2, GL_SHORT, GL_TRUE, sizeof(MeshFileVertex), (const void *)offsetof(MeshFileVertex, normal));
+
+	// Object i's id is i, fetched at baseInstance, so the command picks the object
+	std::vector<GLuint> object_ids(object_models.size());
+	for (size_t i = 0; i < object_ids.size(); ++i)
+		object_ids[i] = (GLuint)i;
+	glGenBuffers(1, &object_id_buffer);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, object_id_buffer);
+	glBufferData(GL_ARRAY_BUFFER, object_ids.size() * sizeof(GLuint), &object_ids[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(batch_object_attribute);
+	glVertexAttribIPointer(batch_object_attribute, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glVertexAttribDivisor(batch_object_attribute, 2);
+
+	GLStateBindVertexArray(0);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLStateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &transform_buffer);
+	GLStateBindBuffer(GL_SHADER_STORAGE_BUFFER, transform_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, object_models.size() * sizeof(glm::mat4), glm::value_ptr(object_models[0]), GL_STATIC_DRAW);
+	GLStateBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glGenBuffers(1, &command_buffer);
+	commands.resize(object_models.size());
+	material_first_command.assign(materials.size(), 0);
+	material_command_count.assign(materials.size(), 0);
+
+	printf("Batch: %u meshes, %u objects, %u materials, %.1f MB of geometry\n", (uint32_t)meshes.size(), (uint32_t)object_models.size(),
+		(uint32_t)materials.size(), (vertex_total * sizeof(MeshFileVertex) + index_total * IndexSize(index_type)) / (1024.0 * 1024.0));
+	return true;
+}
+
+void BatchShutdown()
+{
+	GLStateDeleteVertexArrays(1, &vao);
+	GLuint buffers[] = { vertex_buffer, index_buffer, object_id_buffer, transform_buffer, command_buffer };
+	GLStateDeleteBuffers(5, buffers);
+	vao = vertex_buffer = index_buffer = object_id_buffer = transform_buffer = command_buffer = 0;
+
+	meshes.clear();
+	materials.clear();
+	object_meshes.clear();
+	object_materials.clear();
+	object_models.clear();
+	commands.clear();
+	visible_objects = nullptr;
+	visible_count = 0;
+	commands_instance_count = 0;
+}
+
+void BatchUpdateModels(const glm::mat4* models)
+{
+	PROFILE_SCOPE(ProfileStage_InstanceUpload);
+
+	// Orphaned like the command buffer, the driver hands back fresh storage if last frame's is still in use
+	GLsizeiptr size = (GLsizeiptr)(object_models.size() * sizeof(glm::mat4));
+	GLStateBindBuffer(GL_SHADER_STORAGE_BUFFER, transform_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, glm::value_ptr(models[0]));
+}
+
+void BatchSetVisible(const uint32_t* objects, uint32_t count)
+{
+	visible_objects = objects;
+	visible_count = count;
+	commands_instance_count = 0;
+}
+
+int BatchRender(int eye)
+{
+	return DrawMaterials(eye, false);
+}
+
+int BatchRenderStereo()
+{
+	return DrawMaterials(0, true);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Every scene object drawn with one glMultiDrawElementsIndirect per material
+//
+// Meshes are copied into one shared vertex buffer and one shared index buffer, every object's
+// model matrix sits in a shader storage buffer, and each frame the visible objects become one
+// indirect command each. Drawing is then a program bind and a single call per material, rather
+// than a program, VAO, uniform and draw call per object.
+//
+// The object index gets to the vertex shader as the command's baseInstance, through an instanced
+// attribute, so ARB_shader_draw_parameters isn't needed. The attribute advances every 2 instances
+// so both instances of a stereo draw fetch the same object.
+//
+// Setup:
+//   BatchAddMesh(...), BatchAddMaterial(...), then BatchAddObject(...) for each object
+//   BatchFinalise()
+// Per frame:
+//   BatchUpdateModels(...) if the objects move
+//   BatchSetVisible(...) with the culling result
+//   BatchRender(...) once per eye, or BatchRenderStereo() once
+
+// Needs GL 4.3 or the ARB extensions for indirect multi draw, base instance and storage buffers.
+// Prints what's missing
+bool BatchSupported();
+
+// GLSL for shaders drawing batched objects. BATCH_SHADER_EXTENSIONS goes straight after #version,
+// BATCH_OBJECT_INPUTS adds the object's model matrix, object_model[vObject], to MESH_VERTEX_INPUTS
+#define BATCH_SHADER_EXTENSIONS "#extension GL_ARB_shader_storage_buffer_object : require\n"
+#define BATCH_OBJECT_INPUTS \
+	"layout(location = 2) in uint vObject;" \
+	"layout(std430) readonly buffer ObjectTransforms { mat4 object_model[]; };"
+const GLuint batch_object_attribute = 2;
+const GLuint batch_transforms_binding = 0;	// shader storage binding point
+
+// The mesh's buffers are copied on the GPU in BatchFinalise, keep it alive until then.
+// Returns the index to pass to BatchAddObject
+uint32_t BatchAddMesh(const Mesh& mesh);
+
+// program draws one eye and has a `uniform int eye`, stereo_program draws both eyes from
+// gl_InstanceID like the scene's stereo shader. Both need BATCH_OBJECT_INPUTS
+uint32_t BatchAddMaterial(GLuint program, GLuint stereo_program);
+
+// model is the object's model matrix, the mesh's dequantise is applied on top. Returns the object's index
+uint32_t BatchAddObject(uint32_t mesh, uint32_t material, const glm::mat4& model);
+
+// Builds the shared buffers, no more meshes or objects after this
+bool BatchFinalise();
+void BatchShutdown();
+
+// Replaces every object's model matrix, in the order they were added. These are the final
+// matrices, the mesh's dequantise already applied. The storage buffer is orphaned and refilled
+void BatchUpdateModels(const glm::mat4* models);
+
+// Object indices to draw this frame, kept until the next call so both eyes can use them
+void BatchSetVisible(const uint32_t* objects, uint32_t count);
+
+// Both return how many draw calls they made, the view matrices come from the ViewMatrices uniform buffer
+int BatchRender(int eye);
+int BatchRenderStereo();
@@ -0,0 +1,340 @@
+#include "companion_mirror.h"
+#include "gl_state.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	// One being presented, one waiting to be and one for the frame loop to write into
+	const int slot_count = 3;
+
+	enum SlotState
+	{
+		Slot_Free,
+		Slot_Writing,		// the frame loop is blitting into it
+		Slot_Ready,			// fenced, waiting for the mirror thread
+		Slot_Presenting
+	};
+
+	CompanionMirrorConfig config;
+	SDL_Window* companion_window = nullptr;
+	SDL_Window* render_window = nullptr;	// hidden, the render context lives here once there's a mirror
+	SDL_GLContext mirror_context = nullptr;
+	int window_width = 0;
+	int window_height = 0;
+	int eye_width = 0;			// each mirrored eye's part of the mirror textures
+	int eye_height = 0;
+
+	// Shared between the contexts
+	GLuint program = 0;
+	GLuint sampler = 0;
+	GLuint slot_texture[slot_count];
+	// Only exist in the one they were made in
+	GLuint slot_frame_buffer[slot_count];	// render context
+	GLuint vao = 0;							// mirror context, empty, the quad comes from gl_VertexID
+
+	// Everything from here down is guarded by the mutex once the thread is running
+	std::thread mirror_thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool running = false;
+	bool quit = false;
+	SlotState slot_state[slot_count];
+	GLsync slot_fence[slot_count];
+	int ready_slot = -1;
+
+	// Stats
+	unsigned long long frames_offered = 0;
+	unsigned long long frames_presented = 0;
+	unsigned long long frames_dropped = 0;
+	double swap_ms_total = 0.0;
+	double swap_ms_max = 0.0;
+
+	void MirrorThread()
+	{
+		SDL_GL_MakeCurrent(companion_window, mirror_context);
+
+		// Nothing else draws in this context, so everything but the texture is bound for good
+		glBindVertexArray(vao);
+		glUseProgram(program);
+		glBindSampler(0, sampler);
+		glDisable(GL_DEPTH_TEST);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+		// One eye goes in the middle at the size it would have next to the other
+		if (config.eyes == MirrorEyes_Both)
+			glViewport(0, 0, window_width, window_height);
+		else
+			glViewport(window_width / 4, 0, window_width / 2, window_height);
+
+		for (;;)
+		{
+			int slot;
+			GLsync fence;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [] { return quit || ready_slot >= 0; });
+				if (quit)
+					break;
+
+				slot = ready_slot;
+				ready_slot = -1;
+				slot_state[slot] = Slot_Presenting;
+				fence = slot_fence[slot];
+				slot_fence[slot] = 0;
+			}
+
+			// Waits on the GPU, not here
+			glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fence);
+
+			glClear(GL_COLOR_BUFFER_BIT);
+			glBindTexture(GL_TEXTURE_2D, slot_texture[slot]);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+			std::chrono::steady_clock::time_point swap_start = std::chrono::steady_clock::now();
+			SDL_GL_SwapWindow(companion_window);
+			double swap_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - swap_start).count();
+
+			// The frame loop can't have the slot back until the draw has finished reading it
+			GLsync done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glClientWaitSync(done, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+			glDeleteSync(done);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			slot_state[slot] = Slot_Free;
+			++frames_presented;
+			swap_ms_total += swap_ms;
+			swap_ms_max = std::max(swap_ms_max, swap_ms);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+		SDL_GL_MakeCurrent(companion_window, nullptr);
+	}
+}
+
+bool CompanionMirrorInit(SDL_Window* window, SDL_GLContext render_context, int width, int height, const CompanionMirrorConfig& new_config)
+{
+	config = new_config;
+	if (config.rate <= 0)
+	{
+		printf("Companion mirror: off\n");
+		return false;
+	}
+
+	companion_window = window;
+	window_width = width;
+	window_height = height;
+	config.scale = std::max(0.05f, std::min(1.0f, config.scale));
+	eye_width = std::max(1, (int)(width / 2 * config.scale + 0.5f));
+	eye_height = std::max(1, (int)(height * config.scale + 0.5f));
+
+	render_window = SDL_CreateWindow("Hello VR render", 0, 0, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (render_window == nullptr)
+	{
+		printf("Companion mirror: couldn't create a window for the render context\n");
+		return false;
+	}
+
+	// Comes back current on this thread, set up what only it can see while it is
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	mirror_context = SDL_GL_CreateContext(companion_window);
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+	if (mirror_context == nullptr)
+	{
+		printf("Companion mirror: couldn't create a shared context\n");
+		SDL_GL_MakeCurrent(companion_window, render_context);
+		SDL_DestroyWindow(render_window);
+		render_window = nullptr;
+		return false;
+	}
+
+	// The swap only blocks the mirror thread, so it may as well wait for vsync and not tear
+	SDL_GL_SetSwapInterval(1);
+	glGenVertexArrays(1, &vao);
+
+	if (SDL_GL_MakeCurrent(render_window, render_context) != 0)
+	{
+		printf("Companion mirror: couldn't move the render context off the companion window\n");
+		SDL_GL_MakeCurrent(companion_window, render_context);
+		SDL_GL_DeleteContext(mirror_context);
+		mirror_context = nullptr;
+		SDL_DestroyWindow(render_window);
+		render_window = nullptr;
+		return false;
+	}
+
+	const char* vertex_source =
+		"#version 410\n"
+		"out vec2 fUV;"
+		"void main()"
+		"{"
+		"	fUV = vec2(gl_VertexID & 1, gl_VertexID >> 1);"
+		"	gl_Position = vec4(fUV * 2.0 - 1.0, 0.0, 1.0);"
+		"}";
+	const char* fragment_source =
+		"#version 410\n"
+		"uniform sampler2D tex;"
+		"in vec2 fUV;"
+		"out vec4 outColour;"
+		"void main()"
+		"{"
+		"	outColour = texture(tex, fUV);"
+		"}";
+	program = CreateShaderProgram("companion mirror", vertex_source, fragment_source);
+
+	// Filtering and wrapping are set once here rather than on the textures every frame
+	glGenSamplers(1, &sampler);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	int eye_count = config.eyes == MirrorEyes_Both ? 2 : 1;
+	glGenTextures(slot_count, slot_texture);
+	glGenFramebuffers(slot_count, slot_frame_buffer);
+	for (int slot = 0; slot < slot_count; ++slot)
+	{
+		GLStateBindTexture(GL_TEXTURE_2D, slot_texture[slot]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, eye_width * eye_count, eye_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		GLStateBindFramebuffer(GL_FRAMEBUFFER, slot_frame_buffer[slot]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, slot_texture[slot], 0);
+		slot_state[slot] = Slot_Free;
+		slot_fence[slot] = 0;
+	}
+	GLStateBindTexture(GL_TEXTURE_2D, 0);
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	frames_offered = 0;
+	frames_presented = 0;
+	frames_dropped = 0;
+	swap_ms_total = 0.0;
+	swap_ms_max = 0.0;
+	ready_slot = -1;
+	quit = false;
+
+	// Everything the thread uses has to be on the GPU before it starts using it
+	glFinish();
+	mirror_thread = std::thread(MirrorThread);
+	running = true;
+
+	printf("Companion mirror: every %d frame%s, %s at %dx%d each, presented on its own thread\n",
+		config.rate, config.rate == 1 ? "" : "s",
+		config.eyes == MirrorEyes_Both ? "both eyes" : config.eyes == MirrorEyes_Left ? "left eye" : "right eye",
+		eye_width, eye_height);
+	return true;
+}
+
+void CompanionMirrorShutdown()
+{
+	if (!running)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_one();
+	mirror_thread.join();
+	running = false;
+
+	for (int slot = 0; slot < slot_count; ++slot)
+	{
+		if (slot_fence[slot])
+			glDeleteSync(slot_fence[slot]);
+		slot_fence[slot] = 0;
+	}
+	GLStateDeleteFramebuffers(slot_count, slot_frame_buffer);
+	GLStateDeleteTextures(slot_count, slot_texture);
+	glDeleteSamplers(1, &sampler);
+	glDeleteProgram(program);
+	sampler = 0;
+	program = 0;
+
+	// The vertex array went with the context
+	SDL_GL_DeleteContext(mirror_context);
+	mirror_context = nullptr;
+	vao = 0;
+
+	// Back onto the companion window first, destroying the window a context is current on leaves
+	// nothing current, and the app still has GL objects of its own to delete after this
+	SDL_GL_MakeCurrent(companion_window, SDL_GL_GetCurrentContext());
+	SDL_DestroyWindow(render_window);
+	render_window = nullptr;
+}
+
+void CompanionMirrorSubmit(unsigned long long frame_index, const MirrorSource eyes[2])
+{
+	if (!running || frame_index % config.rate != 0)
+		return;
+
+	// A free slot if there is one, otherwise the one the mirror hasn't picked up yet
+	int slot = -1;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int candidate = 0; candidate < slot_count && slot < 0; ++candidate)
+		{
+			if (slot_state[candidate] == Slot_Free)
+				slot = candidate;
+		}
+		if (slot < 0 && ready_slot >= 0)
+		{
+			slot = ready_slot;
+			ready_slot = -1;
+			glDeleteSync(slot_fence[slot]);
+			slot_fence[slot] = 0;
+			++frames_dropped;
+		}
+		if (slot < 0)
+			return;
+		slot_state[slot] = Slot_Writing;
+		++frames_offered;
+	}
+
+	// Straight from the resolved eyes, downsampled by the blit
+	GLStateBindFramebuffer(GL_DRAW_FRAMEBUFFER, slot_frame_buffer[slot]);
+	int x = 0;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		if ((eye == 0 && config.eyes == MirrorEyes_Right) || (eye == 1 && config.eyes == MirrorEyes_Left))
+			continue;
+
+		GLStateBindFramebuffer(GL_READ_FRAMEBUFFER, eyes[eye].frame_buffer);
+		glBlitFramebuffer(eyes[eye].x0, eyes[eye].y0, eyes[eye].x1, eyes[eye].y1, x, 0, x + eye_width, eye_height,
+			GL_COLOR_BUFFER_BIT,
+			GL_LINEAR);
+		x += eye_width;
+	}
+	GLStateBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	GLStateBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+	// The flush gets the fence to where the mirror context can see it
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		slot_fence[slot] = fence;
+		slot_state[slot] = Slot_Ready;
+		ready_slot = slot;
+	}
+	wake.notify_one();
+}
+
+void CompanionMirrorPrintStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (frames_offered == 0)
+		return;
+
+	printf("Companion mirror: %llu frames handed over, %llu presented, %llu overwritten before the mirror got to them, swap avg %.3f ms max %.3f ms\n",
+		frames_offered, frames_presented, frames_dropped,
+		frames_presented ? swap_ms_total / (double)frames_presented : 0.0, swap_ms_max);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <SDL.h>
+#include <GL/glew.h>
+
+// Shows what the headset sees in the companion window, off the HMD's critical path
+//
+// Every rate frames the frame loop blits the eyes it wants mirrored, downsampled, into one of
+// three mirror textures, fences it and hands it over. A thread with its own context shared with
+// the render context draws the newest one into the window and does the swap, so a slow swap
+// only holds up the mirror. The render context moves to a hidden window of its own and never
+// touches the companion window again. If the mirror falls behind, the frame it hasn't started
+// on yet is overwritten, the frame loop never waits for it.
+
+enum MirrorEyes
+{
+	MirrorEyes_Both,
+	MirrorEyes_Left,
+	MirrorEyes_Right
+};
+
+struct CompanionMirrorConfig
+{
+	int rate;			// mirror every rate'th frame, 0 for no mirror
+	float scale;		// mirror resolution as a share of the window's
+	MirrorEyes eyes;
+
+	CompanionMirrorConfig() : rate(1), scale(1.0f), eyes(MirrorEyes_Both) {}
+};
+
+// Where an eye's image is, in pixels of a frame buffer the render context can read from
+struct MirrorSource
+{
+	GLuint frame_buffer;
+	int x0, y0, x1, y1;
+};
+
+// Call with render_context current on window. Returns false if there's no mirror, either because
+// rate is 0 or because the mirror context couldn't be made, render_context stays on window then
+bool CompanionMirrorInit(SDL_Window* window, SDL_GLContext render_context, int window_width, int window_height, const CompanionMirrorConfig& config);
+void CompanionMirrorShutdown();
+
+// Once a frame after the eyes are resolved, eyes indexed by vr::Hmd_Eye. Does nothing on the
+// frames that aren't mirrored
+void CompanionMirrorSubmit(unsigned long long frame_index, const MirrorSource eyes[2]);
+
+// Frames handed over, presented and overwritten before the mirror got to them, and the swap time
+void CompanionMirrorPrintStats();
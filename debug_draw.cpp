@@ -0,0 +1,339 @@
+#include "debug_draw.h"
+#include "gl_state.h"
+#include "shader.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	struct DebugVertex
+	{
+		float position[3];
+		uint32_t colour;	// RGBA8
+	};
+
+	const int region_count = debug_draw_region_count;
+
+	GLuint program = 0;
+	GLint eye_location = -1;
+	GLuint stereo_program = 0;
+
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	uint32_t region_capacity = 0;			// vertices
+	DebugVertex* mapped = nullptr;			// the whole buffer, all three regions
+	bool persistent = false;				// false when GL_ARB_buffer_storage is missing
+	std::vector<DebugVertex> staging;		// only used without persistent mapping, laid out like the buffer
+
+	struct Region
+	{
+		// Lines fill the region from the front, triangles from the back
+		uint32_t line_vertex_count;
+		uint32_t triangle_vertex_count;
+		GLsync fence;		// only used by DebugDrawBeginFrame, pipelined callers do their own fencing
+	};
+	Region regions[region_count] = {};
+
+	int write_region = -1;					// the one DebugDrawLine and DebugDrawTriangle write to
+	int draw_region = -1;					// the one the render functions draw
+	DebugVertex* region_vertices = nullptr;
+
+	uint64_t frames_stalled = 0;
+	uint64_t vertices_dropped = 0;
+	uint32_t last_frame_vertices = 0;
+
+	uint32_t PackColour(const glm::vec3& colour)
+	{
+		uint32_t r = (uint32_t)(glm::clamp(colour.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+		uint32_t g = (uint32_t)(glm::clamp(colour.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+		uint32_t b = (uint32_t)(glm::clamp(colour.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+		return r | (g << 8) | (b << 16) | (0xFFu << 24);
+	}
+
+	inline void WriteVertex(DebugVertex* vertex, const glm::vec3& position, uint32_t colour)
+	{
+		vertex->position[0] = position.x;
+		vertex->position[1] = position.y;
+		vertex->position[2] = position.z;
+		vertex->colour = colour;
+	}
+
+	GLint RegionFirstVertex(int region)
+	{
+		return (GLint)(region * region_capacity);
+	}
+}
+
+bool DebugDrawInit(uint32_t max_vertices_per_frame)
+{
+	const char* vertex_source =
+		"#version 410\n"
+		VIEW_MATRICES_BLOCK
+		"uniform int eye;"
+		"layout(location = 0) in vec3 vPosition;"
+		"layout(location = 1) in vec4 vColour;"
+		"out vec4 fColour;"
+		"void main()"
+		"{"
+		"	fColour = vColour;"
+		"	gl_Position = eye_view_projection[eye] * vec4(vPosition, 1.0);"
+		"}";
+	const char* stereo_vertex_source =
+		"#version 410\n"
+		VIEW_MATRICES_BLOCK
+		"layout(location = 0) in vec3 vPosition;"
+		"layout(location = 1) in vec4 vColour;"
+		"out vec4 fColour;"
+		"void main()"
+		"{"
+		"	int eye = gl_InstanceID & 1;"
+		"	vec4 position = eye_view_projection[eye] * vec4(vPosition, 1.0);"
+		"	float eye_offset = eye == 0 ? -0.5 : 0.5;"
+		"	fColour = vColour;"
+		"	gl_ClipDistance[0] = eye == 0 ? position.w - position.x : position.w + position.x;"
+		"	gl_Position = vec4(position.x * 0.5 + eye_offset * position.w, position.yzw);"
+		"}";
+	const char* fragment_source =
+		"#version 410\n"
+		"in vec4 fColour;"
+		"out vec4 outColour;"
+		"void main()"
+		"{"
+		"	outColour = fColour;"
+		"}";
+
+	program = CreateShaderProgram("debug draw", vertex_source, fragment_source);
+	stereo_program = CreateShaderProgram("debug draw stereo", stereo_vertex_source, fragment_source);
+	if (program == 0 || stereo_program == 0)
+		return false;
+
+	eye_location = glGetUniformLocation(program, "eye");
+	BindViewMatrices(program);
+	BindViewMatrices(stereo_program);
+
+	region_capacity = max_vertices_per_frame;
+	GLsizeiptr buffer_size = (GLsizeiptr)sizeof(DebugVertex) * region_capacity * region_count;
+
+	glGenVertexArrays(1, &vao);
+	GLStateBindVertexArray(vao);
+	glGenBuffers(1, &vbo);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	persistent = GLEW_ARB_buffer_storage != 0;
+	if (persistent)
+	{
+		// Mapped once for good, coherent so there's nothing to flush
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, buffer_size, nullptr, flags);
+		mapped = (DebugVertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, flags);
+		if (mapped == nullptr)
+		{
+			printf("Debug draw: could not map the vertex buffer\n");
+			return false;
+		}
+	}
+	else
+	{
+		// Fallback, build each frame in system memory and copy it into that frame's region
+		printf("Debug draw: GL_ARB_buffer_storage not available, using glBufferSubData\n");
+		glBufferData(GL_ARRAY_BUFFER, buffer_size, nullptr, GL_DYNAMIC_DRAW);
+		staging.resize(region_capacity * region_count);
+	}
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(DebugVertex), (const void *)offsetof(DebugVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(DebugVertex), (const void *)offsetof(DebugVertex, colour));
+
+	GLStateBindVertexArray(0);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void DebugDrawShutdown()
+{
+	for (int i = 0; i < region_count; ++i)
+	{
+		if (regions[i].fence)
+		{
+			glDeleteSync(regions[i].fence);
+			regions[i].fence = 0;
+		}
+	}
+
+	if (persistent && vbo)
+	{
+		GLStateBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		GLStateBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	mapped = nullptr;
+
+	GLStateDeleteBuffers(1, &vbo);
+	GLStateDeleteVertexArrays(1, &vao);
+	glDeleteProgram(program);
+	glDeleteProgram(stereo_program);
+	vbo = vao = program = stereo_program = 0;
+}
+
+void DebugDrawBeginFrame()
+{
+	// Everything that reads last frame's region has been issued by now, fence it
+	if (draw_region >= 0)
+	{
+		regions[draw_region].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	int region = (write_region + 1) % region_count;
+
+	// The GPU should have finished with this region two frames ago, only wait if it really hasn't
+	if (regions[region].fence)
+	{
+		GLenum result = glClientWaitSync(regions[region].fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			frames_stalled += 1;
+			glClientWaitSync(regions[region].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		}
+		glDeleteSync(regions[region].fence);
+		regions[region].fence = 0;
+	}
+
+	DebugDrawBeginRegion(region);
+}
+
+void DebugDrawEndFrame()
+{
+	DebugDrawEndRegion();
+	DebugDrawUseRegion(write_region);
+}
+
+void DebugDrawBeginRegion(int region)
+{
+	write_region = region;
+	region_vertices = persistent ? mapped + region * region_capacity : &staging[region * region_capacity];
+	regions[region].line_vertex_count = 0;
+	regions[region].triangle_vertex_count = 0;
+}
+
+void DebugDrawEndRegion()
+{
+	last_frame_vertices = regions[write_region].line_vertex_count + regions[write_region].triangle_vertex_count;
+}
+
+void DebugDrawUseRegion(int region)
+{
+	draw_region = region;
+
+	const Region& used = regions[region];
+	if (!persistent && used.line_vertex_count + used.triangle_vertex_count > 0)
+	{
+		GLStateBindBuffer(GL_ARRAY_BUFFER, vbo);
+		GLintptr region_offset = (GLintptr)sizeof(DebugVertex) * RegionFirstVertex(region);
+		const DebugVertex* region_staging = &staging[region * region_capacity];
+		if (used.line_vertex_count > 0)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, region_offset, sizeof(DebugVertex) * used.line_vertex_count, region_staging);
+		}
+		if (used.triangle_vertex_count > 0)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, region_offset + sizeof(DebugVertex) * (region_capacity - used.triangle_vertex_count),
+				sizeof(DebugVertex) * used.triangle_vertex_count, region_staging + region_capacity - used.triangle_vertex_count);
+		}
+	}
+}
+
+void DebugDrawLine(const glm::vec3& start, const glm::vec3& end, const glm::vec3& colour)
+{
+	Region& region = regions[write_region];
+	if (region.line_vertex_count + region.triangle_vertex_count + 2 > region_capacity)
+	{
+		vertices_dropped += 2;
+		return;
+	}
+
+	uint32_t packed = PackColour(colour);
+	WriteVertex(region_vertices + region.line_vertex_count, start, packed);
+	WriteVertex(region_vertices + region.line_vertex_count + 1, end, packed);
+	region.line_vertex_count += 2;
+}
+
+void DebugDrawTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& colour)
+{
+	Region& region = regions[write_region];
+	if (region.line_vertex_count + region.triangle_vertex_count + 3 > region_capacity)
+	{
+		vertices_dropped += 3;
+		return;
+	}
+
+	uint32_t packed = PackColour(colour);
+	region.triangle_vertex_count += 3;
+	DebugVertex* first = region_vertices + region_capacity - region.triangle_vertex_count;
+	WriteVertex(first + 0, a, packed);
+	WriteVertex(first + 1, b, packed);
+	WriteVertex(first + 2, c, packed);
+}
+
+int DebugDrawRender(int eye)
+{
+	if (draw_region < 0)
+		return 0;
+	uint32_t line_vertex_count = regions[draw_region].line_vertex_count;
+	uint32_t triangle_vertex_count = regions[draw_region].triangle_vertex_count;
+	if (line_vertex_count + triangle_vertex_count == 0)
+		return 0;
+
+	GLStateUseProgram(program);
+	GLStateBindVertexArray(vao);
+	glUniform1i(eye_location, eye);
+
+	int draw_calls = 0;
+	if (line_vertex_count > 0)
+	{
+		glDrawArrays(GL_LINES, RegionFirstVertex(draw_region), line_vertex_count);
+		draw_calls += 1;
+	}
+	if (triangle_vertex_count > 0)
+	{
+		glDrawArrays(GL_TRIANGLES, RegionFirstVertex(draw_region) + region_capacity - triangle_vertex_count, triangle_vertex_count);
+		draw_calls += 1;
+	}
+	return draw_calls;
+}
+
+int DebugDrawRenderStereo()
+{
+	if (draw_region < 0)
+		return 0;
+	uint32_t line_vertex_count = regions[draw_region].line_vertex_count;
+	uint32_t triangle_vertex_count = regions[draw_region].triangle_vertex_count;
+	if (line_vertex_count + triangle_vertex_count == 0)
+		return 0;
+
+	GLStateUseProgram(stereo_program);
+	GLStateBindVertexArray(vao);
+
+	int draw_calls = 0;
+	if (line_vertex_count > 0)
+	{
+		glDrawArraysInstanced(GL_LINES, RegionFirstVertex(draw_region), line_vertex_count, 2);
+		draw_calls += 1;
+	}
+	if (triangle_vertex_count > 0)
+	{
+		glDrawArraysInstanced(GL_TRIANGLES, RegionFirstVertex(draw_region) + region_capacity - triangle_vertex_count, triangle_vertex_count, 2);
+		draw_calls += 1;
+	}
+	return draw_calls;
+}
+
+void DebugDrawPrintStats()
+{
+	printf("Debug draw: %u vertices last frame, %llu frames waited on the GPU, %llu vertices dropped (%s)\n",
+		last_frame_vertices, (unsigned long long)frames_stalled, (unsigned long long)vertices_dropped,
+		persistent ? "persistent mapped" : "glBufferSubData");
+}
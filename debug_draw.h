@@ -0,0 +1,49 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Immediate mode lines and triangles for anything that changes every frame
+//
+// Vertices are written straight into a persistently mapped buffer split into three
+// regions, one per frame in flight. Each region is fenced after the frame that used it,
+// so by the time the CPU comes back around to it the GPU is normally long done and
+// nothing waits. No allocations and no buffer respecification after DebugDrawInit.
+//
+// Per frame:
+//   DebugDrawBeginFrame()
+//   DebugDrawLine(...) / DebugDrawTriangle(...) as often as needed
+//   DebugDrawEndFrame()
+//   DebugDrawRender(...) or DebugDrawRenderStereo(...) once per eye or once per stereo pass
+//
+// When one thread builds a frame's geometry while the GL thread is still drawing an earlier one,
+// the builder brackets its calls with DebugDrawBeginRegion(region) and DebugDrawEndRegion(), and
+// the GL thread calls DebugDrawUseRegion(region) before rendering that frame. The caller picks a
+// different region for every frame in flight and makes sure the GPU is done with one before it's
+// written again, these don't fence anything
+
+const int debug_draw_region_count = 3;
+
+// max_vertices_per_frame is per frame, lines take two and triangles three.
+// Anything past that in a frame is dropped and counted
+bool DebugDrawInit(uint32_t max_vertices_per_frame);
+void DebugDrawShutdown();
+
+void DebugDrawBeginFrame();
+void DebugDrawEndFrame();
+
+// No GL in the first two, DebugDrawUseRegion is on the GL thread
+void DebugDrawBeginRegion(int region);
+void DebugDrawEndRegion();
+void DebugDrawUseRegion(int region);
+
+void DebugDrawLine(const glm::vec3& start, const glm::vec3& end, const glm::vec3& colour);
+void DebugDrawTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& colour);
+
+// Both return how many draw calls they made, the matrices come from the ViewMatrices uniform buffer (see shader.h)
+int DebugDrawRender(int eye);
+// Into a double wide target, same instancing scheme as the scene's stereo shader
+int DebugDrawRenderStereo();
+
+// Vertices drawn last frame, frames that had to wait on the GPU and vertices dropped for lack of room
+void DebugDrawPrintStats();
@@ -0,0 +1,125 @@
+#include "device_registry.h"
+#include "vr_backend.h"
+
+#include <cstdio>
+
+namespace
+{
+	// Room for every class OpenVR has, and a few it might add
+	const int max_device_classes = 8;
+
+	VRBackend* registry_hmd = nullptr;
+	vr::ETrackedDeviceClass device_classes[vr::k_unMaxTrackedDeviceCount];
+
+	// Rebuilt whenever a device comes or goes, which is rare
+	vr::TrackedDeviceIndex_t devices_by_class[max_device_classes][vr::k_unMaxTrackedDeviceCount];
+	uint32_t device_counts[max_device_classes];
+
+	int ClassSlot(vr::ETrackedDeviceClass device_class)
+	{
+		int slot = (int)device_class;
+		return slot > 0 && slot < max_device_classes ? slot : 0;
+	}
+
+	void RebuildClassLists()
+	{
+		for (int slot = 0; slot < max_device_classes; ++slot)
+			device_counts[slot] = 0;
+
+		for (vr::TrackedDeviceIndex_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+		{
+			if (device_classes[device] == vr::TrackedDeviceClass_Invalid)
+				continue;
+
+			int slot = ClassSlot(device_classes[device]);
+			devices_by_class[slot][device_counts[slot]++] = device;
+		}
+	}
+
+	// Ask the runtime what the device is now, returns true if anything changed
+	bool RefreshDevice(vr::TrackedDeviceIndex_t device)
+	{
+		vr::ETrackedDeviceClass device_class = vr::TrackedDeviceClass_Invalid;
+		if (registry_hmd->IsTrackedDeviceConnected(device))
+			device_class = registry_hmd->GetTrackedDeviceClass(device);
+
+		if (device_classes[device] == device_class)
+			return false;
+
+		device_classes[device] = device_class;
+		return true;
+	}
+}
+
+void DeviceRegistryInit(VRBackend* hmd)
+{
+	registry_hmd = hmd;
+
+	for (vr::TrackedDeviceIndex_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+	{
+		device_classes[device] = vr::TrackedDeviceClass_Invalid;
+		RefreshDevice(device);
+	}
+
+	RebuildClassLists();
+}
+
+void DeviceRegistryHandleEvent(const vr::VREvent_t& event)
+{
+	if (registry_hmd == nullptr || event.trackedDeviceIndex >= vr::k_unMaxTrackedDeviceCount)
+		return;
+
+	bool changed = false;
+	switch (event.eventType)
+	{
+	case vr::VREvent_TrackedDeviceActivated:
+	case vr::VREvent_TrackedDeviceUpdated:
+	case vr::VREvent_PropertyChanged:
+		changed = RefreshDevice(event.trackedDeviceIndex);
+		break;
+
+	case vr::VREvent_TrackedDeviceDeactivated:
+		changed = device_classes[event.trackedDeviceIndex] != vr::TrackedDeviceClass_Invalid;
+		device_classes[event.trackedDeviceIndex] = vr::TrackedDeviceClass_Invalid;
+		break;
+
+	default:
+		break;
+	}
+
+	if (changed)
+	{
+		RebuildClassLists();
+		printf("Device %u is now '%c', %u controllers connected\n", event.trackedDeviceIndex,
+			GetDeviceClassChar(event.trackedDeviceIndex), GetActiveDeviceCount(vr::TrackedDeviceClass_Controller));
+	}
+}
+
+uint32_t GetActiveDeviceCount(vr::ETrackedDeviceClass device_class)
+{
+	if (device_class == vr::TrackedDeviceClass_Invalid)
+		return 0;
+	return device_counts[ClassSlot(device_class)];
+}
+
+const vr::TrackedDeviceIndex_t* GetActiveDevices(vr::ETrackedDeviceClass device_class)
+{
+	return devices_by_class[ClassSlot(device_class)];
+}
+
+vr::ETrackedDeviceClass GetRegisteredDeviceClass(vr::TrackedDeviceIndex_t device)
+{
+	return device < vr::k_unMaxTrackedDeviceCount ? device_classes[device] : vr::TrackedDeviceClass_Invalid;
+}
+
+char GetDeviceClassChar(vr::TrackedDeviceIndex_t device)
+{
+	switch (GetRegisteredDeviceClass(device))
+	{
+	case vr::TrackedDeviceClass_Controller:        return 'C';
+	case vr::TrackedDeviceClass_HMD:               return 'H';
+	case vr::TrackedDeviceClass_Invalid:           return 'I';
+	case vr::TrackedDeviceClass_TrackingReference: return 'T';
+	default:                                       return '?';
+	}
+}
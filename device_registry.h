@@ -0,0 +1,28 @@
+#pragma once
+
+#include <openvr.h>
+
+class VRBackend;
+
+// Keeps track of which tracked devices are connected and what they are
+//
+// The runtime is asked about every device index once at startup, after that the
+// registry only changes when PollNextEvent reports a device being activated,
+// deactivated or having its properties change. Per frame code can then walk
+// the devices of one class without making any calls into the runtime.
+
+// Scan every device index, call once the runtime is up
+void DeviceRegistryInit(VRBackend* hmd);
+
+// Feed every event from PollNextEvent through here, ones that don't matter are ignored
+void DeviceRegistryHandleEvent(const vr::VREvent_t& event);
+
+// Connected devices of one class, in device index order
+uint32_t GetActiveDeviceCount(vr::ETrackedDeviceClass device_class);
+const vr::TrackedDeviceIndex_t* GetActiveDevices(vr::ETrackedDeviceClass device_class);
+
+// TrackedDeviceClass_Invalid if nothing is connected at that index
+vr::ETrackedDeviceClass GetRegisteredDeviceClass(vr::TrackedDeviceIndex_t device);
+
+// A character for the device's class, H for HMD, C for controller and so on
+char GetDeviceClassChar(vr::TrackedDeviceIndex_t device);
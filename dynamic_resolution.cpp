@@ -0,0 +1,226 @@
+#include "dynamic_resolution.h"
+#include "vr_backend.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	// Results normally come back one or two frames later, a slot that still isn't ready
+	// by the time it comes round again is dropped
+	const int frames_in_flight = 4;
+
+	// All as a share of the budget. Above step_down_threshold for step_down_frames in a row
+	// drops straight to what should land on step_down_target, below step_up_threshold at the
+	// next step up for step_up_frames in a row goes up one step
+	const float step_down_threshold = 0.95f;
+	const float step_down_target = 0.85f;
+	const int step_down_frames = 2;
+	const float step_up_threshold = 0.75f;
+	const int step_up_frames = 45;
+
+	// How quickly the full resolution cost estimate follows new samples
+	const float cost_smoothing = 0.25f;
+
+	bool initialised = false;
+	DynamicResolutionConfig config;
+	float budget_ms = 0.0f;
+	float scale = 1.0f;
+
+	GLuint queries[frames_in_flight][2];
+	bool slot_pending[frames_in_flight];
+	float slot_scale[frames_in_flight];		// what the slot's frame rendered at
+	unsigned long long frames_begun = 0;
+	unsigned long long frame_index = 0;
+
+	float full_cost_ms = -1.0f;		// smoothed eye rendering cost at scale 1, -1 before the first sample
+	int frames_over = 0;
+	int frames_under = 0;
+
+	// Stats
+	unsigned long long frames_rendered = 0;
+	double scale_sum = 0.0;
+	float scale_min = 0.0f;
+	float scale_max = 0.0f;
+	int scale_changes = 0;
+	unsigned long long samples_over_budget = 0;
+	unsigned long long samples = 0;
+
+	float Quantise(float value)
+	{
+		// The epsilon keeps an exact multiple from flooring to the step below
+		float stepped = std::floor(value / config.step + 1e-3f) * config.step;
+		return std::max(config.min_scale, std::min(config.max_scale, stepped));
+	}
+
+	void ChangeScale(float new_scale, float gpu_ms)
+	{
+		printf("Dynamic resolution: frame %llu, scale %.2f -> %.2f (eye rendering %.2f ms on the GPU, budget %.2f ms)\n",
+			frame_index, scale, new_scale, gpu_ms, budget_ms);
+		scale = new_scale;
+		frames_over = 0;
+		frames_under = 0;
+		++scale_changes;
+	}
+
+	void AddSample(float gpu_ms, float sample_scale)
+	{
+		++samples;
+		if (gpu_ms > budget_ms)
+			++samples_over_budget;
+
+		// Eye rendering cost goes mostly with the pixel count, so samples taken at any scale
+		// can be brought to the same footing. Samples from before a change stay usable
+		float full_cost = gpu_ms / (sample_scale * sample_scale);
+		full_cost_ms = full_cost_ms < 0.0f ? full_cost : full_cost_ms + (full_cost - full_cost_ms) * cost_smoothing;
+
+		// Going down looks at the raw sample so a sudden spike isn't averaged away
+		if (full_cost * scale * scale > budget_ms * step_down_threshold)
+		{
+			frames_under = 0;
+			if (++frames_over >= step_down_frames)
+			{
+				float target = Quantise(std::sqrt(budget_ms * step_down_target / full_cost));
+				if (target < scale)
+					ChangeScale(target, gpu_ms);
+				else
+					frames_over = 0;
+			}
+			return;
+		}
+		frames_over = 0;
+
+		float up = Quantise(scale + config.step);
+		if (up > scale && full_cost_ms * up * up < budget_ms * step_up_threshold)
+		{
+			if (++frames_under >= step_up_frames)
+				ChangeScale(up, gpu_ms);
+		}
+		else
+		{
+			frames_under = 0;
+		}
+	}
+
+	// Returns false if the slot's queries aren't done yet
+	bool CollectSlot(int slot)
+	{
+		if (!slot_pending[slot])
+			return true;
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available != GL_TRUE)
+			return false;
+
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+		slot_pending[slot] = false;
+
+		AddSample((float)(end - begin) * 1e-6f, slot_scale[slot]);
+		return true;
+	}
+}
+
+void DynamicResolutionInit(VRBackend* backend, const DynamicResolutionConfig& new_config)
+{
+	config = new_config;
+	config.min_scale = std::max(0.1f, config.min_scale);
+	config.max_scale = std::max(config.min_scale, config.max_scale);
+
+	float frame_ms = 1000.0f / 90.0f;
+	vr::TrackedPropertyError error = vr::TrackedProp_Success;
+	float display_frequency = backend->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float, &error);
+	if (error == vr::TrackedProp_Success && display_frequency > 0.0f)
+		frame_ms = 1000.0f / display_frequency;
+	budget_ms = frame_ms * config.budget_fraction;
+
+	// Start at full resolution, or as near as the range allows, and let the measurements move it
+	scale = Quantise(1.0f);
+
+	glGenQueries(frames_in_flight * 2, &queries[0][0]);
+	for (int slot = 0; slot < frames_in_flight; ++slot)
+		slot_pending[slot] = false;
+	frames_begun = 0;
+	full_cost_ms = -1.0f;
+	frames_over = 0;
+	frames_under = 0;
+
+	frames_rendered = 0;
+	scale_sum = 0.0;
+	scale_min = scale;
+	scale_max = scale;
+	scale_changes = 0;
+	samples_over_budget = 0;
+	samples = 0;
+	initialised = true;
+
+	printf("Dynamic resolution: scale %.2f to %.2f, eye rendering budget %.2f ms of %.2f ms\n",
+		config.min_scale, config.max_scale, budget_ms, frame_ms);
+}
+
+void DynamicResolutionShutdown()
+{
+	if (!initialised)
+		return;
+
+	glDeleteQueries(frames_in_flight * 2, &queries[0][0]);
+	initialised = false;
+}
+
+float DynamicResolutionScale()
+{
+	return initialised ? scale : 1.0f;
+}
+
+void DynamicResolutionBeginFrame(unsigned long long new_frame_index)
+{
+	if (!initialised)
+		return;
+
+	frame_index = new_frame_index;
+
+	int slot = (int)(frames_begun % frames_in_flight);
+	if (!CollectSlot(slot))
+		slot_pending[slot] = false;
+
+	glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+	slot_scale[slot] = scale;
+
+	++frames_rendered;
+	scale_sum += scale;
+	scale_min = std::min(scale_min, scale);
+	scale_max = std::max(scale_max, scale);
+}
+
+void DynamicResolutionEndFrame()
+{
+	if (!initialised)
+		return;
+
+	int slot = (int)(frames_begun % frames_in_flight);
+	glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+	slot_pending[slot] = true;
+	++frames_begun;
+
+	// Oldest first so the samples go in in order, stopping at the first that isn't back yet
+	for (unsigned long long i = frames_begun > frames_in_flight ? frames_begun - frames_in_flight : 0; i < frames_begun; ++i)
+	{
+		if (!CollectSlot((int)(i % frames_in_flight)))
+			break;
+	}
+}
+
+void DynamicResolutionPrintStats()
+{
+	if (!initialised || frames_rendered == 0)
+		return;
+
+	printf("Dynamic resolution: avg scale %.2f, min %.2f, max %.2f, %d changes, %llu of %llu measured frames over the %.2f ms budget\n",
+		(float)(scale_sum / (double)frames_rendered), scale_min, scale_max, scale_changes,
+		samples_over_budget, samples, budget_ms);
+}
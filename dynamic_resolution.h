@@ -0,0 +1,40 @@
+#pragma once
+
+class VRBackend;
+
+// Eye resolution that follows the GPU load
+//
+// The eye targets are allocated once at max_scale and each frame renders into a lower left
+// sub-rectangle of them, so changing resolution never reallocates anything. The GPU time of each
+// frame's eye rendering is measured with timestamp queries, read back a few frames later without
+// waiting, and scaled to what it would cost at full resolution. The next frame's scale is picked
+// from that against the refresh budget.
+//
+// Going down reacts within a couple of frames, since a dropped frame is much worse than a soft one.
+// Going up needs the predicted cost at the next step to stay well under budget for a while, and the
+// gap between the up and down thresholds keeps the scale from bouncing between two steps.
+
+struct DynamicResolutionConfig
+{
+	float min_scale;		// per axis, of the recommended render target size
+	float max_scale;		// the eye targets get allocated at this
+	float step;				// scales are always a multiple of this
+	float budget_fraction;	// share of a refresh the eye rendering may take, the compositor needs the rest
+
+	DynamicResolutionConfig() : min_scale(0.5f), max_scale(1.2f), step(0.05f), budget_fraction(0.8f) {}
+};
+
+// The refresh rate comes from the backend. Needs a current GL context
+void DynamicResolutionInit(VRBackend* backend, const DynamicResolutionConfig& config);
+void DynamicResolutionShutdown();
+
+// What to render this frame at, per axis
+float DynamicResolutionScale();
+
+// Around all of a frame's eye rendering and resolves. EndFrame picks up whatever GPU times have
+// come back and chooses the scale for the next frame. Every change is logged
+void DynamicResolutionBeginFrame(unsigned long long frame_index);
+void DynamicResolutionEndFrame();
+
+// How the scale moved over the run
+void DynamicResolutionPrintStats();
@@ -0,0 +1,120 @@
+#include "foveated_rendering.h"
+#include "gl_state.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	GLuint program = 0;
+	GLint rect_location = -1;
+	GLuint vao = 0;		// empty, the quad comes from gl_VertexID
+
+	FoveationConfig config;
+	glm::vec2 centre[2];
+
+	float LevelSize(int level)
+	{
+		return level == 0 ? config.inner_size : config.middle_size;
+	}
+}
+
+bool FoveationInit(const FoveationConfig& new_config, const glm::vec2 lens_centre[2])
+{
+	config = new_config;
+	config.inner_size = std::max(0.05f, std::min(1.0f, config.inner_size));
+	config.middle_size = std::max(config.inner_size, std::min(1.0f, config.middle_size));
+	centre[0] = lens_centre[0];
+	centre[1] = lens_centre[1];
+
+	const char* vertex_source =
+		"#version 410\n"
+		"uniform vec4 rect;"	// x0, y0, x1, y1 in clip space
+		"void main()"
+		"{"
+		"	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);"
+		"	gl_Position = vec4(mix(rect.xy, rect.zw, corner), -1.0, 1.0);"
+		"}";
+	const char* fragment_source =
+		"#version 410\n"
+		"void main()"
+		"{"
+		"}";
+	program = CreateShaderProgram("foveation mask", vertex_source, fragment_source);
+	if (program == 0)
+		return false;
+	rect_location = glGetUniformLocation(program, "rect");
+	glGenVertexArrays(1, &vao);
+
+	printf("Foveated rendering: inner %.0f%% at full resolution, middle ring to %.0f%% at %.0f%%, the rest at %.0f%%\n",
+		config.inner_size * 100.0f, config.middle_size * 100.0f,
+		foveation_level_scale[1] * 100.0f, foveation_level_scale[2] * 100.0f);
+	return true;
+}
+
+void FoveationShutdown()
+{
+	if (vao)
+	{
+		GLStateDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+	if (program)
+	{
+		glDeleteProgram(program);
+		program = 0;
+	}
+}
+
+FoveationRect FoveationLevelRect(int eye, int level, int width, int height)
+{
+	FoveationRect rect = { 0, 0, width, height };
+	if (level >= foveation_level_count - 1)
+		return rect;
+
+	// Centred on the lens where there's room, pushed back in where it would hang off the edge
+	float size = LevelSize(level);
+	float x0 = std::max(0.0f, std::min(1.0f - size, centre[eye].x - size * 0.5f));
+	float y0 = std::max(0.0f, std::min(1.0f - size, centre[eye].y - size * 0.5f));
+	rect.x0 = (int)floorf(x0 * width);
+	rect.y0 = (int)floorf(y0 * height);
+	rect.x1 = (int)ceilf((x0 + size) * width);
+	rect.y1 = (int)ceilf((y0 + size) * height);
+	return rect;
+}
+
+FoveationRect FoveationDrawRect(int eye, int level, int width, int height)
+{
+	FoveationRect rect = FoveationLevelRect(eye, level, width, height);
+	rect.x0 = std::max(0, rect.x0 - foveation_overlap);
+	rect.y0 = std::max(0, rect.y0 - foveation_overlap);
+	rect.x1 = std::min(width, rect.x1 + foveation_overlap);
+	rect.y1 = std::min(height, rect.y1 + foveation_overlap);
+	return rect;
+}
+
+int FoveationMaskInnerLevels(int eye, int level, int width, int height)
+{
+	if (level == 0 || program == 0)
+		return 0;
+
+	// Pulled in by the overlap so this level still draws a little under the one inside it
+	FoveationRect inner = FoveationLevelRect(eye, level - 1, width, height);
+	float x0 = (inner.x0 + foveation_overlap) * 2.0f / width - 1.0f;
+	float y0 = (inner.y0 + foveation_overlap) * 2.0f / height - 1.0f;
+	float x1 = (inner.x1 - foveation_overlap) * 2.0f / width - 1.0f;
+	float y1 = (inner.y1 - foveation_overlap) * 2.0f / height - 1.0f;
+	if (x1 <= x0 || y1 <= y0)
+		return 0;
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	GLStateUseProgram(program);
+	GLStateBindVertexArray(vao);
+	glUniform4f(rect_location, x0, y0, x1, y1);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	GLStateBindVertexArray(0);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	return 1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Fixed foveated rendering
+//
+// The lens squeezes the edge of each eye's image, so after compositing the periphery of the
+// target is sampled far below the resolution it was shaded at. Instead each eye is split into
+// nested rectangles around the lens centre: the inner one is shaded at full resolution and the
+// middle and outer rings in their own smaller targets. Each ring is drawn with the rectangle
+// inside it masked out of depth, so no sample is shaded twice, then everything is upscaled into
+// the eye's resolve texture, outer ring first.
+//
+// This only works out the rectangles and draws the masks, the frame loop owns the targets.
+
+const int foveation_level_count = 3;	// inner, middle, outer
+// Resolution of each level per axis, the inner level is the eye target itself
+const float foveation_level_scale[foveation_level_count] = { 1.0f, 0.7f, 0.5f };
+// Levels overlap by this many of their own pixels so upscaling doesn't filter in anything
+// from outside what was drawn
+const int foveation_overlap = 2;
+
+struct FoveationConfig
+{
+	float inner_size;	// share of the target's width and height shaded at full resolution
+	float middle_size;	// share covered by the inner level and the middle ring, the outer ring is the rest
+
+	FoveationConfig() : inner_size(0.5f), middle_size(0.8f) {}
+};
+
+// In pixels of a target, origin bottom left, x1/y1 exclusive
+struct FoveationRect
+{
+	int x0, y0, x1, y1;
+};
+
+// lens_centre is where each eye's view axis lands on its target, 0-1 with the origin bottom left
+bool FoveationInit(const FoveationConfig& config, const glm::vec2 lens_centre[2]);
+void FoveationShutdown();
+
+// Where a level sits on a target of width x height, the outer level is all of it
+FoveationRect FoveationLevelRect(int eye, int level, int width, int height);
+// The level's rect grown by the overlap, what has to be drawn and resolved for it
+FoveationRect FoveationDrawRect(int eye, int level, int width, int height);
+
+// Masks what the levels inside this one cover out of depth, drawn at the near plane with colour
+// writes off like the hidden area. The viewport has to be the level's whole target. Returns
+// how many draw calls it made, none for the inner level
+int FoveationMaskInnerLevels(int eye, int level, int width, int height);
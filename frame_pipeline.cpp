@@ -0,0 +1,245 @@
+#include "frame_pipeline.h"
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// A ring of packet slots with one thread pushing and one popping. The slots and indices are
+	// only ever touched through the atomics. The mutex and condition variables are only for
+	// sleeping while there's nothing to do, a thread that's about to sleep counts itself in
+	// sleepers first and the other side only locks and notifies when it sees one (see Wake)
+	struct PacketQueue
+	{
+		static const uint32_t capacity = 4;		// a power of two with room for every packet
+		int slots[capacity];
+		std::atomic<uint32_t> head;				// next to pop, only the consumer moves it
+		std::atomic<uint32_t> tail;				// next to push, only the producer moves it
+		std::atomic<int> sleepers;				// threads in SleepUntil
+		std::mutex mutex;
+		std::condition_variable pushed;
+		std::condition_variable popped;
+	};
+
+	// Call after changing the queue. The fence pairs with the one in SleepUntil: either the
+	// sleeper's count is seen here, or the sleeper sees the change before it sleeps. With nobody
+	// asleep the hand-off never touches the mutex. Otherwise going through the lock means the
+	// sleeper is either still before its check or already waiting, so it can't miss the notify
+	void Wake(PacketQueue& queue, std::condition_variable& condition)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (queue.sleepers.load(std::memory_order_relaxed) == 0)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+		}
+		condition.notify_one();
+	}
+
+	// Sleeps on condition until ready returns true, or at most timeout if it isn't zero
+	template <typename Ready>
+	bool SleepUntil(PacketQueue& queue, std::condition_variable& condition, std::chrono::milliseconds timeout, Ready ready)
+	{
+		std::unique_lock<std::mutex> lock(queue.mutex);
+		queue.sleepers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool done = true;
+		if (timeout.count() == 0)
+			condition.wait(lock, ready);
+		else
+			done = condition.wait_for(lock, timeout, ready);
+
+		queue.sleepers.fetch_sub(1, std::memory_order_relaxed);
+		return done;
+	}
+
+	void Push(PacketQueue& queue, int slot)
+	{
+		uint32_t tail = queue.tail.load(std::memory_order_relaxed);
+		queue.slots[tail % PacketQueue::capacity] = slot;
+		queue.tail.store(tail + 1, std::memory_order_release);
+		Wake(queue, queue.pushed);
+	}
+
+	bool TryPop(PacketQueue& queue, int& slot)
+	{
+		uint32_t head = queue.head.load(std::memory_order_relaxed);
+		if (head == queue.tail.load(std::memory_order_acquire))
+			return false;
+
+		slot = queue.slots[head % PacketQueue::capacity];
+		queue.head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Empty(PacketQueue& queue)
+	{
+		return queue.head.load(std::memory_order_acquire) == queue.tail.load(std::memory_order_relaxed);
+	}
+
+	// Sleeps until there's something to pop, or at most timeout if it isn't zero
+	bool WaitAndPop(PacketQueue& queue, int& slot, std::chrono::milliseconds timeout)
+	{
+		return SleepUntil(queue, queue.pushed, timeout, [&]() { return TryPop(queue, slot); });
+	}
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	FramePacket packets[frame_packet_count];
+	PacketQueue free_packets;		// update thread pops, render thread pushes
+	PacketQueue ready_packets;		// the other way round, never holds more than one
+	std::thread render_thread;
+
+	// Update thread
+	uint64_t next_frame_index = 0;
+	uint64_t acquire_count = 0;
+	uint64_t acquire_waits = 0;
+	double acquire_wait_total_ms = 0.0;
+
+	// Render thread. Retired packets oldest first, each with the fence after its frame
+	int retired[frame_packet_count];
+	GLsync retired_fences[frame_packet_count];
+	int retired_first = 0;
+	int retired_count = 0;
+	uint64_t next_count = 0;
+	uint64_t next_waits = 0;
+	double next_wait_total_ms = 0.0;
+
+	// Hand retired packets the GPU has finished with back to the update thread, oldest first.
+	// With wait set it blocks until the oldest is done
+	void Reclaim(bool wait)
+	{
+		while (retired_count > 0)
+		{
+			GLsync fence = retired_fences[retired_first];
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				if (!wait)
+					return;
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			}
+			glDeleteSync(fence);
+
+			Push(free_packets, retired[retired_first]);
+			retired_first = (retired_first + 1) % frame_packet_count;
+			retired_count -= 1;
+		}
+	}
+}
+
+FramePacket& FramePipelinePacket(int slot)
+{
+	return packets[slot];
+}
+
+void FramePipelineStart(void (*render_loop)())
+{
+	free_packets.head = free_packets.tail = 0;
+	ready_packets.head = ready_packets.tail = 0;
+	free_packets.sleepers = ready_packets.sleepers = 0;
+	for (int slot = 0; slot < frame_packet_count; ++slot)
+	{
+		packets[slot].slot = slot;
+		Push(free_packets, slot);
+	}
+	next_frame_index = 0;
+	retired_first = 0;
+	retired_count = 0;
+
+	render_thread = std::thread(render_loop);
+}
+
+void FramePipelineStop()
+{
+	if (render_thread.joinable())
+		render_thread.join();
+}
+
+FramePacket& FramePipelineAcquire()
+{
+	int slot = 0;
+	if (!Empty(ready_packets) || !TryPop(free_packets, slot))
+	{
+		// Only one frame ahead, the poses are predicted for that. Wait for the render thread to take
+		// the last packet, then for the GPU to give one back if it's behind
+		Clock::time_point start = Clock::now();
+		SleepUntil(ready_packets, ready_packets.popped, std::chrono::milliseconds(0), [&]() { return Empty(ready_packets); });
+		if (!TryPop(free_packets, slot))
+			WaitAndPop(free_packets, slot, std::chrono::milliseconds(0));
+		acquire_wait_total_ms += MillisecondsSince(start);
+		acquire_waits += 1;
+	}
+	acquire_count += 1;
+
+	FramePacket& packet = packets[slot];
+	packet.frame_index = next_frame_index++;
+	packet.toggle_stereo_mode = false;
+	packet.last = false;
+	return packet;
+}
+
+void FramePipelinePublish(FramePacket& packet)
+{
+	Push(ready_packets, packet.slot);
+}
+
+FramePacket& FramePipelineNext()
+{
+	Reclaim(false);
+
+	int slot = 0;
+	if (!TryPop(ready_packets, slot))
+	{
+		// The update thread is behind. It might be waiting on a packet the GPU still has, so keep
+		// handing those back while waiting instead of sleeping through them
+		Clock::time_point start = Clock::now();
+		while (!WaitAndPop(ready_packets, slot, std::chrono::milliseconds(retired_count > 0 ? 1 : 0)))
+			Reclaim(false);
+		next_wait_total_ms += MillisecondsSince(start);
+		next_waits += 1;
+	}
+	Wake(ready_packets, ready_packets.popped);
+
+	next_count += 1;
+	return packets[slot];
+}
+
+void FramePipelineRetire(FramePacket& packet)
+{
+	retired[(retired_first + retired_count) % frame_packet_count] = packet.slot;
+	retired_fences[(retired_first + retired_count) % frame_packet_count] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	retired_count += 1;
+
+	// So the fence gets to the GPU and can signal without anyone waiting on it
+	glFlush();
+	Reclaim(false);
+
+	// Nothing comes after this, clean up the fences
+	if (packet.last)
+	{
+		while (retired_count > 0)
+			Reclaim(true);
+	}
+}
+
+void FramePipelinePrintStats()
+{
+	if (acquire_count == 0 || next_count == 0)
+		return;
+
+	printf("Frame pipeline: %llu frames, the update thread waited on the render thread %llu times (avg %.3f ms a frame), the render thread on the update thread %llu times (avg %.3f ms a frame)\n",
+		(unsigned long long)next_count, (unsigned long long)acquire_waits, acquire_wait_total_ms / acquire_count,
+		(unsigned long long)next_waits, next_wait_total_ms / next_count);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Pipelined frame loop, an update thread prepares frame N+1 while the render thread draws frame N
+//
+// Everything one frame's rendering needs from the update goes in a frame packet. There are three,
+// one being filled by the update thread, one being drawn and one the GPU might still be reading.
+// The update thread publishes a packet and starts on the next one as soon as the render thread
+// has taken it, right after WaitGetPoses, so it's exactly one frame ahead and can predict poses
+// for that. Packets move between the threads through single producer single consumer rings of
+// atomics, so handing one over takes no lock. Only when a thread has to wait for the other does
+// it sleep on the queue's mutex and condition variable, having counted itself as a sleeper first,
+// and only then does the other side take the mutex to wake it. A retired packet is fenced and
+// only goes back on the free queue once the GPU has finished the frame, so anything the GPU
+// reads straight out of a packet (its debug draw region) is safe to rewrite by then.
+
+const int frame_packet_count = 3;
+
+struct FramePacket
+{
+	int slot;							// which packet this is, 0 to frame_packet_count - 1, also the frame's debug draw region
+	uint64_t frame_index;				// filled in by FramePipelineAcquire
+	std::vector<uint32_t> visible_objects;	// what the cull left, sized and filled in before the pipeline starts
+	uint32_t visible_object_count;
+	std::vector<glm::mat4> object_models;	// every scene object's model matrix, --animate only
+	bool toggle_stereo_mode;			// the S key was pressed
+	bool last;							// the render thread stops after this one
+};
+
+// For setting the packets up before FramePipelineStart
+FramePacket& FramePipelinePacket(int slot);
+
+// Runs render_loop on a new thread, which has to take the GL context itself. The calling thread
+// becomes the update thread
+void FramePipelineStart(void (*render_loop)());
+// Waits for the render thread to return, after the update thread has published the last packet
+void FramePipelineStop();
+
+// Update thread, blocks until the render thread has taken the last packet and there's a free one
+FramePacket& FramePipelineAcquire();
+void FramePipelinePublish(FramePacket& packet);
+
+// Render thread, blocks until the update thread has published a packet. Call after WaitGetPoses,
+// the update thread starts on the frame after as soon as this returns
+FramePacket& FramePipelineNext();
+// Once every GL command that reads the packet has been issued. For the last packet this waits
+// for the GPU to finish everything
+void FramePipelineRetire(FramePacket& packet);
+
+// How often and how long each thread waited on the other
+void FramePipelinePrintStats();
@@ -0,0 +1,309 @@
+#include "frame_timing.h"
+#include "profiler.h"
+#include "vr_backend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// Frames the compositor can finish between two looks before the oldest are skipped. A long
+	// enough hitch to skip some still shows up, as the missed vsyncs of the frame after it
+	const uint32_t max_new_timings = 8;
+
+	// Pose samples kept for when their frame's timing comes back, a frame or two later
+	const uint32_t pose_sample_history = 16;
+
+	const uint32_t reprojection_reasons = vr::VRCompositor_ReprojectionReason_Cpu | vr::VRCompositor_ReprojectionReason_Gpu;
+
+	struct PoseSample
+	{
+		uint64_t vsync;				// WaitGetPoses returned after this one
+		float seconds_after_vsync;	// when the pose the frame drew with was sampled
+	};
+
+	struct FrameRecord
+	{
+		uint32_t missed_vsyncs;
+		bool missed;
+		bool reprojected;
+		float app_gpu_ms;
+		float compositor_gpu_ms;
+		float motion_to_photon_ms;	// -1 if its pose sample was gone
+	};
+
+	VRBackend* backend = nullptr;
+	FrameTimingConfig config;
+	float frame_duration = 1.0f / 90.0f;
+	float vsync_to_photons = 0.0f;
+
+	PoseSample pose_samples[pose_sample_history];
+	uint64_t pose_sample_count = 0;
+
+	bool have_frame_index = false;
+	uint32_t last_frame_index = 0;		// the newest the compositor reported
+
+	// The window, with running sums of everything averaged or counted
+	FrameRecord window[frame_timing_window];
+	uint32_t window_count = 0;
+	uint32_t window_next = 0;
+	uint32_t window_missed_frames = 0;
+	uint32_t window_missed_vsyncs = 0;
+	uint32_t window_reprojected = 0;
+	double window_app_gpu_ms = 0.0;
+	double window_compositor_gpu_ms = 0.0;
+	uint32_t window_latency_frames = 0;
+	double window_motion_to_photon_ms = 0.0;
+
+	bool alerting = false;
+	Clock::time_point last_log_time;
+
+	// Stats
+	uint64_t frames_total = 0;
+	uint64_t missed_frames_total = 0;
+	uint64_t missed_vsyncs_total = 0;
+	uint64_t reprojected_cpu_total = 0;
+	uint64_t reprojected_gpu_total = 0;
+	uint64_t timings_skipped = 0;
+	double app_gpu_ms_total = 0.0;
+	double compositor_gpu_ms_total = 0.0;
+	uint64_t latency_frames_total = 0;
+	double motion_to_photon_ms_total = 0.0;
+	float motion_to_photon_max_ms = 0.0f;
+	int alerts = 0;
+
+	void AddToWindow(const FrameRecord& record, int sign)
+	{
+		window_missed_frames += sign * (record.missed ? 1 : 0);
+		window_missed_vsyncs += sign * record.missed_vsyncs;
+		window_reprojected += sign * (record.reprojected ? 1 : 0);
+		window_app_gpu_ms += sign * record.app_gpu_ms;
+		window_compositor_gpu_ms += sign * record.compositor_gpu_ms;
+		if (record.motion_to_photon_ms >= 0.0f)
+		{
+			window_latency_frames += sign;
+			window_motion_to_photon_ms += sign * record.motion_to_photon_ms;
+		}
+	}
+
+	// -1 if the frame's pose sample has already been overwritten, or never was
+	float MotionToPhotonMs(uint32_t frame_index, uint32_t missed_vsyncs)
+	{
+		for (uint32_t i = 0; i < pose_sample_history && i < pose_sample_count; ++i)
+		{
+			const PoseSample& sample = pose_samples[(pose_sample_count - 1 - i) % pose_sample_history];
+			if ((uint32_t)sample.vsync == frame_index)
+				return ((1 + missed_vsyncs) * frame_duration - sample.seconds_after_vsync + vsync_to_photons) * 1000.0f;
+		}
+		return -1.0f;
+	}
+
+	void CheckAlert()
+	{
+		if (config.alert_missed_percent <= 0.0f || window_count < frame_timing_window)
+			return;
+
+		float missed_percent = 100.0f * window_missed_frames / window_count;
+		if (!alerting && missed_percent > config.alert_missed_percent)
+		{
+			printf("Frame timing: ALERT, %u of the last %u frames missed their vsync (%u vsyncs), %u reprojected\n",
+				window_missed_frames, window_count, window_missed_vsyncs, window_reprojected);
+			alerting = true;
+			++alerts;
+		}
+		else if (alerting && missed_percent <= config.alert_missed_percent * 0.5f)
+		{
+			printf("Frame timing: back to %u of the last %u frames missing their vsync\n", window_missed_frames, window_count);
+			alerting = false;
+		}
+	}
+
+	void AddFrame(const vr::Compositor_FrameTiming& timing)
+	{
+		FrameRecord record;
+		record.missed_vsyncs = timing.m_nNumDroppedFrames;
+		record.missed = timing.m_nNumDroppedFrames > 0 || timing.m_nNumMisPresented > 0;
+		record.reprojected = (timing.m_nReprojectionFlags & reprojection_reasons) != 0;
+		record.app_gpu_ms = timing.m_flTotalRenderGpuMs;
+		record.compositor_gpu_ms = timing.m_flCompositorRenderGpuMs;
+		record.motion_to_photon_ms = MotionToPhotonMs(timing.m_nFrameIndex, timing.m_nNumDroppedFrames);
+
+		if (window_count == frame_timing_window)
+			AddToWindow(window[window_next], -1);
+		else
+			window_count += 1;
+		window[window_next] = record;
+		window_next = (window_next + 1) % frame_timing_window;
+		AddToWindow(record, 1);
+
+		frames_total += 1;
+		missed_frames_total += record.missed ? 1 : 0;
+		missed_vsyncs_total += record.missed_vsyncs;
+		reprojected_cpu_total += (timing.m_nReprojectionFlags & vr::VRCompositor_ReprojectionReason_Cpu) ? 1 : 0;
+		reprojected_gpu_total += (timing.m_nReprojectionFlags & vr::VRCompositor_ReprojectionReason_Gpu) ? 1 : 0;
+		app_gpu_ms_total += record.app_gpu_ms;
+		compositor_gpu_ms_total += record.compositor_gpu_ms;
+		if (record.motion_to_photon_ms >= 0.0f)
+		{
+			latency_frames_total += 1;
+			motion_to_photon_ms_total += record.motion_to_photon_ms;
+			motion_to_photon_max_ms = std::max(motion_to_photon_max_ms, record.motion_to_photon_ms);
+		}
+
+		CheckAlert();
+	}
+
+	void PrintLogLine()
+	{
+		FrameTimingStats stats = FrameTimingGetStats();
+		printf("Frame timing: last %u frames, %u missed (%u vsyncs), %u reprojected, app GPU %.2f ms (max %.2f), compositor GPU %.2f ms (max %.2f), motion to photon %.1f ms (max %.1f)\n",
+			stats.frames, stats.missed_frames, stats.missed_vsyncs, stats.reprojected_frames,
+			stats.app_gpu_ms, stats.app_gpu_max_ms, stats.compositor_gpu_ms, stats.compositor_gpu_max_ms,
+			stats.motion_to_photon_ms, stats.motion_to_photon_max_ms);
+	}
+}
+
+void FrameTimingInit(VRBackend* new_backend, const FrameTimingConfig& new_config)
+{
+	backend = new_backend;
+	config = new_config;
+
+	vr::TrackedPropertyError error = vr::TrackedProp_Success;
+	float display_frequency = backend->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float, &error);
+	if (error == vr::TrackedProp_Success && display_frequency > 0.0f)
+		frame_duration = 1.0f / display_frequency;
+
+	vsync_to_photons = backend->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SecondsFromVsyncToPhotons_Float, &error);
+	if (error != vr::TrackedProp_Success)
+		vsync_to_photons = 0.0f;
+
+	last_log_time = Clock::now();
+}
+
+void FrameTimingBeginFrame()
+{
+	PoseSample& sample = pose_samples[pose_sample_count % pose_sample_history];
+	sample.vsync = 0;
+	sample.seconds_after_vsync = 0.0f;
+	backend->GetTimeSinceLastVsync(&sample.seconds_after_vsync, &sample.vsync);
+	pose_sample_count += 1;
+}
+
+void FrameTimingPoseResampled()
+{
+	if (pose_sample_count == 0)
+		return;
+
+	// Still counted from the frame's own vsync, even if another has gone by since
+	PoseSample& sample = pose_samples[(pose_sample_count - 1) % pose_sample_history];
+	float since_vsync = 0.0f;
+	uint64_t vsync = sample.vsync;
+	if (backend->GetTimeSinceLastVsync(&since_vsync, &vsync))
+		sample.seconds_after_vsync = (float)(int64_t)(vsync - sample.vsync) * frame_duration + since_vsync;
+}
+
+void FrameTimingUpdate()
+{
+	// Newest first back to the last one already seen, then taken in oldest first. Past the end of
+	// its history the runtime hands back its oldest again, so the walk stops once the frame index
+	// stops going down
+	vr::Compositor_FrameTiming timings[max_new_timings];
+	vr::Compositor_FrameTiming timing;
+	uint32_t count = 0;
+	uint32_t frames_ago = 0;
+	bool have_previous = false;
+	uint32_t previous_index = 0;
+	for (; backend->GetFrameTiming(&timing, frames_ago); ++frames_ago)
+	{
+		if (have_previous && (int32_t)(timing.m_nFrameIndex - previous_index) >= 0)
+			break;
+		if (have_frame_index && (int32_t)(timing.m_nFrameIndex - last_frame_index) <= 0)
+			break;
+		have_previous = true;
+		previous_index = timing.m_nFrameIndex;
+
+		// Still in flight, it's taken in on a later look once it has been presented
+		if (timing.m_nNumFramePresents == 0)
+			continue;
+
+		if (count == max_new_timings)
+		{
+			// What's older than the ones kept is skipped, the frames since the last one seen
+			if (have_frame_index)
+				timings_skipped += timing.m_nFrameIndex - last_frame_index;
+			break;
+		}
+		timings[count++] = timing;
+	}
+
+	uint32_t missed_vsyncs = 0;
+	for (uint32_t i = count; i-- > 0;)
+	{
+		AddFrame(timings[i]);
+		missed_vsyncs += timings[i].m_nNumDroppedFrames;
+	}
+	if (count > 0)
+	{
+		have_frame_index = true;
+		last_frame_index = timings[0].m_nFrameIndex;
+
+		PROFILE_COUNTER(ProfileCounter_MissedVsyncs, missed_vsyncs);
+		float motion_to_photon_ms = MotionToPhotonMs(timings[0].m_nFrameIndex, timings[0].m_nNumDroppedFrames);
+		if (motion_to_photon_ms >= 0.0f)
+			PROFILE_COUNTER(ProfileCounter_MotionToPhoton, motion_to_photon_ms * 1000.0f);
+	}
+
+	if (config.log_seconds > 0.0f && window_count > 0)
+	{
+		Clock::time_point now = Clock::now();
+		if (std::chrono::duration<float>(now - last_log_time).count() >= config.log_seconds)
+		{
+			PrintLogLine();
+			last_log_time = now;
+		}
+	}
+}
+
+FrameTimingStats FrameTimingGetStats()
+{
+	FrameTimingStats stats;
+	stats.frames = window_count;
+	stats.missed_frames = window_missed_frames;
+	stats.missed_vsyncs = window_missed_vsyncs;
+	stats.reprojected_frames = window_reprojected;
+	stats.app_gpu_ms = window_count > 0 ? (float)(window_app_gpu_ms / window_count) : 0.0f;
+	stats.compositor_gpu_ms = window_count > 0 ? (float)(window_compositor_gpu_ms / window_count) : 0.0f;
+	stats.latency_frames = window_latency_frames;
+	stats.motion_to_photon_ms = window_latency_frames > 0 ? (float)(window_motion_to_photon_ms / window_latency_frames) : 0.0f;
+
+	// Maxima can't be kept as running sums, it's a short walk
+	stats.app_gpu_max_ms = 0.0f;
+	stats.compositor_gpu_max_ms = 0.0f;
+	stats.motion_to_photon_max_ms = 0.0f;
+	for (uint32_t i = 0; i < window_count; ++i)
+	{
+		stats.app_gpu_max_ms = std::max(stats.app_gpu_max_ms, window[i].app_gpu_ms);
+		stats.compositor_gpu_max_ms = std::max(stats.compositor_gpu_max_ms, window[i].compositor_gpu_ms);
+		stats.motion_to_photon_max_ms = std::max(stats.motion_to_photon_max_ms, window[i].motion_to_photon_ms);
+	}
+	return stats;
+}
+
+void FrameTimingPrintStats()
+{
+	if (frames_total == 0)
+		return;
+
+	printf("Frame timing: %llu frames from the compositor, %llu missed their vsync (%llu vsyncs), %llu reprojected for the CPU, %llu for the GPU, %d missed frame alerts\n",
+		(unsigned long long)frames_total, (unsigned long long)missed_frames_total, (unsigned long long)missed_vsyncs_total,
+		(unsigned long long)reprojected_cpu_total, (unsigned long long)reprojected_gpu_total, alerts);
+	printf("Frame timing: avg app GPU %.2f ms, avg compositor GPU %.2f ms, motion to photon avg %.1f ms, max %.1f ms",
+		app_gpu_ms_total / frames_total, compositor_gpu_ms_total / frames_total,
+		latency_frames_total > 0 ? motion_to_photon_ms_total / latency_frames_total : 0.0, motion_to_photon_max_ms);
+	if (timings_skipped > 0)
+		printf(", %llu frames' timing skipped", (unsigned long long)timings_skipped);
+	printf("\n");
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+class VRBackend;
+
+// Compositor frame timing and motion to photon latency
+//
+// After every frame's submits the compositor's timing for each frame it has finished with since
+// the last look gets pulled in: whether the frame missed its vsync and by how many, whether the
+// compositor reprojected because the app's CPU or GPU work was late, and how long the app's and
+// the compositor's GPU work took.
+//
+// Motion to photon is estimated from when the HMD pose the frame was drawn with was sampled to
+// when its photons came out of the display. That's the vsync after the one WaitGetPoses returned
+// on, plus however many vsyncs the frame turned out to be late, plus the display's vsync to
+// photons time. It's the same photon time pose prediction aims for, with the lateness filled in
+// once the compositor knows it. A late latched pose counts from when it was latched.
+//
+// The newest frame_timing_window frames are kept in a ring with running sums, so the rolling
+// stats cost next to nothing to read. Optionally a log line with them is printed every few
+// seconds. When more than alert_missed_percent of a full window's frames missed their vsync an
+// alert is printed, once, and again only after it has dropped back under half that.
+//
+// Call everything from the thread that waits on poses and submits.
+
+const int frame_timing_window = 90;		// frames the rolling stats cover, a second at 90 Hz
+
+struct FrameTimingConfig
+{
+	float log_seconds;				// between log lines, 0 for none
+	float alert_missed_percent;		// of the window's frames, 0 for no alert
+
+	FrameTimingConfig() : log_seconds(0.0f), alert_missed_percent(10.0f) {}
+};
+
+// Over the last frames of the window, whatever the compositor has reported so far
+struct FrameTimingStats
+{
+	uint32_t frames;
+	uint32_t missed_frames;			// shown at a later vsync than the one they were made for
+	uint32_t missed_vsyncs;			// vsyncs the frame before had to be shown again for
+	uint32_t reprojected_frames;	// the compositor reprojected because the app was late
+	float app_gpu_ms;				// average, and the longest
+	float app_gpu_max_ms;
+	float compositor_gpu_ms;
+	float compositor_gpu_max_ms;
+	uint32_t latency_frames;		// frames whose pose sample was still known, the ones below are over these
+	float motion_to_photon_ms;
+	float motion_to_photon_max_ms;
+};
+
+// Refresh rate and vsync to photons come from the backend
+void FrameTimingInit(VRBackend* backend, const FrameTimingConfig& config);
+
+// Straight after WaitGetPoses, the pose sample the frame's motion to photon counts from
+void FrameTimingBeginFrame();
+// The frame's HMD pose was sampled again, late latching
+void FrameTimingPoseResampled();
+// After the frame's submits. Takes in whatever timing the compositor has finished since, logs and alerts
+void FrameTimingUpdate();
+
+FrameTimingStats FrameTimingGetStats();
+
+// Totals over the whole run
+void FrameTimingPrintStats();
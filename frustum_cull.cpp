@@ -0,0 +1,303 @@
+#include "frustum_cull.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULL_SSE 1
+#include <emmintrin.h>
+#endif
+
+void ClearBoundingSpheres(BoundingSpheres& spheres)
+{
+	spheres.centre_x.clear();
+	spheres.centre_y.clear();
+	spheres.centre_z.clear();
+	spheres.radius.clear();
+	spheres.count = 0;
+}
+
+uint32_t AddBoundingSphere(BoundingSpheres& spheres, const glm::vec3& centre, float radius)
+{
+	// Grow by a whole group of 4, the padding never gets reported as visible
+	if (spheres.count == spheres.radius.size())
+	{
+		size_t padded = spheres.radius.size() + 4;
+		spheres.centre_x.resize(padded, 0.0f);
+		spheres.centre_y.resize(padded, 0.0f);
+		spheres.centre_z.resize(padded, 0.0f);
+		spheres.radius.resize(padded, 0.0f);
+	}
+
+	uint32_t index = spheres.count++;
+	spheres.centre_x[index] = centre.x;
+	spheres.centre_y[index] = centre.y;
+	spheres.centre_z[index] = centre.z;
+	spheres.radius[index] = radius;
+	return index;
+}
+
+namespace
+{
+	// Gribb and Hartmann, each plane is the last row of the clip matrix plus or minus one of the others
+	void ExtractPlanes(const glm::mat4& clip_from_space, glm::vec4 planes[6])
+	{
+		glm::mat4 rows = glm::transpose(clip_from_space);
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[3] + rows[2];
+		planes[5] = rows[3] - rows[2];
+		for (int plane = 0; plane < 6; ++plane)
+			planes[plane] /= glm::length(glm::vec3(planes[plane]));
+	}
+}
+
+Frustum BuildCombinedStereoFrustum(const glm::mat4 eye_projection_from_head[2], float margin)
+{
+	// Squashing x and y in clip space widens what ends up inside -w..w
+	glm::mat4 widen(1.0f);
+	widen[0][0] = 1.0f / (1.0f + margin);
+	widen[1][1] = 1.0f / (1.0f + margin);
+
+	glm::vec4 eye_planes[2][6];
+	glm::vec3 corners[16];
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		glm::mat4 clip_from_head = widen * eye_projection_from_head[eye];
+		ExtractPlanes(clip_from_head, eye_planes[eye]);
+
+		glm::mat4 head_from_clip = glm::inverse(clip_from_head);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			glm::vec4 ndc(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 1.0f);
+			glm::vec4 head = head_from_clip * ndc;
+			corners[eye * 8 + corner] = glm::vec3(head) / head.w;
+		}
+	}
+
+	// Each plane faces the same way as one eye's version of it, or halfway between the two, and gets
+	// pushed out until every corner of both frusta is on the inside. Both frusta are convex so that
+	// holds all of them. Of those directions, keep whichever leaves the corners closest to the plane
+	Frustum combined;
+	for (int plane = 0; plane < 6; ++plane)
+	{
+		glm::vec3 candidates[3] =
+		{
+			glm::vec3(eye_planes[0][plane]),
+			glm::vec3(eye_planes[1][plane]),
+			glm::normalize(glm::vec3(eye_planes[0][plane]) + glm::vec3(eye_planes[1][plane]))
+		};
+
+		float best_slack = 1e30f;
+		for (int candidate = 0; candidate < 3; ++candidate)
+		{
+			const glm::vec3& normal = candidates[candidate];
+			float closest = 1e30f, total = 0.0f;
+			for (int corner = 0; corner < 16; ++corner)
+			{
+				float distance = glm::dot(normal, corners[corner]);
+				closest = std::min(closest, distance);
+				total += distance;
+			}
+
+			float slack = total - closest * 16.0f;
+			if (slack < best_slack)
+			{
+				best_slack = slack;
+				combined.planes[plane] = glm::vec4(normal, -closest);
+			}
+		}
+	}
+	return combined;
+}
+
+Frustum TransformFrustum(const Frustum& frustum, const glm::mat4& head_from_world)
+{
+	// dot(plane, head_from_world * p) == dot(transpose(head_from_world) * plane, p).
+	// The view is rigid so the normals stay unit length
+	glm::mat4 transform = glm::transpose(head_from_world);
+	Frustum result;
+	for (int plane = 0; plane < 6; ++plane)
+		result.planes[plane] = transform * frustum.planes[plane];
+	return result;
+}
+
+uint32_t CullBoundingSpheresScalar(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible)
+{
+	uint32_t visible_count = 0;
+	for (uint32_t sphere = 0; sphere < spheres.count; ++sphere)
+	{
+		bool inside = true;
+		for (int plane = 0; plane < 6 && inside; ++plane)
+		{
+			const glm::vec4& p = frustum.planes[plane];
+			float distance = p.x * spheres.centre_x[sphere] + p.y * spheres.centre_y[sphere] + p.z * spheres.centre_z[sphere] + p.w;
+			inside = distance >= -spheres.radius[sphere];
+		}
+		if (inside)
+			visible[visible_count++] = sphere;
+	}
+	return visible_count;
+}
+
+#ifdef FRUSTUM_CULL_SSE
+
+namespace
+{
+	// For each 4 bit visibility mask, the lanes that are set packed to the front
+	const int32_t packed_lanes[16][4] =
+	{
+		{ 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+		{ 2, 0, 0, 0 }, { 0, 2, 0, 0 }, { 1, 2, 0, 0 }, { 0, 1, 2, 0 },
+		{ 3, 0, 0, 0 }, { 0, 3, 0, 0 }, { 1, 3, 0, 0 }, { 0, 1, 3, 0 },
+		{ 2, 3, 0, 0 }, { 0, 2, 3, 0 }, { 1, 2, 3, 0 }, { 0, 1, 2, 3 }
+	};
+	const uint32_t lane_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+}
+
+uint32_t CullBoundingSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible)
+{
+	__m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	for (int plane = 0; plane < 6; ++plane)
+	{
+		plane_x[plane] = _mm_set1_ps(frustum.planes[plane].x);
+		plane_y[plane] = _mm_set1_ps(frustum.planes[plane].y);
+		plane_z[plane] = _mm_set1_ps(frustum.planes[plane].z);
+		plane_w[plane] = _mm_set1_ps(frustum.planes[plane].w);
+	}
+
+	uint32_t visible_count = 0;
+	for (uint32_t first = 0; first < spheres.count; first += 4)
+	{
+		__m128 x = _mm_loadu_ps(&spheres.centre_x[first]);
+		__m128 y = _mm_loadu_ps(&spheres.centre_y[first]);
+		__m128 z = _mm_loadu_ps(&spheres.centre_z[first]);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[first]));
+
+		// Inside only if no plane has the whole sphere behind it
+		__m128 inside = _mm_cmpeq_ps(x, x);
+		for (int plane = 0; plane < 6; ++plane)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[plane], x), _mm_mul_ps(plane_y[plane], y)),
+				_mm_add_ps(_mm_mul_ps(plane_z[plane], z), plane_w[plane]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		if (spheres.count - first < 4)
+			mask &= (1 << (spheres.count - first)) - 1;
+
+		// Always store 4 and only advance past the visible ones, no branch per sphere
+		__m128i lanes = _mm_loadu_si128((const __m128i*)packed_lanes[mask]);
+		_mm_storeu_si128((__m128i*)(visible + visible_count), _mm_add_epi32(lanes, _mm_set1_epi32((int)first)));
+		visible_count += lane_count[mask];
+	}
+	return visible_count;
+}
+
+#else
+
+// No SSE on this target, the scalar version is the only version
+uint32_t CullBoundingSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible)
+{
+	return CullBoundingSpheresScalar(frustum, spheres, visible);
+}
+
+#endif
+
+namespace
+{
+	// Best of a few runs, in microseconds per call
+	template <typename Function>
+	double TimeCalls(Function function, int calls)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 5; ++run)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int call = 0; call < calls; ++call)
+				function();
+			double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / calls;
+			if (us < best) best = us;
+		}
+		return best;
+	}
+}
+
+bool RunCullBenchmark()
+{
+#ifdef FRUSTUM_CULL_SSE
+	printf("Cull benchmark, SSE kernel vs scalar, combined stereo frustum vs one per eye\n");
+#else
+	printf("Cull benchmark, no SSE on this target so both kernels are scalar\n");
+#endif
+
+	// Roughly a Vive: a wider outer edge than inner, eyes 64mm apart
+	glm::mat4 eye_projection_from_head[2];
+	eye_projection_from_head[0] = glm::frustum(-0.14f, 0.11f, -0.125f, 0.125f, 0.1f, 20.0f) * glm::translate(glm::mat4(1.0f), glm::vec3(0.032f, 0.0f, 0.0f));
+	eye_projection_from_head[1] = glm::frustum(-0.11f, 0.14f, -0.125f, 0.125f, 0.1f, 20.0f) * glm::translate(glm::mat4(1.0f), glm::vec3(-0.032f, 0.0f, 0.0f));
+
+	Frustum combined = BuildCombinedStereoFrustum(eye_projection_from_head, 0.0f);
+	// The combined frustum of an eye with itself is just that eye's frustum
+	glm::mat4 left_only[2] = { eye_projection_from_head[0], eye_projection_from_head[0] };
+	glm::mat4 right_only[2] = { eye_projection_from_head[1], eye_projection_from_head[1] };
+	Frustum left = BuildCombinedStereoFrustum(left_only, 0.0f);
+	Frustum right = BuildCombinedStereoFrustum(right_only, 0.0f);
+
+	bool all_ok = true;
+	const uint32_t counts[] = { 1000, 10000, 100000 };
+	for (int test = 0; test < 3; ++test)
+	{
+		// Scattered through a 40m room around the user
+		BoundingSpheres spheres;
+		uint32_t seed = 12345;
+		for (uint32_t i = 0; i < counts[test]; ++i)
+		{
+			float random[4];
+			for (int r = 0; r < 4; ++r)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				random[r] = (seed >> 8) / 16777216.0f;
+			}
+			AddBoundingSphere(spheres, glm::vec3(random[0] * 40.0f - 20.0f, random[1] * 4.0f - 1.6f, random[2] * 40.0f - 20.0f), 0.05f + random[3] * 0.5f);
+		}
+
+		// Turned a little so the planes aren't axis aligned
+		glm::mat4 view = glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(0.2f, 1.0f, 0.1f));
+		Frustum world = TransformFrustum(combined, view);
+		Frustum world_left = TransformFrustum(left, view);
+		Frustum world_right = TransformFrustum(right, view);
+
+		std::vector<uint32_t> simd_visible(CullOutputSize(spheres)), scalar_visible(CullOutputSize(spheres));
+		std::vector<uint32_t> left_visible(CullOutputSize(spheres)), right_visible(CullOutputSize(spheres)), either_visible(spheres.count);
+		uint32_t simd_count = 0, scalar_count = 0, either_count = 0;
+
+		int calls = 2000000 / counts[test];
+		double simd_us = TimeCalls([&]() { simd_count = CullBoundingSpheres(world, spheres, &simd_visible[0]); }, calls);
+		double scalar_us = TimeCalls([&]() { scalar_count = CullBoundingSpheresScalar(world, spheres, &scalar_visible[0]); }, calls);
+		double per_eye_us = TimeCalls([&]()
+		{
+			uint32_t left_count = CullBoundingSpheres(world_left, spheres, &left_visible[0]);
+			uint32_t right_count = CullBoundingSpheres(world_right, spheres, &right_visible[0]);
+			either_count = (uint32_t)(std::set_union(left_visible.begin(), left_visible.begin() + left_count,
+				right_visible.begin(), right_visible.begin() + right_count, either_visible.begin()) - either_visible.begin());
+		}, calls);
+
+		// The kernels have to agree exactly, and the combined frustum can't lose anything either eye sees
+		bool match = simd_count == scalar_count && std::equal(simd_visible.begin(), simd_visible.begin() + simd_count, scalar_visible.begin());
+		bool conservative = std::includes(simd_visible.begin(), simd_visible.begin() + simd_count, either_visible.begin(), either_visible.begin() + either_count);
+		all_ok = all_ok && match && conservative;
+
+		printf("  %6u spheres, %6u visible: SSE %8.2f us, scalar %8.2f us, %.2fx, per eye %8.2f us (%u visible, %u extra from combining)%s%s\n",
+			spheres.count, simd_count, simd_us, scalar_us, scalar_us / simd_us, per_eye_us, either_count, simd_count - either_count,
+			match ? "" : " MISMATCH", conservative ? "" : " MISSED OBJECTS");
+	}
+
+	return all_ok;
+}
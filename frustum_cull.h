@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Visibility culling of bounding spheres against one frustum that covers both eyes
+//
+// The two eye frusta overlap almost completely, so instead of testing every object twice
+// they get merged into a single six plane frustum that contains both. Objects inside it are
+// drawn to both eyes, anything outside is behind or beside the user and skipped. A few objects
+// right at the edge pass that one eye alone would have rejected, which costs less than a second
+// round of plane tests.
+
+// Planes are (normal, d) with the normal pointing inwards, a point p is inside when dot(normal, p) + d >= 0
+struct Frustum
+{
+	glm::vec4 planes[6];	// left, right, bottom, top, near, far
+};
+
+// Structure of arrays so the SSE kernel can test four spheres per plane in one go.
+// The arrays are padded to a multiple of 4, count is how many are real
+struct BoundingSpheres
+{
+	std::vector<float> centre_x;
+	std::vector<float> centre_y;
+	std::vector<float> centre_z;
+	std::vector<float> radius;
+	uint32_t count;
+
+	BoundingSpheres() : count(0) {}
+};
+
+void ClearBoundingSpheres(BoundingSpheres& spheres);
+// Returns the new sphere's index
+uint32_t AddBoundingSphere(BoundingSpheres& spheres, const glm::vec3& centre, float radius);
+
+// Room the visible list passed to CullBoundingSpheres needs, the kernel writes whole groups of 4
+inline uint32_t CullOutputSize(const BoundingSpheres& spheres) { return (uint32_t)spheres.radius.size(); }
+
+// One frustum around both eyes, in head space. eye_projection_from_head is projection * eye_to_head
+// for each eye, the same matrices the view projection is built from.
+// margin widens both eyes' frusta first, as a fraction of the image, for when the view used to draw
+// can move after culling (late latching)
+Frustum BuildCombinedStereoFrustum(const glm::mat4 eye_projection_from_head[2], float margin);
+
+// The same planes in another space, head_from_world is the HMD view matrix
+Frustum TransformFrustum(const Frustum& frustum, const glm::mat4& head_from_world);
+
+// Writes the indices of the spheres that touch the frustum to visible, in order, and returns how many.
+// visible needs CullOutputSize(spheres) entries. SSE where the compiler targets it
+uint32_t CullBoundingSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible);
+
+// One sphere and one plane at a time, for comparison
+uint32_t CullBoundingSpheresScalar(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible);
+
+// Times the SSE kernel against the scalar one and against culling each eye separately,
+// returns false if they disagree
+bool RunCullBenchmark();
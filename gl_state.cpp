@@ -0,0 +1,265 @@
+#include "gl_state.h"
+#include "profiler.h"
+
+#include <cstdint>
+#include <cstdio>
+
+namespace
+{
+	const GLuint unknown = ~0u;		// nothing known about the binding, the next bind goes through
+
+	// Targets whose binding is context state. Anything else passes straight through
+	const GLenum buffer_targets[] =
+	{
+		GL_ARRAY_BUFFER,
+		GL_COPY_READ_BUFFER,
+		GL_COPY_WRITE_BUFFER,
+		GL_DRAW_INDIRECT_BUFFER,
+		GL_PIXEL_PACK_BUFFER,
+		GL_PIXEL_UNPACK_BUFFER,
+		GL_SHADER_STORAGE_BUFFER,
+		GL_UNIFORM_BUFFER,
+	};
+	const int buffer_target_count = sizeof(buffer_targets) / sizeof(buffer_targets[0]);
+
+	const GLenum texture_targets[] =
+	{
+		GL_TEXTURE_2D,
+		GL_TEXTURE_2D_MULTISAMPLE,
+	};
+	const int texture_target_count = sizeof(texture_targets) / sizeof(texture_targets[0]);
+
+	const GLenum capabilities[] =
+	{
+		GL_BLEND,
+		GL_CLIP_DISTANCE0,
+		GL_CULL_FACE,
+		GL_DEPTH_TEST,
+		GL_MULTISAMPLE,
+		GL_SCISSOR_TEST,
+	};
+	const int capability_count = sizeof(capabilities) / sizeof(capabilities[0]);
+
+	bool elide = true;
+
+	GLuint program;
+	GLuint vao;
+	GLuint buffers[buffer_target_count];
+	GLuint read_frame_buffer;
+	GLuint draw_frame_buffer;
+	GLuint textures[texture_target_count];
+	int enabled[capability_count];			// -1 unknown
+
+	uint32_t frame_issued = 0;
+	uint32_t frame_elided = 0;
+	uint64_t issued_total = 0;
+	uint64_t elided_total = 0;
+	uint32_t frame_total = 0;
+
+	int FindTarget(const GLenum* targets, int count, GLenum target)
+	{
+		for (int index = 0; index < count; ++index)
+		{
+			if (targets[index] == target)
+				return index;
+		}
+		return -1;
+	}
+
+	// True if the call has to be made, counts it either way
+	bool Changes(bool changes)
+	{
+		if (changes || !elide)
+		{
+			frame_issued += 1;
+			frame_elided += changes ? 0 : 1;
+			return true;
+		}
+		frame_elided += 1;
+		return false;
+	}
+
+	void SetCapability(GLenum capability, bool enable)
+	{
+		int index = FindTarget(capabilities, capability_count, capability);
+		if (index < 0)
+		{
+			Changes(true);
+		}
+		else
+		{
+			if (!Changes(enabled[index] != (int)enable))
+				return;
+			enabled[index] = enable;
+		}
+
+		if (enable)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+	// A deleted object that's bound leaves zero bound in its place
+	void Forget(GLuint* bound, int count, GLsizei deleted_count, const GLuint* deleted)
+	{
+		for (GLsizei i = 0; i < deleted_count; ++i)
+		{
+			for (int index = 0; index < count; ++index)
+			{
+				if (deleted[i] != 0 && bound[index] == deleted[i])
+					bound[index] = 0;
+			}
+		}
+	}
+}
+
+void GLStateInit(bool elide_calls)
+{
+	elide = elide_calls;
+	GLStateInvalidate();
+}
+
+void GLStateUseProgram(GLuint new_program)
+{
+	if (!Changes(program != new_program))
+		return;
+	program = new_program;
+	glUseProgram(new_program);
+}
+
+void GLStateBindVertexArray(GLuint new_vao)
+{
+	if (!Changes(vao != new_vao))
+		return;
+	vao = new_vao;
+	glBindVertexArray(new_vao);
+}
+
+void GLStateBindBuffer(GLenum target, GLuint buffer)
+{
+	int index = FindTarget(buffer_targets, buffer_target_count, target);
+	if (index < 0)
+	{
+		Changes(true);
+	}
+	else
+	{
+		if (!Changes(buffers[index] != buffer))
+			return;
+		buffers[index] = buffer;
+	}
+	glBindBuffer(target, buffer);
+}
+
+void GLStateBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	Changes(true);
+	glBindBufferBase(target, index, buffer);
+
+	int target_index = FindTarget(buffer_targets, buffer_target_count, target);
+	if (target_index >= 0)
+		buffers[target_index] = buffer;
+}
+
+void GLStateBindFramebuffer(GLenum target, GLuint frame_buffer)
+{
+	bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+	bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+	if (!Changes((read && read_frame_buffer != frame_buffer) || (draw && draw_frame_buffer != frame_buffer)))
+		return;
+	if (read)
+		read_frame_buffer = frame_buffer;
+	if (draw)
+		draw_frame_buffer = frame_buffer;
+	glBindFramebuffer(target, frame_buffer);
+}
+
+void GLStateBindTexture(GLenum target, GLuint texture)
+{
+	int index = FindTarget(texture_targets, texture_target_count, target);
+	if (index < 0)
+	{
+		Changes(true);
+	}
+	else
+	{
+		if (!Changes(textures[index] != texture))
+			return;
+		textures[index] = texture;
+	}
+	glBindTexture(target, texture);
+}
+
+void GLStateEnable(GLenum capability)
+{
+	SetCapability(capability, true);
+}
+
+void GLStateDisable(GLenum capability)
+{
+	SetCapability(capability, false);
+}
+
+void GLStateDeleteBuffers(GLsizei count, const GLuint* deleted)
+{
+	Forget(buffers, buffer_target_count, count, deleted);
+	glDeleteBuffers(count, deleted);
+}
+
+void GLStateDeleteFramebuffers(GLsizei count, const GLuint* deleted)
+{
+	Forget(&read_frame_buffer, 1, count, deleted);
+	Forget(&draw_frame_buffer, 1, count, deleted);
+	glDeleteFramebuffers(count, deleted);
+}
+
+void GLStateDeleteTextures(GLsizei count, const GLuint* deleted)
+{
+	Forget(textures, texture_target_count, count, deleted);
+	glDeleteTextures(count, deleted);
+}
+
+void GLStateDeleteVertexArrays(GLsizei count, const GLuint* deleted)
+{
+	Forget(&vao, 1, count, deleted);
+	glDeleteVertexArrays(count, deleted);
+}
+
+void GLStateInvalidate()
+{
+	program = unknown;
+	vao = unknown;
+	for (int index = 0; index < buffer_target_count; ++index)
+		buffers[index] = unknown;
+	read_frame_buffer = unknown;
+	draw_frame_buffer = unknown;
+	for (int index = 0; index < texture_target_count; ++index)
+		textures[index] = unknown;
+	for (int index = 0; index < capability_count; ++index)
+		enabled[index] = -1;
+}
+
+void GLStateEndFrame()
+{
+	PROFILE_COUNTER(ProfileCounter_GLCallsIssued, frame_issued);
+	PROFILE_COUNTER(ProfileCounter_GLCallsElided, frame_elided);
+	issued_total += frame_issued;
+	elided_total += frame_elided;
+	frame_total += 1;
+	frame_issued = 0;
+	frame_elided = 0;
+}
+
+void GLStatePrintStats()
+{
+	if (frame_total == 0)
+		return;
+
+	double issued = issued_total / (double)frame_total, elided = elided_total / (double)frame_total;
+	if (elide)
+		printf("GL state: avg %.1f binds and enables issued per frame, %.1f more elided as redundant (%.0f%%)\n",
+			issued, elided, 100.0 * elided / (issued + elided));
+	else
+		printf("GL state: avg %.1f binds and enables issued per frame, %.1f of them redundant (%.0f%%, cache off)\n",
+			issued, elided, 100.0 * elided / issued);
+}
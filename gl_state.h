@@ -0,0 +1,45 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Binding and enable state of the render context, tracked so calls that wouldn't change anything
+// never reach the driver
+//
+// Everything that binds programs, vertex arrays, buffers, frame buffers or textures, or enables
+// and disables things, on the render context goes through here instead of straight to GL. If
+// something has to go round it, call GLStateInvalidate() after and the next call of each kind
+// gets issued whatever it is. The companion mirror's own context doesn't use it.
+//
+// Element array buffers belong to the bound vertex array rather than the context, binds to
+// GL_ELEMENT_ARRAY_BUFFER always go through. Textures are only tracked on unit 0, nothing draws
+// with any other. Deleting a bound object unbinds it in GL, so names that might be bound get
+// deleted through the GLStateDelete* calls, otherwise a new object given the same name would
+// look bound already.
+
+// Call with the render context current. With elide false every call is issued, and the ones that
+// would have been dropped are only counted
+void GLStateInit(bool elide);
+
+void GLStateUseProgram(GLuint program);
+void GLStateBindVertexArray(GLuint vao);
+void GLStateBindBuffer(GLenum target, GLuint buffer);
+// Indexed bindings go straight through, but they also bind the buffer to target itself
+void GLStateBindBufferBase(GLenum target, GLuint index, GLuint buffer);
+// GL_FRAMEBUFFER is both GL_READ_FRAMEBUFFER and GL_DRAW_FRAMEBUFFER
+void GLStateBindFramebuffer(GLenum target, GLuint frame_buffer);
+void GLStateBindTexture(GLenum target, GLuint texture);
+void GLStateEnable(GLenum capability);
+void GLStateDisable(GLenum capability);
+
+void GLStateDeleteBuffers(GLsizei count, const GLuint* buffers);
+void GLStateDeleteFramebuffers(GLsizei count, const GLuint* frame_buffers);
+void GLStateDeleteTextures(GLsizei count, const GLuint* textures);
+void GLStateDeleteVertexArrays(GLsizei count, const GLuint* vaos);
+
+// Forget everything, the next call of each kind is issued
+void GLStateInvalidate();
+
+// Once per frame after its last GL call, sets the gl_calls_issued and gl_calls_elided counters
+void GLStateEndFrame();
+// Average calls issued and elided per frame
+void GLStatePrintStats();
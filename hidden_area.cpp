@@ -0,0 +1,155 @@
+#include "hidden_area.h"
+#include "gl_state.h"
+#include "shader.h"
+#include "vr_backend.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+	GLuint program = 0;
+	GLint placement_location = -1;
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	GLint first_vertex[2] = { 0, 0 };
+	GLsizei vertex_count[2] = { 0, 0 };
+	float covered[2] = { 0.0f, 0.0f };		// share of the target
+
+	// The mesh is in texture coordinates with v down, placement is the scale and offset into clip space
+	void Draw(int eye, float scale_x, float offset_x)
+	{
+		if (vertex_count[eye] == 0)
+			return;
+
+		glUniform4f(placement_location, scale_x, -2.0f, offset_x, 1.0f);
+		glDrawArrays(GL_TRIANGLES, first_vertex[eye], vertex_count[eye]);
+	}
+
+	void BeginMask()
+	{
+		// Depth only, the pixels underneath keep the clear colour
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		GLStateUseProgram(program);
+		GLStateBindVertexArray(vao);
+	}
+
+	void EndMask()
+	{
+		GLStateBindVertexArray(0);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+}
+
+bool HiddenAreaInit(VRBackend* backend)
+{
+	std::vector<float> vertices;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		vr::HiddenAreaMesh_t mesh = backend->GetHiddenAreaMesh((vr::Hmd_Eye)eye);
+		first_vertex[eye] = (GLint)(vertices.size() / 2);
+		vertex_count[eye] = mesh.pVertexData ? (GLsizei)(mesh.unTriangleCount * 3) : 0;
+
+		float area = 0.0f;
+		for (uint32_t triangle = 0; triangle < (uint32_t)vertex_count[eye] / 3; ++triangle)
+		{
+			const vr::HmdVector2_t* corners = &mesh.pVertexData[triangle * 3];
+			for (int i = 0; i < 3; ++i)
+			{
+				vertices.push_back(corners[i].v[0]);
+				vertices.push_back(corners[i].v[1]);
+			}
+			area += 0.5f * fabsf((corners[1].v[0] - corners[0].v[0]) * (corners[2].v[1] - corners[0].v[1]) -
+				(corners[2].v[0] - corners[0].v[0]) * (corners[1].v[1] - corners[0].v[1]));
+		}
+		covered[eye] = area;
+	}
+
+	if (vertices.empty())
+	{
+		printf("Hidden area: the runtime has no hidden area mesh for this headset\n");
+		return false;
+	}
+
+	const char* vertex_source =
+		"#version 410\n"
+		"uniform vec4 placement;"
+		"layout(location = 0) in vec2 vPosition;"
+		"void main()"
+		"{"
+		"	gl_Position = vec4(vPosition * placement.xy + placement.zw, -1.0, 1.0);"
+		"}";
+	const char* fragment_source =
+		"#version 410\n"
+		"void main()"
+		"{"
+		"}";
+	program = CreateShaderProgram("hidden area", vertex_source, fragment_source);
+	if (program == 0)
+		return false;
+	placement_location = glGetUniformLocation(program, "placement");
+
+	glGenVertexArrays(1, &vao);
+	GLStateBindVertexArray(vao);
+	glGenBuffers(1, &vbo);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+	GLStateBindVertexArray(0);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void HiddenAreaShutdown()
+{
+	if (vbo)
+	{
+		GLStateDeleteBuffers(1, &vbo);
+		vbo = 0;
+	}
+	if (vao)
+	{
+		GLStateDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+	if (program)
+	{
+		glDeleteProgram(program);
+		program = 0;
+	}
+}
+
+int HiddenAreaRender(int eye)
+{
+	if (program == 0 || vertex_count[eye] == 0)
+		return 0;
+
+	BeginMask();
+	Draw(eye, 2.0f, -1.0f);
+	EndMask();
+	return 1;
+}
+
+int HiddenAreaRenderStereo()
+{
+	if (program == 0)
+		return 0;
+
+	// Half the width each, left eye on the left
+	BeginMask();
+	Draw(0, 1.0f, -1.0f);
+	Draw(1, 1.0f, 0.0f);
+	EndMask();
+	return (vertex_count[0] > 0 ? 1 : 0) + (vertex_count[1] > 0 ? 1 : 0);
+}
+
+void HiddenAreaPrintStats()
+{
+	if (program == 0)
+		return;
+
+	printf("Hidden area: masks %.1f%% of the left eye's target and %.1f%% of the right's\n",
+		covered[0] * 100.0f, covered[1] * 100.0f);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+class VRBackend;
+
+// Keeps the scene from shading pixels the lens never shows
+//
+// The runtime's hidden area mesh for each eye is fetched once and kept in a static vertex buffer.
+// Straight after each eye's clear it's drawn at the near plane into depth only, so everything
+// drawn after it fails the depth test there and gets rejected before shading. Those pixels stay
+// at the clear colour.
+
+// Returns false if there's no hidden area for this headset, there's nothing to draw then
+bool HiddenAreaInit(VRBackend* backend);
+void HiddenAreaShutdown();
+
+// Both return how many draw calls they made. Call with depth testing on, after the clear and
+// before anything else is drawn
+int HiddenAreaRender(int eye);
+// Into the double wide stereo target, each eye's mask in its own half
+int HiddenAreaRenderStereo();
+
+// How much of each eye's target the mask covers
+void HiddenAreaPrintStats();
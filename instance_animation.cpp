@@ -0,0 +1,137 @@
+#include "instance_animation.h"
+#include "job_system.h"
+#include "profiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t animate_grain = 2048;		// objects per job
+
+	struct AnimateJob
+	{
+		const BoundingSpheres* bounds;
+		glm::mat4 mesh_base;
+		float seconds;
+		glm::mat4* models;
+	};
+
+	uint64_t frames_animated = 0;
+	uint64_t objects_animated = 0;
+	double animate_ms_total = 0.0;
+
+	// Between a quarter and one and a quarter turns a second, either way round
+	float SpinRate(uint32_t object)
+	{
+		uint32_t hash = object * 2654435761u;
+		float rate = 1.5707963f + (hash >> 8) / 16777216.0f * 6.2831853f;
+		return hash & 1 ? rate : -rate;
+	}
+
+	void AnimateRange(void* data, uint32_t begin, uint32_t end)
+	{
+		const AnimateJob& job = *(const AnimateJob*)data;
+		const BoundingSpheres& bounds = *job.bounds;
+		for (uint32_t object = begin; object < end; ++object)
+		{
+			float angle = job.seconds * SpinRate(object);
+			float c = cosf(angle), s = sinf(angle);
+
+			// Turned about y, then moved to the sphere's centre
+			glm::mat4 spin(
+				c, 0.0f, -s, 0.0f,
+				0.0f, 1.0f, 0.0f, 0.0f,
+				s, 0.0f, c, 0.0f,
+				bounds.centre_x[object], bounds.centre_y[object], bounds.centre_z[object], 1.0f);
+			job.models[object] = spin * job.mesh_base;
+		}
+	}
+
+	// Best of a few runs, in milliseconds per call
+	template <typename Function>
+	double TimeCalls(Function function, int calls)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 5; ++run)
+		{
+			Clock::time_point start = Clock::now();
+			for (int call = 0; call < calls; ++call)
+				function();
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / calls;
+			if (ms < best) best = ms;
+		}
+		return best;
+	}
+}
+
+void AnimateInstances(const BoundingSpheres& bounds, const glm::mat4& mesh_base, float seconds, glm::mat4* models)
+{
+	PROFILE_SCOPE(ProfileStage_Animate);
+	Clock::time_point start = Clock::now();
+
+	AnimateJob job = { &bounds, mesh_base, seconds, models };
+	JobParallelFor(bounds.count, animate_grain, AnimateRange, &job);
+
+	animate_ms_total += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	frames_animated += 1;
+	objects_animated += bounds.count;
+}
+
+void InstanceAnimationPrintStats()
+{
+	if (frames_animated == 0)
+		return;
+
+	printf("Instance animation: %.0f objects a frame, avg %.3f ms on %d threads\n",
+		objects_animated / (double)frames_animated, animate_ms_total / frames_animated, JobSystemWorkerCount() + 1);
+}
+
+bool RunInstanceBenchmark()
+{
+	JobSystemInit(0);
+	printf("Instance benchmark, spinning every object on one thread vs %d\n", JobSystemWorkerCount() + 1);
+	printf("  CPU only, the upload and the draws need a real run with --animate\n");
+	if (JobSystemWorkerCount() == 0)
+		printf("  One hardware thread, so the job system has no workers and both sides run here\n");
+
+	bool all_ok = true;
+	const uint32_t counts[] = { 1000, 10000, 100000, 1000000 };
+	for (int test = 0; test < 4; ++test)
+	{
+		// Laid out on a grid like the scene objects
+		BoundingSpheres spheres;
+		uint32_t grid_size = (uint32_t)ceil(sqrt((double)counts[test]));
+		for (uint32_t i = 0; i < counts[test]; ++i)
+			AddBoundingSphere(spheres, glm::vec3((i % grid_size) * 0.5f, 1.0f, (i / grid_size) * 0.5f), 0.25f);
+		glm::mat4 mesh_base = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+
+		std::vector<glm::mat4> serial_models(spheres.count), parallel_models(spheres.count);
+		AnimateJob serial_job = { &spheres, mesh_base, 1.25f, &serial_models[0] };
+		AnimateJob parallel_job = { &spheres, mesh_base, 1.25f, &parallel_models[0] };
+
+		int calls = std::max(20000000 / (int)counts[test], 2);
+		calls = std::min(calls, 2000);
+		double serial_ms = TimeCalls([&]() { AnimateRange(&serial_job, 0, spheres.count); }, calls);
+		double parallel_ms = TimeCalls([&]() { JobParallelFor(spheres.count, animate_grain, AnimateRange, &parallel_job); }, calls);
+
+		// Same kernel either way, so the matrices have to match to the bit
+		bool match = memcmp(&serial_models[0], &parallel_models[0], spheres.count * sizeof(glm::mat4)) == 0;
+		all_ok = all_ok && match;
+
+		printf("  %7u objects: one thread %8.3f ms, job system %8.3f ms, %.2fx, %.1f ns an object%s\n",
+			spheres.count, serial_ms, parallel_ms, serial_ms / parallel_ms, parallel_ms * 1e6 / spheres.count, match ? "" : " MISMATCH");
+	}
+
+	JobSystemPrintStats();
+	JobSystemShutdown();
+	return all_ok;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "frustum_cull.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// Every scene object's model matrix rebuilt each frame, for loading up the CPU side of drawing
+// lots of moving instances
+//
+// Each object spins about the vertical axis through its bounding sphere's centre, at a rate and
+// direction of its own, so its bounds never change and culling doesn't need to know. The update is
+// a parallel for on the job system (see job_system.h) writing straight into the model matrix
+// array, which the batch renderer then uploads to its storage buffer in one go.
+
+// mesh_base goes on the right of every object's spin: the mesh's centre moved to the origin, then
+// its dequantise. seconds is the animation's clock. models needs an entry per sphere
+void AnimateInstances(const BoundingSpheres& bounds, const glm::mat4& mesh_base, float seconds, glm::mat4* models);
+
+// How many objects were animated, how long it took per frame and across how many threads
+void InstanceAnimationPrintStats();
+
+// Times the update on this thread alone against the job system for growing instance counts,
+// returns false if they produce different matrices
+bool RunInstanceBenchmark();
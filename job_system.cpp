@@ -0,0 +1,250 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const uint32_t deque_capacity = 1024;	// jobs per worker, a push that finds it full runs the job there and then
+
+	struct Job
+	{
+		JobFunction function;
+		void* data;
+		uint32_t begin;
+		uint32_t end;
+		std::atomic<uint32_t>* remaining;	// the parallel for's count of jobs not finished yet
+	};
+
+	// A ring used as a deque, the owner pops the newest and thieves take the oldest
+	struct Worker
+	{
+		std::mutex mutex;
+		Job jobs[deque_capacity];
+		uint32_t head;		// oldest
+		uint32_t count;
+
+		std::atomic<uint64_t> jobs_run;
+		std::atomic<uint64_t> jobs_stolen;
+	};
+
+	Worker* workers = nullptr;
+	int worker_count = 0;
+	std::vector<std::thread> threads;
+
+	std::atomic<int> queued_jobs(0);			// in any deque, the workers sleep while it's 0, for a moment it can be below
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	bool quit = false;
+
+	std::atomic<uint32_t> next_worker(0);		// where the next parallel for starts dealing
+	std::atomic<uint64_t> parallel_fors(0);
+	std::atomic<uint64_t> caller_jobs_run(0);
+
+	bool Push(Worker& worker, const Job& job)
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (worker.count == deque_capacity)
+			return false;
+		worker.jobs[(worker.head + worker.count) % deque_capacity] = job;
+		worker.count += 1;
+		return true;
+	}
+
+	bool PopNewest(Worker& worker, Job& job)
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (worker.count == 0)
+			return false;
+		worker.count -= 1;
+		job = worker.jobs[(worker.head + worker.count) % deque_capacity];
+		return true;
+	}
+
+	bool PopOldest(Worker& worker, Job& job)
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (worker.count == 0)
+			return false;
+		job = worker.jobs[worker.head];
+		worker.head = (worker.head + 1) % deque_capacity;
+		worker.count -= 1;
+		return true;
+	}
+
+	// self is -1 for a thread that isn't a worker, it only steals
+	bool FindJob(int self, Job& job)
+	{
+		if (self >= 0 && PopNewest(workers[self], job))
+		{
+			queued_jobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		int start = self >= 0 ? self + 1 : 0;
+		for (int i = 0; i < worker_count; ++i)
+		{
+			int victim = (start + i) % worker_count;
+			if (victim != self && PopOldest(workers[victim], job))
+			{
+				queued_jobs.fetch_sub(1, std::memory_order_relaxed);
+				if (self >= 0)
+					workers[self].jobs_stolen.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void RunJob(const Job& job)
+	{
+		job.function(job.data, job.begin, job.end);
+		job.remaining->fetch_sub(1, std::memory_order_release);
+	}
+
+	void WorkerThread(int self)
+	{
+		for (;;)
+		{
+			Job job;
+			if (FindJob(self, job))
+			{
+				RunJob(job);
+				workers[self].jobs_run.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			wake.wait(lock, []() { return quit || queued_jobs.load(std::memory_order_relaxed) > 0; });
+			if (quit)
+				return;
+		}
+	}
+}
+
+void JobSystemInit(int count)
+{
+	if (count <= 0)
+		count = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+
+	worker_count = count;
+	quit = false;
+	if (worker_count == 0)
+		return;
+
+	workers = new Worker[worker_count];
+	for (int i = 0; i < worker_count; ++i)
+	{
+		workers[i].head = 0;
+		workers[i].count = 0;
+		workers[i].jobs_run = 0;
+		workers[i].jobs_stolen = 0;
+	}
+	for (int i = 0; i < worker_count; ++i)
+		threads.push_back(std::thread(WorkerThread, i));
+}
+
+void JobSystemShutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	threads.clear();
+
+	delete[] workers;
+	workers = nullptr;
+	worker_count = 0;
+}
+
+int JobSystemWorkerCount()
+{
+	return worker_count;
+}
+
+void JobParallelFor(uint32_t count, uint32_t grain, JobFunction function, void* data)
+{
+	if (count == 0)
+		return;
+	grain = std::max(grain, 1u);
+	parallel_fors.fetch_add(1, std::memory_order_relaxed);
+
+	if (worker_count == 0 || count <= grain)
+	{
+		function(data, 0, count);
+		caller_jobs_run.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	uint32_t job_count = (count + grain - 1) / grain;
+	std::atomic<uint32_t> remaining(job_count);
+
+	// Dealt out round the workers, starting somewhere different each time
+	uint32_t worker = next_worker.fetch_add(1, std::memory_order_relaxed);
+	uint32_t pushed = 0;
+	for (uint32_t begin = 0; begin < count; begin += grain)
+	{
+		Job job = { function, data, begin, std::min(begin + grain, count), &remaining };
+		if (Push(workers[worker++ % worker_count], job))
+		{
+			pushed += 1;
+		}
+		else
+		{
+			RunJob(job);
+			caller_jobs_run.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	if (pushed > 0)
+	{
+		// Changed before the lock so a worker about to sleep sees it
+		queued_jobs.fetch_add((int)pushed, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		wake.notify_all();
+	}
+
+	// Help until the last job is done, whether it's this parallel for's or someone else's
+	while (remaining.load(std::memory_order_acquire) > 0)
+	{
+		Job job;
+		if (FindJob(-1, job))
+		{
+			RunJob(job);
+			caller_jobs_run.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystemPrintStats()
+{
+	uint64_t fors = parallel_fors.load();
+	if (fors == 0)
+		return;
+
+	uint64_t worker_run = 0, stolen = 0;
+	for (int i = 0; i < worker_count; ++i)
+	{
+		worker_run += workers[i].jobs_run.load();
+		stolen += workers[i].jobs_stolen.load();
+	}
+	uint64_t caller_run = caller_jobs_run.load();
+	uint64_t total = worker_run + caller_run;
+	printf("Jobs: %d workers, %llu parallel fors, %llu jobs, %.1f%% stolen by workers, %.1f%% run by the thread waiting on them\n",
+		worker_count, (unsigned long long)fors, (unsigned long long)total,
+		100.0 * stolen / std::max(total, (uint64_t)1), 100.0 * caller_run / std::max(total, (uint64_t)1));
+}
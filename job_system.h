@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Work stealing job system, for spreading a frame's CPU work over every core
+//
+// There's a worker thread per hardware thread, less one for whoever hands the work out. Every
+// worker has a deque of its own. A parallel for cuts its range into jobs and deals them out to
+// the deques in turn. Workers take from the back of their own deque and steal from the front of
+// the others' once theirs is empty, so it evens out however much each job costs. The thread that
+// asked runs jobs too until the last one is done, it doesn't sleep. Workers sleep when there's
+// nothing left anywhere.
+//
+// A job is a range of thousands of items, so a lock per deque costs nothing next to the job and
+// there's no lock free deque. Nothing allocates after JobSystemInit.
+
+typedef void (*JobFunction)(void* data, uint32_t begin, uint32_t end);
+
+// worker_count 0 is one less than the hardware threads. With none at all every parallel for runs
+// on the thread that calls it
+void JobSystemInit(int worker_count);
+void JobSystemShutdown();
+int JobSystemWorkerCount();
+
+// Calls function on ranges of at most grain items until it has covered 0 to count, on the
+// workers and this thread, and returns when every range is done. Any thread can call it, and
+// several can at once
+void JobParallelFor(uint32_t count, uint32_t grain, JobFunction function, void* data);
+
+// How many jobs ran, how many were stolen and how many the waiting threads ran themselves
+void JobSystemPrintStats();
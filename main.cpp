@@ -6,8 +6,39 @@
 #include <SDL_opengl.h>
 #include <openvr.h>
 
+#include "batch_renderer.h"
+#include "companion_mirror.h"
+#include "debug_draw.h"
+#include "device_registry.h"
+#include "dynamic_resolution.h"
+#include "foveated_rendering.h"
+#include "frame_pipeline.h"
+#include "frame_timing.h"
+#include "frustum_cull.h"
+#include "gl_state.h"
+#include "hidden_area.h"
+#include "instance_animation.h"
+#include "job_system.h"
+#include "mesh.h"
+#include "pose_math.h"
+#include "pose_prediction.h"
+#include "profiler.h"
+#include "render_models.h"
+#include "render_targets.h"
+#include "shader.h"
+#include "startup_trace.h"
+#include "texture_stream.h"
+#include "vr_backend.h"
+#include "vr_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <thread>
 #include <vector>
 
 // This is a tech test of loading up all the OpenVR things and putting something on the HMD
@@ -26,52 +57,125 @@ SDL_Window* companion_window = nullptr;
 const int companion_width = 1280;
 const int companion_height = 640;
 SDL_GLContext gl_context = 0;
+SDL_Window* render_context_window = nullptr;	// what gl_context gets made current on, the mirror moves it off the companion window
 
 // OpenGL 
 GLuint scene_shader_program = 0;
-GLuint scene_vao = 0;	// Vertex attribute object, stores the vertex layout
-GLuint scene_vbo = 0;	// Vertex buffer object, stores the vertex data
-GLint scene_matrix_location = -1;
-GLuint window_shader_program = 0;
-GLuint window_vao = 0;	// Vertex attribute object
-GLuint window_vbo = 0;	// Vertex buffer object
-GLuint window_ebo = 0;	// element buffer object, the order for vertices to be drawn
-
-struct FrameBufferDesc
-{
-	GLuint depth_buffer;
-	GLuint render_texture;
-	GLuint render_frame_buffer;
-	GLuint resolve_texture;
-	GLuint resolve_frame_buffer;
-} left_eye_desc, right_eye_desc;
+Mesh scene_mesh;	// --mesh FILE, or the built in triangles
+GLint scene_eye_location = -1;
+GLint scene_model_location = -1;
+GLint scene_textured_location = -1;
+GLuint scene_stereo_shader_program = 0;	// Same as the scene shader but picks the eye from gl_InstanceID
+GLint scene_stereo_model_location = -1;
+GLint scene_stereo_textured_location = -1;
+GLuint scene_batch_shader_program = 0;			// The scene shaders again, model matrix from the batch's storage buffer
+GLuint scene_batch_stereo_shader_program = 0;
+GLuint view_matrices_ubo = 0;	// Both eyes' view projection, every scene and debug shader reads it
+
+// Scene objects, each one a copy of scene_mesh somewhere in the world
+std::vector<glm::mat4> scene_object_models;		// model * scene_mesh.dequantise, ready for the shader
+BoundingSpheres scene_object_bounds;			// world space, same order as the models
+glm::mat4 scene_mesh_base;						// the mesh moved from its centre to the origin and dequantised, what --animate spins
+const float animation_frame_seconds = 1.0f / 90.0f;	// animated by frame rather than by the clock, so a replay draws the same frames
+std::vector<uint32_t> visible_scene_objects;	// what this frame's cull left, drawn by both eyes
+uint32_t visible_scene_object_count = 0;
+std::vector<int> scene_object_textures;			// streamed texture handles, empty without --texture
+
+FrameBufferDesc left_eye_desc, right_eye_desc;
+FrameBufferDesc stereo_desc;	// Double wide, both eyes side by side. Only created if instanced stereo or --single-texture gets used
+// The middle and outer foveation rings, shared by both eyes. The inner level draws into the eye's own target so [0] is unused
+FrameBufferDesc foveation_level_desc[foveation_level_count];
+
+// Command line options
+bool use_simulated_hmd = false;		// --sim, run against the stand-in runtime instead of SteamVR
+bool hide_companion_window = false;	// --hidden, for running without a display
+int max_frame_count = 0;			// --frames N, quit after N frames, 0 runs forever
+const char* benchmark_name = nullptr;	// --bench NAME, run a microbenchmark and exit instead of starting up
+bool late_latch_poses = false;		// --late-latch, re-sample the HMD pose once just before the eye draws
+const char* scene_mesh_path = nullptr;	// --mesh FILE, a converted .hvm file to draw instead of the built in triangles
+int scene_object_count = 1;			// --objects N, lay out a grid of N copies of the scene mesh
+bool animate_scene = false;			// --animate, spin every scene object about its own centre every frame
+bool frustum_culling = true;		// --no-cull, draw every object whether it's in view or not
+bool batched_rendering = true;		// --naive-draws, a draw call per object instead of one indirect multi draw
+bool dynamic_resolution = false;	// --dynamic-resolution, scale the eye resolution to fit the GPU time budget
+DynamicResolutionConfig dynamic_resolution_config;	// --resolution-range MIN MAX
+FrameTimingConfig frame_timing_config;	// --timing-log SECONDS, --missed-alert PERCENT
+bool hidden_area_mask = true;		// --no-hidden-area, shade the whole eye target including what the lens can't show
+bool foveated_rendering = false;	// --foveated, full resolution only around the lens centre
+int msaa_samples = 4;				// --msaa 0|2|4|8
+bool single_texture = false;		// --single-texture, both eyes in one double wide target, resolved once and submitted twice
+bool shared_targets = true;			// --no-shared-targets, every target gets its own multisampled colour and depth
+FoveationConfig foveation_config;	// --foveation INNER MIDDLE
+CompanionMirrorConfig mirror_config;	// --mirror-rate N, --mirror-scale S, --mirror-eye left|right|both
+bool pipelined_frames = false;		// --pipelined, update the next frame on this thread while a render thread draws this one
+bool gl_state_cache = true;			// --no-state-cache, issue every bind and enable even when it changes nothing
+const char* shader_cache_path = "shader_cache.bin";	// --shader-cache FILE, --no-shader-cache for nullptr
+const char* startup_trace_path = nullptr;	// --startup-trace FILE, chrome://tracing format
+std::vector<const char*> scene_texture_paths;	// --texture FILE, as often as wanted, the objects take turns
+TextureStreamConfig texture_stream_config;		// --texture-budget MB, --texture-upload-ms MS
+const char* trace_record_path = nullptr;	// --record FILE, write the poses, events and input to a trace
+const char* trace_replay_path = nullptr;	// --replay FILE, play a trace back instead of running the runtime
+bool trace_replay_real_time = false;		// --replay-realtime, at the recorded pace instead of as fast as possible
+
+// How the two eye images get drawn
+enum StereoMode
+{
+	StereoMode_MultiPass,	// RenderScene once per eye into that eye's frame buffer
+	StereoMode_Instanced	// one pass into a double wide frame buffer, every draw instanced twice
+};
+StereoMode stereo_mode = StereoMode_MultiPass;	// --stereo multipass|instanced, toggle with S
+
+// Where to write the frame profile at exit, nullptr to skip that format
+const char* profile_csv_path = nullptr;		// --profile-csv
+const char* profile_json_path = nullptr;	// --profile-json
+const char* profile_trace_path = nullptr;	// --profile-trace, chrome://tracing format
+SimulatedVRConfig simulated_hmd_config;
 
 // OpenvR
-vr::IVRSystem* hmd = nullptr;
+VRBackend* hmd = nullptr;
 const float near_plane = 0.1f;
 const float far_plane = 20.0f;
-uint32_t hmd_render_target_width;
+uint32_t hmd_render_target_width;		// what the runtime recommends
 uint32_t hmd_render_target_height;
+uint32_t eye_target_width;				// what the eye targets were allocated at, bigger than recommended with dynamic resolution
+uint32_t eye_target_height;
+uint32_t eye_render_width;				// the lower left part of the eye targets used this frame
+uint32_t eye_render_height;
 glm::mat4 left_eye_projection = glm::mat4(1.0f);
 glm::mat4 left_eye_to_pose = glm::mat4(1.0f);
 glm::mat4 right_eye_projection = glm::mat4(1.0f);
 glm::mat4 right_eye_to_pose = glm::mat4(1.0f);
 
 vr::TrackedDevicePose_t tracked_device_pose[vr::k_unMaxTrackedDeviceCount];
-glm::mat4 mat4_device_pose[vr::k_unMaxTrackedDeviceCount];
-std::string pose_classes_string;							// what classes we saw poses for this frame
-char dev_class_char[vr::k_unMaxTrackedDeviceCount];			// for each device, a character representing its class
-int valid_pose_count;
-glm::mat4 hmd_pose_matrix;
+PoseStore pose_store;										// this frame's poses as matrices, plus the view matrices that come from them
+glm::mat4 eye_projection_from_head[2];						// projection * eye_to_pose for each eye, fixed at startup
+Frustum combined_eye_frustum;								// head space, contains both eyes' frusta
+// Culling uses the WaitGetPoses pose, or a prediction from before it with --pipelined, the pose
+// the eyes get drawn from can look a little further round than that
+const float late_latch_cull_margin = 0.1f;
+// The update thread's own poses with --pipelined, predicted a frame further ahead than WaitGetPoses
+vr::TrackedDevicePose_t update_device_pose[vr::k_unMaxTrackedDeviceCount];
+PoseStore update_pose_store;
+char pose_classes[vr::k_unMaxTrackedDeviceCount + 1];		// what classes we saw poses for this frame, one character per pose
 int tracked_controller_count;
-int tracked_controller_vertex_count;
-GLuint tracked_controller_vbo = 0;
-GLuint tracked_controller_vao = 0;
+int render_model_region = 0;	// which frame's render model draws the GL thread is on, the packet's slot with --pipelined
+int frame_draw_calls = 0;		// glDraw* calls issued this frame, for comparing stereo modes
+int stress_line_count = 0;		// --stress-lines N, extra debug lines per frame to load up the streaming path
+
+// Frame loop stats, kept by whichever thread renders
+int frame_count = 0;
+long long draw_call_total = 0;
+long long visible_object_total = 0;
+double frame_time_total_ms = 0.0;
+double frame_time_min_ms = 1e9;
+double frame_time_max_ms = 0.0;
+std::chrono::steady_clock::time_point last_frame_time;
+int first_frame_phase = -1;		// ends once the first frame is submitted
 
 /* Functions */
 
 // Usefull for getting information about the current hardware setup
-std::string GetTrackedDeviceString(vr::IVRSystem *pHmd, vr::TrackedDeviceIndex_t unDevice, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError *peError = NULL)
+std::string GetTrackedDeviceString(VRBackend *pHmd, vr::TrackedDeviceIndex_t unDevice, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError *peError = NULL)
 {
 	uint32_t unRequiredBufferLen = pHmd->GetStringTrackedDeviceProperty(unDevice, prop, NULL, 0, peError);
 	if (unRequiredBufferLen == 0)
@@ -84,383 +188,1007 @@ std::string GetTrackedDeviceString(vr::IVRSystem *pHmd, vr::TrackedDeviceIndex_t
 	return sResult;
 }
 
-// Create a frame buffer for use with the HMD
-// Fills in the Frame Buffer Description 
-bool CreateFrameBuffer(int width, int height, FrameBufferDesc& desc)
+glm::mat4 GetHMDMartixProjection(vr::Hmd_Eye eye)
+{
+	if (!hmd)
+		return glm::mat4();
+
+	vr::HmdMatrix44_t matrix = hmd->GetProjectionMatrix(eye, near_plane, far_plane);
+
+	return ConvertHMDMat4ToGLMMat4(matrix);
+}
+
+glm::mat4 GetHMDMatrixPoseEye(vr::Hmd_Eye eye)
+{
+	if (!hmd)
+		return glm::mat4();
+
+	vr::HmdMatrix34_t matrix = hmd->GetEyeToHeadTransform(eye);
+
+	return ConvertHMDMat3ToGLMMat4(matrix);
+}
+
+// Copy projection * eye_to_pose * hmd_view for both eyes into the uniform buffer the shaders read
+void UpdateViewMatrices()
 {
-	// render buffer
-	glGenFramebuffers( 1, &desc.render_frame_buffer );
-	glBindFramebuffer( GL_FRAMEBUFFER, desc.render_frame_buffer );
+	// Left bound, so every update after the first in a frame skips the bind
+	GLStateBindBuffer(GL_UNIFORM_BUFFER, view_matrices_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(pose_store.eye_view_projection), pose_store.eye_view_projection);
+}
 
-	// depth
-	glGenRenderbuffers( 1, &desc.depth_buffer );
-	glBindRenderbuffer( GL_RENDERBUFFER, desc.depth_buffer );
-	glRenderbufferStorageMultisample( GL_RENDERBUFFER, 4, GL_DEPTH_COMPONENT, width, height );
-	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, desc.depth_buffer );
+// Swap the HMD pose from WaitGetPoses for a fresh one and rebuild the view matrices from it.
+// Once a frame before either eye is drawn, so both eyes see the same head
+void LateLatchHMDPose()
+{
+	if (!late_latch_poses)
+		return;
 
-	// texture
-	glGenTextures( 1, &desc.render_texture );
-	glBindTexture( GL_TEXTURE_2D_MULTISAMPLE, desc.render_texture );
-	glTexImage2DMultisample( GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA8, width, height, true );
-	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, desc.render_texture, 0 );
+	glm::mat4 hmd_pose;
+	if (!PosePredictionLatchHMD(hmd_pose))
+		return;
+	FrameTimingPoseResampled();
 
-	// resolve buffer
-	glGenFramebuffers( 1, &desc.resolve_frame_buffer );
-	glBindFramebuffer( GL_FRAMEBUFFER, desc.resolve_frame_buffer );
+	pose_store.device_to_absolute[vr::k_unTrackedDeviceIndex_Hmd] = hmd_pose;
+	pose_store.hmd_view = InvertRigidTransform(hmd_pose);
+	pose_store.eye_view_projection[vr::Eye_Left] = eye_projection_from_head[vr::Eye_Left] * pose_store.hmd_view;
+	pose_store.eye_view_projection[vr::Eye_Right] = eye_projection_from_head[vr::Eye_Right] * pose_store.hmd_view;
+	UpdateViewMatrices();
+}
 
-	// texture
-	glGenTextures( 1, &desc.resolve_texture );
-	glBindTexture( GL_TEXTURE_2D, desc.resolve_texture );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
-	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, desc.resolve_texture, 0 );
+// Test every object once against the frustum around both eyes, then both eyes draw the same list.
+// Returns how many of visible are filled in
+uint32_t CullSceneObjects(const glm::mat4& hmd_view, std::vector<uint32_t>& visible)
+{
+	PROFILE_SCOPE(ProfileStage_Cull);
 
-	// Check everything went ok
-	if( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+	uint32_t visible_count = scene_object_bounds.count;
+	if (frustum_culling)
 	{
-		printf("Error creating frame buffer!\n");
-		return false;
+		Frustum world_frustum = TransformFrustum(combined_eye_frustum, hmd_view);
+		visible_count = CullBoundingSpheres(world_frustum, scene_object_bounds, &visible[0]);
 	}
 
-	// Unbind any bound frame buffer
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	return true;
+	PROFILE_COUNTER(ProfileCounter_ObjectsVisible, visible_count);
+	PROFILE_COUNTER(ProfileCounter_ObjectsCulled, scene_object_bounds.count - visible_count);
+	return visible_count;
 }
 
-// Compile a shader program from two strings
-// name is provided for prettier error messages
-GLuint CreateShaderProgram(const char* name, const char* vertex_source, const char* fragment_source)
+// Tell the streaming which textures this frame draws and how big. Roughly how many pixels across
+// each visible object covers, from its bounding sphere and the projection's pixels per unit
+void UpdateTextureStreaming()
 {
-	GLuint shader_program = glCreateProgram();
+	glm::vec3 hmd_position = glm::vec3(glm::inverse(pose_store.hmd_view)[3]);
+	float pixels_per_unit = 0.5f * eye_render_width * left_eye_projection[0][0];
+	for (uint32_t i = 0; i < visible_scene_object_count; ++i)
+	{
+		uint32_t object = visible_scene_objects[i];
+		glm::vec3 centre(scene_object_bounds.centre_x[object], scene_object_bounds.centre_y[object], scene_object_bounds.centre_z[object]);
+		float radius = scene_object_bounds.radius[object];
+		float distance = std::max(glm::length(centre - hmd_position), radius);
+		TextureStreamUse(scene_object_textures[object], 2.0f * radius / distance * pixels_per_unit);
+	}
+	TextureStreamUpdate();
+}
+
+// Objects whose texture hasn't streamed in yet are drawn untextured
+void BindSceneObjectTexture(uint32_t object, GLint textured_location)
+{
+	GLuint texture = TextureStreamGetTexture(scene_object_textures[object]);
+	GLStateBindTexture(GL_TEXTURE_2D, texture);
+	glUniform1i(textured_location, texture != 0);
+}
 
-	// Vertex shader
-	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex_shader, 1, &vertex_source, NULL);
-	glCompileShader(vertex_shader);
+// The scene's draws for one eye into whatever is bound, after the clear and masks
+void DrawScene(vr::Hmd_Eye eye)
+{
+	// What the scene costs in fill, the masks aren't counted
+	PROFILE_SAMPLES_BEGIN();
 
-	GLint status = GL_FALSE;
-	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &status);
-	if (status != GL_TRUE)
+	if (batched_rendering)
 	{
-		printf("Failed to compile %s vertex shader\n", name);
-		glDeleteProgram(shader_program);
-		glDeleteShader(vertex_shader);
-		return 0;
+		frame_draw_calls += BatchRender(eye);
 	}
 	else
 	{
-		glAttachShader(shader_program, vertex_shader);
-		glDeleteShader(vertex_shader); // We can throw it away not it's been attached
+		GLStateUseProgram(scene_shader_program);
+		GLStateBindVertexArray(scene_mesh.vao);
+		glUniform1i(scene_eye_location, eye);
+
+		for (uint32_t i = 0; i < visible_scene_object_count; ++i)
+		{
+			if (!scene_object_textures.empty())
+				BindSceneObjectTexture(visible_scene_objects[i], scene_textured_location);
+			glUniformMatrix4fv(scene_model_location, 1, GL_FALSE, glm::value_ptr(scene_object_models[visible_scene_objects[i]]));
+			glDrawElements(GL_TRIANGLES, scene_mesh.index_count, scene_mesh.index_type, 0);
+		}
+		frame_draw_calls += visible_scene_object_count;
 	}
 
-	// Fragment shader
-	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment_shader, 1, &fragment_source, NULL);
-	glCompileShader(fragment_shader);
+	// Controllers whose render models have loaded, then the axis lines and anything else drawn through debug draw this frame
+	frame_draw_calls += RenderModelsRender(render_model_region, eye);
+	frame_draw_calls += DebugDrawRender(eye);
+	PROFILE_SAMPLES_END();
+}
 
-	status = GL_FALSE;
-	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &status);
-	if (status != GL_TRUE)
+void RenderScene(vr::Hmd_Eye eye)
+{
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (hidden_area_mask)
+		frame_draw_calls += HiddenAreaRender(eye);
+
+	DrawScene(eye);
+}
+
+// Draws both eyes into the double wide stereo frame buffer in one go
+// Every draw has two instances, even instances are the left eye and odd ones the right,
+// the vertex shader moves each into its half of the target and clips it at the middle
+void RenderSceneStereo()
+{
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (hidden_area_mask)
+		frame_draw_calls += HiddenAreaRenderStereo();
+
+	PROFILE_SAMPLES_BEGIN();
+	GLStateEnable(GL_CLIP_DISTANCE0);
+
+	if (batched_rendering)
 	{
-		printf("Failed to compile %s fragment shader\n", name);
-		glDeleteProgram(shader_program);
-		glDeleteShader(fragment_shader);
-		return 0;
+		frame_draw_calls += BatchRenderStereo();
 	}
 	else
 	{
-		glAttachShader(shader_program, fragment_shader);
-		glDeleteShader(fragment_shader);
+		GLStateUseProgram(scene_stereo_shader_program);
+		GLStateBindVertexArray(scene_mesh.vao);
+
+		for (uint32_t i = 0; i < visible_scene_object_count; ++i)
+		{
+			if (!scene_object_textures.empty())
+				BindSceneObjectTexture(visible_scene_objects[i], scene_stereo_textured_location);
+			glUniformMatrix4fv(scene_stereo_model_location, 1, GL_FALSE, glm::value_ptr(scene_object_models[visible_scene_objects[i]]));
+			glDrawElementsInstanced(GL_TRIANGLES, scene_mesh.index_count, scene_mesh.index_type, 0, 2);
+		}
+		frame_draw_calls += visible_scene_object_count;
 	}
 
-	// Now link the shaders into the program
-	glLinkProgram(shader_program);
-	status = GL_TRUE;
-	glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
-	if (status != GL_TRUE)
+	// Controllers whose render models have loaded, then the axis lines and anything else drawn through debug draw this frame
+	frame_draw_calls += RenderModelsRenderStereo(render_model_region);
+	frame_draw_calls += DebugDrawRenderStereo();
+
+	GLStateDisable(GL_CLIP_DISTANCE0);
+	PROFILE_SAMPLES_END();
+}
+
+// region is the render model region this frame's draws go in
+void UpdateControllerAxes(const vr::TrackedDevicePose_t* poses, const PoseStore& store, int region)
+{
+	PROFILE_SCOPE(ProfileStage_ControllerGeometry);
+
+	tracked_controller_count = 0;
+	RenderModelsBeginRegion(region);
+
+	// Don't draw controllers if somebody else has input focus
+	if( hmd->IsInputFocusCapturedByAnotherProcess() )
+		return;
+
+	// Only the connected controllers, the device registry keeps this list up to date from SteamVR events
+	const vr::TrackedDeviceIndex_t* controllers = GetActiveDevices( vr::TrackedDeviceClass_Controller );
+	uint32_t controller_count = GetActiveDeviceCount( vr::TrackedDeviceClass_Controller );
+	for( uint32_t controller = 0; controller < controller_count; ++controller )
 	{
-		printf("Failed to link %s program\n", name);
-		glDeleteProgram(shader_program);
-		return 0;
+		vr::TrackedDeviceIndex_t tracked_device = controllers[controller];
+		tracked_controller_count += 1;
+
+		if( !poses[tracked_device].bPoseIsValid )
+			continue;
+
+		const glm::mat4 mat = store.device_to_absolute[tracked_device];
+		glm::vec4 center = mat * glm::vec4( 0, 0, 0, 1 );
+
+		// Axis lines stand in for the controller until its render model is on the GPU
+		bool drawn_as_model = RenderModelsAdd( region, tracked_device, mat );
+		for( int i = 0; i < 3 && !drawn_as_model; ++i )
+		{
+			glm::vec3 colour( 0, 0, 0 );
+			glm::vec4 point( 0, 0, 0, 1 );
+			point[i] += 0.05f;
+			colour[i] = 1.0;
+			point = mat * point;
+
+			DebugDrawLine( glm::vec3( center.x, center.y, center.z ), glm::vec3( point.x, point.y, point.z ), colour );
+		}
+
+		glm::vec4 start = mat * glm::vec4( 0, 0, -0.02f, 1 );
+		glm::vec4 end = mat * glm::vec4( 0, 0, -39.0f, 1 );
+		glm::vec3 colour( .92f, .92f, .71f );
+
+		DebugDrawLine( glm::vec3( start.x, start.y, start.z ), glm::vec3( end.x, end.y, end.z ), colour );
 	}
-	else
+
+	//printf( "tracked_controlers: %d\n", tracked_controller_count );
+}
+
+// A shell of short spinning lines around the play area, to load up debug draw
+void UpdateStressLines(int frame)
+{
+	PROFILE_SCOPE(ProfileStage_DebugGeometry);
+
+	const float golden_angle = 2.39996323f;
+	const glm::vec3 centre(0.0f, 1.5f, 0.0f);
+	float spin = frame * 0.01f;
+	for (int i = 0; i < stress_line_count; ++i)
 	{
-		printf("Shader success! %d\n", shader_program);
+		// Evenly spread over a sphere
+		float y = 1.0f - 2.0f * (i + 0.5f) / stress_line_count;
+		float radius = sqrtf(1.0f - y * y);
+		float angle = i * golden_angle + spin;
+		glm::vec3 direction(cosf(angle) * radius, y, sinf(angle) * radius);
+		glm::vec3 colour(0.5f + 0.5f * direction.x, 0.5f + 0.5f * y, 0.5f + 0.5f * direction.z);
+
+		DebugDrawLine(centre + direction * 3.0f, centre + direction * 3.2f, colour);
 	}
+}
+
+void UpdateHMDMatrixPose()
+{
+	if (!hmd)
+		return;
+
+	PROFILE_BEGIN(ProfileStage_PoseWait);
+	hmd->WaitGetPoses(tracked_device_pose, vr::k_unMaxTrackedDeviceCount);
+	PROFILE_END(ProfileStage_PoseWait);
+	FrameTimingBeginFrame();
 
-	glUseProgram(0);
-	return shader_program;
+	// Converts every valid pose, inverts the HMD pose and works out both eyes' view projection in one go
+	ProcessPoses(tracked_device_pose, eye_projection_from_head, pose_store);
+	PosePredictionAddPoses(tracked_device_pose);
+	UpdateViewMatrices();
 }
 
-glm::mat4 ConvertHMDMat4ToGLMMat4(const vr::HmdMatrix44_t& mat)
+// On the thread that handles the device events, the registry isn't safe to read from anywhere else
+void UpdatePoseClasses(const PoseStore& store)
 {
-	return glm::mat4(
-		mat.m[0][0], mat.m[1][0], mat.m[2][0], mat.m[3][0],
-		mat.m[0][1], mat.m[1][1], mat.m[2][1], mat.m[3][1],
-		mat.m[0][2], mat.m[1][2], mat.m[2][2], mat.m[3][2],
-		mat.m[0][3], mat.m[1][3], mat.m[2][3], mat.m[3][3]
-	);
+	for (uint32_t i = 0; i < store.valid_count; ++i)
+	{
+		pose_classes[i] = GetDeviceClassChar(store.valid_devices[i]);
+	}
+	pose_classes[store.valid_count] = '\0';
 }
 
-glm::mat4 ConvertHMDMat3ToGLMMat4(const vr::HmdMatrix34_t& mat)
+// Draw into width x height of the bound eye target, x pixels in from the left. The scissor keeps
+// the clear off the rest, whether that's unused because of dynamic resolution or the other eye's half
+void SetEyeViewport(int x, uint32_t width, uint32_t height)
 {
-	return glm::mat4(
-		mat.m[0][0], mat.m[1][0], mat.m[2][0], 0.0,
-		mat.m[0][1], mat.m[1][1], mat.m[2][1], 0.0,
-		mat.m[0][2], mat.m[1][2], mat.m[2][2], 0.0,
-		mat.m[0][3], mat.m[1][3], mat.m[2][3], 1.0f
-	);
+	glViewport(x, 0, width, height);
+	glScissor(x, 0, width, height);
+	GLStateEnable(GL_SCISSOR_TEST);
 }
 
-glm::mat4 GetHMDMartixProjection(vr::Hmd_Eye eye)
+// Resolve part of a target's multisampled half into its resolve texture, nothing to do with MSAA off
+// Both frame buffers are left bound, whatever draws next binds its own. GL_MULTISAMPLE can stay
+// on for it too, blits don't look at it
+void ResolveFrameBuffer(const FrameBufferDesc& desc, int x0, int y0, int x1, int y1)
 {
-	if (!hmd)
-		return glm::mat4();
+	if (desc.render_frame_buffer == desc.resolve_frame_buffer)
+		return;
 
-	vr::HmdMatrix44_t matrix = hmd->GetProjectionMatrix(eye, near_plane, far_plane);
+	GLStateBindFramebuffer(GL_READ_FRAMEBUFFER, desc.render_frame_buffer);
+	GLStateBindFramebuffer(GL_DRAW_FRAMEBUFFER, desc.resolve_frame_buffer);
 
-	return ConvertHMDMat4ToGLMMat4(matrix);
+	glBlitFramebuffer(x0, y0, x1, y1, x0, y0, x1, y1,
+		GL_COLOR_BUFFER_BIT,
+		GL_LINEAR);
 }
 
-glm::mat4 GetHMDMatrixPoseEye(vr::Hmd_Eye eye)
+// The target an eye ends up in, its own or the shared double wide one
+FrameBufferDesc& EyeFrameBuffer(int eye)
 {
-	if (!hmd)
-		return glm::mat4();
+	if (single_texture)
+		return stereo_desc;
+	return eye == vr::Eye_Left ? left_eye_desc : right_eye_desc;
+}
 
-	vr::HmdMatrix34_t matrix = hmd->GetEyeToHeadTransform(eye);
+// Where an eye starts in its target, the right eye is the second half of the shared one
+int EyeTargetOffset(int eye)
+{
+	return single_texture && eye == vr::Eye_Right ? (int)eye_render_width : 0;
+}
 
-	return ConvertHMDMat3ToGLMMat4(matrix);
+// The part of an eye's texture the compositor should show this frame
+vr::VRTextureBounds_t EyeTextureBounds(int eye)
+{
+	float target_width = (float)(single_texture ? eye_target_width * 2 : eye_target_width);
+	vr::VRTextureBounds_t bounds = { EyeTargetOffset(eye) / target_width, 0.0f,
+		(EyeTargetOffset(eye) + eye_render_width) / target_width, eye_render_height / (float)eye_target_height };
+	return bounds;
 }
 
-void RenderScene(vr::Hmd_Eye eye)
+// Render each eye in its own pass and resolve it into that eye's texture.
+// With a single texture both eyes go into their halves of it and get resolved together
+void RenderEyesMultiPass()
 {
-	glm::mat4 view_proj_matrix = glm::mat4(1.0);
+	// render left eye
+	PROFILE_BEGIN(ProfileStage_RenderLeft);
+	GLStateEnable(GL_MULTISAMPLE);
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, EyeFrameBuffer(vr::Eye_Left).render_frame_buffer);
+	SetEyeViewport(EyeTargetOffset(vr::Eye_Left), eye_render_width, eye_render_height);
+
+	RenderScene(vr::Eye_Left);
+	PROFILE_END(ProfileStage_RenderLeft);
+
+	if (!single_texture)
+	{
+		PROFILE_BEGIN(ProfileStage_ResolveLeft);
+		GLStateDisable(GL_SCISSOR_TEST);
+		ResolveFrameBuffer(left_eye_desc, 0, 0, eye_render_width, eye_render_height);
+		PROFILE_END(ProfileStage_ResolveLeft);
+	}
 
-	//view_proj_matrix = glm::perspective( glm::radians( 45.0f ), companion_width / (float)companion_height, near_plane, far_plane )
-	//	* glm::lookAt( glm::vec3( 2, 2, 2 ), glm::vec3( 0, 0, 0 ), glm::vec3( 0, 0, 1 ) );
-	//view_proj_matrix = GetHMDMartixProjection( eye )
-	//* glm::lookAt( glm::vec3( 2, 2, 2 ), glm::vec3( 0, 0, 0 ), glm::vec3( 0, 0, 1 ) )
-	//* GetHMDMatrixPoseEye( eye )
-	//* hmd_pose_matrix;
+	// render Right eye
+	PROFILE_BEGIN(ProfileStage_RenderRight);
+	GLStateEnable(GL_MULTISAMPLE);
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, EyeFrameBuffer(vr::Eye_Right).render_frame_buffer);
+	SetEyeViewport(EyeTargetOffset(vr::Eye_Right), eye_render_width, eye_render_height);
 
-	if (eye == vr::Eye_Left)
+	RenderScene(vr::Eye_Right);
+	PROFILE_END(ProfileStage_RenderRight);
+
+	if (!single_texture)
 	{
-		// Left eye
-		view_proj_matrix =
-			left_eye_projection
-			* left_eye_to_pose
-			* hmd_pose_matrix;
+		PROFILE_BEGIN(ProfileStage_ResolveRight);
+		GLStateDisable(GL_SCISSOR_TEST);
+		ResolveFrameBuffer(right_eye_desc, 0, 0, eye_render_width, eye_render_height);
+		PROFILE_END(ProfileStage_ResolveRight);
 	}
 	else
 	{
-		// Right Eye
-		view_proj_matrix =
-			right_eye_projection
-			* right_eye_to_pose
-			* hmd_pose_matrix;
+		PROFILE_BEGIN(ProfileStage_ResolveStereo);
+		GLStateDisable(GL_SCISSOR_TEST);
+		ResolveFrameBuffer(stereo_desc, 0, 0, eye_render_width * 2, eye_render_height);
+		PROFILE_END(ProfileStage_ResolveStereo);
 	}
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Render both eyes in one instanced pass then resolve each half into that eye's texture,
+// or the whole thing in one go with a single texture
+void RenderEyesInstanced()
+{
+	if (stereo_desc.render_frame_buffer == 0)
+	{
+		// First time through, make the double wide target
+		if (!RenderTargetCreate("stereo", eye_target_width * 2, eye_target_height, msaa_samples, false, stereo_desc))
+		{
+			printf("Falling back to multipass stereo\n");
+			stereo_mode = StereoMode_MultiPass;
+			RenderEyesMultiPass();
+			return;
+		}
+	}
+
+	PROFILE_BEGIN(ProfileStage_RenderStereo);
+	GLStateEnable(GL_MULTISAMPLE);
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, stereo_desc.render_frame_buffer);
+	SetEyeViewport(0, eye_render_width * 2, eye_render_height);
 
-	glUseProgram(scene_shader_program);
-	glBindVertexArray(scene_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, scene_vbo);
-	glUniformMatrix4fv(scene_matrix_location, 1, GL_FALSE, glm::value_ptr(view_proj_matrix));
+	RenderSceneStereo();
+	PROFILE_END(ProfileStage_RenderStereo);
 
-	glDrawArrays(GL_TRIANGLES, 0, 12);
+	PROFILE_BEGIN(ProfileStage_ResolveStereo);
+	GLStateDisable(GL_SCISSOR_TEST);
 
-	// Ensure this application has focus
-	if( !hmd->IsInputFocusCapturedByAnotherProcess() )
+	if (single_texture)
+	{
+		ResolveFrameBuffer(stereo_desc, 0, 0, eye_render_width * 2, eye_render_height);
+	}
+	else
 	{
-		// draw the controller axis lines
-		glBindVertexArray( tracked_controller_vao );
-		glBindBuffer( GL_ARRAY_BUFFER, tracked_controller_vbo );
-		glDrawArrays( GL_LINES, 0, tracked_controller_vertex_count );
+		GLStateBindFramebuffer(GL_READ_FRAMEBUFFER, stereo_desc.render_frame_buffer);
+
+		// Left half
+		GLStateBindFramebuffer(GL_DRAW_FRAMEBUFFER, left_eye_desc.resolve_frame_buffer);
+		glBlitFramebuffer(0, 0, eye_render_width, eye_render_height, 0, 0, eye_render_width, eye_render_height,
+			GL_COLOR_BUFFER_BIT,
+			GL_LINEAR);
+
+		// Right half
+		GLStateBindFramebuffer(GL_DRAW_FRAMEBUFFER, right_eye_desc.resolve_frame_buffer);
+		glBlitFramebuffer(eye_render_width, 0, eye_render_width * 2, eye_render_height, 0, 0, eye_render_width, eye_render_height,
+			GL_COLOR_BUFFER_BIT,
+			GL_LINEAR);
 	}
+	PROFILE_END(ProfileStage_ResolveStereo);
 }
 
-void UpdateControllerAxes()
+// Size of a foveation level's part of its target this frame
+void GetFoveationLevelSize(int level, int& width, int& height)
 {
-	std::vector<GLfloat> vertex_data;
-	tracked_controller_count = 0;
-	tracked_controller_vertex_count = 0;
+	width = std::max(1, (int)(eye_render_width * foveation_level_scale[level] + 0.5f));
+	height = std::max(1, (int)(eye_render_height * foveation_level_scale[level] + 0.5f));
+}
 
-	// Don't draw controllers if somebody else has input focus
-	if( hmd->IsInputFocusCapturedByAnotherProcess() )
-		return;
+// Render each eye as foveation levels, outer ring first, each into its own target. Each ring is
+// resolved and stretched into the eye's texture before the next level is drawn, because without
+// MSAA that texture is what the inner level draws into
+void RenderEyesFoveated()
+{
+	for (int eye = vr::Eye_Left; eye <= vr::Eye_Right; ++eye)
+	{
+		FrameBufferDesc& eye_desc = EyeFrameBuffer(eye);
+		int eye_x = EyeTargetOffset(eye);
+
+		for (int level = foveation_level_count - 1; level >= 0; --level)
+		{
+			int width, height;
+			GetFoveationLevelSize(level, width, height);
+			FoveationRect draw = FoveationDrawRect(eye, level, width, height);
+
+			PROFILE_BEGIN(eye == vr::Eye_Left ? ProfileStage_RenderLeft : ProfileStage_RenderRight);
+			GLStateEnable(GL_MULTISAMPLE);
+
+			// Only the inner level draws into the eye's target, which might be shared with the other eye
+			int x = level == 0 ? eye_x : 0;
+			GLStateBindFramebuffer(GL_FRAMEBUFFER, level == 0 ? eye_desc.render_frame_buffer : foveation_level_desc[level].render_frame_buffer);
+			glViewport(x, 0, width, height);
+			glScissor(x + draw.x0, draw.y0, draw.x1 - draw.x0, draw.y1 - draw.y0);
+			GLStateEnable(GL_SCISSOR_TEST);
+
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			if (hidden_area_mask)
+				frame_draw_calls += HiddenAreaRender(eye);
+			frame_draw_calls += FoveationMaskInnerLevels(eye, level, width, height);
 
-	for( vr::TrackedDeviceIndex_t tracked_device = vr::k_unTrackedDeviceIndex_Hmd + 1; tracked_device < vr::k_unMaxTrackedDeviceCount; ++tracked_device )
+			DrawScene((vr::Hmd_Eye)eye);
+			PROFILE_END(eye == vr::Eye_Left ? ProfileStage_RenderLeft : ProfileStage_RenderRight);
+
+			PROFILE_BEGIN(eye == vr::Eye_Left ? ProfileStage_ResolveLeft : ProfileStage_ResolveRight);
+			GLStateDisable(GL_SCISSOR_TEST);
+
+			FoveationRect target = FoveationLevelRect(eye, level, eye_render_width, eye_render_height);
+			if (level == 0)
+			{
+				// Already full size, resolve straight into the eye's texture
+				ResolveFrameBuffer(eye_desc, eye_x + target.x0, target.y0, eye_x + target.x1, target.y1);
+			}
+			else
+			{
+				// Resolve at the level's own size, then stretch its part over the eye's texture
+				FoveationRect source = FoveationLevelRect(eye, level, width, height);
+				ResolveFrameBuffer(foveation_level_desc[level], draw.x0, draw.y0, draw.x1, draw.y1);
+
+				GLStateBindFramebuffer(GL_READ_FRAMEBUFFER, foveation_level_desc[level].resolve_frame_buffer);
+				GLStateBindFramebuffer(GL_DRAW_FRAMEBUFFER, eye_desc.resolve_frame_buffer);
+				glBlitFramebuffer(source.x0, source.y0, source.x1, source.y1, eye_x + target.x0, target.y0, eye_x + target.x1, target.y1,
+					GL_COLOR_BUFFER_BIT,
+					GL_LINEAR);
+			}
+			PROFILE_END(eye == vr::Eye_Left ? ProfileStage_ResolveLeft : ProfileStage_ResolveRight);
+		}
+	}
+}
+
+void ToggleStereoMode()
+{
+	stereo_mode = stereo_mode == StereoMode_Instanced ? StereoMode_MultiPass : StereoMode_Instanced;
+	printf("Stereo mode: %s\n", stereo_mode == StereoMode_Instanced ? "instanced" : "multipass");
+}
+
+// A key press or the window closing, live or from a replayed trace
+void HandleInput(uint32_t type, uint32_t code, bool& quit, bool& toggle_stereo_mode)
+{
+	VRTraceRecordInput(type, code);
+	if (type == SDL_QUIT) quit = true;
+	else if (type == SDL_KEYDOWN)
 	{
-		if( !hmd->IsTrackedDeviceConnected( tracked_device ) )
-			continue;
+		if (code == SDL_SCANCODE_ESCAPE) quit = true;
+		else if (code == SDL_SCANCODE_S) toggle_stereo_mode = !toggle_stereo_mode;
+	}
+}
 
-		if( hmd->GetTrackedDeviceClass( tracked_device ) != vr::TrackedDeviceClass_Controller )
-			continue;
+// SDL and SteamVR events, returns true when it's time to quit. A press of S only gets reported,
+// the stereo mode belongs to whoever renders
+bool ProcessEvents(bool& toggle_stereo_mode)
+{
+	bool quit = false;
+	SDL_Event sdl_event;
+	vr::VREvent_t vr_event;
 
-		tracked_controller_count += 1;
+	// Process SDL events. A replay only takes its input from the trace, but closing the window still quits
+	bool replaying = VRTraceReplaying();
+	while (SDL_PollEvent(&sdl_event))
+	{
+		if (sdl_event.type == SDL_QUIT && replaying) quit = true;
+		else if (sdl_event.type == SDL_QUIT && !replaying) HandleInput(SDL_QUIT, 0, quit, toggle_stereo_mode);
+		else if (sdl_event.type == SDL_KEYDOWN && !replaying) HandleInput(SDL_KEYDOWN, sdl_event.key.keysym.scancode, quit, toggle_stereo_mode);
+	}
+	uint32_t input_type = 0, input_code = 0;
+	while (VRTraceNextInput(input_type, input_code))
+		HandleInput(input_type, input_code, quit, toggle_stereo_mode);
 
-		if( !tracked_device_pose[tracked_device].bPoseIsValid )
-			continue;
+	// Process SteamVR events
+	while (hmd->PollNextEvent(&vr_event, sizeof(vr_event)))
+	{
+		// Devices coming and going
+		DeviceRegistryHandleEvent(vr_event);
+		RenderModelsHandleEvent(vr_event);
+	}
+	return quit;
+}
 
-		const glm::mat4 mat = mat4_device_pose[tracked_device];
-		glm::vec4 center = mat * glm::vec4( 0, 0, 0, 1 );
+// Everything from the eye draws to handing the frame to the mirror, once the poses, the visible
+// list and the debug geometry for it are in place
+void RenderFrame()
+{
+	GLStateEnable(GL_DEPTH_TEST);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
 
-		for( int i = 0; i < 3; ++i )
-		{
-			glm::vec3 colour( 0, 0, 0 );
-			glm::vec4 point( 0, 0, 0, 1 );
-			point[i] += 0.05f;
-			colour[i] = 1.0;
-			point = mat * point;
+	// Same scale for both eyes, and for the whole frame
+	float resolution_scale = DynamicResolutionScale();
+	if (dynamic_resolution)
+	{
+		eye_render_width = std::min(eye_target_width, (uint32_t)(hmd_render_target_width * resolution_scale + 0.5f));
+		eye_render_height = std::min(eye_target_height, (uint32_t)(hmd_render_target_height * resolution_scale + 0.5f));
+		PROFILE_COUNTER(ProfileCounter_ResolutionScale, resolution_scale * 100.0f);
+	}
+
+	if (!scene_object_textures.empty())
+		UpdateTextureStreaming();
+	RenderModelsUpdate();
+	if (animate_scene && batched_rendering)
+		BatchUpdateModels(&scene_object_models[0]);
+
+	DynamicResolutionBeginFrame(frame_count);
+	// As late as possible but once for both eyes, a pose per eye would pull their views apart
+	LateLatchHMDPose();
+	if (foveated_rendering)
+		RenderEyesFoveated();
+	else if (stereo_mode == StereoMode_Instanced)
+		RenderEyesInstanced();
+	else
+		RenderEyesMultiPass();
+	DynamicResolutionEndFrame();
 
-			vertex_data.push_back( center.x );
-			vertex_data.push_back( center.y );
-			vertex_data.push_back( center.z );
+	// Submit frames to HMD
+	PROFILE_BEGIN(ProfileStage_Submit);
+	if (!hmd->IsInputFocusCapturedByAnotherProcess())
+	{
+		// NOTE: to find out what the error codes mean Ctal+F 'enum EVRCompositorError' in 'openvr.h'
+		vr::EVRCompositorError submit_error = vr::VRCompositorError_None;
 
-			//vertex_data.push_back( colour.x );
-			//vertex_data.push_back( colour.y );
-			//vertex_data.push_back( colour.z );
+		// Tell the compositor which part of the texture has each eye in it
+		vr::VRTextureBounds_t left_eye_bounds = EyeTextureBounds(vr::Eye_Left);
+		vr::VRTextureBounds_t right_eye_bounds = EyeTextureBounds(vr::Eye_Right);
 
-			vertex_data.push_back( point.x );
-			vertex_data.push_back( point.y );
-			vertex_data.push_back( point.z );
+		vr::Texture_t left_eye_texture = { (void*)(uintptr_t)EyeFrameBuffer(vr::Eye_Left).resolve_texture, vr::ETextureType::TextureType_OpenGL, vr::ColorSpace_Gamma };
+		submit_error = hmd->Submit(vr::Eye_Left, &left_eye_texture, &left_eye_bounds);
+		if (submit_error != vr::VRCompositorError_None)
+		{
+			printf("Error in left eye %d\n", submit_error);
+		}
 
-			//vertex_data.push_back( colour.x );
-			//vertex_data.push_back( colour.y );
-			//vertex_data.push_back( colour.z );
 
-			tracked_controller_vertex_count += 2;
+		vr::Texture_t right_eye_texture = { (void*)(uintptr_t)EyeFrameBuffer(vr::Eye_Right).resolve_texture, vr::ETextureType::TextureType_OpenGL, vr::ColorSpace_Gamma };
+		submit_error = hmd->Submit(vr::Eye_Right, &right_eye_texture, &right_eye_bounds);
+		if (submit_error != vr::VRCompositorError_None)
+		{
+			printf("Error in right eye %d\n", submit_error);
 		}
+	}
+	else
+	{
+		printf("Another process has focus of the HMD!\n");
+	}
+	// The runtime's submit makes GL calls of its own on this context
+	GLStateInvalidate();
+	PROFILE_END(ProfileStage_Submit);
 
-		glm::vec4 start = mat * glm::vec4( 0, 0, -0.02f, 1 );
-		glm::vec4 end = mat * glm::vec4( 0, 0, -39.0f, 1 );
-		glm::vec3 colour( .92f, .92f, .71f );
+	// Whatever the compositor has finished with by now, this frame's own timing comes later
+	FrameTimingUpdate();
 
-		vertex_data.push_back( start.x ); vertex_data.push_back( start.y ); vertex_data.push_back( start.z );
-		//vertex_data.push_back( colour.x ); vertex_data.push_back( colour.y ); vertex_data.push_back( colour.z );
+	// Hand the eyes to the companion window mirror, it presents them on its own time
+	PROFILE_BEGIN(ProfileStage_Companion);
+	MirrorSource mirror_sources[2];
+	for (int eye = vr::Eye_Left; eye <= vr::Eye_Right; ++eye)
+	{
+		int x = EyeTargetOffset(eye);
+		mirror_sources[eye].frame_buffer = EyeFrameBuffer(eye).resolve_frame_buffer;
+		mirror_sources[eye].x0 = x;
+		mirror_sources[eye].y0 = 0;
+		mirror_sources[eye].x1 = x + eye_render_width;
+		mirror_sources[eye].y1 = eye_render_height;
+	}
+	CompanionMirrorSubmit(frame_count, mirror_sources);
+	PROFILE_END(ProfileStage_Companion);
 
-		vertex_data.push_back( end.x ); vertex_data.push_back( end.y ); vertex_data.push_back( end.z );
-		//vertex_data.push_back( colour.x ); vertex_data.push_back( colour.y ); vertex_data.push_back( colour.z );
-	
-		tracked_controller_vertex_count += 2;
+	GLStateEndFrame();
+}
+
+// Frame time is measured from the end of one frame to the next, so it includes the WaitGetPoses pacing
+void CountFrame()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double frame_time_ms = std::chrono::duration<double, std::milli>(now - last_frame_time).count();
+	last_frame_time = now;
+	frame_count += 1;
+	if (frame_count == 1)
+	{
+		StartupPhaseEnd(first_frame_phase);
+		StartupTraceFirstFrame();
 	}
+	draw_call_total += frame_draw_calls;
+	visible_object_total += visible_scene_object_count;
+	frame_time_total_ms += frame_time_ms;
+	if (frame_time_ms < frame_time_min_ms) frame_time_min_ms = frame_time_ms;
+	if (frame_time_ms > frame_time_max_ms) frame_time_max_ms = frame_time_ms;
+}
 
-	// Setup the VAO the first time through
-	if( tracked_controller_vao == 0 )
+// The frame loop without --pipelined, everything on this thread one step after the other
+void RunFrames()
+{
+	bool done = false;
+	while (!done)
 	{
-		glGenVertexArrays( 1, &tracked_controller_vao );
-		glBindVertexArray( tracked_controller_vao );
+		PROFILE_FRAME_BEGIN();
 
-		glGenBuffers( 1, &tracked_controller_vbo );
-		glBindBuffer( GL_ARRAY_BUFFER, tracked_controller_vbo );
+		bool toggle_stereo_mode = false;
+		done = ProcessEvents(toggle_stereo_mode);
+		if (toggle_stereo_mode)
+			ToggleStereoMode();
 
-		GLuint stride = 3 * sizeof( GLfloat );
-		GLuint offset = 0;
+		// HEY YOU - IMPORTANT!
+		//
+		// This must be called or the app will not gain focus! Currently called inside UpdateHMDMatrixPose();
+		//		vr::TrackedDevicePose_t pose_buffer[vr::k_unMaxTrackedDeviceCount];
+		//		vr::VRCompositor()->WaitGetPoses( pose_buffer, vr::k_unMaxTrackedDeviceCount, NULL, 0 );
+		//
+		// TBH at this stage I don't fully know what poses are,
+		// apart from the fact valve seem to think they are important and we must get them
+		// Something to do with the position of the HMD
+		frame_draw_calls = 0;
+		UpdateHMDMatrixPose();
+		UpdatePoseClasses(pose_store);
+		visible_scene_object_count = CullSceneObjects(pose_store.hmd_view, visible_scene_objects);
+		if (batched_rendering)
+			BatchSetVisible(&visible_scene_objects[0], visible_scene_object_count);
+		if (animate_scene)
+			AnimateInstances(scene_object_bounds, scene_mesh_base, frame_count * animation_frame_seconds, &scene_object_models[0]);
+
+		DebugDrawBeginFrame();
+		UpdateControllerAxes(tracked_device_pose, pose_store, render_model_region);
+		if (stress_line_count > 0)
+			UpdateStressLines(frame_count);
+		DebugDrawEndFrame();
+
+		RenderFrame();
+		PROFILE_FRAME_END();
+		CountFrame();
+
+		if (max_frame_count > 0 && frame_count >= max_frame_count) done = true;
+	}
+}
 
-		glEnableVertexAttribArray( 0 );
-		glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset );
+// The render thread with --pipelined. Owns the GL context and draws whatever the update thread
+// publishes until it publishes the last packet
+void RenderThread()
+{
+	SDL_GL_MakeCurrent(render_context_window, gl_context);
 
-		offset += sizeof( GLfloat ) * 3;
-		glEnableVertexAttribArray( 1 );
-		glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset );
+	bool last = false;
+	while (!last)
+	{
+		PROFILE_FRAME_BEGIN();
 
-		glBindVertexArray( 0 );
+		// Still paced by WaitGetPoses right before the draws. The update thread starts on the next
+		// frame once this one's packet is taken, after the wait, so it's never more than a frame ahead
+		frame_draw_calls = 0;
+		UpdateHMDMatrixPose();
+		FramePacket& packet = FramePipelineNext();
+		last = packet.last;
+		if (packet.toggle_stereo_mode)
+			ToggleStereoMode();
+
+		// Swapped rather than copied, the packet takes the last frame's list back to cull into
+		visible_scene_objects.swap(packet.visible_objects);
+		visible_scene_object_count = packet.visible_object_count;
+		if (batched_rendering)
+			BatchSetVisible(&visible_scene_objects[0], visible_scene_object_count);
+		if (animate_scene)
+			scene_object_models.swap(packet.object_models);
+		DebugDrawUseRegion(packet.slot);
+		render_model_region = packet.slot;
+
+		RenderFrame();
+		PROFILE_FRAME_END();
+		FramePipelineRetire(packet);
+		CountFrame();
 	}
 
-	glBindBuffer( GL_ARRAY_BUFFER, tracked_controller_vbo );
-	if( vertex_data.size() > 0 )
+	SDL_GL_MakeCurrent(render_context_window, nullptr);
+}
+
+// The frame loop with --pipelined, this thread becomes the update thread. Each frame's events,
+// culling and debug geometry are done here against poses predicted to when it will be on the
+// display, while the render thread draws the frame before it
+void RunPipelinedFrames()
+{
+	static_assert(frame_packet_count <= debug_draw_region_count, "every packet in flight needs its own debug draw region");
+
+	for (int slot = 0; slot < frame_packet_count; ++slot)
 	{
-		glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * vertex_data.size(), vertex_data.data(), GL_STREAM_DRAW );
+		FramePipelinePacket(slot).visible_objects = visible_scene_objects;
+		FramePipelinePacket(slot).visible_object_count = visible_scene_object_count;
+		if (animate_scene)
+			FramePipelinePacket(slot).object_models = scene_object_models;
 	}
+	update_pose_store = pose_store;
 
-	//printf( "tracked_controlers: %d\n", tracked_controller_count );
+	// The context moves to the render thread
+	SDL_GL_MakeCurrent(render_context_window, nullptr);
+	ProfilerSetAheadThread();
+	VRTraceSetAheadThread();
+	FramePipelineStart(RenderThread);
+
+	bool done = false;
+	while (!done)
+	{
+		FramePacket& packet = FramePipelineAcquire();
+		ProfilerBeginAheadFrame(packet.frame_index);
+		VRTraceBeginAheadFrame(packet.frame_index);
+		done = ProcessEvents(packet.toggle_stereo_mode);
+
+		PosePredictionPredictNextFrame(update_device_pose);
+		ProcessPoses(update_device_pose, eye_projection_from_head, update_pose_store);
+		UpdatePoseClasses(update_pose_store);
+		packet.visible_object_count = CullSceneObjects(update_pose_store.hmd_view, packet.visible_objects);
+		if (animate_scene)
+			AnimateInstances(scene_object_bounds, scene_mesh_base, packet.frame_index * animation_frame_seconds, &packet.object_models[0]);
+
+		DebugDrawBeginRegion(packet.slot);
+		UpdateControllerAxes(update_device_pose, update_pose_store, packet.slot);
+		if (stress_line_count > 0)
+			UpdateStressLines((int)packet.frame_index);
+		DebugDrawEndRegion();
+
+		if (max_frame_count > 0 && packet.frame_index + 1 >= (uint64_t)max_frame_count) done = true;
+		packet.last = done;
+
+		ProfilerEndAheadFrame();
+		FramePipelinePublish(packet);
+	}
+	FramePipelineStop();
+
+	SDL_GL_MakeCurrent(render_context_window, gl_context);
 }
 
-void UpdateHMDMatrixPose()
+// Startup work that doesn't need GL runs on these while the window and context are made
+std::thread vr_init_thread;
+std::thread mesh_prefetch_thread;
+const char* vr_init_failure_title = nullptr;	// set if the runtime couldn't be started
+char vr_init_failure[1024];
+
+// With --record, everything from here on goes through the recorder on its way to the app
+void RecordVRBackend()
 {
-	if (!hmd)
+	if (trace_record_path == nullptr)
+		return;
+
+	VRBackend* recording = CreateRecordingVRBackend(hmd, trace_record_path);
+	if (recording == nullptr)
+	{
+		hmd->Shutdown();
+		delete hmd;
+		hmd = nullptr;
+		vr_init_failure_title = "Recording Failed";
+		snprintf(vr_init_failure, sizeof(vr_init_failure), "Unable to record to %s", trace_record_path);
 		return;
+	}
+	hmd = recording;
+}
 
-	vr::VRCompositor()->WaitGetPoses(tracked_device_pose, vr::k_unMaxTrackedDeviceCount, NULL, 0);
+// On vr_init_thread, leaves hmd null and says why if it fails
+void InitVRBackend()
+{
+	STARTUP_PHASE("vr runtime init");
 
-	valid_pose_count = 0;
-	pose_classes_string = "";
-	for (int nDevice = 0; nDevice < vr::k_unMaxTrackedDeviceCount; ++nDevice)
+	if (trace_replay_path)
 	{
-		if (tracked_device_pose[nDevice].bPoseIsValid)
+		// No headset or runtime needed either, and the trace decides how long the run is
+		uint32_t trace_frame_count = 0;
+		hmd = CreateReplayVRBackend(trace_replay_path, trace_replay_real_time, &trace_frame_count);
+		if (hmd == nullptr)
 		{
-			valid_pose_count++;
-			mat4_device_pose[nDevice] = ConvertHMDMat3ToGLMMat4(tracked_device_pose[nDevice].mDeviceToAbsoluteTracking);
-			if (dev_class_char[nDevice] == 0)
-			{
-				switch (hmd->GetTrackedDeviceClass(nDevice))
-				{
-				case vr::TrackedDeviceClass_Controller:        dev_class_char[nDevice] = 'C'; break;
-				case vr::TrackedDeviceClass_HMD:               dev_class_char[nDevice] = 'H'; break;
-				case vr::TrackedDeviceClass_Invalid:           dev_class_char[nDevice] = 'I'; break;
-				//case vr::TrackedDeviceClass_Other:             dev_class_char[nDevice] = 'O'; break;
-				case vr::TrackedDeviceClass_TrackingReference: dev_class_char[nDevice] = 'T'; break;
-				default:                                       dev_class_char[nDevice] = '?'; break;
-				}
-			}
-			pose_classes_string += dev_class_char[nDevice];
+			vr_init_failure_title = "Replay Failed";
+			snprintf(vr_init_failure, sizeof(vr_init_failure), "Unable to replay %s", trace_replay_path);
+			return;
 		}
+		if (max_frame_count == 0 || max_frame_count > (int)trace_frame_count)
+			max_frame_count = (int)trace_frame_count;
+		return;
+	}
+
+	if (use_simulated_hmd)
+	{
+		// No headset or runtime needed, poses are scripted
+		hmd = CreateSimulatedVRBackend(simulated_hmd_config);
+		RecordVRBackend();
+		return;
+	}
+
+	// We can call these before we load the runtime
+	bool is_hmd_present = vr::VR_IsHmdPresent();
+	bool is_runtime_installed = vr::VR_IsRuntimeInstalled();
+	printf("Found HMD: %s\n", is_hmd_present ? "yes" : "no");
+	printf("Found OpenVR runtime: %s\n", is_runtime_installed ? "yes" : "no");
+
+	if (is_hmd_present == false || is_runtime_installed == false)
+	{
+		vr_init_failure_title = "error";
+		snprintf(vr_init_failure, sizeof(vr_init_failure), "Something is missing...");
+		return;
 	}
 
-	if (tracked_device_pose[vr::k_unTrackedDeviceIndex_Hmd].bPoseIsValid)
+	// Load the OpenVR/SteamVR Runtime
+	vr::EVRInitError init_error = vr::VRInitError_None;
+	hmd = CreateOpenVRBackend(&init_error);
+	if (hmd == nullptr)
 	{
-		hmd_pose_matrix = mat4_device_pose[vr::k_unTrackedDeviceIndex_Hmd];
-		hmd_pose_matrix = glm::inverse(hmd_pose_matrix);
+		vr_init_failure_title = "VR_Init Failed";
+		snprintf(vr_init_failure, sizeof(vr_init_failure), "Unable to init VR runtime: %s", vr::VR_GetVRInitErrorAsEnglishDescription(init_error));
+		return;
 	}
+	RecordVRBackend();
+}
+
+// On mesh_prefetch_thread, so the upload later doesn't wait on the disk
+void PrefetchSceneMesh()
+{
+	STARTUP_PHASE("mesh file read");
+	PrefetchMeshFile(scene_mesh_path);
+}
+
+// Before bailing out of startup, a thread that's still joinable would take the process down with it
+void JoinStartupThreads()
+{
+	if (vr_init_thread.joinable())
+		vr_init_thread.join();
+	if (mesh_prefetch_thread.joinable())
+		mesh_prefetch_thread.join();
+}
+
+// Returns false if the arguments didn't make sense
+bool ParseCommandLine(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--sim") == 0) use_simulated_hmd = true;
+		else if (strcmp(arg, "--hidden") == 0) hide_companion_window = true;
+		else if (strcmp(arg, "--no-vsync-wait") == 0) simulated_hmd_config.pace_frames = false;
+		else if (strcmp(arg, "--frames") == 0 && value) { max_frame_count = atoi(value); ++i; }
+		else if (strcmp(arg, "--refresh") == 0 && value) { simulated_hmd_config.refresh_rate = (float)atof(value); ++i; }
+		else if (strcmp(arg, "--controllers") == 0 && value) { simulated_hmd_config.controller_count = atoi(value); ++i; }
+		else if (strcmp(arg, "--stereo") == 0 && value && strcmp(value, "multipass") == 0) { stereo_mode = StereoMode_MultiPass; ++i; }
+		else if (strcmp(arg, "--stereo") == 0 && value && strcmp(value, "instanced") == 0) { stereo_mode = StereoMode_Instanced; ++i; }
+		else if (strcmp(arg, "--stress-lines") == 0 && value) { stress_line_count = atoi(value); ++i; }
+		else if (strcmp(arg, "--late-latch") == 0) late_latch_poses = true;
+		else if (strcmp(arg, "--mesh") == 0 && value) { scene_mesh_path = value; ++i; }
+		else if (strcmp(arg, "--objects") == 0 && value) { scene_object_count = atoi(value); ++i; }
+		else if (strcmp(arg, "--no-cull") == 0) frustum_culling = false;
+		else if (strcmp(arg, "--animate") == 0) animate_scene = true;
+		else if (strcmp(arg, "--naive-draws") == 0) batched_rendering = false;
+		else if (strcmp(arg, "--dynamic-resolution") == 0) dynamic_resolution = true;
+		else if (strcmp(arg, "--no-hidden-area") == 0) hidden_area_mask = false;
+		else if (strcmp(arg, "--foveated") == 0) foveated_rendering = true;
+		else if (strcmp(arg, "--single-texture") == 0) single_texture = true;
+		else if (strcmp(arg, "--no-shared-targets") == 0) shared_targets = false;
+		else if (strcmp(arg, "--pipelined") == 0) pipelined_frames = true;
+		else if (strcmp(arg, "--no-state-cache") == 0) gl_state_cache = false;
+		else if (strcmp(arg, "--shader-cache") == 0 && value) { shader_cache_path = value; ++i; }
+		else if (strcmp(arg, "--no-shader-cache") == 0) shader_cache_path = nullptr;
+		else if (strcmp(arg, "--startup-trace") == 0 && value) { startup_trace_path = value; ++i; }
+		else if (strcmp(arg, "--texture") == 0 && value) { scene_texture_paths.push_back(value); ++i; }
+		else if (strcmp(arg, "--texture-budget") == 0 && value) { texture_stream_config.budget_bytes = (uint64_t)(atof(value) * 1024.0 * 1024.0); ++i; }
+		else if (strcmp(arg, "--texture-upload-ms") == 0 && value) { texture_stream_config.upload_ms = (float)atof(value); ++i; }
+		else if (strcmp(arg, "--record") == 0 && value) { trace_record_path = value; ++i; }
+		else if (strcmp(arg, "--replay") == 0 && value) { trace_replay_path = value; ++i; }
+		else if (strcmp(arg, "--replay-realtime") == 0) trace_replay_real_time = true;
+		else if (strcmp(arg, "--mirror-rate") == 0 && value) { mirror_config.rate = atoi(value); ++i; }
+		else if (strcmp(arg, "--mirror-scale") == 0 && value) { mirror_config.scale = (float)atof(value); ++i; }
+		else if (strcmp(arg, "--mirror-eye") == 0 && value && strcmp(value, "both") == 0) { mirror_config.eyes = MirrorEyes_Both; ++i; }
+		else if (strcmp(arg, "--mirror-eye") == 0 && value && strcmp(value, "left") == 0) { mirror_config.eyes = MirrorEyes_Left; ++i; }
+		else if (strcmp(arg, "--mirror-eye") == 0 && value && strcmp(value, "right") == 0) { mirror_config.eyes = MirrorEyes_Right; ++i; }
+		else if (strcmp(arg, "--msaa") == 0 && value && (atoi(value) == 0 || atoi(value) == 2 || atoi(value) == 4 || atoi(value) == 8))
+		{
+			msaa_samples = atoi(value);
+			++i;
+		}
+		else if (strcmp(arg, "--foveation") == 0 && i + 2 < argc)
+		{
+			foveation_config.inner_size = (float)atof(argv[i + 1]);
+			foveation_config.middle_size = (float)atof(argv[i + 2]);
+			i += 2;
+		}
+		else if (strcmp(arg, "--resolution-range") == 0 && i + 2 < argc)
+		{
+			dynamic_resolution_config.min_scale = (float)atof(argv[i + 1]);
+			dynamic_resolution_config.max_scale = (float)atof(argv[i + 2]);
+			i += 2;
+		}
+		else if (strcmp(arg, "--timing-log") == 0 && value) { frame_timing_config.log_seconds = (float)atof(value); ++i; }
+		else if (strcmp(arg, "--missed-alert") == 0 && value) { frame_timing_config.alert_missed_percent = (float)atof(value); ++i; }
+		else if (strcmp(arg, "--bench") == 0 && value) { benchmark_name = value; ++i; }
+		else if (strcmp(arg, "--profile-csv") == 0 && value) { profile_csv_path = value; ++i; }
+		else if (strcmp(arg, "--profile-json") == 0 && value) { profile_json_path = value; ++i; }
+		else if (strcmp(arg, "--profile-trace") == 0 && value) { profile_trace_path = value; ++i; }
+		else
+		{
+			printf("Unknown argument: %s\n", arg);
+			printf("Usage: %s [--sim] [--hidden] [--frames N] [--refresh HZ] [--controllers N] [--no-vsync-wait]\n"
+				"          [--stereo multipass|instanced] [--stress-lines N] [--late-latch] [--mesh FILE]\n"
+				"          [--objects N] [--animate] [--no-cull] [--naive-draws] [--dynamic-resolution] [--resolution-range MIN MAX]\n"
+				"          [--no-hidden-area] [--foveated] [--foveation INNER MIDDLE] [--msaa 0|2|4|8] [--single-texture]\n"
+				"          [--no-shared-targets] [--mirror-rate N] [--mirror-scale S] [--mirror-eye left|right|both]\n"
+				"          [--pipelined] [--no-state-cache] [--shader-cache FILE] [--no-shader-cache]\n"
+				"          [--texture FILE] [--texture-budget MB] [--texture-upload-ms MS]\n"
+				"          [--record FILE] [--replay FILE] [--replay-realtime]\n"
+				"          [--profile-csv FILE] [--profile-json FILE] [--profile-trace FILE] [--startup-trace FILE]\n"
+				"          [--timing-log SECONDS] [--missed-alert PERCENT]\n"
+				"          [--bench poses|mesh-load|cull|instances]   (CPU only, no GL: instances leaves out the upload and draws)\n", argv[0]);
+			return false;
+		}
+	}
+	return true;
 }
 
 int main(int argc, char* argv[])
 {
-	if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
+	if (!ParseCommandLine(argc, argv))
 	{
-		printf("Could not init SDL! Error: %s\n", SDL_GetError());
 		return 1;
 	}
 
+	// Benchmarks that don't need a window, GL or the runtime
+	if (benchmark_name)
 	{
-		// We can call these before we load the runtime
-		bool is_hmd_present = vr::VR_IsHmdPresent();
-		bool is_runtime_installed = vr::VR_IsRuntimeInstalled();
-		printf("Found HMD: %s\n", is_hmd_present ? "yes" : "no");
-		printf("Found OpenVR runtime: %s\n", is_runtime_installed ? "yes" : "no");
+		if (strcmp(benchmark_name, "poses") == 0) return RunPoseBenchmark() ? 0 : 1;
+		if (strcmp(benchmark_name, "mesh-load") == 0) return RunMeshLoadBenchmark() ? 0 : 1;
+		if (strcmp(benchmark_name, "cull") == 0) return RunCullBenchmark() ? 0 : 1;
+		if (strcmp(benchmark_name, "instances") == 0) return RunInstanceBenchmark() ? 0 : 1;
 
-		if (is_hmd_present == false || is_runtime_installed == false)
-		{
-			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "error", "Something is missing...", NULL);
-			return 1;
-		}
+		printf("Unknown benchmark: %s\n", benchmark_name);
+		return 1;
 	}
 
-	// Load the OpenVR/SteamVR Runtime
-	vr::EVRInitError init_error = vr::VRInitError_None;
-	hmd = vr::VR_Init(&init_error, vr::VRApplication_Scene);
-	if (init_error != vr::VRInitError_None)
+	// Everything from here to the first frame counts as startup
+	StartupTraceBegin();
+
+	// Only video, which brings events with it. Nothing here uses audio, joysticks or haptics
 	{
-		hmd = nullptr;
-		char buf[1024];
-		sprintf_s(buf, sizeof(buf), "Unable to init VR runtime: %s", vr::VR_GetVRInitErrorAsEnglishDescription(init_error));
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "VR_Init Failed", buf, NULL);
-		return 1;
+		STARTUP_PHASE("sdl init");
+		if (SDL_Init(SDL_INIT_VIDEO) < 0)
+		{
+			printf("Could not init SDL! Error: %s\n", SDL_GetError());
+			return 1;
+		}
 	}
 
-	(vr::IVRRenderModels *)vr::VR_GetGenericInterface(vr::IVRRenderModels_Version, &init_error);
+	// Neither of these need GL, so they run while the window, the context and the shaders are made
+	vr_init_thread = std::thread(InitVRBackend);
+	if (scene_mesh_path)
+		mesh_prefetch_thread = std::thread(PrefetchSceneMesh);
 
 	// Create the window
+	int window_phase = StartupPhaseBegin("window and context");
 	companion_window = SDL_CreateWindow(
 		"Hello VR",
 		SDL_WINDOWPOS_CENTERED,
 		SDL_WINDOWPOS_CENTERED,
 		companion_width,
 		companion_height,
-		SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+		SDL_WINDOW_OPENGL | (hide_companion_window ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN));
 	if (companion_window == NULL)
 	{
+		JoinStartupThreads();
 		return 1;
 	}
 
@@ -475,6 +1203,7 @@ int main(int argc, char* argv[])
 	SDL_GL_SetSwapInterval(0);
 	if (gl_context == NULL)
 	{
+		JoinStartupThreads();
 		return 1;
 	}
 
@@ -482,108 +1211,196 @@ int main(int argc, char* argv[])
 	glewExperimental = GL_TRUE;
 	if (glewInit() != GLEW_OK)
 	{
+		JoinStartupThreads();
 		return 1;
 	}
+	StartupPhaseEnd(window_phase);
 
-	{
-		// Get some more info about our environment
-		std::string driver = "No Driver";
-		std::string display = "No Display";
-
-		driver = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_TrackingSystemName_String);
-		display = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SerialNumber_String);
+	// Every bind and enable on this context goes through the cache from here on
+	GLStateInit(gl_state_cache);
 
-		printf("Device: %s\n", display.c_str());
-		printf("Driver: %s\n", driver.c_str());
-	}
+	// Programs made from here on come out of the cache when they can
+	if (shader_cache_path)
+		ShaderCacheInit(shader_cache_path);
 
 	// Setup OpenGL
 	{
+		STARTUP_PHASE("shaders");
+
 		// Create Shaders
 		const char* scene_vertex_source =
 			"#version 410\n"
-			"uniform mat4 matrix;"
-			"in vec3 vPosition;"
+			VIEW_MATRICES_BLOCK
+			MESH_VERTEX_INPUTS
+			"uniform int eye;"
+			"uniform mat4 model;"
+			"out vec3 fNormal;"
+			"out vec2 fUV;"
 			"void main()"
 			"{"
-			"	gl_Position = matrix * vec4(vPosition, 1.0);"
+			"	fNormal = MeshNormal();"
+			"	fUV = vPosition.xz;"
+			"	gl_Position = eye_view_projection[eye] * model * vec4(vPosition, 1.0);"
 			"}";
+		// Lit from above, both sides of a triangle get the same light so nothing drawn goes black.
+		// Textures are projected straight down across the mesh's bounds, no texture coordinates needed
 		const char* scene_fragment_source =
 			"#version 410\n"
+			"uniform sampler2D scene_texture;"
+			"uniform bool textured;"
+			"in vec3 fNormal;"
+			"in vec2 fUV;"
 			"out vec4 outColour;"
 			"void main()"
 			"{"
-			"	outColour = vec4(1.0, 1.0, 1.0, 1.0);"
+			"	float light = 0.6 + 0.4 * abs(dot(normalize(fNormal), vec3(0.27, 0.89, 0.36)));"
+			"	vec3 albedo = textured ? texture(scene_texture, fUV).rgb : vec3(1.0);"
+			"	outColour = vec4(light * albedo, 1.0);"
 			"}";
 		scene_shader_program = CreateShaderProgram("scene", scene_vertex_source, scene_fragment_source);
-		scene_matrix_location = glGetUniformLocation(scene_shader_program, "matrix");
-
-		const char* window_vertex_source =
+		scene_eye_location = glGetUniformLocation(scene_shader_program, "eye");
+		scene_model_location = glGetUniformLocation(scene_shader_program, "model");
+		scene_textured_location = glGetUniformLocation(scene_shader_program, "textured");
+		BindViewMatrices(scene_shader_program);
+
+		// gl_InstanceID picks the eye, x gets squashed into that eye's half of the double wide target
+		// and the clip distance cuts off anything that would spill over into the other eye's half
+		const char* scene_stereo_vertex_source =
 			"#version 410\n"
-			"in vec2 vPosition;"
-			"in vec2 vUV;"
+			VIEW_MATRICES_BLOCK
+			MESH_VERTEX_INPUTS
+			"uniform mat4 model;"
+			"out vec3 fNormal;"
 			"out vec2 fUV;"
 			"void main()"
 			"{"
-			"	fUV = vUV;"
-			"	gl_Position = vec4(vPosition, 0.0, 1.0);"
+			"	int eye = gl_InstanceID & 1;"
+			"	vec4 position = eye_view_projection[eye] * model * vec4(vPosition, 1.0);"
+			"	float eye_offset = eye == 0 ? -0.5 : 0.5;"
+			"	gl_ClipDistance[0] = eye == 0 ? position.w - position.x : position.w + position.x;"
+			"	fNormal = MeshNormal();"
+			"	fUV = vPosition.xz;"
+			"	gl_Position = vec4(position.x * 0.5 + eye_offset * position.w, position.yzw);"
 			"}";
-		const char* window_fragment_source =
-			"#version 410\n"
-			"uniform sampler2D tex;"
-			"in vec2 fUV;"
-			"out vec4 outColour;"
-			"void main()"
-			"{"
-			"	outColour = texture(tex, fUV);"
-			"}";
-		window_shader_program = CreateShaderProgram("window", window_vertex_source, window_fragment_source);
+		scene_stereo_shader_program = CreateShaderProgram("scene stereo", scene_stereo_vertex_source, scene_fragment_source);
+		scene_stereo_model_location = glGetUniformLocation(scene_stereo_shader_program, "model");
+		scene_stereo_textured_location = glGetUniformLocation(scene_stereo_shader_program, "textured");
+		BindViewMatrices(scene_stereo_shader_program);
+
+		// Without the extensions these wouldn't compile, fall back to a draw per object
+		if (batched_rendering && !BatchSupported())
+		{
+			printf("Drawing each object separately instead\n");
+			batched_rendering = false;
+		}
+
+		// A batch draws every object with the same bindings, there's nowhere to switch textures
+		if (batched_rendering && !scene_texture_paths.empty())
+		{
+			printf("Textured objects are drawn one at a time, batching is off\n");
+			batched_rendering = false;
+		}
+
+		if (batched_rendering)
+		{
+			// The object's matrix comes out of the batch's storage buffer, indexed by the command's baseInstance
+			const char* scene_batch_vertex_source =
+				"#version 410\n"
+				BATCH_SHADER_EXTENSIONS
+				VIEW_MATRICES_BLOCK
+				MESH_VERTEX_INPUTS
+				BATCH_OBJECT_INPUTS
+				"uniform int eye;"
+				"out vec3 fNormal;"
+				"out vec2 fUV;"
+				"void main()"
+				"{"
+				"	fNormal = MeshNormal();"
+				"	fUV = vPosition.xz;"
+				"	gl_Position = eye_view_projection[eye] * object_model[vObject] * vec4(vPosition, 1.0);"
+				"}";
+			const char* scene_batch_stereo_vertex_source =
+				"#version 410\n"
+				BATCH_SHADER_EXTENSIONS
+				VIEW_MATRICES_BLOCK
+				MESH_VERTEX_INPUTS
+				BATCH_OBJECT_INPUTS
+				"out vec3 fNormal;"
+				"out vec2 fUV;"
+				"void main()"
+				"{"
+				"	int eye = gl_InstanceID & 1;"
+				"	vec4 position = eye_view_projection[eye] * object_model[vObject] * vec4(vPosition, 1.0);"
+				"	float eye_offset = eye == 0 ? -0.5 : 0.5;"
+				"	gl_ClipDistance[0] = eye == 0 ? position.w - position.x : position.w + position.x;"
+				"	fNormal = MeshNormal();"
+				"	fUV = vPosition.xz;"
+				"	gl_Position = vec4(position.x * 0.5 + eye_offset * position.w, position.yzw);"
+				"}";
+			scene_batch_shader_program = CreateShaderProgram("scene batch", scene_batch_vertex_source, scene_fragment_source);
+			scene_batch_stereo_shader_program = CreateShaderProgram("scene batch stereo", scene_batch_stereo_vertex_source, scene_fragment_source);
+			BindViewMatrices(scene_batch_shader_program);
+			BindViewMatrices(scene_batch_stereo_shader_program);
+		}
 	}
 
-	// Setup the companion window data
+	// Everything after this needs the runtime
 	{
-		// x, y,	u, v
-		// x and y are in normalised device coordinates
-		// each side should take up half the screen
-		GLfloat verts[] =
-		{
-			// Left side
-			-1.0, -1.0f,	0.0, 0.0,
-			0.0, -1.0,		1.0, 0.0,
-			-1.0, 1.0,		0.0, 1.0,
-			0.0, 1.0,		1.0, 1.0,
-
-			// Right side
-			0.0, -1.0,		0.0, 0.0,
-			1.0, -1.0,		1.0, 0.0,
-			0.0, 1.0,		0.0, 1.0,
-			1.0, 1.0,		1.0, 1.0
-		};
+		STARTUP_PHASE("wait for vr runtime");
+		vr_init_thread.join();
+	}
+	if (hmd == nullptr)
+	{
+		JoinStartupThreads();
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, vr_init_failure_title, vr_init_failure, NULL);
+		return 1;
+	}
+	printf("VR backend: %s\n", hmd->GetName());
 
-		GLushort indices[] = { 0, 1, 3, 0, 3, 2, 4, 5, 7, 4, 7, 6 };
+	// Find out what's already plugged in, anything after this arrives as an event
+	DeviceRegistryInit(hmd);
 
-		glGenVertexArrays(1, &window_vao);
-		glBindVertexArray(window_vao);
+	{
+		// Get some more info about our environment
+		std::string driver = "No Driver";
+		std::string display = "No Display";
 
-		glGenBuffers(1, &window_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, window_vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+		driver = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_TrackingSystemName_String);
+		display = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SerialNumber_String);
 
-		glGenBuffers(1, &window_ebo);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, window_ebo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+		printf("Device: %s\n", display.c_str());
+		printf("Driver: %s\n", driver.c_str());
+	}
 
-		GLint posAttrib = glGetAttribLocation(window_shader_program, "vPosition");
-		glEnableVertexAttribArray(posAttrib);
-		glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+	// Setup the companion window mirror, after this the window belongs to the mirror's thread
+	int mirror_phase = StartupPhaseBegin("companion mirror");
+	CompanionMirrorInit(companion_window, gl_context, companion_width, companion_height, mirror_config);
+	render_context_window = SDL_GL_GetCurrentWindow();
+	StartupPhaseEnd(mirror_phase);
 
-		GLint uvAttrib = glGetAttribLocation(window_shader_program, "vUV");
-		glEnableVertexAttribArray(uvAttrib);
-		glVertexAttribPointer(uvAttrib, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+	// The files decode in the background from here and stream in over the first frames
+	std::vector<int> scene_textures;
+	if (!scene_texture_paths.empty())
+	{
+		if (TextureStreamInit(texture_stream_config))
+		{
+			for (size_t i = 0; i < scene_texture_paths.size(); ++i)
+			{
+				int texture = TextureStreamLoad(scene_texture_paths[i]);
+				if (texture >= 0)
+					scene_textures.push_back(texture);
+			}
+		}
+		else
+		{
+			printf("Drawing the scene untextured instead\n");
+		}
 	}
 
 	// Setup scene data
 	{
+		STARTUP_PHASE("scene setup");
+
 		// Some hardcoded Triangles
 		float vertices[] = {
 			0.0f, 0.5f, 2.0f,
@@ -602,36 +1419,139 @@ int main(int argc, char* argv[])
 			-2, 1, 0,
 			-2, 1, 1
 		};
+		uint32_t indices[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+		if (mesh_prefetch_thread.joinable())
+		{
+			STARTUP_PHASE("wait for mesh file read");
+			mesh_prefetch_thread.join();
+		}
+		if (scene_mesh_path && !LoadMesh(scene_mesh_path, scene_mesh))
+		{
+			printf("Drawing the built in triangles instead\n");
+		}
 
 		// Create a crappy triangle for rendering
-		glUseProgram(scene_shader_program);
+		// Goes through the same file format as a converted mesh, just without the file
+		if (scene_mesh.vao == 0)
+		{
+			std::vector<uint8_t> mesh_file;
+			if (!BuildMeshFile(vertices, nullptr, 12, indices, 12, mesh_file) || !CreateMesh(&mesh_file[0], mesh_file.size(), scene_mesh))
+			{
+				return 1;
+			}
+		}
 
-		glGenVertexArrays(1, &scene_vao);
-		glBindVertexArray(scene_vao);
+		// Everything's the same mesh and the same material for now
+		uint32_t batch_mesh = 0, batch_material = 0;
+		if (batched_rendering)
+		{
+			batch_mesh = BatchAddMesh(scene_mesh);
+			batch_material = BatchAddMaterial(scene_batch_shader_program, scene_batch_stereo_shader_program);
+		}
+
+		// One copy of the mesh where it was modelled, or a square grid of them centred on it
+		glm::vec3 mesh_centre = (scene_mesh.bounds_min + scene_mesh.bounds_max) * 0.5f;
+		float mesh_radius = glm::length(scene_mesh.bounds_max - scene_mesh.bounds_min) * 0.5f;
+		scene_mesh_base = glm::translate(glm::mat4(1.0f), -mesh_centre) * scene_mesh.dequantise;
+		int grid_size = (int)ceil(sqrt((double)std::max(scene_object_count, 1)));
+		for (int object = 0; object < std::max(scene_object_count, 1); ++object)
+		{
+			glm::vec3 offset(0.0f);
+			if (scene_object_count > 1)
+			{
+				offset.x = (object % grid_size - (grid_size - 1) * 0.5f) * mesh_radius * 2.0f;
+				offset.z = (object / grid_size - (grid_size - 1) * 0.5f) * mesh_radius * 2.0f;
+			}
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), offset);
+			scene_object_models.push_back(model * scene_mesh.dequantise);
+			if (!scene_textures.empty())
+				scene_object_textures.push_back(scene_textures[object % scene_textures.size()]);
+			AddBoundingSphere(scene_object_bounds, mesh_centre + offset, mesh_radius);
+			if (batched_rendering)
+				BatchAddObject(batch_mesh, batch_material, model);
+		}
 
-		glGenBuffers(1, &scene_vbo); // Generate 1 buffer
-		glBindBuffer(GL_ARRAY_BUFFER, scene_vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		if (batched_rendering)
+		{
+			if (!BatchFinalise())
+			{
+				return 1;
+			}
 
-		GLint posAttrib = glGetAttribLocation(scene_shader_program, "vPosition");
-		glEnableVertexAttribArray(posAttrib);
-		glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+			// The batch has its own copy of the geometry now
+			DestroyMesh(scene_mesh);
+		}
+
+		// With culling off every object is always on the list
+		visible_scene_objects.resize(CullOutputSize(scene_object_bounds));
+		for (uint32_t object = 0; object < scene_object_bounds.count; ++object)
+			visible_scene_objects[object] = object;
+		visible_scene_object_count = scene_object_bounds.count;
 	}
 
 	// Setup the left and right render targets
 	{
+		STARTUP_PHASE("render targets");
+
 		hmd->GetRecommendedRenderTargetSize(&hmd_render_target_width, &hmd_render_target_height);
 
-		CreateFrameBuffer(hmd_render_target_width, hmd_render_target_height, left_eye_desc);
-		CreateFrameBuffer(hmd_render_target_width, hmd_render_target_height, right_eye_desc);
+		// Dynamic resolution allocates for the largest scale up front, changing scale only changes
+		// how much of the targets gets used
+		eye_target_width = hmd_render_target_width;
+		eye_target_height = hmd_render_target_height;
+		if (dynamic_resolution)
+		{
+			float max_scale = std::max(dynamic_resolution_config.min_scale, dynamic_resolution_config.max_scale);
+			eye_target_width = (uint32_t)(hmd_render_target_width * max_scale + 0.5f);
+			eye_target_height = (uint32_t)(hmd_render_target_height * max_scale + 0.5f);
+		}
+		eye_render_width = eye_target_width;
+		eye_render_height = eye_target_height;
+
+		GLint max_samples = 0;
+		glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+		if (msaa_samples > max_samples)
+		{
+			printf("%dx MSAA isn't supported, using %dx\n", msaa_samples, max_samples);
+			msaa_samples = max_samples;
+		}
+
+		// The eyes are always rendered and resolved one after the other, so their multisampled
+		// colour and depth can be one set
+		RenderTargetsInit(shared_targets);
+		if (single_texture)
+		{
+			RenderTargetCreate("stereo", eye_target_width * 2, eye_target_height, msaa_samples, true, stereo_desc);
+		}
+		else
+		{
+			RenderTargetCreate("left eye", eye_target_width, eye_target_height, msaa_samples, true, left_eye_desc);
+			RenderTargetCreate("right eye", eye_target_width, eye_target_height, msaa_samples, true, right_eye_desc);
+		}
+		printf("Eye targets: %ux%u, %dx MSAA, %s\n", eye_target_width, eye_target_height, msaa_samples,
+			single_texture ? "both eyes in one double wide texture" : "one texture per eye");
+
+		if (foveated_rendering)
+		{
+			for (int level = 1; level < foveation_level_count; ++level)
+			{
+				int width = std::max(1, (int)(eye_target_width * foveation_level_scale[level] + 0.5f));
+				int height = std::max(1, (int)(eye_target_height * foveation_level_scale[level] + 0.5f));
+				RenderTargetCreate(level == 1 ? "middle ring" : "outer ring", width, height, msaa_samples, true, foveation_level_desc[level]);
+			}
+		}
 	}
 
 	// Setup the compositer
-	if (!vr::VRCompositor())
+	int compositor_phase = StartupPhaseBegin("compositor init");
+	if (!hmd->InitCompositor())
 	{
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "VR_Init Failed", "Could not initialise compositor", NULL);
 		return 1;
 	}
+	StartupPhaseEnd(compositor_phase);
+	int frame_setup_phase = StartupPhaseBegin("frame setup");
 
 	// Grab the projection and eye to pos matrices
 	// These are fixed, only the pose changes each frame
@@ -639,140 +1559,131 @@ int main(int argc, char* argv[])
 	left_eye_to_pose = GetHMDMatrixPoseEye(vr::Eye_Left);
 	right_eye_projection = GetHMDMartixProjection(vr::Eye_Right);
 	right_eye_to_pose = GetHMDMatrixPoseEye(vr::Eye_Right);
+	eye_projection_from_head[vr::Eye_Left] = left_eye_projection * left_eye_to_pose;
+	eye_projection_from_head[vr::Eye_Right] = right_eye_projection * right_eye_to_pose;
+	combined_eye_frustum = BuildCombinedStereoFrustum(eye_projection_from_head, late_latch_poses || pipelined_frames ? late_latch_cull_margin : 0.0f);
 
-	// Finally!
-	// The application loop
-	bool done = false;
-	SDL_Event sdl_event;
-	vr::VREvent_t vr_event;
-	while (!done)
+	// The foveation levels centre on where each eye looks straight ahead, which is off centre on the target
+	if (foveated_rendering)
 	{
-		// Process SDL events
-		while (SDL_PollEvent(&sdl_event))
+		glm::vec2 lens_centre[2];
+		glm::vec4 axis = left_eye_projection * glm::vec4(0.0f, 0.0f, -1.0f, 1.0f);
+		lens_centre[vr::Eye_Left] = glm::vec2(axis.x / axis.w * 0.5f + 0.5f, axis.y / axis.w * 0.5f + 0.5f);
+		axis = right_eye_projection * glm::vec4(0.0f, 0.0f, -1.0f, 1.0f);
+		lens_centre[vr::Eye_Right] = glm::vec2(axis.x / axis.w * 0.5f + 0.5f, axis.y / axis.w * 0.5f + 0.5f);
+
+		if (!FoveationInit(foveation_config, lens_centre))
 		{
-			if (sdl_event.type == SDL_QUIT) done = true;
-			else if (sdl_event.type == SDL_KEYDOWN)
-			{
-				if (sdl_event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) done = true;
-			}
+			printf("Rendering at full resolution everywhere instead\n");
+			foveated_rendering = false;
 		}
-
-		// Process SteamVR events
-		while (hmd->PollNextEvent(&vr_event, sizeof(vr_event)))
+		else if (stereo_mode == StereoMode_Instanced)
 		{
-			// Apparently it works when we don't actulally poll the SteamVR event list, but you probably should
+			printf("Foveated rendering draws the eyes one at a time, instanced stereo is ignored\n");
 		}
+	}
 
-		// HEY YOU - IMPORTANT!
-		//
-		// This must be called or the app will not gain focus! Currently called inside UpdateHMDMatrixPose();
-		//		vr::TrackedDevicePose_t pose_buffer[vr::k_unMaxTrackedDeviceCount];
-		//		vr::VRCompositor()->WaitGetPoses( pose_buffer, vr::k_unMaxTrackedDeviceCount, NULL, 0 );
-		//
-		// TBH at this stage I don't fully know what poses are,
-		// apart from the fact valve seem to think they are important and we must get them
-		// Something to do with the position of the HMD
-		UpdateHMDMatrixPose();
-		UpdateControllerAxes();
-
-		glEnable(GL_DEPTH_TEST);
-		glClearColor(0.0, 0.0, 0.0, 1.0);
-
-		// render left eye
-		glEnable(GL_MULTISAMPLE);
-		glBindFramebuffer(GL_FRAMEBUFFER, left_eye_desc.render_frame_buffer);
-		glViewport(0, 0, hmd_render_target_width, hmd_render_target_height);
-
-		RenderScene(vr::Eye_Left);
-
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glDisable(GL_MULTISAMPLE);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, left_eye_desc.render_frame_buffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, left_eye_desc.resolve_frame_buffer);
-
-		glBlitFramebuffer(0, 0, hmd_render_target_width, hmd_render_target_height, 0, 0, hmd_render_target_width, hmd_render_target_height,
-			GL_COLOR_BUFFER_BIT,
-			GL_LINEAR);
-
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-		// render Right eye
-		glEnable(GL_MULTISAMPLE);
-		glBindFramebuffer(GL_FRAMEBUFFER, right_eye_desc.render_frame_buffer);
-		glViewport(0, 0, hmd_render_target_width, hmd_render_target_height);
-
-		RenderScene(vr::Eye_Right);
+	// Until the first valid HMD pose arrives look from the origin
+	pose_store.hmd_view = glm::mat4(1.0f);
+	pose_store.eye_view_projection[vr::Eye_Left] = eye_projection_from_head[vr::Eye_Left];
+	pose_store.eye_view_projection[vr::Eye_Right] = eye_projection_from_head[vr::Eye_Right];
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glDisable(GL_MULTISAMPLE);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, right_eye_desc.render_frame_buffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, right_eye_desc.resolve_frame_buffer);
+	// The view matrices live in one uniform buffer, bound once for good
+	glGenBuffers(1, &view_matrices_ubo);
+	GLStateBindBuffer(GL_UNIFORM_BUFFER, view_matrices_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(pose_store.eye_view_projection), pose_store.eye_view_projection, GL_DYNAMIC_DRAW);
+	GLStateBindBuffer(GL_UNIFORM_BUFFER, 0);
+	GLStateBindBufferBase(GL_UNIFORM_BUFFER, view_matrices_binding, view_matrices_ubo);
 
-		glBlitFramebuffer(0, 0, hmd_render_target_width, hmd_render_target_height, 0, 0, hmd_render_target_width, hmd_render_target_height,
-			GL_COLOR_BUFFER_BIT,
-			GL_LINEAR);
+	PosePredictionInit(hmd);
+	FrameTimingInit(hmd, frame_timing_config);
 
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	// Room for the controllers with plenty to spare, plus whatever the stress test asks for
+	if (!DebugDrawInit(4096 + stress_line_count * 2))
+	{
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Debug draw", "Could not set up debug drawing", NULL);
+		return 1;
+	}
 
-		// Submit frames to HMD
-		if (!hmd->IsInputFocusCapturedByAnotherProcess())
-		{
-			// NOTE: to find out what the error codes mean Ctal+F 'enum EVRCompositorError' in 'openvr.h'
-			vr::EVRCompositorError submit_error = vr::VRCompositorError_None;
+	// Controllers stay as axis lines if these can't be drawn
+	if (!RenderModelsInit(hmd))
+		printf("Drawing controllers as lines instead of render models\n");
 
-			vr::Texture_t left_eye_texture = { (void*)left_eye_desc.resolve_texture, vr::ETextureType::TextureType_OpenGL, vr::ColorSpace_Gamma };
-			submit_error = vr::VRCompositor()->Submit(vr::Eye_Left, &left_eye_texture, NULL);
-			if (submit_error != vr::VRCompositorError_None)
-			{
-				printf("Error in left eye %d\n", submit_error);
-			}
+	// The mask never changes, fetch it once
+	if (hidden_area_mask && !HiddenAreaInit(hmd))
+	{
+		printf("Shading the whole eye targets instead\n");
+		hidden_area_mask = false;
+	}
 
+	ProfilerInit(true);
 
-			vr::Texture_t right_eye_texture = { (void*)right_eye_desc.resolve_texture, vr::ETextureType::TextureType_OpenGL, vr::ColorSpace_Gamma };
-			submit_error = vr::VRCompositor()->Submit(vr::Eye_Right, &right_eye_texture, NULL);
-			if (submit_error != vr::VRCompositorError_None)
-			{
-				printf("Error in right eye %d\n", submit_error);
-			}
-		}
-		else
-		{
-			printf("Another process has focus of the HMD!\n");
-		}
-
-		// Draw the companion window
-		glDisable(GL_DEPTH_TEST);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0, 0, companion_width, companion_height);
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
+	if (dynamic_resolution)
+		DynamicResolutionInit(hmd, dynamic_resolution_config);
 
-		glBindVertexArray(window_vao);
-		glUseProgram(window_shader_program);
+	if (animate_scene)
+		JobSystemInit(0);
 
-		// render left eye (first half of index array )
-		glBindTexture(GL_TEXTURE_2D, left_eye_desc.resolve_texture);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	StartupPhaseEnd(frame_setup_phase);
 
-		// render right eye (second half of index array )
-		glBindTexture(GL_TEXTURE_2D, right_eye_desc.resolve_texture);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, (const void *)(12));
+	// Finally!
+	// The application loop
+	first_frame_phase = StartupPhaseBegin("first frame");
+	last_frame_time = std::chrono::steady_clock::now();
+	if (pipelined_frames)
+		RunPipelinedFrames();
+	else
+		RunFrames();
 
-		SDL_GL_SwapWindow(companion_window);
+	if (frame_count > 0)
+	{
+		printf("Frame times: %d frames, avg %.3f ms, min %.3f ms, max %.3f ms\n",
+			frame_count, frame_time_total_ms / frame_count, frame_time_min_ms, frame_time_max_ms);
+		printf("Draw calls: avg %.1f per frame (%s stereo, %s)\n",
+			draw_call_total / (double)frame_count, foveated_rendering ? "foveated multipass" : stereo_mode == StereoMode_Instanced ? "instanced" : "multipass",
+			batched_rendering ? "batched" : "one per object");
+		printf("Scene objects: %u, avg %.1f visible per frame (culling %s)\n",
+			scene_object_bounds.count, visible_object_total / (double)frame_count, frustum_culling ? "on" : "off");
 	}
+	FramePipelinePrintStats();
+	InstanceAnimationPrintStats();
+	JobSystemPrintStats();
+	JobSystemShutdown();
+	GLStatePrintStats();
+	TextureStreamPrintStats();
+	StartupTracePrint();
+	if (startup_trace_path) StartupTraceExport(startup_trace_path);
+	ShaderCachePrintStats();
+
+	DynamicResolutionPrintStats();
+	DynamicResolutionShutdown();
+	ProfilerPrintSummary();
+	if (profile_csv_path) ProfilerExportCSV(profile_csv_path);
+	if (profile_json_path) ProfilerExportJSON(profile_json_path);
+	if (profile_trace_path) ProfilerExportChromeTrace(profile_trace_path);
+	ProfilerShutdown();
+	DebugDrawPrintStats();
+	DebugDrawShutdown();
+	RenderModelsPrintStats();
+	RenderModelsShutdown();
+	HiddenAreaPrintStats();
+	HiddenAreaShutdown();
+	FoveationShutdown();
+	CompanionMirrorShutdown();
+	CompanionMirrorPrintStats();
+	RenderTargetsPrintReport();
+	RenderTargetsShutdown();
+	PosePredictionPrintStats();
+	FrameTimingPrintStats();
+	BatchShutdown();
+	TextureStreamShutdown();
+	ShaderCacheShutdown();
+	GLStateDeleteBuffers(1, &view_matrices_ubo);
 
 	// Shutdown everything
-	vr::VR_Shutdown();
+	hmd->Shutdown();
+	delete hmd;
+	hmd = nullptr;
 	if (companion_window)
 	{
 		SDL_DestroyWindow(companion_window);
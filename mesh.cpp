@@ -0,0 +1,325 @@
+#include "mesh.h"
+#include "gl_state.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// A read only view of a whole file
+	struct MappedFile
+	{
+		const void* data;
+		uint64_t size;
+#ifdef _WIN32
+		HANDLE file;
+		HANDLE mapping;
+#else
+		int file;
+#endif
+	};
+
+	bool MapFile(const char* path, MappedFile& mapped)
+	{
+		memset(&mapped, 0, sizeof(mapped));
+#ifdef _WIN32
+		mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (mapped.file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		GetFileSizeEx(mapped.file, &size);
+		mapped.size = (uint64_t)size.QuadPart;
+		mapped.mapping = mapped.size > 0 ? CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		mapped.data = mapped.mapping ? MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (mapped.data == nullptr)
+		{
+			if (mapped.mapping) CloseHandle(mapped.mapping);
+			CloseHandle(mapped.file);
+			return false;
+		}
+#else
+		mapped.file = open(path, O_RDONLY);
+		if (mapped.file < 0)
+			return false;
+
+		struct stat info;
+		fstat(mapped.file, &info);
+		mapped.size = (uint64_t)info.st_size;
+		void* data = mapped.size > 0 ? mmap(nullptr, (size_t)mapped.size, PROT_READ, MAP_PRIVATE, mapped.file, 0) : MAP_FAILED;
+		if (data == MAP_FAILED)
+		{
+			close(mapped.file);
+			return false;
+		}
+		// It all gets read front to back by the upload
+		madvise(data, (size_t)mapped.size, MADV_SEQUENTIAL | MADV_WILLNEED);
+		mapped.data = data;
+#endif
+		return true;
+	}
+
+	void UnmapFile(MappedFile& mapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mapped.data);
+		CloseHandle(mapped.mapping);
+		CloseHandle(mapped.file);
+#else
+		munmap((void*)mapped.data, (size_t)mapped.size);
+		close(mapped.file);
+#endif
+		mapped.data = nullptr;
+	}
+
+	// Immutable storage when there is some, a static buffer otherwise
+	void UploadBuffer(GLenum target, GLuint& buffer, GLsizeiptr size, const void* data)
+	{
+		glGenBuffers(1, &buffer);
+		GLStateBindBuffer(target, buffer);
+		if (GLEW_ARB_buffer_storage)
+			glBufferStorage(target, size, data, 0);
+		else
+			glBufferData(target, size, data, GL_STATIC_DRAW);
+	}
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+}
+
+bool LoadMesh(const char* path, Mesh& mesh)
+{
+	Clock::time_point start = Clock::now();
+
+	MappedFile mapped;
+	if (!MapFile(path, mapped))
+	{
+		printf("Mesh: could not open %s\n", path);
+		return false;
+	}
+
+	bool created = CreateMesh(mapped.data, mapped.size, mesh);
+	UnmapFile(mapped);
+
+	if (created)
+	{
+		printf("Mesh: %s, %u triangles, %u vertices, %u meshlets, %.1f MB in %.2f ms\n",
+			path, mesh.index_count / 3, mesh.vertex_count, (uint32_t)mesh.meshlets.size(), mapped.size / (1024.0 * 1024.0), MillisecondsSince(start));
+	}
+	return created;
+}
+
+bool PrefetchMeshFile(const char* path)
+{
+	MappedFile mapped;
+	if (!MapFile(path, mapped))
+		return false;
+
+	// One read per page is enough to fault it in
+	bool valid = ValidateMeshFile(mapped.data, mapped.size);
+	const volatile uint8_t* bytes = (const volatile uint8_t*)mapped.data;
+	uint8_t sum = 0;
+	for (uint64_t offset = 0; valid && offset < mapped.size; offset += 4096)
+		sum += bytes[offset];
+	(void)sum;
+
+	UnmapFile(mapped);
+	return valid;
+}
+
+bool CreateMesh(const void* data, uint64_t size, Mesh& mesh)
+{
+	if (!ValidateMeshFile(data, size))
+		return false;
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	const MeshFileHeader& header = *(const MeshFileHeader*)data;
+
+	mesh.vertex_count = header.vertex_count;
+	mesh.index_count = header.index_count;
+	mesh.index_type = header.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	mesh.bounds_min = glm::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+	mesh.bounds_max = glm::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+
+	// Positions arrive as 0 to 1 across the bounds, scale them back up and move them into place
+	glm::vec3 extent = mesh.bounds_max - mesh.bounds_min;
+	mesh.dequantise = glm::mat4(1.0f);
+	mesh.dequantise[0][0] = extent.x;
+	mesh.dequantise[1][1] = extent.y;
+	mesh.dequantise[2][2] = extent.z;
+	mesh.dequantise[3] = glm::vec4(mesh.bounds_min, 1.0f);
+
+	const MeshFileMeshlet* meshlets = (const MeshFileMeshlet*)(bytes + header.meshlet_offset);
+	mesh.meshlets.assign(meshlets, meshlets + header.meshlet_count);
+
+	glGenVertexArrays(1, &mesh.vao);
+	GLStateBindVertexArray(mesh.vao);
+
+	UploadBuffer(GL_ARRAY_BUFFER, mesh.vertex_buffer, (GLsizeiptr)header.vertex_count * sizeof(MeshFileVertex), bytes + header.vertex_offset);
+	UploadBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.index_buffer, (GLsizeiptr)header.index_count * header.index_size, bytes + header.index_offset);
+
+	glEnableVertexAttribArray(mesh_position_attribute);
+	glVertexAttribPointer(mesh_position_attribute, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(MeshFileVertex), (const void *)offsetof(MeshFileVertex, position));
+	glEnableVertexAttribArray(mesh_normal_attribute);
+	glVertexAttribPointer(mesh_normal_attribute, 2, GL_SHORT, GL_TRUE, sizeof(MeshFileVertex), (const void *)offsetof(MeshFileVertex, normal));
+
+	// The element buffer binding belongs to the VAO, so unbind the VAO first
+	GLStateBindVertexArray(0);
+	GLStateBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLStateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void DestroyMesh(Mesh& mesh)
+{
+	GLStateDeleteVertexArrays(1, &mesh.vao);
+	GLStateDeleteBuffers(1, &mesh.vertex_buffer);
+	GLStateDeleteBuffers(1, &mesh.index_buffer);
+	mesh = Mesh();
+}
+
+namespace
+{
+	// A UV sphere, rings * segments * 2 triangles
+	void MakeSphere(uint32_t rings, uint32_t segments, std::vector<float>& positions, std::vector<uint32_t>& indices)
+	{
+		const float pi = 3.14159265f;
+		positions.clear();
+		indices.clear();
+		positions.reserve((rings + 1) * (segments + 1) * 3);
+		indices.reserve(rings * segments * 6);
+
+		for (uint32_t ring = 0; ring <= rings; ++ring)
+		{
+			float theta = pi * ring / rings;
+			for (uint32_t segment = 0; segment <= segments; ++segment)
+			{
+				float phi = 2.0f * pi * segment / segments;
+				positions.push_back(sinf(theta) * cosf(phi));
+				positions.push_back(cosf(theta));
+				positions.push_back(sinf(theta) * sinf(phi));
+			}
+		}
+
+		for (uint32_t ring = 0; ring < rings; ++ring)
+		{
+			for (uint32_t segment = 0; segment < segments; ++segment)
+			{
+				uint32_t a = ring * (segments + 1) + segment;
+				uint32_t b = a + segments + 1;
+				indices.push_back(a); indices.push_back(b); indices.push_back(a + 1);
+				indices.push_back(a + 1); indices.push_back(b); indices.push_back(b + 1);
+			}
+		}
+	}
+
+	// Stands in for the upload, touches every byte so the pages actually get read
+	uint64_t Checksum(const void* data, uint64_t size)
+	{
+		const uint64_t* words = (const uint64_t*)data;
+		uint64_t sum = 0;
+		for (uint64_t i = 0; i < size / 8; ++i)
+			sum += words[i];
+		return sum;
+	}
+
+	// Writes a sphere's mesh file to path and times loading it both ways. Leaves the file behind,
+	// false if anything failed or the two ways didn't agree
+	bool TimeMeshLoad(const char* path, uint32_t rings, uint32_t segments)
+	{
+		std::vector<float> positions;
+		std::vector<uint32_t> indices;
+		MakeSphere(rings, segments, positions, indices);
+
+		Clock::time_point build_start = Clock::now();
+		std::vector<uint8_t> file;
+		if (!BuildMeshFile(&positions[0], nullptr, (uint32_t)(positions.size() / 3), &indices[0], (uint32_t)indices.size(), file))
+			return false;
+		double build_ms = MillisecondsSince(build_start);
+
+		FILE* out = fopen(path, "wb");
+		if (out == nullptr || fwrite(&file[0], 1, file.size(), out) != file.size())
+		{
+			printf("Could not write %s\n", path);
+			if (out) fclose(out);
+			return false;
+		}
+		fclose(out);
+		uint64_t expected = Checksum(&file[0], file.size());
+
+		double map_best = 1e30, read_best = 1e30, validate_best = 1e30;
+		bool match = true;
+		for (int run = 0; run < 5; ++run)
+		{
+			Clock::time_point start = Clock::now();
+			MappedFile mapped;
+			if (!MapFile(path, mapped))
+				return false;
+			uint64_t mapped_sum = Checksum(mapped.data, mapped.size);
+			map_best = fmin(map_best, MillisecondsSince(start));
+			match = match && mapped_sum == expected;
+			UnmapFile(mapped);
+
+			start = Clock::now();
+			FILE* in = fopen(path, "rb");
+			if (in == nullptr)
+				return false;
+			fseek(in, 0, SEEK_END);
+			std::vector<uint8_t> contents((size_t)ftell(in));
+			fseek(in, 0, SEEK_SET);
+			size_t read = fread(&contents[0], 1, contents.size(), in);
+			fclose(in);
+			uint64_t read_sum = Checksum(&contents[0], contents.size());
+			read_best = fmin(read_best, MillisecondsSince(start));
+			match = match && read == contents.size() && read_sum == expected;
+
+			start = Clock::now();
+			bool valid = ValidateMeshFile(&contents[0], contents.size());
+			validate_best = fmin(validate_best, MillisecondsSince(start));
+			match = match && valid;
+		}
+
+		double megabytes = file.size() / (1024.0 * 1024.0);
+		printf("  %4.1fM triangles, %6.1f MB (%.1f bytes/triangle): map %7.2f ms (%5.0f MB/s), read %7.2f ms (%5.0f MB/s), %.2fx, validate %.2f ms, build %.0f ms%s\n",
+			indices.size() / 3 / 1e6, megabytes, file.size() / (indices.size() / 3.0),
+			map_best, megabytes / (map_best / 1000.0), read_best, megabytes / (read_best / 1000.0), read_best / map_best, validate_best, build_ms,
+			match ? "" : " MISMATCH");
+		return match;
+	}
+}
+
+bool RunMeshLoadBenchmark()
+{
+	printf("Mesh load benchmark, mapping the file vs reading it into memory\n");
+	printf("Times are best of 5 with the file in the page cache. Map and read are only the I/O, both read every byte,\n");
+	printf("validate is the header and index checks on a copy that's already in memory\n");
+
+	const char* path = "mesh_load_benchmark.hvm";
+	const uint32_t sizes[][2] = { { 500, 1000 }, { 1000, 2000 }, { 1500, 3000 } };	// 1, 4 and 9 million triangles
+	bool all_ok = true;
+
+	// Every exit goes through the remove, a failed run would otherwise leave hundreds of MB behind
+	for (int test = 0; test < 3 && all_ok; ++test)
+		all_ok = TimeMeshLoad(path, sizes[test][0], sizes[test][1]);
+
+	remove(path);
+	return all_ok;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "mesh_format.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// A mesh file uploaded to immutable GL buffers, drawn with indexed draws
+//
+// LoadMesh() maps the file and passes the mapped vertex and index blocks straight to
+// glBufferStorage, so the data goes from the page cache to the driver without an extra copy.
+
+// Attribute slots mesh VAOs use, shaders that draw meshes pin their inputs to these
+const GLuint mesh_position_attribute = 0;	// vec3, 0 to 1 inside the mesh's bounds
+const GLuint mesh_normal_attribute = 1;		// vec2, octahedral encoded
+
+// GLSL for the vertex side of the format, paste it into any vertex shader that draws meshes.
+// MeshNormal() undoes the octahedral encoding
+#define MESH_VERTEX_INPUTS \
+	"layout(location = 0) in vec3 vPosition;" \
+	"layout(location = 1) in vec2 vNormal;" \
+	"vec3 MeshNormal()" \
+	"{" \
+	"	vec3 n = vec3(vNormal, 1.0 - abs(vNormal.x) - abs(vNormal.y));" \
+	"	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);" \
+	"	return normalize(n);" \
+	"}"
+
+struct Mesh
+{
+	GLuint vao;
+	GLuint vertex_buffer;
+	GLuint index_buffer;
+	GLenum index_type;			// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	uint32_t vertex_count;
+	uint32_t index_count;
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+	glm::mat4 dequantise;		// takes the unorm16 positions back to model space, put it in front of the model matrix
+	std::vector<MeshFileMeshlet> meshlets;
+
+	Mesh()
+		: vao(0)
+		, vertex_buffer(0)
+		, index_buffer(0)
+		, index_type(GL_UNSIGNED_INT)
+		, vertex_count(0)
+		, index_count(0)
+		, dequantise(1.0f)
+	{}
+};
+
+// Returns false and prints why if the file is missing or not a valid mesh file
+bool LoadMesh(const char* path, Mesh& mesh);
+// Reads the whole file into the page cache and checks it, without touching GL, so it can run on
+// another thread while the context is being made. LoadMesh afterwards only has to upload it.
+// Returns false if the file is missing or not a valid mesh file, LoadMesh will say why
+bool PrefetchMeshFile(const char* path);
+// From a whole mesh file that's already in memory
+bool CreateMesh(const void* data, uint64_t size, Mesh& mesh);
+void DestroyMesh(Mesh& mesh);
+
+// Writes a few multi-million triangle files and times mapping them against reading them into memory
+bool RunMeshLoadBenchmark();
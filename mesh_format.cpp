@@ -0,0 +1,324 @@
+#include "mesh_format.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	const uint64_t block_alignment = 16;
+
+	uint64_t AlignUp(uint64_t value)
+	{
+		return (value + block_alignment - 1) & ~(block_alignment - 1);
+	}
+
+	// Whether bytes from offset on ends by end. The offset is checked on its own first, a corrupt
+	// one near the top of the range would wrap offset + bytes around and pass
+	bool BlockFits(uint64_t offset, uint64_t bytes, uint64_t end)
+	{
+		return offset <= end && bytes <= end - offset;
+	}
+
+	uint16_t QuantiseUnorm(float value, float min, float extent)
+	{
+		if (extent <= 0.0f)
+			return 0;
+
+		float unorm = (value - min) / extent;
+		unorm = unorm < 0.0f ? 0.0f : (unorm > 1.0f ? 1.0f : unorm);
+		return (uint16_t)(unorm * 65535.0f + 0.5f);
+	}
+
+	int16_t QuantiseSnorm(float value)
+	{
+		value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+		return (int16_t)floorf(value * 32767.0f + 0.5f);
+	}
+
+	float SignNotZero(float value)
+	{
+		return value < 0.0f ? -1.0f : 1.0f;
+	}
+
+	// Project the unit normal onto an octahedron and unfold it into a square
+	void OctEncode(const float* normal, int16_t* out)
+	{
+		float x = normal[0], y = normal[1], z = normal[2];
+		float length = fabsf(x) + fabsf(y) + fabsf(z);
+		if (length <= 0.0f)
+		{
+			out[0] = 0;
+			out[1] = 0;
+			return;
+		}
+
+		x /= length;
+		y /= length;
+		if (z < 0.0f)
+		{
+			float folded_x = (1.0f - fabsf(y)) * SignNotZero(x);
+			float folded_y = (1.0f - fabsf(x)) * SignNotZero(y);
+			x = folded_x;
+			y = folded_y;
+		}
+		out[0] = QuantiseSnorm(x);
+		out[1] = QuantiseSnorm(y);
+	}
+
+	// Area weighted average of the faces around each vertex
+	void ComputeSmoothNormals(const float* positions, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, std::vector<float>& normals)
+	{
+		normals.assign(vertex_count * 3, 0.0f);
+		for (uint32_t i = 0; i + 2 < index_count; i += 3)
+		{
+			const float* a = positions + indices[i] * 3;
+			const float* b = positions + indices[i + 1] * 3;
+			const float* c = positions + indices[i + 2] * 3;
+			float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float face[3] = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0] };
+
+			for (int corner = 0; corner < 3; ++corner)
+				for (int axis = 0; axis < 3; ++axis)
+					normals[indices[i + corner] * 3 + axis] += face[axis];
+		}
+
+		for (uint32_t vertex = 0; vertex < vertex_count; ++vertex)
+		{
+			float* n = &normals[vertex * 3];
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 0.0f)
+			{
+				n[0] /= length;
+				n[1] /= length;
+				n[2] /= length;
+			}
+		}
+	}
+
+	// Greedy, in triangle order: a meshlet closes when the next triangle would take it over either limit
+	void BuildMeshlets(const float* positions, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, std::vector<MeshFileMeshlet>& meshlets)
+	{
+		// Which meshlet last used each vertex, so counting unique vertices is O(1) per corner
+		std::vector<uint32_t> last_meshlet(vertex_count, UINT32_MAX);
+		std::vector<uint32_t> meshlet_vertices;
+		meshlet_vertices.reserve(meshlet_max_vertices);
+
+		MeshFileMeshlet meshlet;
+		memset(&meshlet, 0, sizeof(meshlet));
+
+		uint32_t triangle_count = index_count / 3;
+		for (uint32_t triangle = 0; triangle <= triangle_count; ++triangle)
+		{
+			bool last = triangle == triangle_count;
+			uint32_t new_vertices = 0;
+			if (!last)
+			{
+				for (int corner = 0; corner < 3; ++corner)
+					new_vertices += last_meshlet[indices[triangle * 3 + corner]] != (uint32_t)meshlets.size() ? 1 : 0;
+			}
+
+			bool full = meshlet.triangle_count == meshlet_max_triangles || meshlet.vertex_count + new_vertices > meshlet_max_vertices;
+			if ((last || full) && meshlet.triangle_count > 0)
+			{
+				// Bounding sphere around the centre of the meshlet's box
+				float box_min[3] = { 1e30f, 1e30f, 1e30f }, box_max[3] = { -1e30f, -1e30f, -1e30f };
+				for (size_t i = 0; i < meshlet_vertices.size(); ++i)
+				{
+					const float* p = positions + meshlet_vertices[i] * 3;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						box_min[axis] = fminf(box_min[axis], p[axis]);
+						box_max[axis] = fmaxf(box_max[axis], p[axis]);
+					}
+				}
+				float radius_squared = 0.0f;
+				for (int axis = 0; axis < 3; ++axis)
+					meshlet.centre[axis] = (box_min[axis] + box_max[axis]) * 0.5f;
+				for (size_t i = 0; i < meshlet_vertices.size(); ++i)
+				{
+					const float* p = positions + meshlet_vertices[i] * 3;
+					float dx = p[0] - meshlet.centre[0], dy = p[1] - meshlet.centre[1], dz = p[2] - meshlet.centre[2];
+					radius_squared = fmaxf(radius_squared, dx * dx + dy * dy + dz * dz);
+				}
+				meshlet.radius = sqrtf(radius_squared);
+
+				meshlets.push_back(meshlet);
+				memset(&meshlet, 0, sizeof(meshlet));
+				meshlet.first_index = triangle * 3;
+				meshlet_vertices.clear();
+			}
+
+			if (last)
+				break;
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				uint32_t vertex = indices[triangle * 3 + corner];
+				if (last_meshlet[vertex] != (uint32_t)meshlets.size())
+				{
+					last_meshlet[vertex] = (uint32_t)meshlets.size();
+					meshlet_vertices.push_back(vertex);
+					meshlet.vertex_count += 1;
+				}
+			}
+			meshlet.triangle_count += 1;
+		}
+	}
+}
+
+bool BuildMeshFile(const float* positions, const float* normals, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count, std::vector<uint8_t>& file)
+{
+	if (vertex_count == 0 || index_count == 0 || index_count % 3 != 0)
+	{
+		printf("Mesh: need at least one whole triangle, got %u vertices and %u indices\n", vertex_count, index_count);
+		return false;
+	}
+	for (uint32_t i = 0; i < index_count; ++i)
+	{
+		if (indices[i] >= vertex_count)
+		{
+			printf("Mesh: index %u is %u, there are only %u vertices\n", i, indices[i], vertex_count);
+			return false;
+		}
+	}
+
+	std::vector<float> smooth_normals;
+	if (normals == nullptr)
+	{
+		ComputeSmoothNormals(positions, vertex_count, indices, index_count, smooth_normals);
+		normals = &smooth_normals[0];
+	}
+
+	std::vector<MeshFileMeshlet> meshlets;
+	BuildMeshlets(positions, vertex_count, indices, index_count, meshlets);
+
+	MeshFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, mesh_file_magic, sizeof(header.magic));
+	header.version = mesh_file_version;
+	header.vertex_count = vertex_count;
+	header.index_count = index_count;
+	header.index_size = vertex_count <= 65536 ? 2 : 4;
+	header.meshlet_count = (uint32_t)meshlets.size();
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		header.bounds_min[axis] = 1e30f;
+		header.bounds_max[axis] = -1e30f;
+	}
+	for (uint32_t vertex = 0; vertex < vertex_count; ++vertex)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			header.bounds_min[axis] = fminf(header.bounds_min[axis], positions[vertex * 3 + axis]);
+			header.bounds_max[axis] = fmaxf(header.bounds_max[axis], positions[vertex * 3 + axis]);
+		}
+	}
+	header.vertex_offset = AlignUp(sizeof(MeshFileHeader));
+	header.index_offset = AlignUp(header.vertex_offset + (uint64_t)vertex_count * sizeof(MeshFileVertex));
+	header.meshlet_offset = AlignUp(header.index_offset + (uint64_t)index_count * header.index_size);
+	header.file_size = header.meshlet_offset + (uint64_t)meshlets.size() * sizeof(MeshFileMeshlet);
+
+	file.assign((size_t)header.file_size, 0);
+	memcpy(&file[0], &header, sizeof(header));
+
+	MeshFileVertex* out_vertices = (MeshFileVertex*)&file[(size_t)header.vertex_offset];
+	for (uint32_t vertex = 0; vertex < vertex_count; ++vertex)
+	{
+		MeshFileVertex& out = out_vertices[vertex];
+		for (int axis = 0; axis < 3; ++axis)
+			out.position[axis] = QuantiseUnorm(positions[vertex * 3 + axis], header.bounds_min[axis], header.bounds_max[axis] - header.bounds_min[axis]);
+		out.padding = 0;
+		OctEncode(normals + vertex * 3, out.normal);
+	}
+
+	if (header.index_size == 2)
+	{
+		uint16_t* out_indices = (uint16_t*)&file[(size_t)header.index_offset];
+		for (uint32_t i = 0; i < index_count; ++i)
+			out_indices[i] = (uint16_t)indices[i];
+	}
+	else
+	{
+		memcpy(&file[(size_t)header.index_offset], indices, index_count * sizeof(uint32_t));
+	}
+
+	if (!meshlets.empty())
+		memcpy(&file[(size_t)header.meshlet_offset], &meshlets[0], meshlets.size() * sizeof(MeshFileMeshlet));
+	return true;
+}
+
+bool ValidateMeshFile(const void* data, uint64_t size)
+{
+	if (size < sizeof(MeshFileHeader))
+	{
+		printf("Mesh: file is too small for a header\n");
+		return false;
+	}
+
+	const MeshFileHeader& header = *(const MeshFileHeader*)data;
+	if (memcmp(header.magic, mesh_file_magic, sizeof(header.magic)) != 0)
+	{
+		printf("Mesh: not a mesh file\n");
+		return false;
+	}
+	if (header.version != mesh_file_version)
+	{
+		printf("Mesh: file is version %u, this build reads version %u, convert it again\n", header.version, mesh_file_version);
+		return false;
+	}
+	if (header.index_size != 2 && header.index_size != 4)
+	{
+		printf("Mesh: bad index size %u\n", header.index_size);
+		return false;
+	}
+	if (header.index_count % 3 != 0 || (header.index_size == 2 && header.vertex_count > 65536))
+	{
+		printf("Mesh: %u indices of %u bytes can't index %u vertices as triangles\n", header.index_count, header.index_size, header.vertex_count);
+		return false;
+	}
+
+	// The blocks get read in place, so they have to be aligned for what's in them
+	if (header.vertex_offset % block_alignment != 0 || header.index_offset % block_alignment != 0 || header.meshlet_offset % block_alignment != 0)
+	{
+		printf("Mesh: blocks aren't on %u byte boundaries, the file is corrupt\n", (uint32_t)block_alignment);
+		return false;
+	}
+
+	// Each block has to end before the next one starts and the last inside the file. The sizes are
+	// 32 bit counts times small strides so they can't overflow 64 bits, the offsets are checked by BlockFits
+	bool fits = header.file_size <= size
+		&& header.vertex_offset >= sizeof(MeshFileHeader)
+		&& BlockFits(header.vertex_offset, (uint64_t)header.vertex_count * sizeof(MeshFileVertex), header.index_offset)
+		&& BlockFits(header.index_offset, (uint64_t)header.index_count * header.index_size, header.meshlet_offset)
+		&& BlockFits(header.meshlet_offset, (uint64_t)header.meshlet_count * sizeof(MeshFileMeshlet), header.file_size);
+	if (!fits)
+	{
+		printf("Mesh: blocks don't fit in the file, it's truncated or corrupt\n");
+		return false;
+	}
+
+	// GL doesn't check indices, one past the vertices would read whatever is after the buffer
+	const uint8_t* index_data = (const uint8_t*)data + header.index_offset;
+	uint32_t max_index = 0;
+	if (header.index_size == 2)
+	{
+		const uint16_t* indices = (const uint16_t*)index_data;
+		for (uint32_t i = 0; i < header.index_count; ++i)
+			max_index = indices[i] > max_index ? indices[i] : max_index;
+	}
+	else
+	{
+		const uint32_t* indices = (const uint32_t*)index_data;
+		for (uint32_t i = 0; i < header.index_count; ++i)
+			max_index = indices[i] > max_index ? indices[i] : max_index;
+	}
+	if (header.index_count > 0 && max_index >= header.vertex_count)
+	{
+		printf("Mesh: index %u is past the %u vertices, the file is corrupt\n", max_index, header.vertex_count);
+		return false;
+	}
+	return true;
+}
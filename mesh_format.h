@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Binary mesh files (.hvm)
+//
+// Laid out so a loader can map the file and hand the blocks straight to GL without copying:
+//   MeshFileHeader
+//   vertex_count MeshFileVertex
+//   index_count indices, 16 or 32 bit depending on index_size
+//   meshlet_count MeshFileMeshlet
+// Each block starts on a 16 byte boundary. Everything is little endian.
+//
+// Positions are unorm16 inside the mesh's bounding box, the loader turns them back into
+// model space with the model matrix. Normals are octahedral encoded snorm16.
+// Triangles come grouped by meshlet, so every meshlet is one contiguous range of indices.
+//
+// No GL or glm in here, the offline converter in tools/ builds against it too.
+
+const char mesh_file_magic[4] = { 'H', 'V', 'M', 'S' };
+const uint32_t mesh_file_version = 1;
+
+// Same limits as NV_mesh_shader's recommendation
+const uint32_t meshlet_max_vertices = 64;
+const uint32_t meshlet_max_triangles = 124;
+
+struct MeshFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t index_size;		// bytes per index, 2 or 4
+	uint32_t meshlet_count;
+	float bounds_min[3];		// the box positions are quantised into
+	float bounds_max[3];
+	uint64_t vertex_offset;		// bytes from the start of the file
+	uint64_t index_offset;
+	uint64_t meshlet_offset;
+	uint64_t file_size;
+};
+
+struct MeshFileVertex
+{
+	uint16_t position[3];		// unorm16, 0 is bounds_min and 65535 bounds_max
+	uint16_t padding;
+	int16_t normal[2];			// octahedral, snorm16
+};
+
+struct MeshFileMeshlet
+{
+	uint32_t first_index;
+	uint32_t triangle_count;
+	uint32_t vertex_count;		// unique vertices the triangles use, at most meshlet_max_vertices
+	float centre[3];			// bounding sphere, model space
+	float radius;
+	uint32_t padding;
+};
+
+static_assert(sizeof(MeshFileHeader) == 80, "MeshFileHeader layout changed, bump mesh_file_version");
+static_assert(sizeof(MeshFileVertex) == 12, "MeshFileVertex layout changed, bump mesh_file_version");
+static_assert(sizeof(MeshFileMeshlet) == 32, "MeshFileMeshlet layout changed, bump mesh_file_version");
+
+// Quantise, split into meshlets and lay out a whole file in memory.
+// positions and normals are 3 floats per vertex, pass null normals to have smooth ones worked out
+bool BuildMeshFile(const float* positions, const float* normals, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count, std::vector<uint8_t>& file);
+
+// Checks the header, that every block is aligned and fits inside size bytes and that every index is in range
+// of the vertices. The indices are read through once, the other blocks aren't read at all
+bool ValidateMeshFile(const void* data, uint64_t size);
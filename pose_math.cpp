@@ -0,0 +1,246 @@
+#include "pose_math.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define POSE_MATH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+glm::mat4 ConvertHMDMat4ToGLMMat4(const vr::HmdMatrix44_t& mat)
+{
+	return glm::mat4(
+		mat.m[0][0], mat.m[1][0], mat.m[2][0], mat.m[3][0],
+		mat.m[0][1], mat.m[1][1], mat.m[2][1], mat.m[3][1],
+		mat.m[0][2], mat.m[1][2], mat.m[2][2], mat.m[3][2],
+		mat.m[0][3], mat.m[1][3], mat.m[2][3], mat.m[3][3]
+	);
+}
+
+glm::mat4 ConvertHMDMat3ToGLMMat4(const vr::HmdMatrix34_t& mat)
+{
+	return glm::mat4(
+		mat.m[0][0], mat.m[1][0], mat.m[2][0], 0.0,
+		mat.m[0][1], mat.m[1][1], mat.m[2][1], 0.0,
+		mat.m[0][2], mat.m[1][2], mat.m[2][2], 0.0,
+		mat.m[0][3], mat.m[1][3], mat.m[2][3], 1.0f
+	);
+}
+
+glm::mat4 InvertRigidTransform(const glm::mat4& pose)
+{
+	glm::mat3 rotation = glm::transpose(glm::mat3(pose));
+	glm::vec3 translation = -(rotation * glm::vec3(pose[3]));
+
+	glm::mat4 inverse(rotation);
+	inverse[3] = glm::vec4(translation, 1.0f);
+	return inverse;
+}
+
+void ProcessPosesScalar(const vr::TrackedDevicePose_t* poses, const glm::mat4 eye_projection_from_head[2], PoseStore& store)
+{
+	store.valid_count = 0;
+	for (vr::TrackedDeviceIndex_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+	{
+		store.valid[device] = poses[device].bPoseIsValid;
+		if (!store.valid[device])
+			continue;
+
+		store.device_to_absolute[device] = ConvertHMDMat3ToGLMMat4(poses[device].mDeviceToAbsoluteTracking);
+		store.valid_devices[store.valid_count++] = device;
+	}
+
+	if (store.valid[vr::k_unTrackedDeviceIndex_Hmd])
+	{
+		store.hmd_view = glm::inverse(store.device_to_absolute[vr::k_unTrackedDeviceIndex_Hmd]);
+		store.eye_view_projection[vr::Eye_Left] = eye_projection_from_head[vr::Eye_Left] * store.hmd_view;
+		store.eye_view_projection[vr::Eye_Right] = eye_projection_from_head[vr::Eye_Right] * store.hmd_view;
+	}
+}
+
+#ifdef POSE_MATH_SSE
+
+namespace
+{
+	// out = a * b, all column major
+	inline void MultiplyMat4(const float* a, const float* b, float* out)
+	{
+		__m128 a0 = _mm_loadu_ps(a + 0);
+		__m128 a1 = _mm_loadu_ps(a + 4);
+		__m128 a2 = _mm_loadu_ps(a + 8);
+		__m128 a3 = _mm_loadu_ps(a + 12);
+
+		for (int column = 0; column < 4; ++column)
+		{
+			const float* b_column = b + column * 4;
+			__m128 result = _mm_mul_ps(a0, _mm_set1_ps(b_column[0]));
+			result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(b_column[1])));
+			result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(b_column[2])));
+			result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(b_column[3])));
+			_mm_storeu_ps(out + column * 4, result);
+		}
+	}
+}
+
+void ProcessPoses(const vr::TrackedDevicePose_t* poses, const glm::mat4 eye_projection_from_head[2], PoseStore& store)
+{
+	// The implicit bottom row of every 3x4 pose
+	const __m128 last_row = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+	store.valid_count = 0;
+	for (vr::TrackedDeviceIndex_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+	{
+		store.valid[device] = poses[device].bPoseIsValid;
+		if (!store.valid[device])
+			continue;
+
+		// OpenVR poses are row major 3x4, the transpose of the rows is the column major 4x4
+		const float* rows = &poses[device].mDeviceToAbsoluteTracking.m[0][0];
+		__m128 row0 = _mm_loadu_ps(rows + 0);
+		__m128 row1 = _mm_loadu_ps(rows + 4);
+		__m128 row2 = _mm_loadu_ps(rows + 8);
+		__m128 row3 = last_row;
+		_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+
+		float* out = glm::value_ptr(store.device_to_absolute[device]);
+		_mm_storeu_ps(out + 0, row0);
+		_mm_storeu_ps(out + 4, row1);
+		_mm_storeu_ps(out + 8, row2);
+		_mm_storeu_ps(out + 12, row3);
+
+		store.valid_devices[store.valid_count++] = device;
+	}
+
+	if (!store.valid[vr::k_unTrackedDeviceIndex_Hmd])
+		return;
+
+	// The HMD pose is a rotation R and translation t, so its inverse is R^T and -R^T t.
+	// Column i of R^T is row i of R, which is exactly how OpenVR stores it
+	const float* rows = &poses[vr::k_unTrackedDeviceIndex_Hmd].mDeviceToAbsoluteTracking.m[0][0];
+	const __m128 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 row0 = _mm_loadu_ps(rows + 0);
+	__m128 row1 = _mm_loadu_ps(rows + 4);
+	__m128 row2 = _mm_loadu_ps(rows + 8);
+
+	__m128 translation = _mm_mul_ps(row0, _mm_set1_ps(rows[3]));
+	translation = _mm_add_ps(translation, _mm_mul_ps(row1, _mm_set1_ps(rows[7])));
+	translation = _mm_add_ps(translation, _mm_mul_ps(row2, _mm_set1_ps(rows[11])));
+	translation = _mm_sub_ps(_mm_setzero_ps(), _mm_and_ps(translation, xyz_mask));
+
+	float* view = glm::value_ptr(store.hmd_view);
+	_mm_storeu_ps(view + 0, _mm_and_ps(row0, xyz_mask));
+	_mm_storeu_ps(view + 4, _mm_and_ps(row1, xyz_mask));
+	_mm_storeu_ps(view + 8, _mm_and_ps(row2, xyz_mask));
+	_mm_storeu_ps(view + 12, _mm_or_ps(translation, last_row));
+
+	MultiplyMat4(glm::value_ptr(eye_projection_from_head[vr::Eye_Left]), view, glm::value_ptr(store.eye_view_projection[vr::Eye_Left]));
+	MultiplyMat4(glm::value_ptr(eye_projection_from_head[vr::Eye_Right]), view, glm::value_ptr(store.eye_view_projection[vr::Eye_Right]));
+}
+
+#else
+
+// No SSE on this target, the glm version is the only version
+void ProcessPoses(const vr::TrackedDevicePose_t* poses, const glm::mat4 eye_projection_from_head[2], PoseStore& store)
+{
+	ProcessPosesScalar(poses, eye_projection_from_head, store);
+}
+
+#endif
+
+namespace
+{
+	// A valid pose with a random rotation and position
+	void MakeTestPose(vr::TrackedDevicePose_t& pose, unsigned int seed)
+	{
+		float yaw = (seed * 0.731f), pitch = (seed * 0.377f), roll = (seed * 0.119f);
+		float cy = cosf(yaw), sy = sinf(yaw), cp = cosf(pitch), sp = sinf(pitch), cr = cosf(roll), sr = sinf(roll);
+
+		memset(&pose, 0, sizeof(pose));
+		pose.bPoseIsValid = true;
+		pose.bDeviceIsConnected = true;
+		float (*m)[4] = pose.mDeviceToAbsoluteTracking.m;
+		m[0][0] = cy * cr + sy * sp * sr; m[0][1] = -cy * sr + sy * sp * cr; m[0][2] = sy * cp; m[0][3] = (seed % 7) * 0.3f;
+		m[1][0] = cp * sr;                m[1][1] = cp * cr;                 m[1][2] = -sp;     m[1][3] = 1.0f + (seed % 3) * 0.2f;
+		m[2][0] = -sy * cr + cy * sp * sr; m[2][1] = sy * sr + cy * sp * cr; m[2][2] = cy * cp; m[2][3] = (seed % 5) * -0.4f;
+	}
+
+	float MaxDifference(const glm::mat4& a, const glm::mat4& b)
+	{
+		float difference = 0.0f;
+		for (int column = 0; column < 4; ++column)
+			for (int row = 0; row < 4; ++row)
+				difference = fmaxf(difference, fabsf(a[column][row] - b[column][row]));
+		return difference;
+	}
+
+	// Best of a few runs, in nanoseconds per call
+	template <typename Function>
+	double TimeCalls(Function function, const vr::TrackedDevicePose_t* poses, const glm::mat4* eye_projection_from_head, PoseStore& store, int calls)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 5; ++run)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int call = 0; call < calls; ++call)
+				function(poses, eye_projection_from_head, store);
+			double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+			if (ns < best) best = ns;
+		}
+		return best;
+	}
+}
+
+bool RunPoseBenchmark()
+{
+#ifdef POSE_MATH_SSE
+	printf("Pose benchmark, SSE kernel vs glm\n");
+#else
+	printf("Pose benchmark, no SSE on this target so both paths are glm\n");
+#endif
+
+	glm::mat4 eye_projection_from_head[2];
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		vr::TrackedDevicePose_t pose;
+		MakeTestPose(pose, 100 + eye);
+		eye_projection_from_head[eye] = ConvertHMDMat3ToGLMMat4(pose.mDeviceToAbsoluteTracking);
+		eye_projection_from_head[eye][2][3] = -1.0f;	// something projection shaped
+	}
+
+	static PoseStore simd_store, scalar_store;
+	bool all_match = true;
+
+	// A typical room (HMD, two base stations, two controllers) and a fully loaded one
+	const uint32_t valid_counts[] = { 5, vr::k_unMaxTrackedDeviceCount };
+	for (int test = 0; test < 2; ++test)
+	{
+		vr::TrackedDevicePose_t poses[vr::k_unMaxTrackedDeviceCount];
+		memset(poses, 0, sizeof(poses));
+		for (uint32_t device = 0; device < valid_counts[test]; ++device)
+			MakeTestPose(poses[device], device + 1);
+
+		ProcessPoses(poses, eye_projection_from_head, simd_store);
+		ProcessPosesScalar(poses, eye_projection_from_head, scalar_store);
+
+		float difference = MaxDifference(simd_store.hmd_view, scalar_store.hmd_view);
+		for (int eye = 0; eye < 2; ++eye)
+			difference = fmaxf(difference, MaxDifference(simd_store.eye_view_projection[eye], scalar_store.eye_view_projection[eye]));
+		for (uint32_t device = 0; device < valid_counts[test]; ++device)
+			difference = fmaxf(difference, MaxDifference(simd_store.device_to_absolute[device], scalar_store.device_to_absolute[device]));
+		bool match = difference < 1e-4f && simd_store.valid_count == scalar_store.valid_count;
+		all_match = all_match && match;
+
+		const int calls = 200000;
+		double simd_ns = TimeCalls(ProcessPoses, poses, eye_projection_from_head, simd_store, calls);
+		double scalar_ns = TimeCalls(ProcessPosesScalar, poses, eye_projection_from_head, scalar_store, calls);
+		printf("  %2u valid poses: kernel %8.1f ns, glm %8.1f ns, %.2fx, max difference %g%s\n",
+			valid_counts[test], simd_ns, scalar_ns, scalar_ns / simd_ns, difference, match ? "" : " MISMATCH");
+	}
+
+	return all_match;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <openvr.h>
+
+// Everything derived from one WaitGetPoses call, kept as separate arrays rather than
+// one struct per device so the conversion kernel can stream straight through them
+struct PoseStore
+{
+	// Indexed by tracked device, only meaningful where valid[device] is set
+	glm::mat4 device_to_absolute[vr::k_unMaxTrackedDeviceCount];
+	bool valid[vr::k_unMaxTrackedDeviceCount];
+
+	// The devices that had a valid pose, in index order
+	vr::TrackedDeviceIndex_t valid_devices[vr::k_unMaxTrackedDeviceCount];
+	uint32_t valid_count;
+
+	// Absolute tracking space to head space, the inverse of the HMD's pose.
+	// Left alone when the HMD pose isn't valid so the last good view sticks
+	glm::mat4 hmd_view;
+
+	// projection * eye_to_head * hmd_view, for vr::Eye_Left and vr::Eye_Right
+	glm::mat4 eye_view_projection[2];
+};
+
+glm::mat4 ConvertHMDMat4ToGLMMat4(const vr::HmdMatrix44_t& mat);
+glm::mat4 ConvertHMDMat3ToGLMMat4(const vr::HmdMatrix34_t& mat);
+
+// Inverse of a pose that's only a rotation and a translation, the rotation transposed and the
+// translation rotated back. What ProcessPoses does for the HMD, without a general inverse
+glm::mat4 InvertRigidTransform(const glm::mat4& pose);
+
+// Fill in the pose store from a full array of k_unMaxTrackedDeviceCount poses.
+// eye_projection_from_head is projection * eye_to_head for each eye, these don't change so
+// the caller works them out once.
+//
+// Uses SSE when the compiler targets it: every valid 3x4 pose is transposed straight into
+// a column major 4x4, the HMD is inverted as a rigid transform (rotation transposed,
+// translation rotated back) and both eye matrices come out of the same pass.
+void ProcessPoses(const vr::TrackedDevicePose_t* poses, const glm::mat4 eye_projection_from_head[2], PoseStore& store);
+
+// The same thing done one matrix at a time with glm and a general inverse, for comparison
+void ProcessPosesScalar(const vr::TrackedDevicePose_t* poses, const glm::mat4 eye_projection_from_head[2], PoseStore& store);
+
+// Times ProcessPoses against ProcessPosesScalar and checks they agree, returns false if they don't
+bool RunPoseBenchmark();
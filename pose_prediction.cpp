@@ -0,0 +1,234 @@
+#include "pose_prediction.h"
+#include "pose_math.h"
+#include "vr_backend.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const int history_size = 4;
+
+	struct PoseSample
+	{
+		Clock::time_point photon_time;		// when the pose was predicted for
+		vr::HmdMatrix34_t device_to_absolute;
+		glm::vec3 velocity;					// metres per second, tracking space
+		glm::vec3 angular_velocity;			// radians per second, tracking space
+	};
+
+	VRBackend* backend = nullptr;
+	float frame_duration = 1.0f / 90.0f;
+	float vsync_to_photons = 0.0f;
+
+	// Newest sample for a device is at (history_count - 1) % history_size
+	PoseSample history[vr::k_unMaxTrackedDeviceCount][history_size];
+	uint64_t history_count[vr::k_unMaxTrackedDeviceCount];
+
+	// This frame, as of WaitGetPoses
+	Clock::time_point frame_pose_time;
+	uint64_t frame_vsync = 0;
+	bool frame_has_poses = false;
+
+	uint64_t frames = 0;
+	uint64_t latches = 0;
+	uint64_t extrapolated = 0;
+	uint64_t age_removed_count = 0;
+	double age_removed_total_ms = 0.0;
+	double age_removed_max_ms = 0.0;
+
+	glm::vec3 Position(const vr::HmdMatrix34_t& mat)
+	{
+		return glm::vec3(mat.m[0][3], mat.m[1][3], mat.m[2][3]);
+	}
+
+	// The rotation that takes from to to, as an axis scaled by its angle
+	glm::vec3 RotationBetween(const vr::HmdMatrix34_t& from, const vr::HmdMatrix34_t& to)
+	{
+		// delta = to * from^T
+		float delta[3][3];
+		for (int row = 0; row < 3; ++row)
+			for (int column = 0; column < 3; ++column)
+				delta[row][column] = to.m[row][0] * from.m[column][0] + to.m[row][1] * from.m[column][1] + to.m[row][2] * from.m[column][2];
+
+		float cos_angle = (delta[0][0] + delta[1][1] + delta[2][2] - 1.0f) * 0.5f;
+		float angle = acosf(cos_angle < -1.0f ? -1.0f : (cos_angle > 1.0f ? 1.0f : cos_angle));
+		glm::vec3 axis(delta[2][1] - delta[1][2], delta[0][2] - delta[2][0], delta[1][0] - delta[0][1]);
+		float axis_length = glm::length(axis);
+		if (axis_length < 1e-6f)
+			return glm::vec3(0.0f);
+
+		return axis * (angle / axis_length);
+	}
+
+	// Move a pose along its velocities for seconds, rotation is applied in tracking space
+	void Extrapolate(const PoseSample& sample, float seconds, vr::HmdMatrix34_t& out)
+	{
+		out = sample.device_to_absolute;
+
+		glm::vec3 rotation = sample.angular_velocity * seconds;
+		float angle = glm::length(rotation);
+		if (angle > 1e-6f)
+		{
+			// Rodrigues, R = I + sin(a) K + (1 - cos(a)) K^2 for the unit axis k
+			glm::vec3 k = rotation / angle;
+			float s = sinf(angle), c = 1.0f - cosf(angle);
+			float r[3][3] =
+			{
+				{ 1.0f - c * (k.y * k.y + k.z * k.z), -s * k.z + c * k.x * k.y, s * k.y + c * k.x * k.z },
+				{ s * k.z + c * k.x * k.y, 1.0f - c * (k.x * k.x + k.z * k.z), -s * k.x + c * k.y * k.z },
+				{ -s * k.y + c * k.x * k.z, s * k.x + c * k.y * k.z, 1.0f - c * (k.x * k.x + k.y * k.y) }
+			};
+
+			for (int row = 0; row < 3; ++row)
+				for (int column = 0; column < 3; ++column)
+					out.m[row][column] = r[row][0] * sample.device_to_absolute.m[0][column] + r[row][1] * sample.device_to_absolute.m[1][column] + r[row][2] * sample.device_to_absolute.m[2][column];
+		}
+
+		glm::vec3 position = Position(sample.device_to_absolute) + sample.velocity * seconds;
+		out.m[0][3] = position.x;
+		out.m[1][3] = position.y;
+		out.m[2][3] = position.z;
+	}
+
+	// Seconds from now until this frame is on the display, keeps counting from the vsync
+	// WaitGetPoses returned after even if rendering has run over into the next one
+	float SecondsToPhotons()
+	{
+		float since_vsync = 0.0f;
+		uint64_t vsync = frame_vsync;
+		if (!backend->GetTimeSinceLastVsync(&since_vsync, &vsync))
+			return frame_duration + vsync_to_photons;
+
+		float seconds = (float)((int64_t)(frame_vsync + 1) - (int64_t)vsync) * frame_duration - since_vsync + vsync_to_photons;
+		return seconds > 0.0f ? seconds : 0.0f;
+	}
+
+	Clock::time_point After(Clock::time_point time, float seconds)
+	{
+		return time + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(seconds));
+	}
+}
+
+void PosePredictionInit(VRBackend* vr_backend)
+{
+	backend = vr_backend;
+	memset(history_count, 0, sizeof(history_count));
+
+	vr::TrackedPropertyError error = vr::TrackedProp_Success;
+	float display_frequency = backend->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float, &error);
+	if (error == vr::TrackedProp_Success && display_frequency > 0.0f)
+		frame_duration = 1.0f / display_frequency;
+
+	vsync_to_photons = backend->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SecondsFromVsyncToPhotons_Float, &error);
+	if (error != vr::TrackedProp_Success)
+		vsync_to_photons = 0.0f;
+}
+
+void PosePredictionAddPoses(const vr::TrackedDevicePose_t* poses)
+{
+	frame_pose_time = Clock::now();
+	frame_vsync = 0;
+	float since_vsync = 0.0f;
+	backend->GetTimeSinceLastVsync(&since_vsync, &frame_vsync);
+	Clock::time_point photon_time = After(frame_pose_time, SecondsToPhotons());
+
+	frame_has_poses = poses[vr::k_unTrackedDeviceIndex_Hmd].bPoseIsValid;
+	frames += 1;
+
+	for (vr::TrackedDeviceIndex_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+	{
+		const vr::TrackedDevicePose_t& pose = poses[device];
+		if (!pose.bPoseIsValid)
+			continue;
+
+		PoseSample& sample = history[device][history_count[device] % history_size];
+		sample.photon_time = photon_time;
+		sample.device_to_absolute = pose.mDeviceToAbsoluteTracking;
+		sample.velocity = glm::vec3(pose.vVelocity.v[0], pose.vVelocity.v[1], pose.vVelocity.v[2]);
+		sample.angular_velocity = glm::vec3(pose.vAngularVelocity.v[0], pose.vAngularVelocity.v[1], pose.vAngularVelocity.v[2]);
+
+		// Not every driver reports velocities, work them out from the previous sample instead
+		bool has_velocity = glm::length(sample.velocity) > 0.0f || glm::length(sample.angular_velocity) > 0.0f;
+		if (!has_velocity && history_count[device] > 0)
+		{
+			const PoseSample& previous = history[device][(history_count[device] - 1) % history_size];
+			float seconds = std::chrono::duration<float>(sample.photon_time - previous.photon_time).count();
+			if (seconds > 0.0f)
+			{
+				sample.velocity = (Position(sample.device_to_absolute) - Position(previous.device_to_absolute)) / seconds;
+				sample.angular_velocity = RotationBetween(previous.device_to_absolute, sample.device_to_absolute) / seconds;
+			}
+		}
+
+		history_count[device] += 1;
+	}
+}
+
+bool PosePredictionLatchHMD(glm::mat4& device_to_absolute)
+{
+	const vr::TrackedDeviceIndex_t hmd = vr::k_unTrackedDeviceIndex_Hmd;
+	if (history_count[hmd] == 0)
+		return false;
+
+	Clock::time_point now = Clock::now();
+	float seconds_to_photons = SecondsToPhotons();
+
+	vr::TrackedDevicePose_t pose;
+	backend->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, seconds_to_photons, &pose, 1);
+	latches += 1;
+
+	if (pose.bPoseIsValid)
+	{
+		device_to_absolute = ConvertHMDMat3ToGLMMat4(pose.mDeviceToAbsoluteTracking);
+
+		// Only counts when this frame's WaitGetPoses pose is what got replaced
+		if (frame_has_poses)
+		{
+			double age_removed_ms = std::chrono::duration<double, std::milli>(now - frame_pose_time).count();
+			age_removed_total_ms += age_removed_ms;
+			age_removed_count += 1;
+			if (age_removed_ms > age_removed_max_ms) age_removed_max_ms = age_removed_ms;
+		}
+		return true;
+	}
+
+	// Tracking dropped out, carry the last good pose on to this frame's photon time
+	const PoseSample& newest = history[hmd][(history_count[hmd] - 1) % history_size];
+	float seconds = std::chrono::duration<float>(After(now, seconds_to_photons) - newest.photon_time).count();
+	vr::HmdMatrix34_t extrapolated_pose;
+	Extrapolate(newest, seconds, extrapolated_pose);
+	device_to_absolute = ConvertHMDMat3ToGLMMat4(extrapolated_pose);
+	extrapolated += 1;
+	return true;
+}
+
+void PosePredictionPredictNextFrame(vr::TrackedDevicePose_t* poses)
+{
+	// The frame rendering now shows one frame after the vsync its WaitGetPoses returned in, the
+	// next one a frame after that. Counted from the current vsync since this frame's isn't safe to read here
+	float since_vsync = 0.0f;
+	float seconds_to_photons = 2.0f * frame_duration + vsync_to_photons;
+	if (backend->GetTimeSinceLastVsync(&since_vsync, nullptr))
+		seconds_to_photons -= since_vsync;
+
+	backend->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, seconds_to_photons, poses, vr::k_unMaxTrackedDeviceCount);
+}
+
+void PosePredictionPrintStats()
+{
+	if (latches == 0)
+		return;
+
+	printf("Pose prediction: %llu latches over %llu frames, %llu extrapolated\n",
+		(unsigned long long)latches, (unsigned long long)frames, (unsigned long long)extrapolated);
+	if (age_removed_count > 0)
+	{
+		printf("  late latching removed avg %.3f ms of pose age per frame (max %.3f ms)\n",
+			age_removed_total_ms / age_removed_count, age_removed_max_ms);
+	}
+}
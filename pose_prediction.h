@@ -0,0 +1,34 @@
+#pragma once
+
+#include <openvr.h>
+#include <glm/glm.hpp>
+
+class VRBackend;
+
+// Late latching of the HMD pose
+//
+// WaitGetPoses() hands out poses at the top of the frame, but an eye's draws only get
+// issued some milliseconds later. PosePredictionLatchHMD() asks the runtime again, just
+// before the draws, for the pose predicted to the same photon time, so the view matrix is
+// built from younger tracking data. If the runtime can't give a valid pose the newest good
+// one is extrapolated to that time with its linear and angular velocity.
+//
+// A short history of samples is kept per device. Velocities come from the runtime when it
+// reports them and from the last two samples when it doesn't.
+
+void PosePredictionInit(VRBackend* backend);
+
+// Call straight after WaitGetPoses() with everything it returned
+void PosePredictionAddPoses(const vr::TrackedDevicePose_t* poses);
+
+// The HMD pose for this frame's photon time, as fresh as it can be had.
+// False if there has never been a valid HMD pose
+bool PosePredictionLatchHMD(glm::mat4& device_to_absolute);
+
+// Every device's pose predicted to when the frame after this one will be on the display, for
+// preparing that frame while this one renders. Only asks the runtime, so it can be called from
+// another thread than the rest of these
+void PosePredictionPredictNextFrame(vr::TrackedDevicePose_t* poses);
+
+// How much pose age late latching removed, and how often it had to fall back to extrapolating
+void PosePredictionPrintStats();
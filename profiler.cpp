@@ -0,0 +1,775 @@
+#include "profiler.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	const char* stage_names[ProfileStage_Count] =
+	{
+		"pose_wait",
+		"cull",
+		"animate",
+		"controller_geometry",
+		"debug_geometry",
+		"texture_upload",
+		"instance_upload",
+		"render_left",
+		"resolve_left",
+		"render_right",
+		"resolve_right",
+		"render_stereo",
+		"resolve_stereo",
+		"submit",
+		"companion"
+	};
+
+	const char* counter_names[ProfileCounter_Count] =
+	{
+		"objects_visible",
+		"objects_culled",
+		"resolution_scale",
+		"samples_passed",
+		"update_overlap",
+		"texture_upload_bytes",
+		"gl_calls_issued",
+		"gl_calls_elided",
+		"missed_vsyncs",
+		"motion_to_photon_us"
+	};
+}
+
+const char* GetProfileStageName(ProfileStage stage)
+{
+	return stage >= 0 && stage < ProfileStage_Count ? stage_names[stage] : "unknown";
+}
+
+const char* GetProfileCounterName(ProfileCounter counter)
+{
+	return counter >= 0 && counter < ProfileCounter_Count ? counter_names[counter] : "unknown";
+}
+
+#ifndef DISABLE_PROFILER
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// GPU results normally come back one or two frames later,
+	// if a slot still isn't ready after this many frames its GPU times are dropped
+	const int gpu_frames_in_flight = 4;
+
+	// GL_SAMPLES_PASSED queries can't nest or overlap, so a frame's sample count is the sum of a few separate spans
+	const int max_sample_spans = 8;
+
+	// How far the ahead thread can get in front, a frame's ahead record is reused this many frames later
+	const int ahead_record_count = 4;
+
+	struct FrameRecord
+	{
+		uint64_t frame_index;
+		double start_ms;							// since ProfilerInit
+		float cpu_ms;								// the whole frame
+		float ahead_start_ms;						// since the start of the frame, negative, when its update started on the ahead thread
+		float ahead_ms;								// -1 if there wasn't one
+		bool cpu_stage_ran[ProfileStage_Count];
+		bool cpu_stage_ahead[ProfileStage_Count];		// ran on the ahead thread
+		float cpu_stage_start_ms[ProfileStage_Count];	// since the start of the frame, negative if it ran ahead
+		float cpu_stage_ms[ProfileStage_Count];
+		float gpu_stage_start_ms[ProfileStage_Count];	// since ProfilerInit, on the CPU's timeline
+		float gpu_stage_ms[ProfileStage_Count];			// -1 if not measured
+		float counters[ProfileCounter_Count];
+		bool counter_set[ProfileCounter_Count];
+	};
+
+	// What the ahead thread recorded for a frame the frame thread hasn't begun yet
+	struct AheadRecord
+	{
+		uint64_t frame_index;
+		bool complete;
+		double start_ms;							// since ProfilerInit
+		double end_ms;
+		bool stage_ran[ProfileStage_Count];
+		float stage_start_ms[ProfileStage_Count];		// since start_ms
+		float stage_ms[ProfileStage_Count];
+		float counters[ProfileCounter_Count];
+		bool counter_set[ProfileCounter_Count];
+	};
+
+	FrameRecord history[profiler_history_size];
+	uint64_t frames_begun = 0;
+	uint64_t frames_completed = 0;
+	bool in_frame = false;
+
+	Clock::time_point epoch;
+	Clock::time_point frame_start;
+	Clock::time_point stage_start[ProfileStage_Count];
+
+	// Only the ahead thread touches these, except for records it has completed
+	bool ahead_thread_set = false;
+	std::thread::id ahead_thread;
+	AheadRecord ahead_records[ahead_record_count];
+	AheadRecord* ahead_record = nullptr;		// the frame being prepared, null outside of one
+	Clock::time_point ahead_frame_start;
+	Clock::time_point ahead_stage_start[ProfileStage_Count];
+
+	bool gpu_enabled = false;
+	GLint64 gpu_epoch_ns = 0;		// GL_TIMESTAMP at the same moment as epoch
+	GLuint gpu_queries[gpu_frames_in_flight][ProfileStage_Count][2];
+	bool gpu_query_used[gpu_frames_in_flight][ProfileStage_Count];
+	bool gpu_slot_pending[gpu_frames_in_flight];
+	uint64_t gpu_slot_frame[gpu_frames_in_flight];
+	GLuint gpu_sample_queries[gpu_frames_in_flight][max_sample_spans];
+	int gpu_sample_spans[gpu_frames_in_flight];
+	bool sample_span_open = false;
+	uint64_t gpu_frames_dropped = 0;
+
+	// Summaries sort into here so they don't need to allocate
+	float scratch[profiler_history_size];
+
+	double MillisecondsSince(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	FrameRecord& RecordForFrame(uint64_t frame)
+	{
+		return history[frame % profiler_history_size];
+	}
+
+	bool OnAheadThread()
+	{
+		return ahead_thread_set && std::this_thread::get_id() == ahead_thread;
+	}
+
+	// Fold what the ahead thread recorded for the frame being ended into its record
+	void MergeAheadRecord(FrameRecord& record)
+	{
+		const AheadRecord& ahead = ahead_records[record.frame_index % ahead_record_count];
+		if (!ahead.complete || ahead.frame_index != record.frame_index)
+			return;
+
+		record.ahead_start_ms = (float)(ahead.start_ms - record.start_ms);
+		record.ahead_ms = (float)(ahead.end_ms - ahead.start_ms);
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		{
+			if (!ahead.stage_ran[stage])
+				continue;
+			record.cpu_stage_ran[stage] = true;
+			record.cpu_stage_ahead[stage] = true;
+			record.cpu_stage_start_ms[stage] = record.ahead_start_ms + ahead.stage_start_ms[stage];
+			record.cpu_stage_ms[stage] = ahead.stage_ms[stage];
+		}
+		for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+		{
+			if (!ahead.counter_set[counter])
+				continue;
+			record.counters[counter] = ahead.counters[counter];
+			record.counter_set[counter] = true;
+		}
+
+		// How much of the update happened while the previous frame was still going
+		if (record.frame_index > 0 && record.ahead_ms > 0.0f)
+		{
+			const FrameRecord& previous = RecordForFrame(record.frame_index - 1);
+			double overlap_start = std::max(ahead.start_ms, previous.start_ms);
+			double overlap_end = std::min(ahead.end_ms, previous.start_ms + previous.cpu_ms);
+			double overlap_ms = std::max(0.0, overlap_end - overlap_start);
+			record.counters[ProfileCounter_UpdateOverlap] = (float)(overlap_ms * 100.0 / record.ahead_ms);
+			record.counter_set[ProfileCounter_UpdateOverlap] = true;
+		}
+	}
+
+	// Read back a slot's queries if the GPU has finished with all of them, never blocks
+	bool CollectGpuSlot(int slot)
+	{
+		if (!gpu_slot_pending[slot])
+			return true;
+
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		{
+			if (!gpu_query_used[slot][stage])
+				continue;
+
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(gpu_queries[slot][stage][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available != GL_TRUE)
+				return false;
+		}
+
+		FrameRecord& record = RecordForFrame(gpu_slot_frame[slot]);
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		{
+			if (!gpu_query_used[slot][stage])
+				continue;
+
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(gpu_queries[slot][stage][0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(gpu_queries[slot][stage][1], GL_QUERY_RESULT, &end);
+			record.gpu_stage_start_ms[stage] = (float)((GLint64)begin - gpu_epoch_ns) * 1e-6f;
+			record.gpu_stage_ms[stage] = (float)(end - begin) * 1e-6f;
+		}
+
+		if (gpu_sample_spans[slot] > 0)
+		{
+			// Queries finish in order, the last span being ready means they all are
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(gpu_sample_queries[slot][gpu_sample_spans[slot] - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available != GL_TRUE)
+				return false;
+
+			GLuint64 samples = 0;
+			for (int span = 0; span < gpu_sample_spans[slot]; ++span)
+			{
+				GLuint64 span_samples = 0;
+				glGetQueryObjectui64v(gpu_sample_queries[slot][span], GL_QUERY_RESULT, &span_samples);
+				samples += span_samples;
+			}
+			record.counters[ProfileCounter_SamplesPassed] = (float)samples;
+			record.counter_set[ProfileCounter_SamplesPassed] = true;
+		}
+
+		gpu_slot_pending[slot] = false;
+		return true;
+	}
+
+	// Copy one stage's times from the history into scratch, returns how many there were
+	int GatherStage(int stage, bool gpu)
+	{
+		uint64_t count = std::min<uint64_t>(frames_completed, profiler_history_size);
+		int gathered = 0;
+		for (uint64_t frame = frames_completed - count; frame < frames_completed; ++frame)
+		{
+			const FrameRecord& record = RecordForFrame(frame);
+			float ms = gpu ? record.gpu_stage_ms[stage] : record.cpu_stage_ms[stage];
+			if (ms >= 0.0f && (gpu || record.cpu_stage_ran[stage]))
+				scratch[gathered++] = ms;
+		}
+		return gathered;
+	}
+
+	int GatherCounter(int counter)
+	{
+		uint64_t count = std::min<uint64_t>(frames_completed, profiler_history_size);
+		int gathered = 0;
+		for (uint64_t frame = frames_completed - count; frame < frames_completed; ++frame)
+		{
+			const FrameRecord& record = RecordForFrame(frame);
+			if (record.counter_set[counter])
+				scratch[gathered++] = record.counters[counter];
+		}
+		return gathered;
+	}
+
+	int GatherFrames()
+	{
+		uint64_t count = std::min<uint64_t>(frames_completed, profiler_history_size);
+		int gathered = 0;
+		for (uint64_t frame = frames_completed - count; frame < frames_completed; ++frame)
+			scratch[gathered++] = RecordForFrame(frame).cpu_ms;
+		return gathered;
+	}
+
+	// Reorders values
+	float Percentile(float* values, int count, float p)
+	{
+		int index = (int)(p * (count - 1) + 0.5f);
+		std::nth_element(values, values + index, values + count);
+		return values[index];
+	}
+
+	struct Percentiles
+	{
+		int count;
+		float p50, p95, p99;
+	};
+
+	Percentiles Summarise(int count)
+	{
+		Percentiles result = { count, 0.0f, 0.0f, 0.0f };
+		if (count > 0)
+		{
+			result.p50 = Percentile(scratch, count, 0.50f);
+			result.p95 = Percentile(scratch, count, 0.95f);
+			result.p99 = Percentile(scratch, count, 0.99f);
+		}
+		return result;
+	}
+}
+
+void ProfilerInit(bool gpu_timing)
+{
+	memset(history, 0, sizeof(history));
+	memset(ahead_records, 0, sizeof(ahead_records));
+	frames_begun = 0;
+	frames_completed = 0;
+	in_frame = false;
+	epoch = Clock::now();
+
+	gpu_enabled = gpu_timing;
+	if (gpu_enabled)
+	{
+		glGenQueries(gpu_frames_in_flight * ProfileStage_Count * 2, &gpu_queries[0][0][0]);
+		glGenQueries(gpu_frames_in_flight * max_sample_spans, &gpu_sample_queries[0][0]);
+		glGetInteger64v(GL_TIMESTAMP, &gpu_epoch_ns);
+		memset(gpu_query_used, 0, sizeof(gpu_query_used));
+		memset(gpu_slot_pending, 0, sizeof(gpu_slot_pending));
+		memset(gpu_sample_spans, 0, sizeof(gpu_sample_spans));
+		sample_span_open = false;
+	}
+}
+
+void ProfilerShutdown()
+{
+	if (gpu_enabled)
+	{
+		glDeleteQueries(gpu_frames_in_flight * ProfileStage_Count * 2, &gpu_queries[0][0][0]);
+		glDeleteQueries(gpu_frames_in_flight * max_sample_spans, &gpu_sample_queries[0][0]);
+		gpu_enabled = false;
+	}
+
+	if (gpu_frames_dropped > 0)
+	{
+		printf("Profiler: GPU times for %llu frames were not ready in time and were dropped\n", (unsigned long long)gpu_frames_dropped);
+	}
+}
+
+void ProfilerBeginFrame()
+{
+	frame_start = Clock::now();
+	in_frame = true;
+
+	FrameRecord& record = RecordForFrame(frames_begun);
+	record.frame_index = frames_begun;
+	record.start_ms = MillisecondsSince(epoch, frame_start);
+	record.cpu_ms = 0.0f;
+	record.ahead_start_ms = 0.0f;
+	record.ahead_ms = -1.0f;
+	for (int stage = 0; stage < ProfileStage_Count; ++stage)
+	{
+		record.cpu_stage_ran[stage] = false;
+		record.cpu_stage_ahead[stage] = false;
+		record.cpu_stage_start_ms[stage] = 0.0f;
+		record.cpu_stage_ms[stage] = 0.0f;
+		record.gpu_stage_start_ms[stage] = -1.0f;
+		record.gpu_stage_ms[stage] = -1.0f;
+	}
+	for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+	{
+		record.counters[counter] = 0.0f;
+		record.counter_set[counter] = false;
+	}
+
+	if (gpu_enabled)
+	{
+		// Pick up whatever earlier frames the GPU has finished with
+		for (int slot = 0; slot < gpu_frames_in_flight; ++slot)
+			CollectGpuSlot(slot);
+
+		// This frame's slot is still busy from gpu_frames_in_flight frames ago, give up on those results
+		int slot = (int)(frames_begun % gpu_frames_in_flight);
+		if (gpu_slot_pending[slot])
+		{
+			gpu_slot_pending[slot] = false;
+			gpu_frames_dropped += 1;
+		}
+
+		gpu_slot_frame[slot] = frames_begun;
+		memset(gpu_query_used[slot], 0, sizeof(gpu_query_used[slot]));
+		gpu_sample_spans[slot] = 0;
+	}
+}
+
+void ProfilerEndFrame()
+{
+	if (!in_frame)
+		return;
+
+	FrameRecord& record = RecordForFrame(frames_begun);
+	record.cpu_ms = (float)MillisecondsSince(frame_start, Clock::now());
+	if (ahead_thread_set)
+		MergeAheadRecord(record);
+
+	if (gpu_enabled)
+	{
+		int slot = (int)(frames_begun % gpu_frames_in_flight);
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+			gpu_slot_pending[slot] = gpu_slot_pending[slot] || gpu_query_used[slot][stage];
+		gpu_slot_pending[slot] = gpu_slot_pending[slot] || gpu_sample_spans[slot] > 0;
+	}
+
+	frames_begun += 1;
+	frames_completed = frames_begun;
+	in_frame = false;
+}
+
+void ProfilerBeginStage(ProfileStage stage)
+{
+	if (OnAheadThread())
+	{
+		if (ahead_record == nullptr)
+			return;
+
+		ahead_stage_start[stage] = Clock::now();
+		if (!ahead_record->stage_ran[stage])
+		{
+			ahead_record->stage_ran[stage] = true;
+			ahead_record->stage_start_ms[stage] = (float)MillisecondsSince(ahead_frame_start, ahead_stage_start[stage]);
+		}
+		return;
+	}
+
+	if (!in_frame)
+		return;
+
+	stage_start[stage] = Clock::now();
+
+	FrameRecord& record = RecordForFrame(frames_begun);
+	if (!record.cpu_stage_ran[stage])
+	{
+		record.cpu_stage_ran[stage] = true;
+		record.cpu_stage_start_ms[stage] = (float)MillisecondsSince(frame_start, stage_start[stage]);
+	}
+
+	// A stage that runs more than once in a frame gets one GPU span from its first begin to its last end
+	if (gpu_enabled)
+	{
+		int slot = (int)(frames_begun % gpu_frames_in_flight);
+		if (!gpu_query_used[slot][stage])
+		{
+			glQueryCounter(gpu_queries[slot][stage][0], GL_TIMESTAMP);
+			gpu_query_used[slot][stage] = true;
+		}
+	}
+}
+
+void ProfilerEndStage(ProfileStage stage)
+{
+	if (OnAheadThread())
+	{
+		if (ahead_record != nullptr)
+			ahead_record->stage_ms[stage] += (float)MillisecondsSince(ahead_stage_start[stage], Clock::now());
+		return;
+	}
+
+	if (!in_frame)
+		return;
+
+	FrameRecord& record = RecordForFrame(frames_begun);
+	record.cpu_stage_ms[stage] += (float)MillisecondsSince(stage_start[stage], Clock::now());
+
+	if (gpu_enabled)
+	{
+		int slot = (int)(frames_begun % gpu_frames_in_flight);
+		glQueryCounter(gpu_queries[slot][stage][1], GL_TIMESTAMP);
+	}
+}
+
+void ProfilerBeginSampleCount()
+{
+	if (!in_frame || !gpu_enabled || sample_span_open)
+		return;
+
+	int slot = (int)(frames_begun % gpu_frames_in_flight);
+	if (gpu_sample_spans[slot] >= max_sample_spans)
+		return;
+
+	glBeginQuery(GL_SAMPLES_PASSED, gpu_sample_queries[slot][gpu_sample_spans[slot]++]);
+	sample_span_open = true;
+}
+
+void ProfilerEndSampleCount()
+{
+	if (!sample_span_open)
+		return;
+
+	glEndQuery(GL_SAMPLES_PASSED);
+	sample_span_open = false;
+}
+
+void ProfilerSetCounter(ProfileCounter counter, float value)
+{
+	if (OnAheadThread())
+	{
+		if (ahead_record != nullptr)
+		{
+			ahead_record->counters[counter] = value;
+			ahead_record->counter_set[counter] = true;
+		}
+		return;
+	}
+
+	if (!in_frame)
+		return;
+
+	FrameRecord& record = RecordForFrame(frames_begun);
+	record.counters[counter] = value;
+	record.counter_set[counter] = true;
+}
+
+void ProfilerSetAheadThread()
+{
+	ahead_thread = std::this_thread::get_id();
+	ahead_thread_set = true;
+}
+
+void ProfilerBeginAheadFrame(unsigned long long frame)
+{
+	if (!OnAheadThread())
+		return;
+
+	ahead_frame_start = Clock::now();
+	ahead_record = &ahead_records[frame % ahead_record_count];
+	memset(ahead_record, 0, sizeof(*ahead_record));
+	ahead_record->frame_index = frame;
+	ahead_record->start_ms = MillisecondsSince(epoch, ahead_frame_start);
+}
+
+void ProfilerEndAheadFrame()
+{
+	if (!OnAheadThread() || ahead_record == nullptr)
+		return;
+
+	ahead_record->end_ms = MillisecondsSince(epoch, Clock::now());
+	ahead_record->complete = true;
+	ahead_record = nullptr;
+}
+
+void ProfilerPrintSummary()
+{
+	if (frames_completed == 0)
+		return;
+
+	// GPU results for the last few frames won't be in yet, this is the last chance to get them
+	if (gpu_enabled)
+	{
+		glFinish();
+		for (int slot = 0; slot < gpu_frames_in_flight; ++slot)
+			CollectGpuSlot(slot);
+	}
+
+	Percentiles frame = Summarise(GatherFrames());
+	printf("Profile over the last %d frames (ms)      p50      p95      p99\n", frame.count);
+	printf("  %-20s cpu      %8.3f %8.3f %8.3f\n", "frame", frame.p50, frame.p95, frame.p99);
+
+	for (int stage = 0; stage < ProfileStage_Count; ++stage)
+	{
+		Percentiles cpu = Summarise(GatherStage(stage, false));
+		if (cpu.count == 0)
+			continue;
+		printf("  %-20s cpu      %8.3f %8.3f %8.3f\n", stage_names[stage], cpu.p50, cpu.p95, cpu.p99);
+
+		Percentiles gpu = Summarise(GatherStage(stage, true));
+		if (gpu.count > 0)
+			printf("  %-20s gpu      %8.3f %8.3f %8.3f\n", "", gpu.p50, gpu.p95, gpu.p99);
+	}
+
+	for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+	{
+		Percentiles values = Summarise(GatherCounter(counter));
+		if (values.count > 0)
+			printf("  %-20s count    %8.0f %8.0f %8.0f\n", counter_names[counter], values.p50, values.p95, values.p99);
+	}
+}
+
+bool ProfilerExportCSV(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+	{
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "frame,start_ms,frame_cpu_ms");
+	for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		fprintf(file, ",%s_cpu_ms,%s_gpu_ms", stage_names[stage], stage_names[stage]);
+	for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+		fprintf(file, ",%s", counter_names[counter]);
+	fprintf(file, "\n");
+
+	uint64_t count = std::min<uint64_t>(frames_completed, profiler_history_size);
+	for (uint64_t frame = frames_completed - count; frame < frames_completed; ++frame)
+	{
+		const FrameRecord& record = RecordForFrame(frame);
+		fprintf(file, "%llu,%.4f,%.4f", (unsigned long long)record.frame_index, record.start_ms, record.cpu_ms);
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		{
+			// Empty cells for stages that didn't run or GPU times that never came back
+			if (record.cpu_stage_ran[stage]) fprintf(file, ",%.4f", record.cpu_stage_ms[stage]);
+			else fprintf(file, ",");
+			if (record.gpu_stage_ms[stage] >= 0.0f) fprintf(file, ",%.4f", record.gpu_stage_ms[stage]);
+			else fprintf(file, ",");
+		}
+		for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+		{
+			if (record.counter_set[counter]) fprintf(file, ",%.0f", record.counters[counter]);
+			else fprintf(file, ",");
+		}
+		fprintf(file, "\n");
+	}
+
+	fclose(file);
+	printf("Wrote profile to %s\n", path);
+	return true;
+}
+
+bool ProfilerExportJSON(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+	{
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	Percentiles frame = Summarise(GatherFrames());
+	fprintf(file, "{\n  \"frame_count\": %d,\n", frame.count);
+	fprintf(file, "  \"frame\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f },\n", frame.p50, frame.p95, frame.p99);
+
+	fprintf(file, "  \"stages\": {");
+	bool first_stage = true;
+	for (int stage = 0; stage < ProfileStage_Count; ++stage)
+	{
+		Percentiles cpu = Summarise(GatherStage(stage, false));
+		if (cpu.count == 0)
+			continue;
+		Percentiles gpu = Summarise(GatherStage(stage, true));
+
+		fprintf(file, "%s\n    \"%s\": {", first_stage ? "" : ",", stage_names[stage]);
+		fprintf(file, " \"cpu\": { \"count\": %d, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f },", cpu.count, cpu.p50, cpu.p95, cpu.p99);
+		fprintf(file, " \"gpu\": { \"count\": %d, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f } }", gpu.count, gpu.p50, gpu.p95, gpu.p99);
+		first_stage = false;
+	}
+	fprintf(file, "\n  },\n");
+
+	fprintf(file, "  \"counters\": {");
+	bool first_counter = true;
+	for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+	{
+		Percentiles values = Summarise(GatherCounter(counter));
+		if (values.count == 0)
+			continue;
+
+		fprintf(file, "%s\n    \"%s\": { \"count\": %d, \"p50\": %.0f, \"p95\": %.0f, \"p99\": %.0f }", first_counter ? "" : ",",
+			counter_names[counter], values.count, values.p50, values.p95, values.p99);
+		first_counter = false;
+	}
+	fprintf(file, "\n  },\n");
+
+	// Raw numbers, null where a stage didn't run
+	fprintf(file, "  \"frames\": [");
+	uint64_t count = std::min<uint64_t>(frames_completed, profiler_history_size);
+	for (uint64_t frame_index = frames_completed - count; frame_index < frames_completed; ++frame_index)
+	{
+		const FrameRecord& record = RecordForFrame(frame_index);
+		fprintf(file, "%s\n    { \"frame\": %llu, \"cpu_ms\": %.4f", frame_index == frames_completed - count ? "" : ",",
+			(unsigned long long)record.frame_index, record.cpu_ms);
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		{
+			if (!record.cpu_stage_ran[stage])
+				continue;
+			fprintf(file, ", \"%s\": [%.4f, ", stage_names[stage], record.cpu_stage_ms[stage]);
+			if (record.gpu_stage_ms[stage] >= 0.0f) fprintf(file, "%.4f]", record.gpu_stage_ms[stage]);
+			else fprintf(file, "null]");
+		}
+		for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+		{
+			if (record.counter_set[counter])
+				fprintf(file, ", \"%s\": %.0f", counter_names[counter], record.counters[counter]);
+		}
+		fprintf(file, " }");
+	}
+	fprintf(file, "\n  ]\n}\n");
+
+	fclose(file);
+	printf("Wrote profile to %s\n", path);
+	return true;
+}
+
+bool ProfilerExportChromeTrace(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+	{
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	if (ahead_thread_set)
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"CPU update\"}}");
+
+	// Timestamps and durations are in microseconds
+	uint64_t count = std::min<uint64_t>(frames_completed, profiler_history_size);
+	for (uint64_t frame = frames_completed - count; frame < frames_completed; ++frame)
+	{
+		const FrameRecord& record = RecordForFrame(frame);
+		double frame_start_us = record.start_ms * 1000.0;
+		fprintf(file, ",\n{\"name\":\"frame %llu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+			(unsigned long long)record.frame_index, frame_start_us, record.cpu_ms * 1000.0);
+		if (record.ahead_ms >= 0.0f)
+		{
+			fprintf(file, ",\n{\"name\":\"update %llu\",\"ph\":\"X\",\"pid\":1,\"tid\":3,\"ts\":%.3f,\"dur\":%.3f}",
+				(unsigned long long)record.frame_index, frame_start_us + record.ahead_start_ms * 1000.0, record.ahead_ms * 1000.0);
+		}
+
+		for (int stage = 0; stage < ProfileStage_Count; ++stage)
+		{
+			if (!record.cpu_stage_ran[stage])
+				continue;
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				stage_names[stage], record.cpu_stage_ahead[stage] ? 3 : 1,
+				frame_start_us + record.cpu_stage_start_ms[stage] * 1000.0, record.cpu_stage_ms[stage] * 1000.0);
+
+			if (record.gpu_stage_ms[stage] >= 0.0f)
+			{
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+					stage_names[stage], record.gpu_stage_start_ms[stage] * 1000.0, record.gpu_stage_ms[stage] * 1000.0);
+			}
+		}
+
+		for (int counter = 0; counter < ProfileCounter_Count; ++counter)
+		{
+			if (record.counter_set[counter])
+			{
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%.0f}}",
+					counter_names[counter], frame_start_us, record.counters[counter]);
+			}
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	fclose(file);
+	printf("Wrote profile to %s\n", path);
+	return true;
+}
+
+#else
+
+// Compiled out, keep the entry points so callers don't need their own #ifdefs
+void ProfilerInit(bool) {}
+void ProfilerShutdown() {}
+void ProfilerBeginFrame() {}
+void ProfilerEndFrame() {}
+void ProfilerBeginStage(ProfileStage) {}
+void ProfilerEndStage(ProfileStage) {}
+void ProfilerSetCounter(ProfileCounter, float) {}
+void ProfilerBeginSampleCount() {}
+void ProfilerEndSampleCount() {}
+void ProfilerSetAheadThread() {}
+void ProfilerBeginAheadFrame(unsigned long long) {}
+void ProfilerEndAheadFrame() {}
+void ProfilerPrintSummary() {}
+bool ProfilerExportCSV(const char*) { return false; }
+bool ProfilerExportJSON(const char*) { return false; }
+bool ProfilerExportChromeTrace(const char*) { return false; }
+
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+
+// Per stage CPU and GPU frame timing
+//
+// Each frame the time spent in every stage is measured on the CPU with a monotonic clock
+// and on the GPU with GL_TIMESTAMP queries. GPU results are read back a few frames later
+// without ever waiting on them. A few per frame counts (how many objects got culled, ...)
+// are recorded alongside. The last profiler_history_size frames are kept in a ring
+// buffer and summarised (p50/p95/p99) or exported when the app exits.
+//
+// Nothing here allocates after ProfilerInit. Build with DISABLE_PROFILER defined and the
+// PROFILE_* macros compile to nothing.
+//
+// Frames are begun and ended on one thread. With the pipelined frame loop the next frame's
+// update runs on a second thread while this one renders, its stages are recorded against the
+// frame they prepare (see ProfilerBeginAheadFrame) and show up as their own track in the trace.
+
+enum ProfileStage
+{
+	ProfileStage_PoseWait,
+	ProfileStage_Cull,
+	ProfileStage_Animate,			// the --animate model matrices, on the job system
+	ProfileStage_ControllerGeometry,
+	ProfileStage_DebugGeometry,		// the --stress-lines load
+	ProfileStage_TextureUpload,		// streamed texture levels copied into the upload ring and handed to GL
+	ProfileStage_InstanceUpload,	// the --animate model matrices into the batch's storage buffer
+	ProfileStage_RenderLeft,
+	ProfileStage_ResolveLeft,
+	ProfileStage_RenderRight,
+	ProfileStage_ResolveRight,
+	ProfileStage_RenderStereo,		// both eyes in one pass, instanced stereo only
+	ProfileStage_ResolveStereo,
+	ProfileStage_Submit,
+	ProfileStage_Companion,
+	ProfileStage_Count
+};
+
+// Things counted once per frame, summarised and exported the same way as the stage times
+enum ProfileCounter
+{
+	ProfileCounter_ObjectsVisible,	// scene objects inside the combined stereo frustum
+	ProfileCounter_ObjectsCulled,
+	ProfileCounter_ResolutionScale,	// percent of the recommended size per axis, dynamic resolution only
+	ProfileCounter_SamplesPassed,	// samples the scene draws wrote, from GL_SAMPLES_PASSED, i.e. the fill they cost
+	ProfileCounter_UpdateOverlap,	// percent of the frame's update that ran while the frame before it rendered, pipelined only
+	ProfileCounter_TextureUploadBytes,	// streamed texture data uploaded this frame
+	ProfileCounter_GLCallsIssued,	// binds and enables that reached the driver, see gl_state.h
+	ProfileCounter_GLCallsElided,	// and the ones that were dropped because they changed nothing
+	ProfileCounter_MissedVsyncs,	// vsyncs the compositor reported missed since the frame before, see frame_timing.h
+	ProfileCounter_MotionToPhoton,	// microseconds, estimated for the newest frame the compositor finished
+	ProfileCounter_Count
+};
+
+const int profiler_history_size = 1024;		// frames kept for summaries and export
+
+const char* GetProfileStageName(ProfileStage stage);
+const char* GetProfileCounterName(ProfileCounter counter);
+
+// GPU timing needs a current GL context, pass false to only time the CPU
+void ProfilerInit(bool gpu_timing);
+void ProfilerShutdown();
+
+void ProfilerBeginFrame();
+void ProfilerEndFrame();
+void ProfilerBeginStage(ProfileStage stage);
+void ProfilerEndStage(ProfileStage stage);
+// Overwrites this frame's value, counters that aren't set in a frame are left out for that frame
+void ProfilerSetCounter(ProfileCounter counter, float value);
+// Count the samples that pass the depth test between these into ProfileCounter_SamplesPassed.
+// Up to 8 spans a frame are summed, they can't nest. Needs GPU timing, read back like the GPU times
+void ProfilerBeginSampleCount();
+void ProfilerEndSampleCount();
+
+// For a thread that prepares frames ahead of the one calling ProfilerBeginFrame. Call once from
+// that thread before either starts on frames. Between ProfilerBeginAheadFrame(frame) and
+// ProfilerEndAheadFrame() its stages and counters go to that frame, which it has to finish before
+// the frame thread ends it, and it can be no more than three frames ahead
+void ProfilerSetAheadThread();
+void ProfilerBeginAheadFrame(unsigned long long frame);
+void ProfilerEndAheadFrame();
+
+// Print p50/p95/p99 for every stage that ran and every counter that was set
+void ProfilerPrintSummary();
+
+// One row per frame, one CPU and one GPU column per stage then one column per counter
+bool ProfilerExportCSV(const char* path);
+// Per stage and per counter percentiles followed by the raw per frame numbers
+bool ProfilerExportJSON(const char* path);
+// Load in chrome://tracing or ui.perfetto.dev, CPU, GPU and ahead of time update show up as separate tracks and counters as graphs
+bool ProfilerExportChromeTrace(const char* path);
+
+struct ProfileScope
+{
+	ProfileScope(ProfileStage stage) : stage(stage) { ProfilerBeginStage(stage); }
+	~ProfileScope() { ProfilerEndStage(stage); }
+	ProfileStage stage;
+};
+
+#ifndef DISABLE_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+#define PROFILE_BEGIN(stage) ProfilerBeginStage(stage)
+#define PROFILE_END(stage) ProfilerEndStage(stage)
+#define PROFILE_FRAME_BEGIN() ProfilerBeginFrame()
+#define PROFILE_FRAME_END() ProfilerEndFrame()
+#define PROFILE_COUNTER(counter, value) ProfilerSetCounter(counter, (float)(value))
+#define PROFILE_SAMPLES_BEGIN() ProfilerBeginSampleCount()
+#define PROFILE_SAMPLES_END() ProfilerEndSampleCount()
+#else
+#define PROFILE_SCOPE(stage) ((void)0)
+#define PROFILE_BEGIN(stage) ((void)0)
+#define PROFILE_END(stage) ((void)0)
+#define PROFILE_FRAME_BEGIN() ((void)0)
+#define PROFILE_FRAME_END() ((void)0)
+#define PROFILE_COUNTER(counter, value) ((void)0)
+#define PROFILE_SAMPLES_BEGIN() ((void)0)
+#define PROFILE_SAMPLES_END() ((void)0)
+#endif
@@ -0,0 +1,572 @@
+#include "render_models.h"
+#include "debug_draw.h"
+#include "gl_state.h"
+#include "shader.h"
+#include "vr_backend.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const int region_count = debug_draw_region_count;
+	const uint32_t max_draws = vr::k_unMaxTrackedDeviceCount;
+	const std::chrono::milliseconds poll_interval(5);	// between polls of the runtime while anything is loading
+
+	enum ModelState
+	{
+		Model_Loading,
+		Model_Ready,		// on the GPU
+		Model_Failed
+	};
+
+	// One per render model name, however many devices use it
+	struct Model
+	{
+		std::string name;				// set before the loader hears about it and never changed after
+		std::atomic<int> state;
+		int device_count;				// event thread
+
+		// GL thread
+		GLuint vao;
+		GLuint vertex_buffer;
+		GLuint index_buffer;
+		GLuint texture;
+		GLsizei index_count;
+		double upload_ms;
+
+		// Loader thread, only read once the model is ready
+		uint32_t vertex_count;
+		uint32_t triangle_count;
+		double load_ms;
+	};
+
+	// Everything the runtime handed out for a model, copied so it can have its memory back
+	struct StagedModel
+	{
+		int model;
+		std::vector<vr::RenderModel_Vertex_t> vertices;
+		std::vector<uint16_t> indices;
+		uint32_t texture_width;
+		uint32_t texture_height;
+		int level_count;
+		std::vector<uint8_t> texels;	// RGBA8, every mip level one after the other, empty if the model has no texture
+	};
+
+	// A model the loader is polling the runtime for
+	struct PendingLoad
+	{
+		int model;
+		vr::RenderModel_t* render_model;	// once that part's loaded, then it waits on the texture
+		Clock::time_point start;
+	};
+
+	struct Draw
+	{
+		int model;
+		glm::mat4 device_to_absolute;
+	};
+
+	bool initialised = false;
+	VRBackend* backend = nullptr;
+	Model models[render_models_max_models];
+	int model_count = 0;					// event thread
+
+	// Shared with the loader thread
+	std::thread loader_thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<int> requests;				// models asked for that the loader hasn't picked up yet
+	std::deque<StagedModel> staged;			// loaded, waiting for the GL thread
+	bool quit = false;
+
+	// Event thread
+	int device_model[vr::k_unMaxTrackedDeviceCount];	// -1 until the device is first seen, -2 if it has no model
+	Draw draws[region_count][max_draws];
+	uint32_t draw_count[region_count] = {};
+
+	// GL thread
+	GLuint program = 0;
+	GLint eye_location = -1;
+	GLint model_location = -1;
+	GLuint stereo_program = 0;
+	GLint stereo_model_location = -1;
+	GLuint white_texture = 0;				// for models without one
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// Immutable storage when there is some, a static buffer otherwise
+	void UploadBuffer(GLenum target, GLuint& buffer, GLsizeiptr size, const void* data)
+	{
+		glGenBuffers(1, &buffer);
+		GLStateBindBuffer(target, buffer);
+		if (GLEW_ARB_buffer_storage)
+			glBufferStorage(target, size, data, 0);
+		else
+			glBufferData(target, size, data, GL_STATIC_DRAW);
+	}
+
+	uint32_t LevelSize(uint32_t size, int level)
+	{
+		return std::max(size >> level, 1u);
+	}
+
+	// 2x2 box filter down to 1x1 on the loader thread, glGenerateMipmap can stall the frame
+	// for a long time the first time a driver sees it. Odd edges repeat their last texel
+	void BuildMipChain(StagedModel& staged_model, const uint8_t* texels)
+	{
+		uint32_t width = staged_model.texture_width, height = staged_model.texture_height;
+		staged_model.level_count = 1;
+		size_t total = (size_t)width * height * 4;
+		while (LevelSize(width, staged_model.level_count - 1) > 1 || LevelSize(height, staged_model.level_count - 1) > 1)
+		{
+			total += (size_t)LevelSize(width, staged_model.level_count) * LevelSize(height, staged_model.level_count) * 4;
+			staged_model.level_count += 1;
+		}
+		staged_model.texels.resize(total);
+		std::copy(texels, texels + (size_t)width * height * 4, staged_model.texels.begin());
+
+		size_t source_offset = 0;
+		for (int level = 1; level < staged_model.level_count; ++level)
+		{
+			uint32_t source_width = LevelSize(width, level - 1), source_height = LevelSize(height, level - 1);
+			uint32_t level_width = LevelSize(width, level), level_height = LevelSize(height, level);
+			const uint8_t* source = &staged_model.texels[source_offset];
+			uint8_t* destination = &staged_model.texels[source_offset + (size_t)source_width * source_height * 4];
+
+			for (uint32_t y = 0; y < level_height; ++y)
+			{
+				uint32_t y0 = std::min(y * 2, source_height - 1), y1 = std::min(y * 2 + 1, source_height - 1);
+				for (uint32_t x = 0; x < level_width; ++x)
+				{
+					uint32_t x0 = std::min(x * 2, source_width - 1), x1 = std::min(x * 2 + 1, source_width - 1);
+					for (int channel = 0; channel < 4; ++channel)
+					{
+						uint32_t sum = source[(y0 * source_width + x0) * 4 + channel] + source[(y0 * source_width + x1) * 4 + channel] +
+							source[(y1 * source_width + x0) * 4 + channel] + source[(y1 * source_width + x1) * 4 + channel];
+						destination[(y * level_width + x) * 4 + channel] = (uint8_t)((sum + 2) / 4);
+					}
+				}
+			}
+			source_offset += (size_t)source_width * source_height * 4;
+		}
+	}
+
+	// True once the load is over one way or the other
+	bool PollLoad(PendingLoad& load)
+	{
+		Model& model = models[load.model];
+		vr::EVRRenderModelError error = vr::VRRenderModelError_None;
+		if (load.render_model == nullptr)
+		{
+			error = backend->LoadRenderModel_Async(model.name.c_str(), &load.render_model);
+			if (error == vr::VRRenderModelError_Loading)
+				return false;
+			if (error != vr::VRRenderModelError_None)
+			{
+				printf("Render models: could not load %s, error %d\n", model.name.c_str(), (int)error);
+				load.render_model = nullptr;
+				model.state = Model_Failed;
+				return true;
+			}
+		}
+
+		vr::RenderModel_TextureMap_t* texture = nullptr;
+		if (load.render_model->diffuseTextureId != vr::INVALID_TEXTURE_ID)
+		{
+			error = backend->LoadTexture_Async(load.render_model->diffuseTextureId, &texture);
+			if (error == vr::VRRenderModelError_Loading)
+				return false;
+			if (error != vr::VRRenderModelError_None)
+			{
+				printf("Render models: could not load the texture for %s, error %d, it's drawn untextured\n", model.name.c_str(), (int)error);
+				texture = nullptr;
+			}
+		}
+
+		// Nothing to draw, and nothing to upload either
+		const vr::RenderModel_t& render_model = *load.render_model;
+		if (render_model.unVertexCount == 0 || render_model.unTriangleCount == 0)
+		{
+			printf("Render models: %s is empty, drawn as lines\n", model.name.c_str());
+			if (texture)
+				backend->FreeTexture(texture);
+			backend->FreeRenderModel(load.render_model);
+			load.render_model = nullptr;
+			model.state = Model_Failed;
+			return true;
+		}
+
+		StagedModel staged_model;
+		staged_model.model = load.model;
+		staged_model.vertices.assign(render_model.rVertexData, render_model.rVertexData + render_model.unVertexCount);
+		staged_model.indices.assign(render_model.rIndexData, render_model.rIndexData + render_model.unTriangleCount * 3);
+		staged_model.texture_width = texture ? texture->unWidth : 0;
+		staged_model.texture_height = texture ? texture->unHeight : 0;
+		staged_model.level_count = 0;
+		if (texture)
+			BuildMipChain(staged_model, texture->rubTextureMapData);
+
+		model.vertex_count = render_model.unVertexCount;
+		model.triangle_count = render_model.unTriangleCount;
+		model.load_ms = MillisecondsSince(load.start);
+
+		if (texture)
+			backend->FreeTexture(texture);
+		backend->FreeRenderModel(load.render_model);
+		load.render_model = nullptr;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		staged.push_back(StagedModel());
+		std::swap(staged.back(), staged_model);
+		return true;
+	}
+
+	void LoaderThread()
+	{
+		std::vector<PendingLoad> loading;
+		for (;;)
+		{
+			{
+				// Asleep while there's nothing to load, otherwise back every few milliseconds to poll
+				std::unique_lock<std::mutex> lock(mutex);
+				if (loading.empty())
+					wake.wait(lock, []() { return quit || !requests.empty(); });
+				else
+					wake.wait_for(lock, poll_interval, []() { return quit; });
+				if (quit)
+					break;
+
+				for (size_t i = 0; i < requests.size(); ++i)
+				{
+					PendingLoad load = { requests[i], nullptr, Clock::now() };
+					loading.push_back(load);
+				}
+				requests.clear();
+			}
+
+			for (size_t i = 0; i < loading.size();)
+			{
+				if (PollLoad(loading[i]))
+					loading.erase(loading.begin() + i);
+				else
+					++i;
+			}
+		}
+
+		// Whatever's half loaded goes back to the runtime
+		for (size_t i = 0; i < loading.size(); ++i)
+		{
+			if (loading[i].render_model)
+				backend->FreeRenderModel(loading[i].render_model);
+		}
+	}
+
+	// Finds the device's model in the cache or starts loading it, -2 if it hasn't got one
+	int RequestModel(vr::TrackedDeviceIndex_t device)
+	{
+		char name[vr::k_unMaxPropertyStringSize];
+		vr::TrackedPropertyError error = vr::TrackedProp_Success;
+		backend->GetStringTrackedDeviceProperty(device, vr::Prop_RenderModelName_String, name, sizeof(name), &error);
+		if (error != vr::TrackedProp_Success || name[0] == '\0')
+			return -2;
+
+		for (int index = 0; index < model_count; ++index)
+		{
+			if (models[index].name == name)
+			{
+				models[index].device_count += 1;
+				return index;
+			}
+		}
+
+		if (model_count == render_models_max_models)
+		{
+			printf("Render models: no room for %s\n", name);
+			return -2;
+		}
+
+		int index = model_count++;
+		Model& model = models[index];
+		model.name = name;
+		model.state = Model_Loading;
+		model.device_count = 1;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requests.push_back(index);
+		}
+		wake.notify_one();
+		return index;
+	}
+
+	void Upload(const StagedModel& staged_model)
+	{
+		Clock::time_point start = Clock::now();
+		Model& model = models[staged_model.model];
+
+		glGenVertexArrays(1, &model.vao);
+		GLStateBindVertexArray(model.vao);
+		UploadBuffer(GL_ARRAY_BUFFER, model.vertex_buffer, (GLsizeiptr)(staged_model.vertices.size() * sizeof(vr::RenderModel_Vertex_t)), &staged_model.vertices[0]);
+		UploadBuffer(GL_ELEMENT_ARRAY_BUFFER, model.index_buffer, (GLsizeiptr)(staged_model.indices.size() * sizeof(uint16_t)), &staged_model.indices[0]);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vr::RenderModel_Vertex_t), (const void *)offsetof(vr::RenderModel_Vertex_t, vPosition));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vr::RenderModel_Vertex_t), (const void *)offsetof(vr::RenderModel_Vertex_t, vNormal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vr::RenderModel_Vertex_t), (const void *)offsetof(vr::RenderModel_Vertex_t, rfTextureCoord));
+		GLStateBindVertexArray(0);
+		GLStateBindBuffer(GL_ARRAY_BUFFER, 0);
+		model.index_count = (GLsizei)staged_model.indices.size();
+
+		if (!staged_model.texels.empty())
+		{
+			glGenTextures(1, &model.texture);
+			GLStateBindTexture(GL_TEXTURE_2D, model.texture);
+			size_t offset = 0;
+			for (int level = 0; level < staged_model.level_count; ++level)
+			{
+				uint32_t width = LevelSize(staged_model.texture_width, level), height = LevelSize(staged_model.texture_height, level);
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &staged_model.texels[offset]);
+				offset += (size_t)width * height * 4;
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, staged_model.level_count - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			GLStateBindTexture(GL_TEXTURE_2D, 0);
+		}
+
+		model.upload_ms = MillisecondsSince(start);
+		model.state.store(Model_Ready, std::memory_order_release);
+	}
+
+	int Render(GLuint draw_program, GLint draw_model_location, int region, GLsizei instances)
+	{
+		GLStateUseProgram(draw_program);
+		for (uint32_t i = 0; i < draw_count[region]; ++i)
+		{
+			const Draw& draw = draws[region][i];
+			const Model& model = models[draw.model];
+			glUniformMatrix4fv(draw_model_location, 1, GL_FALSE, glm::value_ptr(draw.device_to_absolute));
+			GLStateBindTexture(GL_TEXTURE_2D, model.texture ? model.texture : white_texture);
+			GLStateBindVertexArray(model.vao);
+			glDrawElementsInstanced(GL_TRIANGLES, model.index_count, GL_UNSIGNED_SHORT, 0, instances);
+		}
+		GLStateBindVertexArray(0);
+		return (int)draw_count[region];
+	}
+}
+
+bool RenderModelsInit(VRBackend* vr_backend)
+{
+	const char* vertex_source =
+		"#version 410\n"
+		VIEW_MATRICES_BLOCK
+		"uniform int eye;"
+		"uniform mat4 model;"
+		"layout(location = 0) in vec3 vPosition;"
+		"layout(location = 1) in vec3 vNormal;"
+		"layout(location = 2) in vec2 vUV;"
+		"out vec3 fNormal;"
+		"out vec2 fUV;"
+		"void main()"
+		"{"
+		"	fNormal = mat3(model) * vNormal;"
+		"	fUV = vUV;"
+		"	gl_Position = eye_view_projection[eye] * model * vec4(vPosition, 1.0);"
+		"}";
+	const char* stereo_vertex_source =
+		"#version 410\n"
+		VIEW_MATRICES_BLOCK
+		"uniform mat4 model;"
+		"layout(location = 0) in vec3 vPosition;"
+		"layout(location = 1) in vec3 vNormal;"
+		"layout(location = 2) in vec2 vUV;"
+		"out vec3 fNormal;"
+		"out vec2 fUV;"
+		"void main()"
+		"{"
+		"	int eye = gl_InstanceID & 1;"
+		"	vec4 position = eye_view_projection[eye] * model * vec4(vPosition, 1.0);"
+		"	float eye_offset = eye == 0 ? -0.5 : 0.5;"
+		"	gl_ClipDistance[0] = eye == 0 ? position.w - position.x : position.w + position.x;"
+		"	fNormal = mat3(model) * vNormal;"
+		"	fUV = vUV;"
+		"	gl_Position = vec4(position.x * 0.5 + eye_offset * position.w, position.yzw);"
+		"}";
+	// Lit the same way as the scene
+	const char* fragment_source =
+		"#version 410\n"
+		"uniform sampler2D diffuse;"
+		"in vec3 fNormal;"
+		"in vec2 fUV;"
+		"out vec4 outColour;"
+		"void main()"
+		"{"
+		"	float light = 0.6 + 0.4 * abs(dot(normalize(fNormal), vec3(0.27, 0.89, 0.36)));"
+		"	outColour = vec4(light * texture(diffuse, fUV).rgb, 1.0);"
+		"}";
+
+	program = CreateShaderProgram("render model", vertex_source, fragment_source);
+	stereo_program = CreateShaderProgram("render model stereo", stereo_vertex_source, fragment_source);
+	if (program == 0 || stereo_program == 0)
+		return false;
+
+	eye_location = glGetUniformLocation(program, "eye");
+	model_location = glGetUniformLocation(program, "model");
+	stereo_model_location = glGetUniformLocation(stereo_program, "model");
+	BindViewMatrices(program);
+	BindViewMatrices(stereo_program);
+
+	const uint8_t white[4] = { 255, 255, 255, 255 };
+	glGenTextures(1, &white_texture);
+	GLStateBindTexture(GL_TEXTURE_2D, white_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	GLStateBindTexture(GL_TEXTURE_2D, 0);
+
+	backend = vr_backend;
+	for (uint32_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+		device_model[device] = -1;
+	model_count = 0;
+	quit = false;
+	loader_thread = std::thread(LoaderThread);
+
+	initialised = true;
+	return true;
+}
+
+void RenderModelsShutdown()
+{
+	if (!initialised)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_one();
+	loader_thread.join();
+	staged.clear();
+	requests.clear();
+
+	for (int index = 0; index < model_count; ++index)
+	{
+		Model& model = models[index];
+		GLStateDeleteVertexArrays(1, &model.vao);
+		GLStateDeleteBuffers(1, &model.vertex_buffer);
+		GLStateDeleteBuffers(1, &model.index_buffer);
+		GLStateDeleteTextures(1, &model.texture);
+		model.vao = model.vertex_buffer = model.index_buffer = model.texture = 0;
+	}
+	GLStateDeleteTextures(1, &white_texture);
+	glDeleteProgram(program);
+	glDeleteProgram(stereo_program);
+	white_texture = program = stereo_program = 0;
+	initialised = false;
+}
+
+void RenderModelsHandleEvent(const vr::VREvent_t& event)
+{
+	if (!initialised || event.eventType != vr::VREvent_TrackedDeviceDeactivated || event.trackedDeviceIndex >= vr::k_unMaxTrackedDeviceCount)
+		return;
+
+	int& model = device_model[event.trackedDeviceIndex];
+	if (model >= 0)
+		models[model].device_count -= 1;
+	model = -1;
+}
+
+void RenderModelsBeginRegion(int region)
+{
+	draw_count[region] = 0;
+}
+
+bool RenderModelsAdd(int region, vr::TrackedDeviceIndex_t device, const glm::mat4& device_to_absolute)
+{
+	if (!initialised || device >= vr::k_unMaxTrackedDeviceCount)
+		return false;
+
+	if (device_model[device] == -1)
+		device_model[device] = RequestModel(device);
+
+	int model = device_model[device];
+	if (model < 0 || models[model].state.load(std::memory_order_acquire) != Model_Ready || draw_count[region] == max_draws)
+		return false;
+
+	Draw& draw = draws[region][draw_count[region]++];
+	draw.model = model;
+	draw.device_to_absolute = device_to_absolute;
+	return true;
+}
+
+void RenderModelsUpdate()
+{
+	if (!initialised)
+		return;
+
+	// One a frame at most, whatever's left waits for the next
+	StagedModel staged_model;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (staged.empty())
+			return;
+		std::swap(staged_model, staged.front());
+		staged.pop_front();
+	}
+	Upload(staged_model);
+}
+
+int RenderModelsRender(int region, int eye)
+{
+	if (!initialised || draw_count[region] == 0)
+		return 0;
+
+	GLStateUseProgram(program);
+	glUniform1i(eye_location, eye);
+	return Render(program, model_location, region, 1);
+}
+
+int RenderModelsRenderStereo(int region)
+{
+	if (!initialised || draw_count[region] == 0)
+		return 0;
+
+	return Render(stereo_program, stereo_model_location, region, 2);
+}
+
+void RenderModelsPrintStats()
+{
+	for (int index = 0; index < model_count; ++index)
+	{
+		const Model& model = models[index];
+		int state = model.state.load(std::memory_order_acquire);
+		if (state == Model_Ready)
+		{
+			printf("Render models: %s, %u vertices and %u triangles, loaded in %.1f ms off the frame, uploaded in %.3f ms, drawn for %d device%s\n",
+				model.name.c_str(), model.vertex_count, model.triangle_count, model.load_ms, model.upload_ms, model.device_count, model.device_count == 1 ? "" : "s");
+		}
+		else
+		{
+			printf("Render models: %s %s\n", model.name.c_str(), state == Model_Failed ? "failed to load" : "was still loading");
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <openvr.h>
+
+class VRBackend;
+
+// Controller render models, loaded in the background and drawn where the controllers are
+//
+// The runtime hands render models and their textures out asynchronously, the loads keep
+// returning Loading until they're ready. A loader thread polls them for every model that's been
+// asked for, copies what comes back into a staging queue and gives the runtime its memory back,
+// so nothing on the frame ever waits for a model. The GL thread takes one staged model a frame
+// and uploads it. GPU meshes are cached by render model name, two controllers of the same kind
+// share one set of buffers and one texture.
+//
+// Which models get drawn where is built up per frame, in one of debug_draw_region_count regions
+// the same way as debug draw, so it can happen on another thread than the drawing:
+//   RenderModelsBeginRegion(region)
+//   RenderModelsAdd(...) for every device that should be drawn
+//   RenderModelsUpdate() on the GL thread, then RenderModelsRender(region, eye) or
+//   RenderModelsRenderStereo(region)
+
+const int render_models_max_models = 16;
+
+// Call with the context current, starts the loader thread. False if the shaders didn't build
+bool RenderModelsInit(VRBackend* backend);
+// Stops the loader, call before the backend shuts down
+void RenderModelsShutdown();
+
+// No GL in these three, they go on the thread that handles the device events
+// Feed every event from PollNextEvent through here. A device that's deactivated forgets its model,
+// whatever turns up at its index next asks for its own. The cached mesh stays for whoever uses it
+void RenderModelsHandleEvent(const vr::VREvent_t& event);
+void RenderModelsBeginRegion(int region);
+// Draws the device's render model this frame. The first time a device comes through, its model
+// is asked for. False until the model is on the GPU, or if it never will be
+bool RenderModelsAdd(int region, vr::TrackedDeviceIndex_t device, const glm::mat4& device_to_absolute);
+
+// GL thread, uploads the next staged model if there is one
+void RenderModelsUpdate();
+
+// Both return how many draw calls they made, the matrices come from the ViewMatrices uniform buffer (see shader.h)
+int RenderModelsRender(int region, int eye);
+// Into a double wide target, same instancing scheme as the scene's stereo shader
+int RenderModelsRenderStereo(int region);
+
+// Which models were loaded, how long the runtime took and how many devices share them
+void RenderModelsPrintStats();
@@ -0,0 +1,231 @@
+#include "render_targets.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+	enum AttachmentKind
+	{
+		Attachment_Depth,		// renderbuffer, transient
+		Attachment_Colour,		// texture the target renders into, transient
+		Attachment_Resolve		// texture that gets submitted, never shared
+	};
+
+	struct Allocation
+	{
+		AttachmentKind kind;
+		GLuint name;
+		int samples;
+		int width;
+		int height;
+		size_t bytes_per_sample;
+		size_t bytes;
+		std::string users;		// names of the targets attached to it
+	};
+
+	bool share_transient = true;
+	std::vector<Allocation> allocations;
+	std::vector<GLuint> frame_buffers;
+	size_t unshared_bytes = 0;		// what the same targets would take with their own attachments
+
+	size_t BytesForBits(GLint bits)
+	{
+		// 24 bit depth gets padded out to 32
+		if (bits <= 8)
+			return 1;
+		if (bits <= 16)
+			return 2;
+		if (bits <= 32)
+			return 4;
+		return (bits + 7) / 8;
+	}
+
+	// (Re)allocates the storage at the allocation's size and works out what it costs from what
+	// the driver actually picked
+	void Specify(Allocation& allocation)
+	{
+		int pixels = allocation.width * allocation.height;
+		GLint bits = 0;
+
+		if (allocation.kind == Attachment_Depth)
+		{
+			glBindRenderbuffer(GL_RENDERBUFFER, allocation.name);
+			if (allocation.samples > 0)
+				glRenderbufferStorageMultisample(GL_RENDERBUFFER, allocation.samples, GL_DEPTH_COMPONENT, allocation.width, allocation.height);
+			else
+				glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, allocation.width, allocation.height);
+			glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_DEPTH_SIZE, &bits);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		}
+		else
+		{
+			GLenum target = allocation.samples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+			GLStateBindTexture(target, allocation.name);
+			if (allocation.samples > 0)
+			{
+				glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, allocation.samples, GL_RGBA8, allocation.width, allocation.height, true);
+			}
+			else
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, allocation.width, allocation.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+
+			const GLenum channels[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE };
+			for (GLenum channel : channels)
+			{
+				GLint channel_bits = 0;
+				glGetTexLevelParameteriv(target, 0, channel, &channel_bits);
+				bits += channel_bits;
+			}
+			GLStateBindTexture(target, 0);
+		}
+
+		allocation.bytes_per_sample = BytesForBits(bits);
+		allocation.bytes = (size_t)pixels * std::max(1, allocation.samples) * allocation.bytes_per_sample;
+	}
+
+	// Returns the index of an allocation big enough for width x height, from the pool if the
+	// attachment is transient and sharing is on
+	size_t Acquire(AttachmentKind kind, int samples, int width, int height, const char* user)
+	{
+		if (share_transient && kind != Attachment_Resolve)
+		{
+			for (size_t index = 0; index < allocations.size(); ++index)
+			{
+				Allocation& allocation = allocations[index];
+				if (allocation.kind != kind || allocation.samples != samples)
+					continue;
+
+				if (width > allocation.width || height > allocation.height)
+				{
+					// Whatever is attached already follows the object to its new storage
+					allocation.width = std::max(allocation.width, width);
+					allocation.height = std::max(allocation.height, height);
+					Specify(allocation);
+				}
+				allocation.users += ", ";
+				allocation.users += user;
+				unshared_bytes += (size_t)width * height * std::max(1, samples) * allocation.bytes_per_sample;
+				return index;
+			}
+		}
+
+		Allocation allocation;
+		allocation.kind = kind;
+		allocation.name = 0;
+		allocation.samples = samples;
+		allocation.width = width;
+		allocation.height = height;
+		allocation.users = user;
+		if (kind == Attachment_Depth)
+			glGenRenderbuffers(1, &allocation.name);
+		else
+			glGenTextures(1, &allocation.name);
+		Specify(allocation);
+
+		unshared_bytes += allocation.bytes;
+		allocations.push_back(allocation);
+		return allocations.size() - 1;
+	}
+
+	bool CheckFrameBuffer(const char* name)
+	{
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("Error creating frame buffer for the %s!\n", name);
+			GLStateBindFramebuffer(GL_FRAMEBUFFER, 0);
+			return false;
+		}
+		return true;
+	}
+}
+
+void RenderTargetsInit(bool share)
+{
+	share_transient = share;
+}
+
+void RenderTargetsShutdown()
+{
+	if (!frame_buffers.empty())
+		GLStateDeleteFramebuffers((GLsizei)frame_buffers.size(), &frame_buffers[0]);
+	for (size_t index = 0; index < allocations.size(); ++index)
+	{
+		if (allocations[index].kind == Attachment_Depth)
+			glDeleteRenderbuffers(1, &allocations[index].name);
+		else
+			GLStateDeleteTextures(1, &allocations[index].name);
+	}
+	frame_buffers.clear();
+	allocations.clear();
+	unshared_bytes = 0;
+}
+
+bool RenderTargetCreate(const char* name, int width, int height, int samples, bool with_resolve, FrameBufferDesc& desc)
+{
+	// The colour is only transient if it gets resolved into something else
+	bool colour_is_resolve = samples == 0 && with_resolve;
+
+	desc.depth_buffer = allocations[Acquire(Attachment_Depth, samples, width, height, name)].name;
+	desc.render_texture = allocations[Acquire(colour_is_resolve ? Attachment_Resolve : Attachment_Colour, samples, width, height, name)].name;
+
+	// render buffer
+	glGenFramebuffers(1, &desc.render_frame_buffer);
+	frame_buffers.push_back(desc.render_frame_buffer);
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, desc.render_frame_buffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, desc.depth_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, samples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, desc.render_texture, 0);
+	if (!CheckFrameBuffer(name))
+		return false;
+
+	if (!with_resolve || colour_is_resolve)
+	{
+		desc.resolve_frame_buffer = with_resolve ? desc.render_frame_buffer : 0;
+		desc.resolve_texture = with_resolve ? desc.render_texture : 0;
+		GLStateBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return true;
+	}
+
+	// resolve buffer
+	desc.resolve_texture = allocations[Acquire(Attachment_Resolve, 0, width, height, name)].name;
+	glGenFramebuffers(1, &desc.resolve_frame_buffer);
+	frame_buffers.push_back(desc.resolve_frame_buffer);
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, desc.resolve_frame_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, desc.resolve_texture, 0);
+	if (!CheckFrameBuffer(name))
+		return false;
+
+	GLStateBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return true;
+}
+
+void RenderTargetsPrintReport()
+{
+	if (allocations.empty())
+		return;
+
+	const double megabyte = 1024.0 * 1024.0;
+	size_t total_bytes = 0;
+	for (size_t index = 0; index < allocations.size(); ++index)
+		total_bytes += allocations[index].bytes;
+
+	printf("Render targets: %.1f MB of GPU memory in %u allocations, %.1f MB with every target owning its attachments (sharing %s)\n",
+		total_bytes / megabyte, (unsigned)allocations.size(), unshared_bytes / megabyte, share_transient ? "on" : "off");
+	for (size_t index = 0; index < allocations.size(); ++index)
+	{
+		const Allocation& allocation = allocations[index];
+		const char* kind = allocation.kind == Attachment_Depth ? "depth" : allocation.kind == Attachment_Colour ? "colour" : "resolve";
+		char label[32];
+		if (allocation.samples > 0)
+			snprintf(label, sizeof(label), "%dx %s", allocation.samples, kind);
+		else
+			snprintf(label, sizeof(label), "%s", kind);
+		printf("  %-10s %5dx%-5d %8.1f MB  %s\n", label, allocation.width, allocation.height, allocation.bytes / megabyte, allocation.users.c_str());
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// The eye render targets and what they cost in GPU memory
+//
+// Every attachment a target needs is made here and its size recorded. The multisampled colour
+// and the depth buffer only live until the target is resolved, and the eyes are rendered and
+// resolved one after the other, so with sharing on targets get their transient attachments from
+// a pool: the first target to ask for a format and sample count allocates it, later ones attach
+// the same object, grown if they're bigger. Nothing carries over from one target to the next,
+// every pass starts with a clear. The resolve textures are what gets submitted and always belong
+// to one target, and so does the colour with MSAA off since it doubles as the resolve texture.
+
+struct FrameBufferDesc
+{
+	GLuint depth_buffer;
+	GLuint render_texture;
+	GLuint render_frame_buffer;
+	GLuint resolve_texture;
+	GLuint resolve_frame_buffer;
+};
+
+// With share_transient off every target gets its own attachments, for comparing the footprint
+void RenderTargetsInit(bool share_transient);
+// Deletes every target that was made
+void RenderTargetsShutdown();
+
+// Fills in desc with a target of width x height, samples 0 for no MSAA. If with_resolve is false
+// only the render half is made, for targets that get resolved somewhere else. With MSAA off the
+// render half doubles as the resolve half. name is for the memory report
+bool RenderTargetCreate(const char* name, int width, int height, int samples, bool with_resolve, FrameBufferDesc& desc);
+
+// Every allocation with its size and the targets using it, and the total against what it would
+// be without sharing
+void RenderTargetsPrintReport();
@@ -0,0 +1,366 @@
+#include "shader.h"
+#include "gl_state.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// Cache file layout, everything little endian:
+	//   CacheFileHeader
+	//   entry_count times a CacheFileEntry followed by its size bytes of program binary
+	const char cache_file_magic[4] = { 'H', 'V', 'S', 'C' };
+	const uint32_t cache_file_version = 1;
+
+	struct CacheFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t driver_hash;		// the file is thrown away if the driver changed
+		uint32_t entry_count;
+		uint32_t padding;
+	};
+
+	struct CacheFileEntry
+	{
+		uint64_t key;
+		uint32_t format;			// what glGetProgramBinary said it was
+		uint32_t size;
+	};
+
+	static_assert(sizeof(CacheFileHeader) == 24, "CacheFileHeader layout changed, bump cache_file_version");
+	static_assert(sizeof(CacheFileEntry) == 16, "CacheFileEntry layout changed, bump cache_file_version");
+
+	struct CachedProgram
+	{
+		GLenum format;
+		std::vector<uint8_t> binary;
+		bool used;					// looked up or stored this run, only these get written back
+
+		CachedProgram() : format(0), used(false) {}
+	};
+
+	bool cache_enabled = false;
+	bool cache_dirty = false;		// a binary was stored, or one from the file went unused
+	std::string cache_path;
+	uint64_t driver_hash = 0;
+	std::unordered_map<uint64_t, CachedProgram> cached_programs;
+
+	int programs_loaded = 0;		// from a binary
+	int programs_compiled = 0;
+	int binaries_rejected = 0;		// the driver wouldn't take them, compiled instead
+	double program_create_ms = 0.0;
+
+	// FNV-1a, a 0 byte goes in after each string so "ab" + "c" and "a" + "bc" differ
+	uint64_t HashString(uint64_t hash, const char* text)
+	{
+		for (const char* c = text ? text : ""; ; ++c)
+		{
+			hash ^= (uint8_t)*c;
+			hash *= 1099511628211ull;
+			if (*c == '\0')
+				return hash;
+		}
+	}
+
+	const uint64_t hash_seed = 14695981039346656037ull;
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	bool LoadCacheFile()
+	{
+		FILE* file = fopen(cache_path.c_str(), "rb");
+		if (file == nullptr)
+			return false;
+
+		// Sizes in the file are checked against what's left of it before anything gets allocated
+		fseek(file, 0, SEEK_END);
+		long bytes_left = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		CacheFileHeader header;
+		bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+			memcmp(header.magic, cache_file_magic, sizeof(cache_file_magic)) == 0 &&
+			header.version == cache_file_version &&
+			header.driver_hash == driver_hash;
+		bytes_left -= sizeof(header);
+
+		for (uint32_t i = 0; ok && i < header.entry_count; ++i)
+		{
+			CacheFileEntry entry;
+			ok = fread(&entry, sizeof(entry), 1, file) == 1 && entry.size > 0;
+			bytes_left -= sizeof(entry);
+			ok = ok && bytes_left >= 0 && entry.size <= (unsigned long)bytes_left;
+			if (!ok)
+				break;
+			bytes_left -= entry.size;
+
+			CachedProgram& program = cached_programs[entry.key];
+			program.format = entry.format;
+			program.binary.resize(entry.size);
+			ok = fread(&program.binary[0], 1, entry.size, file) == entry.size;
+		}
+		fclose(file);
+
+		// A truncated or stale file is as good as none, it gets rewritten at shutdown
+		if (!ok)
+			cached_programs.clear();
+		return ok;
+	}
+
+	void SaveCacheFile()
+	{
+		FILE* file = fopen(cache_path.c_str(), "wb");
+		if (file == nullptr)
+		{
+			printf("Could not write shader cache %s\n", cache_path.c_str());
+			return;
+		}
+
+		CacheFileHeader header = {};
+		memcpy(header.magic, cache_file_magic, sizeof(cache_file_magic));
+		header.version = cache_file_version;
+		header.driver_hash = driver_hash;
+		header.entry_count = 0;
+		for (auto& cached : cached_programs)
+			header.entry_count += cached.second.used ? 1 : 0;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+		// Binaries nothing asked for this run are from edited shaders or older builds, they'd
+		// otherwise pile up forever
+		for (auto& cached : cached_programs)
+		{
+			if (!cached.second.used)
+				continue;
+			CacheFileEntry entry = { cached.first, cached.second.format, (uint32_t)cached.second.binary.size() };
+			ok = ok && fwrite(&entry, sizeof(entry), 1, file) == 1;
+			ok = ok && fwrite(&cached.second.binary[0], 1, entry.size, file) == entry.size;
+		}
+		fclose(file);
+
+		if (!ok)
+		{
+			printf("Could not write shader cache %s\n", cache_path.c_str());
+			remove(cache_path.c_str());
+		}
+	}
+
+	// Returns 0 if the driver wouldn't take the binary
+	GLuint LoadProgramBinary(const CachedProgram& cached)
+	{
+		GLuint shader_program = glCreateProgram();
+		glProgramBinary(shader_program, cached.format, &cached.binary[0], (GLsizei)cached.binary.size());
+
+		GLint status = GL_FALSE;
+		glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			glDeleteProgram(shader_program);
+			return 0;
+		}
+		return shader_program;
+	}
+
+	void StoreProgramBinary(uint64_t key, GLuint shader_program)
+	{
+		GLint size = 0;
+		glGetProgramiv(shader_program, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (size <= 0)
+			return;
+
+		CachedProgram& cached = cached_programs[key];
+		cached.binary.resize(size);
+		GLsizei written = 0;
+		glGetProgramBinary(shader_program, size, &written, &cached.format, &cached.binary[0]);
+		if (written <= 0)
+		{
+			cached_programs.erase(key);
+			return;
+		}
+		cached.binary.resize(written);
+		cached.used = true;
+		cache_dirty = true;
+	}
+
+	// Compile a shader program from two strings
+	// name is provided for prettier error messages
+	GLuint CompileShaderProgram(const char* name, const char* vertex_source, const char* fragment_source)
+	{
+		GLuint shader_program = glCreateProgram();
+
+		// Vertex shader
+		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex_shader, 1, &vertex_source, NULL);
+		glCompileShader(vertex_shader);
+
+		GLint status = GL_FALSE;
+		glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			printf("Failed to compile %s vertex shader\n", name);
+			glDeleteProgram(shader_program);
+			glDeleteShader(vertex_shader);
+			return 0;
+		}
+		else
+		{
+			glAttachShader(shader_program, vertex_shader);
+			glDeleteShader(vertex_shader); // We can throw it away not it's been attached
+		}
+
+		// Fragment shader
+		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment_shader, 1, &fragment_source, NULL);
+		glCompileShader(fragment_shader);
+
+		status = GL_FALSE;
+		glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			printf("Failed to compile %s fragment shader\n", name);
+			glDeleteProgram(shader_program);
+			glDeleteShader(fragment_shader);
+			return 0;
+		}
+		else
+		{
+			glAttachShader(shader_program, fragment_shader);
+			glDeleteShader(fragment_shader);
+		}
+
+		// Otherwise the driver is free to not keep anything it could hand back
+		if (cache_enabled)
+			glProgramParameteri(shader_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+		// Now link the shaders into the program
+		glLinkProgram(shader_program);
+		status = GL_TRUE;
+		glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			printf("Failed to link %s program\n", name);
+			glDeleteProgram(shader_program);
+			return 0;
+		}
+		else
+		{
+			printf("Shader success! %d\n", shader_program);
+		}
+
+		return shader_program;
+	}
+}
+
+bool ShaderCacheInit(const char* path)
+{
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	if (format_count == 0)
+	{
+		printf("Shader cache: the driver can't save program binaries, compiling every time\n");
+		return false;
+	}
+
+	// A binary is only any good to the exact driver that made it
+	driver_hash = HashString(hash_seed, (const char*)glGetString(GL_VENDOR));
+	driver_hash = HashString(driver_hash, (const char*)glGetString(GL_RENDERER));
+	driver_hash = HashString(driver_hash, (const char*)glGetString(GL_VERSION));
+
+	cache_path = path;
+	cache_enabled = true;
+	cache_dirty = false;
+	cached_programs.clear();
+
+	if (LoadCacheFile())
+		printf("Shader cache: %s, %d program binaries\n", path, (int)cached_programs.size());
+	else
+		printf("Shader cache: %s, empty\n", path);
+	return true;
+}
+
+void ShaderCacheShutdown()
+{
+	// Anything left unused from the file gets dropped
+	for (auto& cached : cached_programs)
+		cache_dirty = cache_dirty || !cached.second.used;
+
+	if (cache_enabled && cache_dirty)
+		SaveCacheFile();
+
+	cache_enabled = false;
+	cache_dirty = false;
+	cached_programs.clear();
+}
+
+void ShaderCachePrintStats()
+{
+	if (programs_loaded + programs_compiled == 0)
+		return;
+
+	printf("Shader programs: %d made in %.2f ms, %d from the cache, %d compiled, %d cached binaries rejected\n",
+		programs_loaded + programs_compiled, program_create_ms, programs_loaded, programs_compiled, binaries_rejected);
+}
+
+GLuint CreateShaderProgram(const char* name, const char* vertex_source, const char* fragment_source)
+{
+	Clock::time_point start = Clock::now();
+	GLuint shader_program = 0;
+
+	uint64_t key = 0;
+	if (cache_enabled)
+	{
+		key = HashString(HashString(driver_hash, vertex_source), fragment_source);
+
+		auto cached = cached_programs.find(key);
+		if (cached != cached_programs.end())
+		{
+			shader_program = LoadProgramBinary(cached->second);
+			if (shader_program != 0)
+			{
+				cached->second.used = true;
+				programs_loaded += 1;
+			}
+			else
+			{
+				// Same driver string but it changed its mind, compile and replace it
+				printf("Shader cache: %s binary rejected, compiling\n", name);
+				binaries_rejected += 1;
+				cached_programs.erase(cached);
+			}
+		}
+	}
+
+	if (shader_program == 0)
+	{
+		shader_program = CompileShaderProgram(name, vertex_source, fragment_source);
+		if (shader_program != 0)
+		{
+			programs_compiled += 1;
+			if (cache_enabled)
+				StoreProgramBinary(key, shader_program);
+		}
+	}
+
+	program_create_ms += MillisecondsSince(start);
+	GLStateUseProgram(0);
+	return shader_program;
+}
+
+void BindViewMatrices(GLuint program)
+{
+	GLuint block_index = glGetUniformBlockIndex(program, "ViewMatrices");
+	if (block_index != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, block_index, view_matrices_binding);
+	}
+}
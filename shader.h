@@ -0,0 +1,26 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Compile a shader program from two strings
+// name is provided for prettier error messages, returns 0 on failure
+GLuint CreateShaderProgram(const char* name, const char* vertex_source, const char* fragment_source);
+
+// Linked programs kept on disk as driver binaries, keyed by their source and the GL vendor,
+// renderer and version. Once this is set up CreateShaderProgram tries the binary first and only
+// compiles when there isn't one or the driver won't take it.
+// Call with the context current before any programs are made. Returns false if the driver can't
+// hand binaries back, everything gets compiled then
+bool ShaderCacheInit(const char* path);
+// Writes the file back if anything had to be compiled or any binary in it went unused this run.
+// Only the programs this run made go in, so binaries of edited shaders don't pile up
+void ShaderCacheShutdown();
+// How many programs came from the cache and how long making all of them took
+void ShaderCachePrintStats();
+
+// Both eyes' view projection matrices, shared by every shader through one uniform buffer.
+// Paste VIEW_MATRICES_BLOCK into the vertex source and call BindViewMatrices() once on the program
+#define VIEW_MATRICES_BLOCK "layout(std140) uniform ViewMatrices { mat4 eye_view_projection[2]; };"
+const GLuint view_matrices_binding = 0;
+
+void BindViewMatrices(GLuint program);
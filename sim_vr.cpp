@@ -0,0 +1,627 @@
+#include "vr_backend.h"
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A stand-in for SteamVR so the frame loop can run without a headset
+//
+// Device layout copies what a typical Vive setup reports:
+//   0    HMD
+//   1-2  base stations (static)
+//   3-4  controllers
+//
+// Poses are a pure function of the simulated vsync count, not of wall clock time,
+// so two runs with the same settings see exactly the same head and hand motion.
+// The exception is GetDeviceToAbsoluteTrackingPose() with frame pacing on, which samples
+// the same motion at the current wall clock time the way a late re-sample would.
+
+namespace
+{
+	const float pi = 3.14159265f;
+
+	const vr::TrackedDeviceIndex_t first_base_station = 1;
+	const vr::TrackedDeviceIndex_t first_controller = 3;
+	const uint32_t base_station_count = 2;
+
+	// Tangents of the half angles of each eye's field of view, roughly a Vive
+	const float fov_inner = 1.25f;
+	const float fov_outer = 1.39f;
+	const float fov_vertical = 1.47f;
+	const float half_ipd = 0.032f;
+
+	// The lens shows a circle of about this tangent radius around the view axis, the corners
+	// of the target outside it make up the hidden area
+	const float lens_radius = 1.45f;
+	const int hidden_area_segments = 64;
+
+	// Every controller is the same model, which takes about as long to load as one SteamVR hasn't
+	// cached yet, and then its texture a bit longer
+	const char* const controller_model_name = "sim_controller";
+	const vr::TextureID_t controller_texture_id = 0;
+	const double render_model_load_seconds = 0.25;
+	const double render_model_texture_load_seconds = 0.1;
+	const int controller_model_segments = 24;
+	const int controller_texture_size = 128;
+
+	// Frames GetFrameTiming can look back over
+	const uint32_t frame_timing_history = 16;
+
+	// Write a rotation (yaw about Y, then pitch about X) and a position into a 3x4 pose matrix
+	void SetPoseMatrix(vr::HmdMatrix34_t& mat, float yaw, float pitch, const float position[3])
+	{
+		float cy = cosf(yaw), sy = sinf(yaw);
+		float cp = cosf(pitch), sp = sinf(pitch);
+
+		mat.m[0][0] = cy;  mat.m[0][1] = sy * sp; mat.m[0][2] = sy * cp; mat.m[0][3] = position[0];
+		mat.m[1][0] = 0;   mat.m[1][1] = cp;      mat.m[1][2] = -sp;     mat.m[1][3] = position[1];
+		mat.m[2][0] = -sy; mat.m[2][1] = cy * sp; mat.m[2][2] = cy * cp; mat.m[2][3] = position[2];
+	}
+}
+
+class SimulatedVRBackend : public VRBackend
+{
+public:
+	SimulatedVRBackend(const SimulatedVRConfig& config)
+		: config(config)
+		, frame_index(0)
+		, missed_vsyncs(0)
+		, submit_count(0)
+		, frame_timing_count(0)
+		, pending_event_count(0)
+		, next_pending_event(0)
+	{
+		device_count = first_controller + config.controller_count;
+
+		// Everything is already plugged in, tell the app about it the same way SteamVR does at startup
+		for (vr::TrackedDeviceIndex_t device = 0; device < device_count; ++device)
+		{
+			vr::VREvent_t& event = pending_events[pending_event_count++];
+			memset(&event, 0, sizeof(event));
+			event.eventType = vr::VREvent_TrackedDeviceActivated;
+			event.trackedDeviceIndex = device;
+		}
+
+		start_time = std::chrono::steady_clock::now();
+	}
+
+	const char* GetName() { return "Simulated"; }
+
+	void GetRecommendedRenderTargetSize(uint32_t* width, uint32_t* height)
+	{
+		*width = config.render_target_width;
+		*height = config.render_target_height;
+	}
+
+	vr::HmdMatrix44_t GetProjectionMatrix(vr::Hmd_Eye eye, float near_z, float far_z)
+	{
+		// Off centre frustum, the outer edge of each eye sees further than the inner edge
+		float left = eye == vr::Eye_Left ? -fov_outer : -fov_inner;
+		float right = eye == vr::Eye_Left ? fov_inner : fov_outer;
+		float bottom = -fov_vertical;
+		float top = fov_vertical;
+
+		vr::HmdMatrix44_t mat;
+		memset(&mat, 0, sizeof(mat));
+		mat.m[0][0] = 2.0f / (right - left);
+		mat.m[0][2] = (right + left) / (right - left);
+		mat.m[1][1] = 2.0f / (top - bottom);
+		mat.m[1][2] = (top + bottom) / (top - bottom);
+		mat.m[2][2] = -(far_z + near_z) / (far_z - near_z);
+		mat.m[2][3] = -2.0f * far_z * near_z / (far_z - near_z);
+		mat.m[3][2] = -1.0f;
+		return mat;
+	}
+
+	vr::HmdMatrix34_t GetEyeToHeadTransform(vr::Hmd_Eye eye)
+	{
+		const float offset[3] = { eye == vr::Eye_Left ? -half_ipd : half_ipd, 0.0f, 0.0f };
+		vr::HmdMatrix34_t mat;
+		SetPoseMatrix(mat, 0.0f, 0.0f, offset);
+		return mat;
+	}
+
+	vr::HiddenAreaMesh_t GetHiddenAreaMesh(vr::Hmd_Eye eye)
+	{
+		std::vector<vr::HmdVector2_t>& vertices = hidden_area[eye];
+		if (vertices.empty())
+			BuildHiddenArea(eye, vertices);
+
+		vr::HiddenAreaMesh_t mesh = { &vertices[0], (uint32_t)vertices.size() / 3 };
+		return mesh;
+	}
+
+	bool IsTrackedDeviceConnected(vr::TrackedDeviceIndex_t device)
+	{
+		return device < device_count;
+	}
+
+	vr::ETrackedDeviceClass GetTrackedDeviceClass(vr::TrackedDeviceIndex_t device)
+	{
+		if (device == vr::k_unTrackedDeviceIndex_Hmd) return vr::TrackedDeviceClass_HMD;
+		if (device < first_controller) return vr::TrackedDeviceClass_TrackingReference;
+		if (device < device_count) return vr::TrackedDeviceClass_Controller;
+		return vr::TrackedDeviceClass_Invalid;
+	}
+
+	uint32_t GetStringTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, char* buffer, uint32_t buffer_size, vr::TrackedPropertyError* error)
+	{
+		char value[64] = "";
+		switch (prop)
+		{
+		case vr::Prop_TrackingSystemName_String: snprintf(value, sizeof(value), "simulated"); break;
+		case vr::Prop_SerialNumber_String:       snprintf(value, sizeof(value), "SIM-%02u", device); break;
+		case vr::Prop_RenderModelName_String:
+			if (GetTrackedDeviceClass(device) != vr::TrackedDeviceClass_Controller)
+			{
+				if (error) *error = vr::TrackedProp_UnknownProperty;
+				return 0;
+			}
+			snprintf(value, sizeof(value), "%s", controller_model_name);
+			break;
+		default:
+			if (error) *error = vr::TrackedProp_UnknownProperty;
+			return 0;
+		}
+
+		// Same contract as OpenVR, the returned length includes the terminator
+		uint32_t required = (uint32_t)strlen(value) + 1;
+		if (buffer_size < required)
+		{
+			if (error) *error = vr::TrackedProp_BufferTooSmall;
+			return required;
+		}
+
+		memcpy(buffer, value, required);
+		if (error) *error = vr::TrackedProp_Success;
+		return required;
+	}
+
+	float GetFloatTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* error)
+	{
+		if (error) *error = vr::TrackedProp_Success;
+		if (device == vr::k_unTrackedDeviceIndex_Hmd && prop == vr::Prop_DisplayFrequency_Float) return config.refresh_rate;
+		if (device == vr::k_unTrackedDeviceIndex_Hmd && prop == vr::Prop_SecondsFromVsyncToPhotons_Float) return 0.0f;	// photons at vsync
+
+		if (error) *error = vr::TrackedProp_UnknownProperty;
+		return 0.0f;
+	}
+
+	bool GetTimeSinceLastVsync(float* seconds_since_last_vsync, uint64_t* frame_counter)
+	{
+		// Unpaced it's always right on the vsync, and frame_index / rate * rate can round down below it
+		if (!config.pace_frames)
+		{
+			if (seconds_since_last_vsync) *seconds_since_last_vsync = 0.0f;
+			if (frame_counter) *frame_counter = frame_index;
+			return true;
+		}
+
+		double now = GetSimulatedTime();
+		uint64_t vsync = (uint64_t)(now * config.refresh_rate);
+		if (seconds_since_last_vsync) *seconds_since_last_vsync = (float)(now - vsync / (double)config.refresh_rate);
+		if (frame_counter) *frame_counter = vsync;
+		return true;
+	}
+
+	void GetDeviceToAbsoluteTrackingPose(vr::ETrackingUniverseOrigin origin, float seconds_to_photons, vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		double display_time = GetSimulatedTime() + seconds_to_photons;
+		for (uint32_t device = 0; device < pose_count; ++device)
+		{
+			GetScriptedPose(device, display_time, poses[device]);
+		}
+	}
+
+	bool PollNextEvent(vr::VREvent_t* event, uint32_t event_size)
+	{
+		if (next_pending_event >= pending_event_count)
+			return false;
+
+		memcpy(event, &pending_events[next_pending_event++], event_size < sizeof(vr::VREvent_t) ? event_size : sizeof(vr::VREvent_t));
+		return true;
+	}
+
+	bool IsInputFocusCapturedByAnotherProcess() { return false; }
+
+	bool InitCompositor() { return true; }
+
+	vr::EVRCompositorError WaitGetPoses(vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		uint64_t finished_frame = frame_index;
+		uint64_t late_vsyncs = 0;
+		if (config.pace_frames)
+		{
+			// Block until the next vsync like the real compositor does.
+			// If the app has already blown through one or more vsyncs those frames are missed
+			std::chrono::duration<double> period(1.0 / config.refresh_rate);
+			std::chrono::duration<double> since_start = std::chrono::steady_clock::now() - start_time;
+			uint64_t vsyncs_elapsed = (uint64_t)(since_start.count() / period.count());
+			if (vsyncs_elapsed > frame_index)
+			{
+				late_vsyncs = vsyncs_elapsed - frame_index;
+				missed_vsyncs += late_vsyncs;
+				frame_index = vsyncs_elapsed;
+			}
+
+			std::this_thread::sleep_until(start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(period * (double)(frame_index + 1)));
+		}
+
+		// Coming back for poses is when the frame before is finished with
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (finished_frame > 0)
+			AddFrameTiming(finished_frame, late_vsyncs, std::chrono::duration<float, std::milli>(now - last_pose_time).count());
+		last_pose_time = now;
+		frame_index += 1;
+
+		// Poses are predicted to when this frame will be on the display, one frame after vsync
+		double display_time = (frame_index + 1) / (double)config.refresh_rate;
+		for (uint32_t device = 0; device < pose_count; ++device)
+		{
+			GetScriptedPose(device, display_time, poses[device]);
+		}
+		return vr::VRCompositorError_None;
+	}
+
+	vr::EVRCompositorError Submit(vr::Hmd_Eye eye, const vr::Texture_t* texture, const vr::VRTextureBounds_t* bounds)
+	{
+		if (texture == nullptr || texture->handle == nullptr || texture->eType != vr::TextureType_OpenGL)
+			return vr::VRCompositorError_InvalidTexture;
+
+		// The real compositor flushes the app's context on submit, do the same so GPU work gets kicked off at the same point
+		glFlush();
+		submit_count += 1;
+		return vr::VRCompositorError_None;
+	}
+
+	bool GetFrameTiming(vr::Compositor_FrameTiming* timing, uint32_t frames_ago)
+	{
+		if (frames_ago >= frame_timing_count || frames_ago >= frame_timing_history)
+			return false;
+
+		*timing = frame_timings[(frame_timing_count - 1 - frames_ago) % frame_timing_history];
+		return true;
+	}
+
+	vr::EVRRenderModelError LoadRenderModel_Async(const char* name, vr::RenderModel_t** model)
+	{
+		if (strcmp(name, controller_model_name) != 0)
+			return vr::VRRenderModelError_InvalidModel;
+		if (!LoadFinished(model_load_start, render_model_load_seconds))
+			return vr::VRRenderModelError_Loading;
+
+		*model = BuildControllerModel();
+		return vr::VRRenderModelError_None;
+	}
+
+	void FreeRenderModel(vr::RenderModel_t* model)
+	{
+		delete[] model->rVertexData;
+		delete[] model->rIndexData;
+		delete model;
+	}
+
+	vr::EVRRenderModelError LoadTexture_Async(vr::TextureID_t texture_id, vr::RenderModel_TextureMap_t** texture)
+	{
+		if (texture_id != controller_texture_id)
+			return vr::VRRenderModelError_InvalidTexture;
+		if (!LoadFinished(texture_load_start, render_model_texture_load_seconds))
+			return vr::VRRenderModelError_Loading;
+
+		*texture = BuildControllerTexture();
+		return vr::VRRenderModelError_None;
+	}
+
+	void FreeTexture(vr::RenderModel_TextureMap_t* texture)
+	{
+		delete[] texture->rubTextureMapData;
+		delete texture;
+	}
+
+	void Shutdown()
+	{
+		printf("Simulated HMD: %llu vsyncs, %llu missed, %llu eye submits\n",
+			(unsigned long long)frame_index.load(), (unsigned long long)missed_vsyncs, (unsigned long long)submit_count);
+	}
+
+private:
+	// The frame that started at vsync frame, the last one WaitGetPoses returned on. There's no compositor here
+	// and no GPU times, only whether it was late. A frame that was is shown that many vsyncs late,
+	// the one before it scanned out again in the meantime, as if the compositor had reprojected it
+	void AddFrameTiming(uint64_t frame, uint64_t late_vsyncs, float frame_interval_ms)
+	{
+		vr::Compositor_FrameTiming& timing = frame_timings[frame_timing_count % frame_timing_history];
+		memset(&timing, 0, sizeof(timing));
+		timing.m_nSize = sizeof(timing);
+		timing.m_nFrameIndex = (uint32_t)frame;
+		timing.m_nNumFramePresents = 1;
+		timing.m_nNumMisPresented = late_vsyncs > 0 ? 1 : 0;
+		timing.m_nNumDroppedFrames = (uint32_t)late_vsyncs;
+		timing.m_nReprojectionFlags = late_vsyncs > 0 ? vr::VRCompositor_ReprojectionReason_Cpu : 0;
+		timing.m_flSystemTimeInSeconds = frame / (double)config.refresh_rate;
+		timing.m_flClientFrameIntervalMs = frame_interval_ms;
+		frame_timing_count += 1;
+	}
+
+	// The ring between the lens circle and the edge of the target, one quad per segment of the circle,
+	// plus the corner wherever a quad's outer edge turns one
+	void BuildHiddenArea(vr::Hmd_Eye eye, std::vector<vr::HmdVector2_t>& vertices)
+	{
+		// Same extents as GetProjectionMatrix, the view axis is off centre towards the nose
+		float left = eye == vr::Eye_Left ? -fov_outer : -fov_inner;
+		float right = eye == vr::Eye_Left ? fov_inner : fov_outer;
+		float centre_u = -left / (right - left);
+		float centre_v = 0.5f;
+		float radius_u = lens_radius / (right - left);
+		float radius_v = lens_radius / (2.0f * fov_vertical);
+
+		float inner[hidden_area_segments + 1][2];
+		float outer[hidden_area_segments + 1][2];
+		bool outer_on_side[hidden_area_segments + 1];	// on the left or right edge rather than the top or bottom
+		for (int i = 0; i <= hidden_area_segments; ++i)
+		{
+			float angle = 2.0f * pi * (i % hidden_area_segments) / hidden_area_segments;
+			float du = cosf(angle), dv = sinf(angle);
+
+			// Out from the centre until the ray leaves the target, snapped exactly onto the edge
+			float to_edge_u = du > 0.0f ? (1.0f - centre_u) / du : du < 0.0f ? -centre_u / du : 1e9f;
+			float to_edge_v = dv > 0.0f ? (1.0f - centre_v) / dv : dv < 0.0f ? -centre_v / dv : 1e9f;
+			outer_on_side[i] = to_edge_u < to_edge_v;
+			float to_edge = outer_on_side[i] ? to_edge_u : to_edge_v;
+			outer[i][0] = outer_on_side[i] ? (du > 0.0f ? 1.0f : 0.0f) : centre_u + du * to_edge;
+			outer[i][1] = outer_on_side[i] ? centre_v + dv * to_edge : (dv > 0.0f ? 1.0f : 0.0f);
+
+			// Where the circle runs off the target there's nothing to hide
+			float to_lens = 1.0f / sqrtf((du * du) / (radius_u * radius_u) + (dv * dv) / (radius_v * radius_v));
+			inner[i][0] = to_lens < to_edge ? centre_u + du * to_lens : outer[i][0];
+			inner[i][1] = to_lens < to_edge ? centre_v + dv * to_lens : outer[i][1];
+		}
+
+		for (int i = 0; i < hidden_area_segments; ++i)
+		{
+			const float* a = inner[i];
+			const float* b = outer[i];
+			const float* c = outer[i + 1];
+			const float* d = inner[i + 1];
+			if (a[0] != b[0] || a[1] != b[1] || c[0] != d[0] || c[1] != d[1])
+			{
+				AddTriangle(vertices, a, b, c);
+				AddTriangle(vertices, a, c, d);
+			}
+
+			// b and c on different edges, the corner between them isn't covered yet
+			if (outer_on_side[i] != outer_on_side[i + 1])
+			{
+				float corner[2] = { outer_on_side[i] ? b[0] : c[0], outer_on_side[i] ? c[1] : b[1] };
+				AddTriangle(vertices, b, corner, c);
+			}
+		}
+	}
+
+	static void AddTriangle(std::vector<vr::HmdVector2_t>& vertices, const float* a, const float* b, const float* c)
+	{
+		const float* corners[3] = { a, b, c };
+		for (int i = 0; i < 3; ++i)
+		{
+			vr::HmdVector2_t vertex = { { corners[i][0], corners[i][1] } };
+			vertices.push_back(vertex);
+		}
+	}
+
+	// The first call starts the load, true once it's been going for seconds. Like SteamVR, once
+	// something has loaded it's cached and comes back straight away
+	bool LoadFinished(std::chrono::steady_clock::time_point& start, double seconds)
+	{
+		std::lock_guard<std::mutex> lock(render_model_mutex);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (start == std::chrono::steady_clock::time_point())
+			start = now;
+		return std::chrono::duration<double>(now - start).count() >= seconds;
+	}
+
+	// A tube along Z from z_front to z_back, capped at both ends. v runs from v_front to v_back
+	// along the side, u goes round
+	static void AddCylinder(std::vector<vr::RenderModel_Vertex_t>& vertices, std::vector<uint16_t>& indices,
+		float radius_front, float radius_back, float z_front, float z_back, float v_front, float v_back)
+	{
+		const int segments = controller_model_segments;
+		uint16_t side = (uint16_t)vertices.size();
+		for (int i = 0; i <= segments; ++i)
+		{
+			float angle = 2.0f * pi * i / segments;
+			float c = cosf(angle), s = sinf(angle);
+			vr::RenderModel_Vertex_t front = { { { radius_front * c, radius_front * s, z_front } }, { { c, s, 0.0f } }, { (float)i / segments, v_front } };
+			vr::RenderModel_Vertex_t back = { { { radius_back * c, radius_back * s, z_back } }, { { c, s, 0.0f } }, { (float)i / segments, v_back } };
+			vertices.push_back(front);
+			vertices.push_back(back);
+		}
+		for (int i = 0; i < segments; ++i)
+		{
+			uint16_t front = (uint16_t)(side + i * 2), back = (uint16_t)(front + 1);
+			uint16_t quad[6] = { front, (uint16_t)(front + 2), back, (uint16_t)(front + 2), (uint16_t)(back + 2), back };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+
+		// The caps face out along Z, one fan each
+		for (int cap = 0; cap < 2; ++cap)
+		{
+			float z = cap == 0 ? z_front : z_back;
+			float radius = cap == 0 ? radius_front : radius_back;
+			float normal_z = cap == 0 ? -1.0f : 1.0f;
+			uint16_t centre = (uint16_t)vertices.size();
+			vr::RenderModel_Vertex_t middle = { { { 0.0f, 0.0f, z } }, { { 0.0f, 0.0f, normal_z } }, { 0.5f, v_front } };
+			vertices.push_back(middle);
+			for (int i = 0; i <= segments; ++i)
+			{
+				float angle = 2.0f * pi * i / segments;
+				vr::RenderModel_Vertex_t rim = { { { radius * cosf(angle), radius * sinf(angle), z } }, { { 0.0f, 0.0f, normal_z } }, { (float)i / segments, v_front } };
+				vertices.push_back(rim);
+			}
+			for (int i = 0; i < segments; ++i)
+			{
+				uint16_t a = (uint16_t)(centre + 1 + i), b = (uint16_t)(a + 1);
+				uint16_t triangle[3] = { centre, cap == 0 ? b : a, cap == 0 ? a : b };
+				indices.insert(indices.end(), triangle, triangle + 3);
+			}
+		}
+	}
+
+	// Roughly a wand, a ring at the front and the handle running back from it. The pointer comes out along -Z
+	static vr::RenderModel_t* BuildControllerModel()
+	{
+		std::vector<vr::RenderModel_Vertex_t> vertices;
+		std::vector<uint16_t> indices;
+		AddCylinder(vertices, indices, 0.045f, 0.045f, -0.08f, -0.05f, 0.0f, 0.25f);
+		AddCylinder(vertices, indices, 0.022f, 0.018f, -0.05f, 0.12f, 0.25f, 1.0f);
+
+		vr::RenderModel_Vertex_t* vertex_data = new vr::RenderModel_Vertex_t[vertices.size()];
+		uint16_t* index_data = new uint16_t[indices.size()];
+		memcpy(vertex_data, &vertices[0], vertices.size() * sizeof(vr::RenderModel_Vertex_t));
+		memcpy(index_data, &indices[0], indices.size() * sizeof(uint16_t));
+
+		vr::RenderModel_t* model = new vr::RenderModel_t;
+		model->rVertexData = vertex_data;
+		model->unVertexCount = (uint32_t)vertices.size();
+		model->rIndexData = index_data;
+		model->unTriangleCount = (uint32_t)indices.size() / 3;
+		model->diffuseTextureId = controller_texture_id;
+		return model;
+	}
+
+	// Light grey ring, dark grey handle with grip lines across it
+	static vr::RenderModel_TextureMap_t* BuildControllerTexture()
+	{
+		const int size = controller_texture_size;
+		uint8_t* texels = new uint8_t[size * size * 4];
+		for (int y = 0; y < size; ++y)
+		{
+			uint8_t grey = y < size / 4 ? 170 : (y % 8 < 2 ? 90 : 55);
+			for (int x = 0; x < size; ++x)
+			{
+				uint8_t* texel = &texels[(y * size + x) * 4];
+				texel[0] = texel[1] = texel[2] = grey;
+				texel[3] = 255;
+			}
+		}
+
+		vr::RenderModel_TextureMap_t* texture = new vr::RenderModel_TextureMap_t;
+		texture->unWidth = (uint16_t)size;
+		texture->unHeight = (uint16_t)size;
+		texture->rubTextureMapData = texels;
+		return texture;
+	}
+
+	// Seconds on the simulated display's clock. Unpaced, every frame is exactly one vsync long
+	double GetSimulatedTime()
+	{
+		if (!config.pace_frames)
+			return frame_index / (double)config.refresh_rate;
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	void GetScriptedPose(vr::TrackedDeviceIndex_t device, double time, vr::TrackedDevicePose_t& pose)
+	{
+		memset(&pose, 0, sizeof(pose));
+		if (device >= device_count)
+		{
+			pose.eTrackingResult = vr::TrackingResult_Uninitialized;
+			return;
+		}
+
+		pose.bDeviceIsConnected = true;
+		pose.bPoseIsValid = true;
+		pose.eTrackingResult = vr::TrackingResult_Running_OK;
+
+		float t = (float)time;
+		float yaw = 0.0f, pitch = 0.0f, yaw_rate = 0.0f, pitch_rate = 0.0f;
+		float position[3] = { 0.0f, 0.0f, 0.0f };
+		float velocity[3] = { 0.0f, 0.0f, 0.0f };
+
+		if (device == vr::k_unTrackedDeviceIndex_Hmd)
+		{
+			// Standing, looking around slowly and bobbing a little
+			const float yaw_freq = 2.0f * pi * 0.2f, pitch_freq = 2.0f * pi * 0.13f, bob_freq = 2.0f * pi * 0.5f;
+			yaw = 0.7f * sinf(yaw_freq * t);
+			yaw_rate = 0.7f * yaw_freq * cosf(yaw_freq * t);
+			pitch = 0.17f * sinf(pitch_freq * t);
+			pitch_rate = 0.17f * pitch_freq * cosf(pitch_freq * t);
+			position[1] = 1.7f + 0.02f * sinf(bob_freq * t);
+			velocity[1] = 0.02f * bob_freq * cosf(bob_freq * t);
+		}
+		else if (device < first_controller)
+		{
+			// Base stations sit in opposite corners of the room, up high, looking in
+			float side = device == first_base_station ? -1.0f : 1.0f;
+			yaw = side > 0 ? pi * 0.75f : -pi * 0.25f;
+			pitch = -0.5f;
+			position[0] = 2.0f * side;
+			position[1] = 2.4f;
+			position[2] = 2.0f * side;
+		}
+		else
+		{
+			// Hands held out in front, waving the pointer side to side in circles
+			float side = device == first_controller ? -1.0f : 1.0f;
+			const float freq = 2.0f * pi * 0.7f;
+			float phase = side * 0.5f;
+			yaw = 1.0f * sinf(freq * t + phase);
+			yaw_rate = 1.0f * freq * cosf(freq * t + phase);
+			pitch = 0.3f * cosf(freq * t + phase);
+			pitch_rate = -0.3f * freq * sinf(freq * t + phase);
+			position[0] = 0.2f * side + 0.1f * cosf(freq * t);
+			position[1] = 1.1f + 0.1f * sinf(freq * t);
+			position[2] = -0.35f;
+			velocity[0] = -0.1f * freq * sinf(freq * t);
+			velocity[1] = 0.1f * freq * cosf(freq * t);
+		}
+
+		SetPoseMatrix(pose.mDeviceToAbsoluteTracking, yaw, pitch, position);
+		for (int i = 0; i < 3; ++i)
+			pose.vVelocity.v[i] = velocity[i];
+
+		// Angular velocity in tracking space, the yaw axis is always world up
+		// and the pitch axis is the device's own X axis after yawing
+		pose.vAngularVelocity.v[0] = cosf(yaw) * pitch_rate;
+		pose.vAngularVelocity.v[1] = yaw_rate;
+		pose.vAngularVelocity.v[2] = -sinf(yaw) * pitch_rate;
+	}
+
+	SimulatedVRConfig config;
+	uint32_t device_count;
+	std::chrono::steady_clock::time_point start_time;
+	std::atomic<uint64_t> frame_index;		// simulated vsyncs since startup, read from the update thread when the frame loop is pipelined
+	uint64_t missed_vsyncs;
+	uint64_t submit_count;
+
+	vr::Compositor_FrameTiming frame_timings[frame_timing_history];
+	uint32_t frame_timing_count;
+	std::chrono::steady_clock::time_point last_pose_time;
+
+	vr::VREvent_t pending_events[vr::k_unMaxTrackedDeviceCount];
+	std::vector<vr::HmdVector2_t> hidden_area[2];	// per eye, built on first request
+	uint32_t pending_event_count;
+	uint32_t next_pending_event;
+
+	// Render models load on the app's loader thread
+	std::mutex render_model_mutex;
+	std::chrono::steady_clock::time_point model_load_start;		// zero until the first request
+	std::chrono::steady_clock::time_point texture_load_start;
+};
+
+VRBackend* CreateSimulatedVRBackend(const SimulatedVRConfig& config)
+{
+	SimulatedVRConfig checked = config;
+	if (checked.controller_count < 0) checked.controller_count = 0;
+	if (checked.controller_count > 2) checked.controller_count = 2;
+	if (checked.refresh_rate <= 0.0f) checked.refresh_rate = 90.0f;
+
+	return new SimulatedVRBackend(checked);
+}
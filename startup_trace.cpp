@@ -0,0 +1,144 @@
+#include "startup_trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const int max_threads = 8;
+
+	struct PhaseRecord
+	{
+		const char* name;
+		int thread;				// 0 is the one that called StartupTraceBegin
+		double start_ms;		// since StartupTraceBegin
+		double end_ms;			// -1 until it ends
+	};
+
+	std::mutex mutex;
+	Clock::time_point epoch;
+	bool begun = false;
+	PhaseRecord phases[startup_trace_max_phases];
+	int phase_count = 0;
+	std::thread::id threads[max_threads];
+	int thread_count = 0;
+	double first_frame_ms = -1.0;
+
+	double MillisecondsSinceEpoch()
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - epoch).count();
+	}
+
+	// Under the lock
+	int ThreadIndex()
+	{
+		std::thread::id id = std::this_thread::get_id();
+		for (int thread = 0; thread < thread_count; ++thread)
+		{
+			if (threads[thread] == id)
+				return thread;
+		}
+		if (thread_count == max_threads)
+			return max_threads - 1;
+		threads[thread_count] = id;
+		return thread_count++;
+	}
+}
+
+void StartupTraceBegin()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	epoch = Clock::now();
+	begun = true;
+	phase_count = 0;
+	thread_count = 0;
+	first_frame_ms = -1.0;
+	ThreadIndex();
+}
+
+int StartupPhaseBegin(const char* name)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!begun || phase_count == startup_trace_max_phases)
+		return -1;
+
+	PhaseRecord& phase = phases[phase_count];
+	phase.name = name;
+	phase.thread = ThreadIndex();
+	phase.start_ms = MillisecondsSinceEpoch();
+	phase.end_ms = -1.0;
+	return phase_count++;
+}
+
+void StartupPhaseEnd(int phase)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (phase >= 0 && phase < phase_count)
+		phases[phase].end_ms = MillisecondsSinceEpoch();
+}
+
+void StartupTraceFirstFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (begun && first_frame_ms < 0.0)
+		first_frame_ms = MillisecondsSinceEpoch();
+}
+
+void StartupTracePrint()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!begun)
+		return;
+
+	if (first_frame_ms >= 0.0)
+		printf("Startup: %.1f ms to the first frame submitted\n", first_frame_ms);
+	else
+		printf("Startup: no frame was submitted\n");
+
+	printf("  %-24s %6s %9s %9s\n", "phase", "thread", "start ms", "ms");
+	for (int i = 0; i < phase_count; ++i)
+	{
+		const PhaseRecord& phase = phases[i];
+		if (phase.end_ms < 0.0)
+			continue;
+		printf("  %-24s %6d %9.1f %9.1f\n", phase.name, phase.thread, phase.start_ms, phase.end_ms - phase.start_ms);
+	}
+}
+
+bool StartupTraceExport(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+	{
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Timestamps and durations are in microseconds
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+	for (int thread = 1; thread < thread_count; ++thread)
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"startup worker %d\"}}", thread, thread);
+
+	for (int i = 0; i < phase_count; ++i)
+	{
+		const PhaseRecord& phase = phases[i];
+		if (phase.end_ms < 0.0)
+			continue;
+		fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			phase.name, phase.thread, phase.start_ms * 1000.0, (phase.end_ms - phase.start_ms) * 1000.0);
+	}
+	if (first_frame_ms >= 0.0)
+		fprintf(file, ",\n{\"name\":\"first frame submitted\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f}", first_frame_ms * 1000.0);
+	fprintf(file, "\n]}\n");
+
+	fclose(file);
+	printf("Wrote startup trace to %s\n", path);
+	return true;
+}
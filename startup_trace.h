@@ -0,0 +1,33 @@
+#pragma once
+
+// Where the time to the first frame goes
+//
+// Startup is split into named phases, timed from StartupTraceBegin() at the top of main() to the
+// first frame handed to the compositor. Phases can run on any thread and overlap, the ones on
+// other threads than main() get their own tracks in the trace. Unlike the frame profiler this is
+// never compiled out, it's a handful of clock reads once per run.
+
+const int startup_trace_max_phases = 32;	// any more are dropped
+
+void StartupTraceBegin();
+// name has to outlive the trace, a string literal. Returns what to pass to StartupPhaseEnd
+int StartupPhaseBegin(const char* name);
+void StartupPhaseEnd(int phase);
+// Once the first frame has been submitted, only the first call counts
+void StartupTraceFirstFrame();
+
+// Every phase with when it started and how long it took, and the time to the first frame
+void StartupTracePrint();
+// Load in chrome://tracing or ui.perfetto.dev
+bool StartupTraceExport(const char* path);
+
+struct StartupPhase
+{
+	StartupPhase(const char* name) : phase(StartupPhaseBegin(name)) {}
+	~StartupPhase() { StartupPhaseEnd(phase); }
+	int phase;
+};
+
+#define STARTUP_CONCAT_INNER(a, b) a##b
+#define STARTUP_CONCAT(a, b) STARTUP_CONCAT_INNER(a, b)
+#define STARTUP_PHASE(name) StartupPhase STARTUP_CONCAT(startup_phase_, __LINE__)(name)
@@ -0,0 +1,721 @@
+#include "texture_stream.h"
+#include "gl_state.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const int segment_count = 3;				// frames in flight, each gets a third of the ring
+	const uint32_t tail_size = 64;				// levels this size and smaller are never evicted
+	const int max_levels = 32;
+	const int max_uploads_per_frame = 64;		// glTexSubImage2D calls, the small levels are one each
+	const uint32_t copy_chunk_bytes = 256 * 1024;	// the clock is checked between chunks
+
+	enum TextureState
+	{
+		Texture_Free,
+		Texture_Decoding,
+		Texture_Decoded,
+		Texture_Failed
+	};
+
+	struct StreamedTexture
+	{
+		// A decode thread fills these in before setting the state to decoded, after that only the
+		// GL thread touches them
+		std::string path;
+		uint32_t width;
+		uint32_t height;
+		int level_count;
+		std::vector<uint8_t> texels;			// RGBA8, every level, largest first
+		size_t level_offset[max_levels];
+
+		// GL thread only. The texture holds levels resident_top to the last, starting from its own level 0
+		GLuint texture;
+		GLuint next_texture;					// one more level than texture, being streamed into
+		int tail_top;							// the largest level that's never evicted
+		int resident_top;						// the largest level in texture, level_count if there's no texture yet
+		int wanted_top;							// the largest level worth having at the size it's drawn
+		uint64_t last_used_frame;
+		bool used;								// ever
+	};
+
+	TextureStreamConfig config;
+	bool initialised = false;
+
+	// Guards the state of every texture and the decode queue
+	std::mutex mutex;
+	std::condition_variable wake;
+	TextureState texture_state[texture_stream_max_textures];
+	std::deque<int> decode_queue;
+	bool quit = false;
+	std::vector<std::thread> decode_threads;
+
+	StreamedTexture textures[texture_stream_max_textures];
+	bool texture_created[texture_stream_max_textures];		// GL thread's view, has its GL texture
+	int texture_count = 0;
+
+	GLuint ring_buffer = 0;
+	uint32_t segment_bytes = 0;
+	uint8_t* ring_mapped = nullptr;			// persistent mapping of the whole ring
+	bool persistent = false;				// false when GL_ARB_buffer_storage is missing
+	std::vector<uint8_t> staging;			// only used without persistent mapping, laid out like the ring
+	GLsync segment_fence[segment_count] = {};
+
+	// The chain being built, one at a time. Levels upload_top up to upload_end are streamed into its
+	// next_texture, the rest were copied over from its texture
+	int upload_texture = -1;
+	int upload_top = 0;
+	int upload_end = 0;
+	int upload_level = 0;
+	uint32_t upload_row = 0;
+
+	uint64_t frame = 0;
+	uint64_t resident_bytes = 0;
+
+	uint64_t frames_uploading = 0;			// frames that uploaded anything
+	uint64_t bytes_uploaded = 0;
+	uint64_t max_frame_bytes = 0;
+	double upload_ms_total = 0.0;
+	double upload_ms_max = 0.0;
+	uint64_t levels_uploaded = 0;
+	uint64_t levels_evicted = 0;
+	uint64_t ring_stalls = 0;				// frames skipped because the GPU still had the segment
+	uint64_t budget_blocks = 0;				// frames a level was wanted but nothing could be evicted for it
+	uint64_t peak_resident_bytes = 0;
+
+	uint32_t LevelWidth(const StreamedTexture& texture, int level)
+	{
+		return std::max(1u, texture.width >> level);
+	}
+
+	uint32_t LevelHeight(const StreamedTexture& texture, int level)
+	{
+		return std::max(1u, texture.height >> level);
+	}
+
+	uint64_t LevelBytes(const StreamedTexture& texture, int level)
+	{
+		return (uint64_t)LevelWidth(texture, level) * LevelHeight(texture, level) * 4;
+	}
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// Skips whitespace and # comments, then reads one number of a PPM header
+	bool ReadHeaderNumber(const std::vector<uint8_t>& file, size_t& at, uint32_t& value)
+	{
+		while (at < file.size())
+		{
+			if (file[at] == '#')
+			{
+				while (at < file.size() && file[at] != '\n')
+					++at;
+			}
+			else if (file[at] == ' ' || file[at] == '\t' || file[at] == '\r' || file[at] == '\n')
+			{
+				++at;
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		if (at >= file.size() || file[at] < '0' || file[at] > '9')
+			return false;
+		value = 0;
+		while (at < file.size() && file[at] >= '0' && file[at] <= '9')
+			value = value * 10 + (file[at++] - '0');
+		return true;
+	}
+
+	// Binary PPM into level 0 of texture, RGBA8
+	bool DecodePPM(const std::vector<uint8_t>& file, StreamedTexture& texture)
+	{
+		size_t at = 2;
+		uint32_t width = 0, height = 0, max_value = 0;
+		if (file.size() < 2 || file[0] != 'P' || file[1] != '6' ||
+			!ReadHeaderNumber(file, at, width) || !ReadHeaderNumber(file, at, height) || !ReadHeaderNumber(file, at, max_value))
+			return false;
+
+		// Exactly one whitespace character between the header and the pixels
+		at += 1;
+		if (width == 0 || height == 0 || max_value != 255 || file.size() < at + (size_t)width * height * 3)
+			return false;
+
+		texture.width = width;
+		texture.height = height;
+		texture.texels.resize((size_t)width * height * 4);
+		const uint8_t* in = &file[at];
+		uint8_t* out = &texture.texels[0];
+		for (size_t texel = 0; texel < (size_t)width * height; ++texel)
+		{
+			out[texel * 4 + 0] = in[texel * 3 + 0];
+			out[texel * 4 + 1] = in[texel * 3 + 1];
+			out[texel * 4 + 2] = in[texel * 3 + 2];
+			out[texel * 4 + 3] = 255;
+		}
+		return true;
+	}
+
+	// 2x2 box filter down to 1x1, odd edges repeat their last texel
+	void BuildMipChain(StreamedTexture& texture)
+	{
+		texture.level_count = 1;
+		while (texture.level_count < max_levels && (LevelWidth(texture, texture.level_count - 1) > 1 || LevelHeight(texture, texture.level_count - 1) > 1))
+			texture.level_count += 1;
+
+		size_t total = 0;
+		for (int level = 0; level < texture.level_count; ++level)
+		{
+			texture.level_offset[level] = total;
+			total += (size_t)LevelBytes(texture, level);
+		}
+		texture.texels.resize(total);
+
+		for (int level = 1; level < texture.level_count; ++level)
+		{
+			uint32_t source_width = LevelWidth(texture, level - 1), source_height = LevelHeight(texture, level - 1);
+			uint32_t width = LevelWidth(texture, level), height = LevelHeight(texture, level);
+			const uint8_t* source = &texture.texels[texture.level_offset[level - 1]];
+			uint8_t* destination = &texture.texels[texture.level_offset[level]];
+
+			for (uint32_t y = 0; y < height; ++y)
+			{
+				uint32_t y0 = std::min(y * 2, source_height - 1), y1 = std::min(y * 2 + 1, source_height - 1);
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					uint32_t x0 = std::min(x * 2, source_width - 1), x1 = std::min(x * 2 + 1, source_width - 1);
+					for (int channel = 0; channel < 4; ++channel)
+					{
+						uint32_t sum = source[(y0 * source_width + x0) * 4 + channel] + source[(y0 * source_width + x1) * 4 + channel] +
+							source[(y1 * source_width + x0) * 4 + channel] + source[(y1 * source_width + x1) * 4 + channel];
+						destination[(y * width + x) * 4 + channel] = (uint8_t)((sum + 2) / 4);
+					}
+				}
+			}
+		}
+	}
+
+	bool DecodeFile(StreamedTexture& texture)
+	{
+		FILE* file = fopen(texture.path.c_str(), "rb");
+		if (file == nullptr)
+			return false;
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		std::vector<uint8_t> contents(size > 0 ? (size_t)size : 0);
+		bool read = size > 0 && fread(&contents[0], 1, contents.size(), file) == contents.size();
+		fclose(file);
+
+		if (!read || !DecodePPM(contents, texture))
+			return false;
+		BuildMipChain(texture);
+		return true;
+	}
+
+	void DecodeThread()
+	{
+		for (;;)
+		{
+			int index = -1;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, []() { return quit || !decode_queue.empty(); });
+				if (quit)
+					return;
+				index = decode_queue.front();
+				decode_queue.pop_front();
+			}
+
+			bool decoded = DecodeFile(textures[index]);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			texture_state[index] = decoded ? Texture_Decoded : Texture_Failed;
+		}
+	}
+
+	// Decoded files get their GL texture, with no levels in it yet
+	void CreateDecodedTextures()
+	{
+		for (int index = 0; index < texture_count; ++index)
+		{
+			if (texture_created[index])
+				continue;
+
+			TextureState state;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				state = texture_state[index];
+			}
+			if (state == Texture_Failed)
+			{
+				printf("Texture stream: could not decode %s\n", textures[index].path.c_str());
+				texture_created[index] = true;
+				continue;
+			}
+			if (state != Texture_Decoded)
+				continue;
+
+			StreamedTexture& texture = textures[index];
+			texture_created[index] = true;
+			if (LevelWidth(texture, 0) * 4 > segment_bytes)
+			{
+				printf("Texture stream: %s is too wide for the upload ring\n", texture.path.c_str());
+				texture.level_count = 0;
+				continue;
+			}
+
+			texture.tail_top = 0;
+			while (texture.tail_top < texture.level_count - 1 && (LevelWidth(texture, texture.tail_top) > tail_size || LevelHeight(texture, texture.tail_top) > tail_size))
+				texture.tail_top += 1;
+			texture.resident_top = texture.level_count;
+			if (!texture.used)
+				texture.wanted_top = texture.tail_top;
+		}
+	}
+
+	// Decoded and streamable, whether or not any of it is on the GPU yet
+	bool Ready(int index)
+	{
+		return texture_created[index] && textures[index].level_count > 0;
+	}
+
+	uint64_t ChainBytes(const StreamedTexture& texture, int top)
+	{
+		uint64_t bytes = 0;
+		for (int level = top; level < texture.level_count; ++level)
+			bytes += LevelBytes(texture, level);
+		return bytes;
+	}
+
+	// Immutable storage for levels top to the last
+	GLuint CreateChain(const StreamedTexture& texture, int top)
+	{
+		GLuint chain = 0;
+		glGenTextures(1, &chain);
+		GLStateBindTexture(GL_TEXTURE_2D, chain);
+		glTexStorage2D(GL_TEXTURE_2D, texture.level_count - top, GL_RGBA8, LevelWidth(texture, top), LevelHeight(texture, top));
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		GLStateBindTexture(GL_TEXTURE_2D, 0);
+		return chain;
+	}
+
+	// Levels first to the last from the texture's current chain into one that starts at top, on the GPU
+	void CopyResidentLevels(const StreamedTexture& texture, int first, GLuint chain, int top)
+	{
+		for (int level = first; level < texture.level_count; ++level)
+		{
+			glCopyImageSubData(texture.texture, GL_TEXTURE_2D, level - texture.resident_top, 0, 0, 0,
+				chain, GL_TEXTURE_2D, level - top, 0, 0, 0, LevelWidth(texture, level), LevelHeight(texture, level), 1);
+		}
+	}
+
+	// Drops the largest resident level of the least recently used texture that can spare one,
+	// either because it wasn't drawn this frame or because it has more than it's drawn at.
+	// Never from for_texture or anything drawn more recently than it. Returns false if there's nothing
+	bool EvictOne(int for_texture)
+	{
+		int victim = -1;
+		for (int index = 0; index < texture_count; ++index)
+		{
+			if (!Ready(index) || index == for_texture || index == upload_texture)
+				continue;
+			const StreamedTexture& texture = textures[index];
+			if (texture.resident_top >= texture.tail_top)
+				continue;
+
+			bool spare = texture.resident_top < texture.wanted_top;
+			if (!spare && (texture.last_used_frame == frame || texture.last_used_frame > textures[for_texture].last_used_frame))
+				continue;
+
+			if (victim < 0 || texture.last_used_frame < textures[victim].last_used_frame ||
+				(texture.last_used_frame == textures[victim].last_used_frame && texture.resident_top < textures[victim].resident_top))
+				victim = index;
+		}
+		if (victim < 0)
+			return false;
+
+		// Into a chain one level shorter, then the old one goes and takes its memory with it
+		StreamedTexture& texture = textures[victim];
+		int top = texture.resident_top + 1;
+		GLuint chain = CreateChain(texture, top);
+		CopyResidentLevels(texture, top, chain, top);
+		GLStateDeleteTextures(1, &texture.texture);
+		texture.texture = chain;
+		texture.resident_top = top;
+		resident_bytes -= LevelBytes(texture, top - 1);
+		levels_evicted += 1;
+		return true;
+	}
+
+	// Picks the next chain to build and allocates it. Every texture's tail comes first, all in one
+	// go, then one level at a time for whichever texture drawn this frame is furthest from what it wants
+	bool StartNextChain()
+	{
+		int best = -1;
+		bool best_tail = false;
+		int best_gap = 0;
+		for (int index = 0; index < texture_count; ++index)
+		{
+			if (!Ready(index))
+				continue;
+			const StreamedTexture& texture = textures[index];
+			if (texture.resident_top == 0)
+				continue;
+
+			bool tail = texture.resident_top > texture.tail_top;
+			int gap = texture.resident_top - texture.wanted_top;
+			if (!tail && (texture.last_used_frame != frame || gap <= 0))
+				continue;
+
+			if (best < 0 || (tail && !best_tail) || (tail == best_tail && gap > best_gap))
+			{
+				best = index;
+				best_tail = tail;
+				best_gap = gap;
+			}
+		}
+		if (best < 0)
+			return false;
+
+		// Both chains are there until the new one is finished
+		StreamedTexture& texture = textures[best];
+		int top = best_tail ? texture.tail_top : texture.resident_top - 1;
+		uint64_t bytes = ChainBytes(texture, top);
+		while (resident_bytes + bytes > config.budget_bytes)
+		{
+			if (!EvictOne(best))
+			{
+				// The tail goes in regardless, everything has to be drawable
+				if (best_tail)
+					break;
+				budget_blocks += 1;
+				return false;
+			}
+		}
+
+		texture.next_texture = CreateChain(texture, top);
+		if (!best_tail)
+			CopyResidentLevels(texture, texture.resident_top, texture.next_texture, top);
+		resident_bytes += bytes;
+		peak_resident_bytes = std::max(peak_resident_bytes, resident_bytes);
+
+		upload_texture = best;
+		upload_top = top;
+		upload_end = best_tail ? texture.level_count : texture.resident_top;
+		upload_level = top;
+		upload_row = 0;
+		return true;
+	}
+
+	// The new chain is complete, it replaces the old one
+	void FinishChain()
+	{
+		StreamedTexture& texture = textures[upload_texture];
+		if (texture.texture)
+		{
+			GLStateDeleteTextures(1, &texture.texture);
+			resident_bytes -= ChainBytes(texture, texture.resident_top);
+		}
+		texture.texture = texture.next_texture;
+		texture.next_texture = 0;
+		texture.resident_top = upload_top;
+		levels_uploaded += upload_end - upload_top;
+		upload_texture = -1;
+	}
+}
+
+bool TextureStreamInit(const TextureStreamConfig& stream_config)
+{
+	// Levels come and go by copying between immutable chains
+	if (!GLEW_ARB_texture_storage || !GLEW_ARB_copy_image)
+	{
+		printf("Texture stream: needs GL_ARB_texture_storage and GL_ARB_copy_image\n");
+		return false;
+	}
+
+	config = stream_config;
+	segment_bytes = (config.ring_bytes / segment_count) & ~3u;
+	GLsizeiptr ring_size = (GLsizeiptr)segment_bytes * segment_count;
+
+	glGenBuffers(1, &ring_buffer);
+	GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring_buffer);
+	persistent = GLEW_ARB_buffer_storage != 0;
+	if (persistent)
+	{
+		// Mapped once for good, coherent so there's nothing to flush
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ring_size, nullptr, flags);
+		ring_mapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ring_size, flags);
+		if (ring_mapped == nullptr)
+		{
+			printf("Texture stream: could not map the upload ring\n");
+			GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			GLStateDeleteBuffers(1, &ring_buffer);
+			ring_buffer = 0;
+			return false;
+		}
+	}
+	else
+	{
+		// Fallback, copy into system memory and from there into that frame's segment
+		printf("Texture stream: GL_ARB_buffer_storage not available, using glBufferSubData\n");
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, ring_size, nullptr, GL_STREAM_DRAW);
+		staging.resize((size_t)ring_size);
+	}
+	GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	for (int index = 0; index < texture_stream_max_textures; ++index)
+	{
+		texture_state[index] = Texture_Free;
+		texture_created[index] = false;
+	}
+	texture_count = 0;
+	quit = false;
+	for (int thread = 0; thread < std::max(1, config.decode_threads); ++thread)
+		decode_threads.push_back(std::thread(DecodeThread));
+
+	initialised = true;
+	printf("Texture stream: %.0f MB budget, %.1f ms and %.1f MB of uploads a frame, %d decode threads\n",
+		config.budget_bytes / (1024.0 * 1024.0), config.upload_ms, segment_bytes / (1024.0 * 1024.0), (int)decode_threads.size());
+	return true;
+}
+
+void TextureStreamShutdown()
+{
+	if (!initialised)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+		decode_queue.clear();
+	}
+	wake.notify_all();
+	for (size_t thread = 0; thread < decode_threads.size(); ++thread)
+		decode_threads[thread].join();
+	decode_threads.clear();
+
+	for (int index = 0; index < texture_count; ++index)
+	{
+		GLStateDeleteTextures(1, &textures[index].texture);
+		GLStateDeleteTextures(1, &textures[index].next_texture);
+		textures[index] = StreamedTexture();
+	}
+	texture_count = 0;
+	resident_bytes = 0;
+	upload_texture = -1;
+
+	for (int segment = 0; segment < segment_count; ++segment)
+	{
+		if (segment_fence[segment])
+			glDeleteSync(segment_fence[segment]);
+		segment_fence[segment] = 0;
+	}
+	if (persistent)
+	{
+		GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring_buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	ring_mapped = nullptr;
+	GLStateDeleteBuffers(1, &ring_buffer);
+	ring_buffer = 0;
+	initialised = false;
+}
+
+int TextureStreamLoad(const char* path)
+{
+	if (!initialised || texture_count == texture_stream_max_textures)
+		return -1;
+
+	int index = texture_count++;
+	StreamedTexture& texture = textures[index];
+	texture = StreamedTexture();
+	texture.path = path;
+	texture.texture = 0;
+	texture.used = false;
+	texture.last_used_frame = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		texture_state[index] = Texture_Decoding;
+		decode_queue.push_back(index);
+	}
+	wake.notify_one();
+	return index;
+}
+
+void TextureStreamUse(int texture_index, float screen_pixels)
+{
+	if (texture_index < 0 || texture_index >= texture_count)
+		return;
+
+	// Until it's decoded there's no size to compare with, the first use after that counts
+	StreamedTexture& texture = textures[texture_index];
+	int wanted = 0;
+	if (Ready(texture_index))
+	{
+		float texels_per_pixel = LevelWidth(texture, 0) / std::max(screen_pixels, 1.0f);
+		while (wanted < texture.tail_top && texels_per_pixel >= 2.0f)
+		{
+			texels_per_pixel *= 0.5f;
+			wanted += 1;
+		}
+	}
+
+	// The biggest it's drawn at this frame decides
+	if (texture.last_used_frame != frame || !texture.used)
+		texture.wanted_top = wanted;
+	else
+		texture.wanted_top = std::min(texture.wanted_top, wanted);
+	texture.last_used_frame = frame;
+	texture.used = true;
+}
+
+void TextureStreamUpdate()
+{
+	if (!initialised)
+		return;
+
+	PROFILE_SCOPE(ProfileStage_TextureUpload);
+	Clock::time_point start = Clock::now();
+	CreateDecodedTextures();
+
+	// The GPU should have finished with this segment two frames ago, if it hasn't, skip a frame
+	// rather than wait
+	int segment = (int)(frame % segment_count);
+	bool segment_free = true;
+	if (segment_fence[segment])
+	{
+		if (glClientWaitSync(segment_fence[segment], 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			segment_free = false;
+			ring_stalls += 1;
+		}
+		else
+		{
+			glDeleteSync(segment_fence[segment]);
+			segment_fence[segment] = 0;
+		}
+	}
+
+	// Copy as many rows as fit in the segment and the time, nothing new is drawn from until its
+	// whole chain is in
+	uint32_t segment_used = 0;
+	int upload_calls = 0;
+	uint8_t* ring = persistent ? ring_mapped : &staging[0];
+	while (segment_free && upload_calls < max_uploads_per_frame && MillisecondsSince(start) < config.upload_ms)
+	{
+		if (upload_texture < 0 && !StartNextChain())
+			break;
+
+		StreamedTexture& texture = textures[upload_texture];
+		uint32_t width = LevelWidth(texture, upload_level), height = LevelHeight(texture, upload_level);
+		uint32_t row_bytes = width * 4;
+		uint32_t rows = std::min(height - upload_row, (segment_bytes - segment_used) / row_bytes);
+		if (rows == 0)
+			break;
+
+		uint32_t ring_offset = segment * segment_bytes + segment_used;
+		const uint8_t* source = &texture.texels[texture.level_offset[upload_level] + (size_t)upload_row * row_bytes];
+		uint32_t chunk_rows = std::max(1u, copy_chunk_bytes / row_bytes);
+		uint32_t copied_rows = 0;
+		while (copied_rows < rows)
+		{
+			uint32_t chunk = std::min(chunk_rows, rows - copied_rows);
+			memcpy(ring + ring_offset + copied_rows * row_bytes, source + (size_t)copied_rows * row_bytes, (size_t)chunk * row_bytes);
+			copied_rows += chunk;
+			if (MillisecondsSince(start) >= config.upload_ms)
+				break;
+		}
+
+		// Only bound around the upload itself
+		GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring_buffer);
+		if (!persistent)
+			glBufferSubData(GL_PIXEL_UNPACK_BUFFER, ring_offset, copied_rows * row_bytes, ring + ring_offset);
+		GLStateBindTexture(GL_TEXTURE_2D, texture.next_texture);
+		glTexSubImage2D(GL_TEXTURE_2D, upload_level - upload_top, 0, upload_row, width, copied_rows, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)(uintptr_t)ring_offset);
+		GLStateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		upload_calls += 1;
+
+		segment_used += copied_rows * row_bytes;
+		upload_row += copied_rows;
+		if (upload_row == height)
+		{
+			upload_level += 1;
+			upload_row = 0;
+			if (upload_level == upload_end)
+				FinishChain();
+		}
+	}
+	GLStateBindTexture(GL_TEXTURE_2D, 0);
+	if (segment_used > 0)
+		segment_fence[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	double ms = MillisecondsSince(start);
+	if (segment_used > 0)
+	{
+		frames_uploading += 1;
+		bytes_uploaded += segment_used;
+		max_frame_bytes = std::max<uint64_t>(max_frame_bytes, segment_used);
+		upload_ms_total += ms;
+		upload_ms_max = std::max(upload_ms_max, ms);
+	}
+	PROFILE_COUNTER(ProfileCounter_TextureUploadBytes, segment_used);
+	frame += 1;
+}
+
+GLuint TextureStreamGetTexture(int texture_index)
+{
+	if (texture_index < 0 || texture_index >= texture_count || !Ready(texture_index))
+		return 0;
+	return textures[texture_index].texture;
+}
+
+void TextureStreamPrintStats()
+{
+	if (!initialised || texture_count == 0)
+		return;
+
+	int drawable = 0, complete = 0;
+	for (int index = 0; index < texture_count; ++index)
+	{
+		if (TextureStreamGetTexture(index) != 0)
+			drawable += 1;
+		if (Ready(index) && textures[index].resident_top == 0)
+			complete += 1;
+	}
+
+	printf("Texture stream: %d textures, %d drawable, %d with every level, %.1f MB resident (peak %.1f MB) of a %.0f MB budget\n",
+		texture_count, drawable, complete, resident_bytes / (1024.0 * 1024.0), peak_resident_bytes / (1024.0 * 1024.0), config.budget_bytes / (1024.0 * 1024.0));
+	if (frames_uploading > 0)
+	{
+		printf("Texture stream: uploaded %.1f MB in %llu levels over %llu frames, avg %.2f MB %.3f ms a frame, max %.2f MB %.3f ms\n",
+			bytes_uploaded / (1024.0 * 1024.0), (unsigned long long)levels_uploaded, (unsigned long long)frames_uploading,
+			bytes_uploaded / (1024.0 * 1024.0) / frames_uploading, upload_ms_total / frames_uploading,
+			max_frame_bytes / (1024.0 * 1024.0), upload_ms_max);
+	}
+	printf("Texture stream: %llu levels evicted, %llu frames the budget held a level back, %llu frames skipped with the GPU still on the ring\n",
+		(unsigned long long)levels_evicted, (unsigned long long)budget_blocks, (unsigned long long)ring_stalls);
+}
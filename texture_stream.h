@@ -0,0 +1,56 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+// Textures streamed in a mip level at a time under a GPU memory budget
+//
+// Files are decoded and mipmapped on worker threads. Levels go up to the GPU from the smallest
+// up, a few rows at a time, through a ring of pixel buffer memory split into one segment per
+// frame in flight, so an upload never waits on the GPU and never takes more than upload_ms of a
+// frame. Each texture's resident levels live in an immutable chain. A bigger level goes into a
+// new chain one level longer, the levels already there are copied across on the GPU and the new
+// chain replaces the old one once the last row is in, so a texture is never drawn half uploaded.
+// Levels a texture doesn't need for the size it's drawn at aren't fetched, and when the budget is
+// full the least recently used textures are copied into shorter chains, dropping their largest
+// level. The last few small levels of every texture come in first and stay, so it can always be
+// drawn.
+//
+// Per frame, on the GL thread:
+//   TextureStreamUse(...) for every texture about to be drawn
+//   TextureStreamUpdate()
+//   TextureStreamGetTexture(...) when drawing
+
+struct TextureStreamConfig
+{
+	uint64_t budget_bytes;		// GPU memory every streamed texture's resident levels can take together
+	float upload_ms;			// CPU time per frame for copying and issuing uploads
+	uint32_t ring_bytes;		// pixel buffer memory for uploads, one third of it a frame
+	int decode_threads;
+
+	TextureStreamConfig() : budget_bytes(64ull << 20), upload_ms(1.0f), ring_bytes(12u << 20), decode_threads(2) {}
+};
+
+const int texture_stream_max_textures = 256;
+
+// Call with the context current. Returns false without GL_ARB_texture_storage and
+// GL_ARB_copy_image or if the upload ring couldn't be made
+bool TextureStreamInit(const TextureStreamConfig& config);
+void TextureStreamShutdown();
+
+// Queues the file for decoding, binary PPM (P6) with 8 bit channels. Returns the texture's
+// handle, or -1 if there's no room for another. A file that won't decode is reported once and
+// never becomes drawable
+int TextureStreamLoad(const char* path);
+
+// The texture will be drawn this frame covering screen_pixels across, which picks how many
+// levels it's worth having and marks it as recently used
+void TextureStreamUse(int texture, float screen_pixels);
+// Picks up decoded files, evicts and fetches levels against the budget and uploads
+void TextureStreamUpdate();
+// 0 until the texture has something to draw with. Mipmapped, trilinear filtered and repeating
+GLuint TextureStreamGetTexture(int texture);
+
+// Bytes and time spent uploading per frame, what's resident against the budget and evictions
+void TextureStreamPrintStats();
@@ -0,0 +1,683 @@
+// Offline converter from OBJ and glTF 2.0 to the app's binary mesh format
+//
+//   mesh_convert input.obj|input.gltf|input.glb output.hvm
+//
+// Everything in the input is flattened into one mesh. OBJ positions and normals are used
+// as they are, materials and texture coordinates are dropped. glTF triangle primitives are
+// placed with their node transforms, buffers can be .bin files next to the .gltf, base64
+// data URIs or the binary chunk of a .glb.
+//
+// Build with the mesh format from the app:
+//   g++ -O2 -std=c++11 tools/mesh_convert.cpp mesh_format.cpp -o mesh_convert
+
+#include "../mesh_format.h"
+
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// What every input format gets turned into before BuildMeshFile
+	struct Geometry
+	{
+		std::vector<float> positions;
+		std::vector<float> normals;		// empty, or one per position
+		std::vector<uint32_t> indices;
+	};
+
+	bool ReadFile(const std::string& path, std::vector<uint8_t>& contents)
+	{
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+		{
+			printf("Could not open %s\n", path.c_str());
+			return false;
+		}
+
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		contents.resize(size > 0 ? (size_t)size : 0);
+		size_t read = contents.empty() ? 0 : fread(&contents[0], 1, contents.size(), file);
+		fclose(file);
+		if (read != contents.size())
+		{
+			printf("Could not read %s\n", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	/* OBJ */
+
+	// OBJ indices start at 1, negative ones count back from the end
+	bool ResolveObjIndex(long index, size_t count, uint32_t& out)
+	{
+		long resolved = index > 0 ? index - 1 : (long)count + index;
+		if (index == 0 || resolved < 0 || (size_t)resolved >= count)
+			return false;
+		out = (uint32_t)resolved;
+		return true;
+	}
+
+	bool LoadObj(const std::string& path, Geometry& geometry)
+	{
+		std::vector<uint8_t> contents;
+		if (!ReadFile(path, contents))
+			return false;
+		contents.push_back('\0');
+
+		std::vector<float> positions, normals;
+		// v/vn pairs already turned into output vertices
+		std::unordered_map<uint64_t, uint32_t> vertex_lookup;
+		std::vector<uint32_t> face;
+		bool any_normals = false, missing_normals = false;
+		int line_number = 0;
+
+		const char* cursor = (const char*)&contents[0];
+		while (*cursor)
+		{
+			line_number += 1;
+			const char* line = cursor;
+			while (*cursor && *cursor != '\n') ++cursor;
+			const char* line_end = cursor;
+			if (*cursor) ++cursor;
+
+			while (line < line_end && (*line == ' ' || *line == '\t')) ++line;
+
+			if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+			{
+				char* end = (char*)line + 1;
+				for (int axis = 0; axis < 3; ++axis)
+					positions.push_back(strtof(end, &end));
+			}
+			else if (line[0] == 'v' && line[1] == 'n')
+			{
+				char* end = (char*)line + 2;
+				for (int axis = 0; axis < 3; ++axis)
+					normals.push_back(strtof(end, &end));
+			}
+			else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+			{
+				face.clear();
+				const char* corner = line + 1;
+				while (corner < line_end)
+				{
+					while (corner < line_end && (*corner == ' ' || *corner == '\t' || *corner == '\r')) ++corner;
+					if (corner >= line_end)
+						break;
+
+					// v, v/vt, v//vn or v/vt/vn
+					char* end = nullptr;
+					long position_index = strtol(corner, &end, 10);
+					long normal_index = 0;
+					if (*end == '/')
+					{
+						++end;
+						if (*end != '/') strtol(end, &end, 10);
+						if (*end == '/') normal_index = strtol(end + 1, &end, 10);
+					}
+					corner = end;
+
+					uint32_t position = 0, normal = UINT32_MAX;
+					if (!ResolveObjIndex(position_index, positions.size() / 3, position)
+						|| (normal_index != 0 && !ResolveObjIndex(normal_index, normals.size() / 3, normal)))
+					{
+						printf("%s:%d: face index out of range\n", path.c_str(), line_number);
+						return false;
+					}
+					any_normals = any_normals || normal != UINT32_MAX;
+					missing_normals = missing_normals || normal == UINT32_MAX;
+
+					uint64_t key = ((uint64_t)normal << 32) | position;
+					std::unordered_map<uint64_t, uint32_t>::iterator found = vertex_lookup.find(key);
+					if (found == vertex_lookup.end())
+					{
+						uint32_t vertex = (uint32_t)(geometry.positions.size() / 3);
+						found = vertex_lookup.insert(std::make_pair(key, vertex)).first;
+						geometry.positions.insert(geometry.positions.end(), &positions[position * 3], &positions[position * 3] + 3);
+						for (int axis = 0; axis < 3; ++axis)
+							geometry.normals.push_back(normal != UINT32_MAX ? normals[normal * 3 + axis] : 0.0f);
+					}
+					face.push_back(found->second);
+				}
+
+				// Polygons become fans
+				for (size_t i = 2; i < face.size(); ++i)
+				{
+					geometry.indices.push_back(face[0]);
+					geometry.indices.push_back(face[i - 1]);
+					geometry.indices.push_back(face[i]);
+				}
+			}
+		}
+
+		// Half done normals are worse than none, let the format work them all out
+		if (!any_normals || missing_normals)
+			geometry.normals.clear();
+		return true;
+	}
+
+	/* JSON, just enough for glTF */
+
+	struct JsonValue
+	{
+		enum Type { Null, Bool, Number, String, Array, Object } type;
+		double number;
+		std::string string;
+		std::vector<JsonValue> array;
+		std::map<std::string, JsonValue> object;
+
+		JsonValue() : type(Null), number(0.0) {}
+
+		const JsonValue& operator[](const char* key) const
+		{
+			static const JsonValue null_value;
+			std::map<std::string, JsonValue>::const_iterator found = object.find(key);
+			return found != object.end() ? found->second : null_value;
+		}
+		const JsonValue& operator[](int index) const
+		{
+			static const JsonValue null_value;
+			return index >= 0 && (size_t)index < array.size() ? array[index] : null_value;
+		}
+		bool IsNull() const { return type == Null; }
+		int AsInt(int fallback = -1) const { return type == Number ? (int)number : fallback; }
+		float AsFloat(float fallback = 0.0f) const { return type == Number ? (float)number : fallback; }
+	};
+
+	struct JsonParser
+	{
+		const char* cursor;
+		const char* end;
+
+		void SkipSpace()
+		{
+			while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')) ++cursor;
+		}
+
+		bool Expect(char c)
+		{
+			SkipSpace();
+			if (cursor >= end || *cursor != c)
+				return false;
+			++cursor;
+			return true;
+		}
+
+		bool ParseString(std::string& out)
+		{
+			if (!Expect('"'))
+				return false;
+			out.clear();
+			while (cursor < end && *cursor != '"')
+			{
+				char c = *cursor++;
+				if (c == '\\' && cursor < end)
+				{
+					char escaped = *cursor++;
+					switch (escaped)
+					{
+					case 'n': out += '\n'; break;
+					case 't': out += '\t'; break;
+					case 'r': out += '\r'; break;
+					case 'b': out += '\b'; break;
+					case 'f': out += '\f'; break;
+					case 'u':
+						// Only ever in names here, keep it as a placeholder rather than decoding UTF-16
+						cursor += cursor + 4 <= end ? 4 : end - cursor;
+						out += '?';
+						break;
+					default: out += escaped; break;
+					}
+				}
+				else
+				{
+					out += c;
+				}
+			}
+			return Expect('"');
+		}
+
+		bool Parse(JsonValue& value)
+		{
+			SkipSpace();
+			if (cursor >= end)
+				return false;
+
+			char c = *cursor;
+			if (c == '{')
+			{
+				++cursor;
+				value.type = JsonValue::Object;
+				SkipSpace();
+				if (cursor < end && *cursor == '}') { ++cursor; return true; }
+				do
+				{
+					std::string key;
+					if (!ParseString(key) || !Expect(':') || !Parse(value.object[key]))
+						return false;
+				} while (Expect(','));
+				return Expect('}');
+			}
+			if (c == '[')
+			{
+				++cursor;
+				value.type = JsonValue::Array;
+				SkipSpace();
+				if (cursor < end && *cursor == ']') { ++cursor; return true; }
+				do
+				{
+					value.array.push_back(JsonValue());
+					if (!Parse(value.array.back()))
+						return false;
+				} while (Expect(','));
+				return Expect(']');
+			}
+			if (c == '"')
+			{
+				value.type = JsonValue::String;
+				return ParseString(value.string);
+			}
+			if (strncmp(cursor, "true", 4) == 0) { cursor += 4; value.type = JsonValue::Bool; value.number = 1.0; return true; }
+			if (strncmp(cursor, "false", 5) == 0) { cursor += 5; value.type = JsonValue::Bool; value.number = 0.0; return true; }
+			if (strncmp(cursor, "null", 4) == 0) { cursor += 4; value.type = JsonValue::Null; return true; }
+
+			char* number_end = nullptr;
+			value.number = strtod(cursor, &number_end);
+			if (number_end == cursor)
+				return false;
+			value.type = JsonValue::Number;
+			cursor = number_end;
+			return true;
+		}
+	};
+
+	/* glTF */
+
+	bool DecodeBase64(const char* text, std::vector<uint8_t>& out)
+	{
+		static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		uint32_t bits = 0;
+		int bit_count = 0;
+		for (const char* c = text; *c && *c != '='; ++c)
+		{
+			const char* found = strchr(alphabet, *c);
+			if (found == nullptr || *c == '\0')
+				return false;
+			bits = (bits << 6) | (uint32_t)(found - alphabet);
+			bit_count += 6;
+			if (bit_count >= 8)
+			{
+				bit_count -= 8;
+				out.push_back((uint8_t)(bits >> bit_count));
+			}
+		}
+		return true;
+	}
+
+	// Column major 4x4, same as glTF stores them
+	struct Matrix
+	{
+		float m[16];
+	};
+
+	Matrix Identity()
+	{
+		Matrix result;
+		memset(result.m, 0, sizeof(result.m));
+		result.m[0] = result.m[5] = result.m[10] = result.m[15] = 1.0f;
+		return result;
+	}
+
+	Matrix Multiply(const Matrix& a, const Matrix& b)
+	{
+		Matrix result;
+		for (int column = 0; column < 4; ++column)
+			for (int row = 0; row < 4; ++row)
+				result.m[column * 4 + row] = a.m[0 * 4 + row] * b.m[column * 4 + 0] + a.m[1 * 4 + row] * b.m[column * 4 + 1]
+					+ a.m[2 * 4 + row] * b.m[column * 4 + 2] + a.m[3 * 4 + row] * b.m[column * 4 + 3];
+		return result;
+	}
+
+	Matrix NodeTransform(const JsonValue& node)
+	{
+		Matrix result = Identity();
+		if (node["matrix"].array.size() == 16)
+		{
+			for (int i = 0; i < 16; ++i)
+				result.m[i] = node["matrix"][i].AsFloat();
+			return result;
+		}
+
+		// T * R * S
+		float t[3] = { node["translation"][0].AsFloat(0.0f), node["translation"][1].AsFloat(0.0f), node["translation"][2].AsFloat(0.0f) };
+		float q[4] = { node["rotation"][0].AsFloat(0.0f), node["rotation"][1].AsFloat(0.0f), node["rotation"][2].AsFloat(0.0f), node["rotation"][3].AsFloat(1.0f) };
+		float s[3] = { node["scale"][0].AsFloat(1.0f), node["scale"][1].AsFloat(1.0f), node["scale"][2].AsFloat(1.0f) };
+		float x = q[0], y = q[1], z = q[2], w = q[3];
+		float rotation[9] =
+		{
+			1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+			2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+			2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)
+		};
+		for (int column = 0; column < 3; ++column)
+			for (int row = 0; row < 3; ++row)
+				result.m[column * 4 + row] = rotation[column * 3 + row] * s[column];
+		result.m[12] = t[0];
+		result.m[13] = t[1];
+		result.m[14] = t[2];
+		return result;
+	}
+
+	struct Gltf
+	{
+		JsonValue json;
+		std::vector<std::vector<uint8_t> > buffers;
+	};
+
+	// Pointer to the first element of an accessor, its stride and count. Null if it's not something we can read
+	const uint8_t* AccessorData(const Gltf& gltf, int accessor_index, int expected_components, size_t& stride, size_t& count, int& component_type)
+	{
+		const JsonValue& accessor = gltf.json["accessors"][accessor_index];
+		const JsonValue& view = gltf.json["bufferViews"][accessor["bufferView"].AsInt()];
+		int buffer_index = view["buffer"].AsInt();
+		if (accessor.IsNull() || view.IsNull() || buffer_index < 0 || buffer_index >= (int)gltf.buffers.size())
+			return nullptr;
+
+		static const char* type_names[] = { "", "SCALAR", "VEC2", "VEC3", "VEC4" };
+		if (accessor["type"].string != type_names[expected_components])
+			return nullptr;
+
+		component_type = accessor["componentType"].AsInt();
+		size_t component_size = component_type == 5121 ? 1 : (component_type == 5123 ? 2 : 4);
+		size_t element_size = component_size * expected_components;
+		stride = view["byteStride"].AsInt(0) > 0 ? (size_t)view["byteStride"].AsInt() : element_size;
+		count = (size_t)accessor["count"].AsInt(0);
+
+		size_t offset = (size_t)view["byteOffset"].AsInt(0) + (size_t)accessor["byteOffset"].AsInt(0);
+		const std::vector<uint8_t>& buffer = gltf.buffers[buffer_index];
+		if (count == 0 || offset + (count - 1) * stride + element_size > buffer.size())
+			return nullptr;
+		return &buffer[offset];
+	}
+
+	bool AddPrimitive(const Gltf& gltf, const JsonValue& primitive, const Matrix& transform, Geometry& geometry)
+	{
+		// Triangles only, the default mode
+		if (primitive["mode"].AsInt(4) != 4)
+			return true;
+
+		size_t position_stride = 0, position_count = 0;
+		int position_type = 0;
+		const uint8_t* positions = AccessorData(gltf, primitive["attributes"]["POSITION"].AsInt(), 3, position_stride, position_count, position_type);
+		if (positions == nullptr || position_type != 5126)
+		{
+			printf("Skipping a primitive without float positions\n");
+			return true;
+		}
+
+		size_t normal_stride = 0, normal_count = 0;
+		int normal_type = 0;
+		const uint8_t* normals = primitive["attributes"]["NORMAL"].IsNull() ? nullptr
+			: AccessorData(gltf, primitive["attributes"]["NORMAL"].AsInt(), 3, normal_stride, normal_count, normal_type);
+		if (normals && (normal_type != 5126 || normal_count != position_count))
+			normals = nullptr;
+
+		uint32_t first_vertex = (uint32_t)(geometry.positions.size() / 3);
+		for (size_t vertex = 0; vertex < position_count; ++vertex)
+		{
+			const float* p = (const float*)(positions + vertex * position_stride);
+			for (int row = 0; row < 3; ++row)
+				geometry.positions.push_back(transform.m[row] * p[0] + transform.m[4 + row] * p[1] + transform.m[8 + row] * p[2] + transform.m[12 + row]);
+
+			// Rotation and uniform scale only, the format renormalises anyway
+			float n[3] = { 0.0f, 0.0f, 0.0f };
+			if (normals)
+			{
+				const float* source = (const float*)(normals + vertex * normal_stride);
+				for (int row = 0; row < 3; ++row)
+					n[row] = transform.m[row] * source[0] + transform.m[4 + row] * source[1] + transform.m[8 + row] * source[2];
+			}
+			geometry.normals.insert(geometry.normals.end(), n, n + 3);
+		}
+
+		if (primitive["indices"].IsNull())
+		{
+			for (size_t vertex = 0; vertex + 2 < position_count; vertex += 3)
+				for (int corner = 0; corner < 3; ++corner)
+					geometry.indices.push_back(first_vertex + (uint32_t)(vertex + corner));
+			return true;
+		}
+
+		size_t index_stride = 0, index_count = 0;
+		int index_type = 0;
+		const uint8_t* indices = AccessorData(gltf, primitive["indices"].AsInt(), 1, index_stride, index_count, index_type);
+		if (indices == nullptr)
+		{
+			printf("Bad index accessor\n");
+			return false;
+		}
+		for (size_t i = 0; i + 2 < index_count; i += 3)
+		{
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint8_t* source = indices + (i + corner) * index_stride;
+				uint32_t index = index_type == 5121 ? *source : (index_type == 5123 ? *(const uint16_t*)source : *(const uint32_t*)source);
+				if (index >= position_count)
+				{
+					printf("Index %u out of range\n", index);
+					return false;
+				}
+				geometry.indices.push_back(first_vertex + index);
+			}
+		}
+		return true;
+	}
+
+	bool AddNode(const Gltf& gltf, int node_index, const Matrix& parent, Geometry& geometry, int depth)
+	{
+		const JsonValue& node = gltf.json["nodes"][node_index];
+		if (node.IsNull() || depth > 64)
+			return false;
+
+		Matrix transform = Multiply(parent, NodeTransform(node));
+		if (!node["mesh"].IsNull())
+		{
+			const JsonValue& primitives = gltf.json["meshes"][node["mesh"].AsInt()]["primitives"];
+			for (size_t i = 0; i < primitives.array.size(); ++i)
+				if (!AddPrimitive(gltf, primitives[i], transform, geometry))
+					return false;
+		}
+
+		const JsonValue& children = node["children"];
+		for (size_t i = 0; i < children.array.size(); ++i)
+			if (!AddNode(gltf, children[i].AsInt(), transform, geometry, depth + 1))
+				return false;
+		return true;
+	}
+
+	bool LoadGltf(const std::string& path, bool binary, Geometry& geometry)
+	{
+		std::vector<uint8_t> contents;
+		if (!ReadFile(path, contents))
+			return false;
+
+		// A .glb is a 12 byte header then chunks, JSON first and optionally the binary buffer
+		const char* json_start = (const char*)contents.data();
+		size_t json_size = contents.size();
+		std::vector<uint8_t> binary_chunk;
+		if (binary)
+		{
+			if (contents.size() < 20 || memcmp(&contents[0], "glTF", 4) != 0)
+			{
+				printf("%s is not a binary glTF file\n", path.c_str());
+				return false;
+			}
+			size_t offset = 12;
+			json_size = 0;
+			while (offset + 8 <= contents.size())
+			{
+				uint32_t chunk_size = *(const uint32_t*)&contents[offset];
+				uint32_t chunk_type = *(const uint32_t*)&contents[offset + 4];
+				if (offset + 8 + chunk_size > contents.size())
+					break;
+				if (chunk_type == 0x4E4F534A)		// "JSON"
+				{
+					json_start = (const char*)&contents[offset + 8];
+					json_size = chunk_size;
+				}
+				else if (chunk_type == 0x004E4942)	// "BIN\0"
+				{
+					binary_chunk.assign(contents.begin() + offset + 8, contents.begin() + offset + 8 + chunk_size);
+				}
+				offset += 8 + ((chunk_size + 3) & ~3u);
+			}
+		}
+
+		Gltf gltf;
+		JsonParser parser = { json_start, json_start + json_size };
+		if (json_size == 0 || !parser.Parse(gltf.json) || gltf.json.type != JsonValue::Object)
+		{
+			printf("Could not parse the glTF JSON in %s\n", path.c_str());
+			return false;
+		}
+
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		const JsonValue& buffers = gltf.json["buffers"];
+		for (size_t i = 0; i < buffers.array.size(); ++i)
+		{
+			gltf.buffers.push_back(std::vector<uint8_t>());
+			const std::string& uri = buffers[i]["uri"].string;
+			if (uri.empty())
+			{
+				gltf.buffers.back().swap(binary_chunk);
+			}
+			else if (uri.compare(0, 5, "data:") == 0)
+			{
+				size_t comma = uri.find(',');
+				if (comma == std::string::npos || !DecodeBase64(uri.c_str() + comma + 1, gltf.buffers.back()))
+				{
+					printf("Bad data URI in buffer %u\n", (unsigned)i);
+					return false;
+				}
+			}
+			else if (!ReadFile(directory + uri, gltf.buffers.back()))
+			{
+				return false;
+			}
+		}
+
+		// The default scene's node tree, or every mesh as it is if there's no scene
+		const JsonValue& scenes = gltf.json["scenes"];
+		const JsonValue& scene = scenes[gltf.json["scene"].AsInt(0)];
+		if (!scene.IsNull())
+		{
+			for (size_t i = 0; i < scene["nodes"].array.size(); ++i)
+				if (!AddNode(gltf, scene["nodes"][i].AsInt(), Identity(), geometry, 0))
+					return false;
+		}
+		else
+		{
+			const JsonValue& meshes = gltf.json["meshes"];
+			for (size_t mesh = 0; mesh < meshes.array.size(); ++mesh)
+				for (size_t i = 0; i < meshes[mesh]["primitives"].array.size(); ++i)
+					if (!AddPrimitive(gltf, meshes[mesh]["primitives"][i], Identity(), geometry))
+						return false;
+		}
+
+		// If any primitive had no normals work them all out instead
+		for (size_t i = 0; i < geometry.normals.size(); i += 3)
+		{
+			if (geometry.normals[i] == 0.0f && geometry.normals[i + 1] == 0.0f && geometry.normals[i + 2] == 0.0f)
+			{
+				geometry.normals.clear();
+				break;
+			}
+		}
+		return true;
+	}
+
+	bool EndsWith(const std::string& text, const char* suffix)
+	{
+		size_t length = strlen(suffix);
+		if (text.size() < length)
+			return false;
+		for (size_t i = 0; i < length; ++i)
+			if (tolower(text[text.size() - length + i]) != suffix[i])
+				return false;
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		printf("Usage: %s input.obj|input.gltf|input.glb output.hvm\n", argv[0]);
+		return 1;
+	}
+
+	std::string input = argv[1];
+	Geometry geometry;
+	Clock::time_point start = Clock::now();
+
+	bool loaded = false;
+	if (EndsWith(input, ".obj")) loaded = LoadObj(input, geometry);
+	else if (EndsWith(input, ".gltf")) loaded = LoadGltf(input, false, geometry);
+	else if (EndsWith(input, ".glb")) loaded = LoadGltf(input, true, geometry);
+	else printf("Don't know how to read %s, expected .obj, .gltf or .glb\n", input.c_str());
+	if (!loaded)
+		return 1;
+	double parse_ms = MillisecondsSince(start);
+
+	if (geometry.indices.empty())
+	{
+		printf("No triangles in %s\n", input.c_str());
+		return 1;
+	}
+	if (geometry.positions.size() / 3 > UINT32_MAX || geometry.indices.size() > UINT32_MAX)
+	{
+		printf("Too big, meshes are limited to 2^32 vertices and indices\n");
+		return 1;
+	}
+
+	start = Clock::now();
+	std::vector<uint8_t> file;
+	if (!BuildMeshFile(&geometry.positions[0], geometry.normals.empty() ? nullptr : &geometry.normals[0], (uint32_t)(geometry.positions.size() / 3),
+		&geometry.indices[0], (uint32_t)geometry.indices.size(), file))
+	{
+		return 1;
+	}
+	double build_ms = MillisecondsSince(start);
+
+	FILE* output = fopen(argv[2], "wb");
+	if (output == nullptr || fwrite(&file[0], 1, file.size(), output) != file.size())
+	{
+		printf("Could not write %s\n", argv[2]);
+		if (output) fclose(output);
+		return 1;
+	}
+	fclose(output);
+
+	const MeshFileHeader& header = *(const MeshFileHeader*)&file[0];
+	printf("%s: %u triangles, %u vertices, %u meshlets, %u bit indices, %.2f MB\n",
+		argv[2], header.index_count / 3, header.vertex_count, header.meshlet_count, header.index_size * 8, file.size() / (1024.0 * 1024.0));
+	printf("Parsed in %.1f ms, built in %.1f ms\n", parse_ms, build_ms);
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include "vr_backend.h"
+
+#include <cstdio>
+
+// Forwards everything to the real SteamVR runtime
+class OpenVRBackend : public VRBackend
+{
+public:
+	OpenVRBackend(vr::IVRSystem* system, vr::IVRRenderModels* render_models)
+		: system(system)
+		, compositor(nullptr)
+		, render_models(render_models)
+	{}
+
+	const char* GetName() { return "OpenVR"; }
+
+	void GetRecommendedRenderTargetSize(uint32_t* width, uint32_t* height)
+	{
+		system->GetRecommendedRenderTargetSize(width, height);
+	}
+
+	vr::HmdMatrix44_t GetProjectionMatrix(vr::Hmd_Eye eye, float near_z, float far_z)
+	{
+		return system->GetProjectionMatrix(eye, near_z, far_z);
+	}
+
+	vr::HmdMatrix34_t GetEyeToHeadTransform(vr::Hmd_Eye eye)
+	{
+		return system->GetEyeToHeadTransform(eye);
+	}
+
+	vr::HiddenAreaMesh_t GetHiddenAreaMesh(vr::Hmd_Eye eye)
+	{
+		return system->GetHiddenAreaMesh(eye, vr::k_eHiddenAreaMesh_Standard);
+	}
+
+	bool IsTrackedDeviceConnected(vr::TrackedDeviceIndex_t device)
+	{
+		return system->IsTrackedDeviceConnected(device);
+	}
+
+	vr::ETrackedDeviceClass GetTrackedDeviceClass(vr::TrackedDeviceIndex_t device)
+	{
+		return system->GetTrackedDeviceClass(device);
+	}
+
+	uint32_t GetStringTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, char* buffer, uint32_t buffer_size, vr::TrackedPropertyError* error)
+	{
+		return system->GetStringTrackedDeviceProperty(device, prop, buffer, buffer_size, error);
+	}
+
+	float GetFloatTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* error)
+	{
+		return system->GetFloatTrackedDeviceProperty(device, prop, error);
+	}
+
+	bool GetTimeSinceLastVsync(float* seconds_since_last_vsync, uint64_t* frame_counter)
+	{
+		return system->GetTimeSinceLastVsync(seconds_since_last_vsync, frame_counter);
+	}
+
+	void GetDeviceToAbsoluteTrackingPose(vr::ETrackingUniverseOrigin origin, float seconds_to_photons, vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		system->GetDeviceToAbsoluteTrackingPose(origin, seconds_to_photons, poses, pose_count);
+	}
+
+	bool PollNextEvent(vr::VREvent_t* event, uint32_t event_size)
+	{
+		return system->PollNextEvent(event, event_size);
+	}
+
+	bool IsInputFocusCapturedByAnotherProcess()
+	{
+		return system->IsInputFocusCapturedByAnotherProcess();
+	}
+
+	bool InitCompositor()
+	{
+		compositor = vr::VRCompositor();
+		return compositor != nullptr;
+	}
+
+	vr::EVRCompositorError WaitGetPoses(vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		return compositor->WaitGetPoses(poses, pose_count, NULL, 0);
+	}
+
+	vr::EVRCompositorError Submit(vr::Hmd_Eye eye, const vr::Texture_t* texture, const vr::VRTextureBounds_t* bounds)
+	{
+		return compositor->Submit(eye, texture, bounds);
+	}
+
+	bool GetFrameTiming(vr::Compositor_FrameTiming* timing, uint32_t frames_ago)
+	{
+		timing->m_nSize = sizeof(vr::Compositor_FrameTiming);
+		return compositor->GetFrameTiming(timing, frames_ago);
+	}
+
+	vr::EVRRenderModelError LoadRenderModel_Async(const char* name, vr::RenderModel_t** model)
+	{
+		if (render_models == nullptr)
+			return vr::VRRenderModelError_NotSupported;
+		return render_models->LoadRenderModel_Async(name, model);
+	}
+
+	void FreeRenderModel(vr::RenderModel_t* model)
+	{
+		render_models->FreeRenderModel(model);
+	}
+
+	vr::EVRRenderModelError LoadTexture_Async(vr::TextureID_t texture_id, vr::RenderModel_TextureMap_t** texture)
+	{
+		if (render_models == nullptr)
+			return vr::VRRenderModelError_NotSupported;
+		return render_models->LoadTexture_Async(texture_id, texture);
+	}
+
+	void FreeTexture(vr::RenderModel_TextureMap_t* texture)
+	{
+		render_models->FreeTexture(texture);
+	}
+
+	void Shutdown()
+	{
+		vr::VR_Shutdown();
+		system = nullptr;
+		compositor = nullptr;
+		render_models = nullptr;
+	}
+
+private:
+	vr::IVRSystem* system;
+	vr::IVRCompositor* compositor;
+	vr::IVRRenderModels* render_models;		// null if the runtime wouldn't hand it out, controllers stay as lines then
+};
+
+VRBackend* CreateOpenVRBackend(vr::EVRInitError* error)
+{
+	vr::IVRSystem* system = vr::VR_Init(error, vr::VRApplication_Scene);
+	if (*error != vr::VRInitError_None)
+		return nullptr;
+
+	vr::EVRInitError render_models_error = vr::VRInitError_None;
+	vr::IVRRenderModels* render_models = (vr::IVRRenderModels *)vr::VR_GetGenericInterface(vr::IVRRenderModels_Version, &render_models_error);
+	if (render_models_error != vr::VRInitError_None)
+		render_models = nullptr;
+
+	return new OpenVRBackend(system, render_models);
+}
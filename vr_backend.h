@@ -0,0 +1,74 @@
+#pragma once
+
+#include <openvr.h>
+
+// The parts of IVRSystem and IVRCompositor the app actually uses, behind one interface
+// so the frame loop can run against either SteamVR or a stand-in runtime.
+//
+// The method names and arguments mirror the OpenVR calls they replace, so code that
+// used to call hmd->Foo() or vr::VRCompositor()->Foo() reads the same.
+class VRBackend
+{
+public:
+	virtual ~VRBackend() {}
+
+	virtual const char* GetName() = 0;
+
+	// IVRSystem
+	virtual void GetRecommendedRenderTargetSize(uint32_t* width, uint32_t* height) = 0;
+	virtual vr::HmdMatrix44_t GetProjectionMatrix(vr::Hmd_Eye eye, float near_z, float far_z) = 0;
+	virtual vr::HmdMatrix34_t GetEyeToHeadTransform(vr::Hmd_Eye eye) = 0;
+	// Triangles covering the part of the eye's target the lens never shows, in 0-1 texture coordinates with v down.
+	// The vertex data stays valid until Shutdown
+	virtual vr::HiddenAreaMesh_t GetHiddenAreaMesh(vr::Hmd_Eye eye) = 0;
+	virtual bool IsTrackedDeviceConnected(vr::TrackedDeviceIndex_t device) = 0;
+	virtual vr::ETrackedDeviceClass GetTrackedDeviceClass(vr::TrackedDeviceIndex_t device) = 0;
+	virtual uint32_t GetStringTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, char* buffer, uint32_t buffer_size, vr::TrackedPropertyError* error = NULL) = 0;
+	virtual float GetFloatTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* error = NULL) = 0;
+	virtual bool GetTimeSinceLastVsync(float* seconds_since_last_vsync, uint64_t* frame_counter) = 0;
+	// Poses predicted seconds_to_photons from now, for re-sampling after WaitGetPoses
+	virtual void GetDeviceToAbsoluteTrackingPose(vr::ETrackingUniverseOrigin origin, float seconds_to_photons, vr::TrackedDevicePose_t* poses, uint32_t pose_count) = 0;
+	virtual bool PollNextEvent(vr::VREvent_t* event, uint32_t event_size) = 0;
+	virtual bool IsInputFocusCapturedByAnotherProcess() = 0;
+
+	// IVRCompositor
+	virtual bool InitCompositor() = 0;
+	virtual vr::EVRCompositorError WaitGetPoses(vr::TrackedDevicePose_t* poses, uint32_t pose_count) = 0;
+	virtual vr::EVRCompositorError Submit(vr::Hmd_Eye eye, const vr::Texture_t* texture, const vr::VRTextureBounds_t* bounds = NULL) = 0;
+	// The compositor's timing for a frame it has finished with, frames_ago 0 is the newest.
+	// Fills in m_nSize itself. False if there's no timing that far back, or none at all
+	virtual bool GetFrameTiming(vr::Compositor_FrameTiming* timing, uint32_t frames_ago = 0) = 0;
+
+	// IVRRenderModels. The loads return VRRenderModelError_Loading until the runtime has the model
+	// or texture ready, poll them again later. Safe to call from a thread of its own
+	virtual vr::EVRRenderModelError LoadRenderModel_Async(const char* name, vr::RenderModel_t** model) = 0;
+	virtual void FreeRenderModel(vr::RenderModel_t* model) = 0;
+	virtual vr::EVRRenderModelError LoadTexture_Async(vr::TextureID_t texture_id, vr::RenderModel_TextureMap_t** texture) = 0;
+	virtual void FreeTexture(vr::RenderModel_TextureMap_t* texture) = 0;
+
+	virtual void Shutdown() = 0;
+};
+
+// Settings for the stand-in runtime
+struct SimulatedVRConfig
+{
+	float refresh_rate;					// Hz, WaitGetPoses blocks until the next simulated vsync
+	uint32_t render_target_width;		// what GetRecommendedRenderTargetSize reports
+	uint32_t render_target_height;
+	int controller_count;				// 0, 1 or 2 scripted controllers
+	bool pace_frames;					// false runs the loop as fast as it can
+
+	SimulatedVRConfig()
+		: refresh_rate(90.0f)
+		, render_target_width(1512)
+		, render_target_height(1680)
+		, controller_count(2)
+		, pace_frames(true)
+	{}
+};
+
+// Loads the SteamVR runtime, returns nullptr and fills in error on failure
+VRBackend* CreateOpenVRBackend(vr::EVRInitError* error);
+
+// A fake HMD with scripted head and controller motion, needs no headset or runtime
+VRBackend* CreateSimulatedVRBackend(const SimulatedVRConfig& config);
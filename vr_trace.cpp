@@ -0,0 +1,1013 @@
+#include "vr_trace.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Trace file layout, everything in the writer's byte order:
+//
+//   "HVTR", u32 version
+//   u32 render target width, height
+//   f32 display frequency, seconds from vsync to photons
+//   per eye: f32 left, right, bottom, top tangents, f32 eye to head 3x4
+//   HMD tracking system name and serial number, 64 bytes each
+//   per eye: u32 hidden area vertex count, then f32 u, v for each vertex
+//
+// then records until the end of the file, each a u8 type and then:
+//
+//   Frame    u32 microseconds since the last frame, u64 vsync, f32 seconds since it, u8 input focus
+//            captured, u8 pose count, then per pose u8 device, u8 valid | connected << 1,
+//            u8 tracking result, f32 3x4 device to absolute, f32 velocity, f32 angular velocity
+//   Device   u8 device, u8 connected, u8 class
+//   Event    u32 type, u32 device, f32 age, u16 data size, the data
+//   Input    u32 type, u32 code
+//
+// Frame numbers aren't written, a record belongs to however many frames came before it
+
+class RecordingVRBackend;
+class ReplayVRBackend;
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const char trace_magic[4] = { 'H', 'V', 'T', 'R' };
+	const uint32_t trace_version = 1;
+	const uint32_t name_bytes = 64;
+
+	enum RecordType
+	{
+		Record_Frame = 1,
+		Record_Device,
+		Record_Event,
+		Record_Input
+	};
+
+	void Put(std::vector<uint8_t>& out, const void* data, size_t size)
+	{
+		out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	}
+
+	template <typename T>
+	void Put(std::vector<uint8_t>& out, T value)
+	{
+		Put(out, &value, sizeof(value));
+	}
+
+	// Reads a trace front to back, stops for good at the first read past the end
+	struct Reader
+	{
+		const uint8_t* data;
+		size_t size;
+		size_t offset;
+		bool overrun;
+
+		bool Get(void* out, size_t bytes)
+		{
+			if (overrun || size - offset < bytes)
+			{
+				overrun = true;
+				return false;
+			}
+			memcpy(out, data + offset, bytes);
+			offset += bytes;
+			return true;
+		}
+
+		template <typename T>
+		T Get()
+		{
+			T value = T();
+			Get(&value, sizeof(value));
+			return value;
+		}
+	};
+
+	void PutPose(std::vector<uint8_t>& out, uint8_t device, const vr::TrackedDevicePose_t& pose)
+	{
+		Put<uint8_t>(out, device);
+		Put<uint8_t>(out, (uint8_t)((pose.bPoseIsValid ? 1 : 0) | (pose.bDeviceIsConnected ? 2 : 0)));
+		Put<uint8_t>(out, (uint8_t)pose.eTrackingResult);
+		Put(out, &pose.mDeviceToAbsoluteTracking.m[0][0], 12 * sizeof(float));
+		Put(out, pose.vVelocity.v, 3 * sizeof(float));
+		Put(out, pose.vAngularVelocity.v, 3 * sizeof(float));
+	}
+
+	uint8_t GetPose(Reader& reader, vr::TrackedDevicePose_t& pose)
+	{
+		uint8_t device = reader.Get<uint8_t>();
+		uint8_t flags = reader.Get<uint8_t>();
+		pose.bPoseIsValid = (flags & 1) != 0;
+		pose.bDeviceIsConnected = (flags & 2) != 0;
+		pose.eTrackingResult = (vr::ETrackingResult)reader.Get<uint8_t>();
+		reader.Get(&pose.mDeviceToAbsoluteTracking.m[0][0], 12 * sizeof(float));
+		reader.Get(pose.vVelocity.v, 3 * sizeof(float));
+		reader.Get(pose.vAngularVelocity.v, 3 * sizeof(float));
+		return device;
+	}
+
+	// What a device the runtime has never heard of reports, and what both sides compare the first
+	// frame's poses against
+	vr::TrackedDevicePose_t UnknownPose()
+	{
+		vr::TrackedDevicePose_t pose;
+		memset(&pose, 0, sizeof(pose));
+		pose.eTrackingResult = vr::TrackingResult_Uninitialized;
+		return pose;
+	}
+
+	bool SamePose(const vr::TrackedDevicePose_t& a, const vr::TrackedDevicePose_t& b)
+	{
+		return a.bPoseIsValid == b.bPoseIsValid && a.bDeviceIsConnected == b.bDeviceIsConnected && a.eTrackingResult == b.eTrackingResult
+			&& memcmp(&a.mDeviceToAbsoluteTracking, &b.mDeviceToAbsoluteTracking, sizeof(a.mDeviceToAbsoluteTracking)) == 0
+			&& memcmp(&a.vVelocity, &b.vVelocity, sizeof(a.vVelocity)) == 0
+			&& memcmp(&a.vAngularVelocity, &b.vAngularVelocity, sizeof(a.vAngularVelocity)) == 0;
+	}
+
+	bool DeviceEvent(uint32_t event_type)
+	{
+		return event_type == vr::VREvent_TrackedDeviceActivated || event_type == vr::VREvent_TrackedDeviceDeactivated || event_type == vr::VREvent_TrackedDeviceUpdated;
+	}
+
+	// The recorder's writer. Records go into the open chunk under the lock, the thread writes out
+	// full ones and hands them back empty so the frame doesn't allocate either
+	const size_t chunk_bytes = 64 << 10;
+	FILE* trace_file = nullptr;
+	std::mutex writer_mutex;
+	std::condition_variable writer_wake;
+	std::vector<uint8_t> open_chunk;
+	std::deque<std::vector<uint8_t>> full_chunks;
+	std::vector<std::vector<uint8_t>> spare_chunks;
+	std::thread writer_thread;
+	bool writer_quit = false;
+	bool write_failed = false;
+	uint64_t bytes_appended = 0;
+	size_t max_full_chunks = 0;
+
+	void WriterThread()
+	{
+		std::unique_lock<std::mutex> lock(writer_mutex);
+		for (;;)
+		{
+			writer_wake.wait(lock, []() { return writer_quit || !full_chunks.empty(); });
+			if (full_chunks.empty())
+				return;
+
+			std::vector<uint8_t> chunk;
+			chunk.swap(full_chunks.front());
+			full_chunks.pop_front();
+			lock.unlock();
+
+			if (fwrite(&chunk[0], 1, chunk.size(), trace_file) != chunk.size())
+				write_failed = true;
+			chunk.clear();
+
+			lock.lock();
+			spare_chunks.push_back(std::vector<uint8_t>());
+			spare_chunks.back().swap(chunk);
+		}
+	}
+
+	// Called from whichever thread has something to record
+	void Append(const std::vector<uint8_t>& record)
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		open_chunk.insert(open_chunk.end(), record.begin(), record.end());
+		bytes_appended += record.size();
+		if (open_chunk.size() < chunk_bytes)
+			return;
+
+		full_chunks.push_back(std::vector<uint8_t>());
+		full_chunks.back().swap(open_chunk);
+		if (full_chunks.size() > max_full_chunks)
+			max_full_chunks = full_chunks.size();
+		if (!spare_chunks.empty())
+		{
+			open_chunk.swap(spare_chunks.back());
+			spare_chunks.pop_back();
+		}
+		else
+			open_chunk.reserve(chunk_bytes * 2);
+		writer_wake.notify_one();
+	}
+
+	RecordingVRBackend* recorder = nullptr;
+	ReplayVRBackend* replay = nullptr;
+}
+
+class RecordingVRBackend : public VRBackend
+{
+public:
+	RecordingVRBackend(VRBackend* runtime, const char* path)
+		: runtime(runtime)
+		, path(path)
+		, name(std::string(runtime->GetName()) + ", recording")
+		, last_frame_time(Clock::now())
+		, frame_count(0)
+		, pose_count_total(0)
+		, event_count(0)
+		, input_count(0)
+	{
+		for (uint32_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+			last_poses[device] = UnknownPose();
+	}
+
+	// Everything that doesn't change over a session, plus whatever is connected already
+	void WriteHeader()
+	{
+		std::vector<uint8_t> header;
+		Put(header, trace_magic, sizeof(trace_magic));
+		Put<uint32_t>(header, trace_version);
+
+		uint32_t width = 0, height = 0;
+		runtime->GetRecommendedRenderTargetSize(&width, &height);
+		Put<uint32_t>(header, width);
+		Put<uint32_t>(header, height);
+
+		vr::TrackedPropertyError error = vr::TrackedProp_Success;
+		float display_frequency = runtime->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float, &error);
+		Put<float>(header, error == vr::TrackedProp_Success ? display_frequency : 0.0f);
+		float vsync_to_photons = runtime->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SecondsFromVsyncToPhotons_Float, &error);
+		Put<float>(header, error == vr::TrackedProp_Success ? vsync_to_photons : 0.0f);
+
+		for (int eye = vr::Eye_Left; eye <= vr::Eye_Right; ++eye)
+		{
+			// Back out the tangents, the depth part depends on the planes the app asks for
+			vr::HmdMatrix44_t projection = runtime->GetProjectionMatrix((vr::Hmd_Eye)eye, 1.0f, 2.0f);
+			float width_x = 2.0f / projection.m[0][0], sum_x = projection.m[0][2] * width_x;
+			float width_y = 2.0f / projection.m[1][1], sum_y = projection.m[1][2] * width_y;
+			Put<float>(header, (sum_x - width_x) * 0.5f);
+			Put<float>(header, (sum_x + width_x) * 0.5f);
+			Put<float>(header, (sum_y - width_y) * 0.5f);
+			Put<float>(header, (sum_y + width_y) * 0.5f);
+
+			vr::HmdMatrix34_t eye_to_head = runtime->GetEyeToHeadTransform((vr::Hmd_Eye)eye);
+			Put(header, &eye_to_head.m[0][0], 12 * sizeof(float));
+		}
+
+		vr::TrackedDeviceProperty names[2] = { vr::Prop_TrackingSystemName_String, vr::Prop_SerialNumber_String };
+		for (int i = 0; i < 2; ++i)
+		{
+			char value[name_bytes];
+			memset(value, 0, sizeof(value));
+			runtime->GetStringTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, names[i], value, name_bytes - 1);
+			Put(header, value, name_bytes);
+		}
+
+		for (int eye = vr::Eye_Left; eye <= vr::Eye_Right; ++eye)
+		{
+			vr::HiddenAreaMesh_t mesh = runtime->GetHiddenAreaMesh((vr::Hmd_Eye)eye);
+			uint32_t vertex_count = mesh.pVertexData ? mesh.unTriangleCount * 3 : 0;
+			Put<uint32_t>(header, vertex_count);
+			if (vertex_count > 0)
+				Put(header, mesh.pVertexData, vertex_count * sizeof(vr::HmdVector2_t));
+		}
+		Append(header);
+
+		for (vr::TrackedDeviceIndex_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+		{
+			if (runtime->IsTrackedDeviceConnected(device))
+				RecordDevice(device);
+		}
+	}
+
+	void RecordInput(uint32_t type, uint32_t code)
+	{
+		std::vector<uint8_t> record;
+		Put<uint8_t>(record, Record_Input);
+		Put<uint32_t>(record, type);
+		Put<uint32_t>(record, code);
+		Append(record);
+		input_count += 1;
+	}
+
+	const char* GetName() { return name.c_str(); }
+
+	void GetRecommendedRenderTargetSize(uint32_t* width, uint32_t* height) { runtime->GetRecommendedRenderTargetSize(width, height); }
+	vr::HmdMatrix44_t GetProjectionMatrix(vr::Hmd_Eye eye, float near_z, float far_z) { return runtime->GetProjectionMatrix(eye, near_z, far_z); }
+	vr::HmdMatrix34_t GetEyeToHeadTransform(vr::Hmd_Eye eye) { return runtime->GetEyeToHeadTransform(eye); }
+	vr::HiddenAreaMesh_t GetHiddenAreaMesh(vr::Hmd_Eye eye) { return runtime->GetHiddenAreaMesh(eye); }
+	bool IsTrackedDeviceConnected(vr::TrackedDeviceIndex_t device) { return runtime->IsTrackedDeviceConnected(device); }
+	vr::ETrackedDeviceClass GetTrackedDeviceClass(vr::TrackedDeviceIndex_t device) { return runtime->GetTrackedDeviceClass(device); }
+
+	uint32_t GetStringTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, char* buffer, uint32_t buffer_size, vr::TrackedPropertyError* error)
+	{
+		return runtime->GetStringTrackedDeviceProperty(device, prop, buffer, buffer_size, error);
+	}
+
+	float GetFloatTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* error)
+	{
+		return runtime->GetFloatTrackedDeviceProperty(device, prop, error);
+	}
+
+	bool GetTimeSinceLastVsync(float* seconds_since_last_vsync, uint64_t* frame_counter) { return runtime->GetTimeSinceLastVsync(seconds_since_last_vsync, frame_counter); }
+
+	// Not recorded, replay answers these from the frames around the time asked for
+	void GetDeviceToAbsoluteTrackingPose(vr::ETrackingUniverseOrigin origin, float seconds_to_photons, vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		runtime->GetDeviceToAbsoluteTrackingPose(origin, seconds_to_photons, poses, pose_count);
+	}
+
+	bool PollNextEvent(vr::VREvent_t* event, uint32_t event_size)
+	{
+		if (!runtime->PollNextEvent(event, event_size))
+			return false;
+
+		// Whatever the registry is about to ask about the device, as of now
+		if (DeviceEvent(event->eventType))
+			RecordDevice(event->trackedDeviceIndex);
+
+		std::vector<uint8_t> record;
+		Put<uint8_t>(record, Record_Event);
+		Put<uint32_t>(record, event->eventType);
+		Put<uint32_t>(record, event->trackedDeviceIndex);
+		Put<float>(record, event->eventAgeSeconds);
+		uint32_t data_offset = (uint32_t)((const uint8_t*)&event->data - (const uint8_t*)event);
+		uint16_t data_size = (uint16_t)(event_size > data_offset ? std::min<uint32_t>(event_size - data_offset, sizeof(event->data)) : 0);
+		Put<uint16_t>(record, data_size);
+		Put(record, &event->data, data_size);
+		Append(record);
+		event_count += 1;
+		return true;
+	}
+
+	bool IsInputFocusCapturedByAnotherProcess() { return runtime->IsInputFocusCapturedByAnotherProcess(); }
+
+	bool InitCompositor() { return runtime->InitCompositor(); }
+
+	vr::EVRCompositorError WaitGetPoses(vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		vr::EVRCompositorError error = runtime->WaitGetPoses(poses, pose_count);
+
+		Clock::time_point now = Clock::now();
+		uint32_t since_last_frame_us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - last_frame_time).count();
+		last_frame_time = now;
+		float since_vsync = 0.0f;
+		uint64_t vsync = 0;
+		runtime->GetTimeSinceLastVsync(&since_vsync, &vsync);
+
+		frame_record.clear();
+		Put<uint8_t>(frame_record, Record_Frame);
+		Put<uint32_t>(frame_record, since_last_frame_us);
+		Put<uint64_t>(frame_record, vsync);
+		Put<float>(frame_record, since_vsync);
+		Put<uint8_t>(frame_record, runtime->IsInputFocusCapturedByAnotherProcess() ? 1 : 0);
+		size_t count_offset = frame_record.size();
+		Put<uint8_t>(frame_record, 0);
+
+		// Only what moved, everything else replays as it was last frame
+		uint8_t changed = 0;
+		for (uint32_t device = 0; device < pose_count && device < vr::k_unMaxTrackedDeviceCount; ++device)
+		{
+			if (SamePose(poses[device], last_poses[device]))
+				continue;
+			PutPose(frame_record, (uint8_t)device, poses[device]);
+			last_poses[device] = poses[device];
+			changed += 1;
+		}
+		frame_record[count_offset] = changed;
+		Append(frame_record);
+
+		frame_count += 1;
+		pose_count_total += changed;
+		return error;
+	}
+
+	vr::EVRCompositorError Submit(vr::Hmd_Eye eye, const vr::Texture_t* texture, const vr::VRTextureBounds_t* bounds)
+	{
+		return runtime->Submit(eye, texture, bounds);
+	}
+
+	bool GetFrameTiming(vr::Compositor_FrameTiming* timing, uint32_t frames_ago) { return runtime->GetFrameTiming(timing, frames_ago); }
+
+	vr::EVRRenderModelError LoadRenderModel_Async(const char* name, vr::RenderModel_t** model) { return runtime->LoadRenderModel_Async(name, model); }
+	void FreeRenderModel(vr::RenderModel_t* model) { runtime->FreeRenderModel(model); }
+	vr::EVRRenderModelError LoadTexture_Async(vr::TextureID_t texture_id, vr::RenderModel_TextureMap_t** texture) { return runtime->LoadTexture_Async(texture_id, texture); }
+	void FreeTexture(vr::RenderModel_TextureMap_t* texture) { runtime->FreeTexture(texture); }
+
+	void Shutdown()
+	{
+		runtime->Shutdown();
+		delete runtime;
+		runtime = nullptr;
+
+		{
+			std::lock_guard<std::mutex> lock(writer_mutex);
+			if (!open_chunk.empty())
+			{
+				full_chunks.push_back(std::vector<uint8_t>());
+				full_chunks.back().swap(open_chunk);
+			}
+			writer_quit = true;
+		}
+		writer_wake.notify_one();
+		writer_thread.join();
+		if (fclose(trace_file) != 0)
+			write_failed = true;
+		trace_file = nullptr;
+		recorder = nullptr;
+
+		if (write_failed)
+			printf("Trace recorder: could not write all of %s\n", path.c_str());
+		printf("Trace recorder: %llu frames, %llu poses, %llu events and %llu inputs, %.2f MB to %s (avg %.0f bytes a frame), at most %u chunks waited on the disk\n",
+			(unsigned long long)frame_count, (unsigned long long)pose_count_total, (unsigned long long)event_count, (unsigned long long)input_count,
+			bytes_appended / (1024.0 * 1024.0), path.c_str(), frame_count > 0 ? bytes_appended / (double)frame_count : 0.0, (unsigned)max_full_chunks);
+	}
+
+private:
+	void RecordDevice(vr::TrackedDeviceIndex_t device)
+	{
+		if (device >= vr::k_unMaxTrackedDeviceCount)
+			return;
+
+		std::vector<uint8_t> record;
+		bool connected = runtime->IsTrackedDeviceConnected(device);
+		Put<uint8_t>(record, Record_Device);
+		Put<uint8_t>(record, (uint8_t)device);
+		Put<uint8_t>(record, connected ? 1 : 0);
+		Put<uint8_t>(record, (uint8_t)(connected ? runtime->GetTrackedDeviceClass(device) : vr::TrackedDeviceClass_Invalid));
+		Append(record);
+	}
+
+	VRBackend* runtime;
+	std::string path;
+	std::string name;
+
+	// Render thread
+	vr::TrackedDevicePose_t last_poses[vr::k_unMaxTrackedDeviceCount];
+	std::vector<uint8_t> frame_record;
+	Clock::time_point last_frame_time;
+	uint64_t frame_count;
+	uint64_t pose_count_total;
+
+	// Whichever thread polls events
+	uint64_t event_count;
+	uint64_t input_count;
+};
+
+class ReplayVRBackend : public VRBackend
+{
+public:
+	struct Frame
+	{
+		double time;				// seconds from the first frame
+		uint64_t vsync;
+		float since_vsync;
+		bool input_focus_captured;
+	};
+
+	// A device changing or a runtime event, due once frame frames have been handed out
+	struct Event
+	{
+		uint32_t frame;
+		bool device_change;
+		vr::TrackedDeviceIndex_t device;
+		bool connected;
+		vr::ETrackedDeviceClass device_class;
+		vr::VREvent_t event;
+	};
+
+	struct Input
+	{
+		uint32_t frame;
+		uint32_t type;
+		uint32_t code;
+	};
+
+	ReplayVRBackend(bool real_time)
+		: real_time(real_time)
+		, render_target_width(0)
+		, render_target_height(0)
+		, display_frequency(90.0f)
+		, vsync_to_photons(0.0f)
+		, pose_device_count(0)
+		, next_event(0)
+		, next_input(0)
+		, frame_index(0)
+		, ahead_frame(0)
+		, late_frames(0)
+		, submit_count(0)
+	{
+		memset(device_connected, 0, sizeof(device_connected));
+		for (uint32_t device = 0; device < vr::k_unMaxTrackedDeviceCount; ++device)
+			device_class[device] = vr::TrackedDeviceClass_Invalid;
+	}
+
+	bool Load(const char* path)
+	{
+		FILE* file = fopen(path, "rb");
+		if (file == nullptr)
+		{
+			printf("Replay: could not open %s\n", path);
+			return false;
+		}
+		std::vector<uint8_t> data;
+		uint8_t buffer[64 << 10];
+		size_t read = 0;
+		while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			data.insert(data.end(), buffer, buffer + read);
+		fclose(file);
+
+		Reader reader = { data.empty() ? nullptr : &data[0], data.size(), 0, false };
+		char magic[4] = {};
+		reader.Get(magic, sizeof(magic));
+		uint32_t version = reader.Get<uint32_t>();
+		if (memcmp(magic, trace_magic, sizeof(magic)) != 0 || version != trace_version)
+		{
+			printf("Replay: %s isn't a version %u trace\n", path, trace_version);
+			return false;
+		}
+
+		render_target_width = reader.Get<uint32_t>();
+		render_target_height = reader.Get<uint32_t>();
+		display_frequency = reader.Get<float>();
+		vsync_to_photons = reader.Get<float>();
+		if (display_frequency <= 0.0f)
+			display_frequency = 90.0f;
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			reader.Get(tangents[eye], sizeof(tangents[eye]));
+			reader.Get(&eye_to_head[eye].m[0][0], 12 * sizeof(float));
+		}
+		char name[name_bytes];
+		reader.Get(name, name_bytes);
+		tracking_system.assign(name, strnlen(name, name_bytes));
+		reader.Get(name, name_bytes);
+		serial_number.assign(name, strnlen(name, name_bytes));
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			uint32_t vertex_count = reader.Get<uint32_t>();
+			if (reader.overrun || vertex_count > (reader.size - reader.offset) / sizeof(vr::HmdVector2_t))
+			{
+				reader.overrun = true;
+				break;
+			}
+			hidden_area[eye].resize(vertex_count);
+			if (vertex_count > 0)
+				reader.Get(&hidden_area[eye][0], vertex_count * sizeof(vr::HmdVector2_t));
+		}
+		if (reader.overrun)
+		{
+			printf("Replay: %s is cut off in its header\n", path);
+			return false;
+		}
+
+		// Poses come in as changes, they're only laid out per frame once it's known how many
+		// devices ever moved
+		struct PoseChange
+		{
+			uint32_t frame;
+			uint8_t device;
+			vr::TrackedDevicePose_t pose;
+		};
+		std::vector<PoseChange> changes;
+		double time = 0.0;
+		while (reader.offset < reader.size)
+		{
+			size_t record_start = reader.offset;
+			uint8_t type = reader.Get<uint8_t>();
+			uint32_t frame = (uint32_t)frames.size();
+			if (type == Record_Frame)
+			{
+				Frame recorded;
+				uint32_t since_last_frame_us = reader.Get<uint32_t>();
+				time += frames.empty() ? 0.0 : since_last_frame_us / 1000000.0;
+				recorded.time = time;
+				recorded.vsync = reader.Get<uint64_t>();
+				recorded.since_vsync = reader.Get<float>();
+				recorded.input_focus_captured = reader.Get<uint8_t>() != 0;
+				uint8_t changed = reader.Get<uint8_t>();
+				for (uint8_t i = 0; i < changed && !reader.overrun; ++i)
+				{
+					PoseChange change;
+					change.frame = frame;
+					change.device = GetPose(reader, change.pose);
+					if (change.device < vr::k_unMaxTrackedDeviceCount)
+					{
+						changes.push_back(change);
+						pose_device_count = std::max<uint32_t>(pose_device_count, change.device + 1);
+					}
+				}
+				if (!reader.overrun)
+					frames.push_back(recorded);
+			}
+			else if (type == Record_Device)
+			{
+				Event event;
+				memset(&event, 0, sizeof(event));
+				event.frame = frame;
+				event.device_change = true;
+				event.device = reader.Get<uint8_t>();
+				event.connected = reader.Get<uint8_t>() != 0;
+				event.device_class = (vr::ETrackedDeviceClass)reader.Get<uint8_t>();
+				if (!reader.overrun && event.device < vr::k_unMaxTrackedDeviceCount)
+					events.push_back(event);
+			}
+			else if (type == Record_Event)
+			{
+				Event event;
+				memset(&event, 0, sizeof(event));
+				event.frame = frame;
+				event.event.eventType = reader.Get<uint32_t>();
+				event.event.trackedDeviceIndex = reader.Get<uint32_t>();
+				event.event.eventAgeSeconds = reader.Get<float>();
+				uint16_t data_size = reader.Get<uint16_t>();
+				std::vector<uint8_t> event_data(data_size);
+				if (data_size > 0 && reader.Get(&event_data[0], data_size))
+					memcpy(&event.event.data, &event_data[0], std::min<size_t>(data_size, sizeof(event.event.data)));
+				if (!reader.overrun)
+					events.push_back(event);
+			}
+			else if (type == Record_Input)
+			{
+				Input input;
+				input.frame = frame;
+				input.type = reader.Get<uint32_t>();
+				input.code = reader.Get<uint32_t>();
+				if (!reader.overrun)
+					inputs.push_back(input);
+			}
+			else
+			{
+				printf("Replay: %s has an unknown record at byte %llu, stopping there\n", path, (unsigned long long)record_start);
+				break;
+			}
+
+			// A recording that was cut short, keep everything up to the last whole record
+			if (reader.overrun)
+			{
+				printf("Replay: %s ends part way through a record, stopping there\n", path);
+				break;
+			}
+		}
+		if (frames.empty())
+		{
+			printf("Replay: %s has no frames\n", path);
+			return false;
+		}
+
+		// Every frame gets every device that ever moved, carried on from the frame before
+		frame_poses.resize(frames.size() * pose_device_count, UnknownPose());
+		size_t next_change = 0;
+		for (uint32_t frame = 0; frame < frames.size() && pose_device_count > 0; ++frame)
+		{
+			vr::TrackedDevicePose_t* poses = FramePoses(frame);
+			if (frame > 0)
+				memcpy(poses, FramePoses(frame - 1), pose_device_count * sizeof(vr::TrackedDevicePose_t));
+			for (; next_change < changes.size() && changes[next_change].frame == frame; ++next_change)
+				poses[changes[next_change].device] = changes[next_change].pose;
+		}
+
+		// Whatever was connected before the first frame is there from the start, the way the
+		// runtime would have it on startup
+		DeliverDeviceChanges(0);
+
+		printf("Replay: %s, %u frames over %.1f s, %u events, %u inputs, %s\n", path, (uint32_t)frames.size(), frames.back().time,
+			(uint32_t)events.size(), (uint32_t)inputs.size(), real_time ? "in real time" : "as fast as possible");
+		return true;
+	}
+
+	uint32_t FrameCount() { return (uint32_t)frames.size(); }
+
+	void SetAheadThread()
+	{
+		ahead_thread = std::this_thread::get_id();
+	}
+
+	void BeginAheadFrame(uint64_t frame)
+	{
+		ahead_frame = (uint32_t)frame;
+	}
+
+	bool NextInput(uint32_t& type, uint32_t& code)
+	{
+		if (next_input >= inputs.size() || inputs[next_input].frame > HandedOut())
+			return false;
+
+		type = inputs[next_input].type;
+		code = inputs[next_input].code;
+		next_input += 1;
+		return true;
+	}
+
+	const char* GetName() { return "Replay"; }
+
+	void GetRecommendedRenderTargetSize(uint32_t* width, uint32_t* height)
+	{
+		*width = render_target_width;
+		*height = render_target_height;
+	}
+
+	// The recorded tangents, with the depth range the app asks for
+	vr::HmdMatrix44_t GetProjectionMatrix(vr::Hmd_Eye eye, float near_z, float far_z)
+	{
+		float left = tangents[eye][0], right = tangents[eye][1];
+		float bottom = tangents[eye][2], top = tangents[eye][3];
+
+		vr::HmdMatrix44_t mat;
+		memset(&mat, 0, sizeof(mat));
+		mat.m[0][0] = 2.0f / (right - left);
+		mat.m[0][2] = (right + left) / (right - left);
+		mat.m[1][1] = 2.0f / (top - bottom);
+		mat.m[1][2] = (top + bottom) / (top - bottom);
+		mat.m[2][2] = -(far_z + near_z) / (far_z - near_z);
+		mat.m[2][3] = -2.0f * far_z * near_z / (far_z - near_z);
+		mat.m[3][2] = -1.0f;
+		return mat;
+	}
+
+	vr::HmdMatrix34_t GetEyeToHeadTransform(vr::Hmd_Eye eye) { return eye_to_head[eye]; }
+
+	vr::HiddenAreaMesh_t GetHiddenAreaMesh(vr::Hmd_Eye eye)
+	{
+		vr::HiddenAreaMesh_t mesh = { hidden_area[eye].empty() ? nullptr : &hidden_area[eye][0], (uint32_t)hidden_area[eye].size() / 3 };
+		return mesh;
+	}
+
+	bool IsTrackedDeviceConnected(vr::TrackedDeviceIndex_t device)
+	{
+		return device < vr::k_unMaxTrackedDeviceCount && device_connected[device];
+	}
+
+	vr::ETrackedDeviceClass GetTrackedDeviceClass(vr::TrackedDeviceIndex_t device)
+	{
+		return device < vr::k_unMaxTrackedDeviceCount ? device_class[device] : vr::TrackedDeviceClass_Invalid;
+	}
+
+	uint32_t GetStringTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, char* buffer, uint32_t buffer_size, vr::TrackedPropertyError* error)
+	{
+		const std::string* value = nullptr;
+		if (device == vr::k_unTrackedDeviceIndex_Hmd && prop == vr::Prop_TrackingSystemName_String) value = &tracking_system;
+		if (device == vr::k_unTrackedDeviceIndex_Hmd && prop == vr::Prop_SerialNumber_String) value = &serial_number;
+		if (value == nullptr)
+		{
+			if (error) *error = vr::TrackedProp_UnknownProperty;
+			return 0;
+		}
+
+		uint32_t required = (uint32_t)value->size() + 1;
+		if (buffer_size < required)
+		{
+			if (error) *error = vr::TrackedProp_BufferTooSmall;
+			return required;
+		}
+
+		memcpy(buffer, value->c_str(), required);
+		if (error) *error = vr::TrackedProp_Success;
+		return required;
+	}
+
+	float GetFloatTrackedDeviceProperty(vr::TrackedDeviceIndex_t device, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* error)
+	{
+		if (error) *error = vr::TrackedProp_Success;
+		if (device == vr::k_unTrackedDeviceIndex_Hmd && prop == vr::Prop_DisplayFrequency_Float) return display_frequency;
+		if (device == vr::k_unTrackedDeviceIndex_Hmd && prop == vr::Prop_SecondsFromVsyncToPhotons_Float) return vsync_to_photons;
+
+		if (error) *error = vr::TrackedProp_UnknownProperty;
+		return 0.0f;
+	}
+
+	// As of the last WaitGetPoses, however long ago that was
+	bool GetTimeSinceLastVsync(float* seconds_since_last_vsync, uint64_t* frame_counter)
+	{
+		int frame = CurrentFrame();
+		if (seconds_since_last_vsync) *seconds_since_last_vsync = frame >= 0 ? frames[frame].since_vsync : 0.0f;
+		if (frame_counter) *frame_counter = frame >= 0 ? frames[frame].vsync : 0;
+		return true;
+	}
+
+	// The recorded frame whose poses were predicted for the nearest display time to the one asked for
+	void GetDeviceToAbsoluteTrackingPose(vr::ETrackingUniverseOrigin origin, float seconds_to_photons, vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		// WaitGetPoses predicts to a frame after its vsync. Before the first one it's as if there
+		// had been one right on the vsync
+		int frame = CurrentFrame();
+		float since_vsync = frame >= 0 ? frames[frame].since_vsync : 0.0f;
+		float frame_duration = 1.0f / display_frequency;
+		float ahead = (since_vsync + seconds_to_photons - frame_duration - vsync_to_photons) / frame_duration;
+		frame += (int)floorf(ahead + 0.5f);
+		frame = std::max(0, std::min(frame, (int)frames.size() - 1));
+		CopyPoses(frame, poses, pose_count);
+	}
+
+	bool PollNextEvent(vr::VREvent_t* event, uint32_t event_size)
+	{
+		uint32_t handed_out = HandedOut();
+		DeliverDeviceChanges(handed_out);
+		if (next_event >= events.size() || events[next_event].frame > handed_out)
+			return false;
+
+		memcpy(event, &events[next_event].event, std::min<uint32_t>(event_size, sizeof(vr::VREvent_t)));
+		next_event += 1;
+		return true;
+	}
+
+	bool IsInputFocusCapturedByAnotherProcess()
+	{
+		int frame = CurrentFrame();
+		return frame >= 0 && frames[frame].input_focus_captured;
+	}
+
+	bool InitCompositor() { return true; }
+
+	vr::EVRCompositorError WaitGetPoses(vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		uint32_t frame = std::min<uint32_t>(frame_index, (uint32_t)frames.size() - 1);
+		if (real_time)
+		{
+			// Paced from the first frame, a frame that's already late goes out straight away
+			Clock::time_point now = Clock::now();
+			if (frame_index == 0)
+				start_time = now;
+			Clock::time_point due = start_time + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frames[frame].time));
+			if (due > now)
+				std::this_thread::sleep_until(due);
+			else if (frame_index > 0)
+				late_frames += 1;
+		}
+
+		CopyPoses(frame, poses, pose_count);
+		frame_index += 1;
+		return vr::VRCompositorError_None;
+	}
+
+	vr::EVRCompositorError Submit(vr::Hmd_Eye eye, const vr::Texture_t* texture, const vr::VRTextureBounds_t* bounds)
+	{
+		if (texture == nullptr || texture->handle == nullptr || texture->eType != vr::TextureType_OpenGL)
+			return vr::VRCompositorError_InvalidTexture;
+
+		// Same as the simulated runtime, flush where the real compositor would
+		glFlush();
+		submit_count += 1;
+		return vr::VRCompositorError_None;
+	}
+
+	// Compositor timing isn't recorded, a replay has no idea how its frames were presented
+	bool GetFrameTiming(vr::Compositor_FrameTiming* timing, uint32_t frames_ago) { return false; }
+
+	// Render model names aren't recorded, so nothing asks for these and controllers stay as lines
+	vr::EVRRenderModelError LoadRenderModel_Async(const char* name, vr::RenderModel_t** model) { return vr::VRRenderModelError_NotSupported; }
+	void FreeRenderModel(vr::RenderModel_t* model) {}
+	vr::EVRRenderModelError LoadTexture_Async(vr::TextureID_t texture_id, vr::RenderModel_TextureMap_t** texture) { return vr::VRRenderModelError_NotSupported; }
+	void FreeTexture(vr::RenderModel_TextureMap_t* texture) {}
+
+	void Shutdown()
+	{
+		uint32_t handed_out = frame_index;
+		printf("Replay: %u of %u frames played, %u past the end, %u submits",
+			std::min<uint32_t>(handed_out, (uint32_t)frames.size()), (uint32_t)frames.size(),
+			handed_out > frames.size() ? handed_out - (uint32_t)frames.size() : 0, (uint32_t)submit_count);
+		if (real_time)
+			printf(", %u frames late", (uint32_t)late_frames);
+		printf("\n");
+		replay = nullptr;
+	}
+
+private:
+	vr::TrackedDevicePose_t* FramePoses(uint32_t frame)
+	{
+		return pose_device_count > 0 ? &frame_poses[frame * pose_device_count] : nullptr;
+	}
+
+	// How many frames WaitGetPoses has handed out. For the ahead thread, as many as come before
+	// the frame it's preparing, so what it sees doesn't depend on how far the render thread has got
+	uint32_t HandedOut()
+	{
+		return std::this_thread::get_id() == ahead_thread ? ahead_frame : (uint32_t)frame_index;
+	}
+
+	// The frame the last WaitGetPoses handed out, -1 before the first. For the ahead thread, the
+	// one before the frame it's preparing
+	int CurrentFrame()
+	{
+		uint32_t handed_out = HandedOut();
+		return handed_out == 0 ? -1 : (int)std::min<uint32_t>(handed_out - 1, (uint32_t)frames.size() - 1);
+	}
+
+	void CopyPoses(int frame, vr::TrackedDevicePose_t* poses, uint32_t pose_count)
+	{
+		for (uint32_t device = 0; device < pose_count; ++device)
+			poses[device] = frame >= 0 && device < pose_device_count ? FramePoses(frame)[device] : UnknownPose();
+	}
+
+	// Device changes take effect just before the event that follows them is polled
+	void DeliverDeviceChanges(uint32_t frame)
+	{
+		for (; next_event < events.size() && events[next_event].device_change && events[next_event].frame <= frame; ++next_event)
+		{
+			const Event& change = events[next_event];
+			device_connected[change.device] = change.connected;
+			device_class[change.device] = change.device_class;
+		}
+	}
+
+	bool real_time;
+	uint32_t render_target_width;
+	uint32_t render_target_height;
+	float display_frequency;
+	float vsync_to_photons;
+	float tangents[2][4];
+	vr::HmdMatrix34_t eye_to_head[2];
+	std::string tracking_system;
+	std::string serial_number;
+	std::vector<vr::HmdVector2_t> hidden_area[2];
+
+	std::vector<Frame> frames;
+	std::vector<vr::TrackedDevicePose_t> frame_poses;	// pose_device_count per frame
+	uint32_t pose_device_count;
+	std::vector<Event> events;
+	std::vector<Input> inputs;
+
+	// The thread that polls events
+	size_t next_event;
+	size_t next_input;
+	bool device_connected[vr::k_unMaxTrackedDeviceCount];
+	vr::ETrackedDeviceClass device_class[vr::k_unMaxTrackedDeviceCount];
+
+	// Render thread, frame_index is read from the update thread when the frame loop is pipelined
+	std::atomic<uint32_t> frame_index;		// frames handed out by WaitGetPoses
+
+	// Update thread, when the frame loop is pipelined. Set before the render thread starts
+	std::thread::id ahead_thread;
+	uint32_t ahead_frame;
+	Clock::time_point start_time;
+	uint32_t late_frames;
+	uint32_t submit_count;
+};
+
+VRBackend* CreateRecordingVRBackend(VRBackend* runtime, const char* path)
+{
+	trace_file = fopen(path, "wb");
+	if (trace_file == nullptr)
+	{
+		printf("Trace recorder: could not open %s\n", path);
+		return nullptr;
+	}
+
+	open_chunk.clear();
+	open_chunk.reserve(chunk_bytes * 2);
+	full_chunks.clear();
+	spare_chunks.clear();
+	writer_quit = false;
+	write_failed = false;
+	bytes_appended = 0;
+	max_full_chunks = 0;
+	writer_thread = std::thread(WriterThread);
+
+	recorder = new RecordingVRBackend(runtime, path);
+	recorder->WriteHeader();
+	return recorder;
+}
+
+VRBackend* CreateReplayVRBackend(const char* path, bool real_time, uint32_t* frame_count)
+{
+	ReplayVRBackend* backend = new ReplayVRBackend(real_time);
+	if (!backend->Load(path))
+	{
+		delete backend;
+		return nullptr;
+	}
+
+	*frame_count = backend->FrameCount();
+	replay = backend;
+	return backend;
+}
+
+void VRTraceRecordInput(uint32_t type, uint32_t code)
+{
+	if (recorder)
+		recorder->RecordInput(type, code);
+}
+
+bool VRTraceNextInput(uint32_t& type, uint32_t& code)
+{
+	return replay != nullptr && replay->NextInput(type, code);
+}
+
+bool VRTraceReplaying()
+{
+	return replay != nullptr;
+}
+
+void VRTraceSetAheadThread()
+{
+	if (replay)
+		replay->SetAheadThread();
+}
+
+void VRTraceBeginAheadFrame(uint64_t frame)
+{
+	if (replay)
+		replay->BeginAheadFrame(frame);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "vr_backend.h"
+
+#include <cstdint>
+
+// Recording a session's tracking and input, and playing it back in place of the runtime
+//
+// The recorder wraps whichever backend is running and passes everything through. What the app
+// got from WaitGetPoses every frame, the runtime's events and the key presses it handled go into
+// an append only binary trace. A pose only gets written when it changed since the frame before,
+// so base stations cost nothing after the first frame. Records are appended to a chunk in memory
+// and full chunks are written out by a thread of its own, the frame never waits on the disk.
+//
+// The replay backend reads a whole trace in at startup and hands the same poses back from
+// WaitGetPoses, one recorded frame per call, either as fast as the app asks or at the times they
+// were recorded. Events and key presses come back before the same frame's poses they came before
+// when recorded. Anything asked for between frames, like the late latched or next frame's poses,
+// comes from the recorded frame nearest the time asked for, never from the clock, so two replays
+// of a trace with the same options draw exactly the same frames. With --pipelined the update
+// thread's lookups, events and key presses are for the frame it's preparing (see
+// VRTraceSetAheadThread), not whichever one the render thread has got to.
+
+// Passes everything through to runtime, which it takes over, and writes the trace to path.
+// Returns nullptr if the file can't be opened, runtime is left alone then
+VRBackend* CreateRecordingVRBackend(VRBackend* runtime, const char* path);
+
+// Plays back a trace the recorder wrote. Returns nullptr if it can't be read, otherwise
+// frame_count is how many frames it has, after those WaitGetPoses keeps returning the last one
+VRBackend* CreateReplayVRBackend(const char* path, bool real_time, uint32_t* frame_count);
+
+// App input goes through these so it's recorded and replayed with the rest. Both do nothing
+// without a recorder or a replay running
+void VRTraceRecordInput(uint32_t type, uint32_t code);
+// The next recorded input that's due by the current frame, false once there isn't one
+bool VRTraceNextInput(uint32_t& type, uint32_t& code);
+// True while a replay is running, live input should be ignored then
+bool VRTraceReplaying();
+
+// For the pipelined update thread, call once from it before the render thread starts. Between
+// frames the replay answers that thread as if WaitGetPoses had handed out frames up to, but not
+// including, the one passed to VRTraceBeginAheadFrame, which is the frame it's preparing. Both do
+// nothing without a replay
+void VRTraceSetAheadThread();
+void VRTraceBeginAheadFrame(uint64_t frame);